@@ -0,0 +1,78 @@
+-- Runs the benchmark scripts in-process and prints the time each one takes,
+-- followed by the memory used by a few large tables. Build the interpreter
+-- once per configuration you want to compare (for example with and without
+-- LUA_NANBOXING in luaconf.h) and run this from the benchmarks directory:
+--
+--   lua bench.lua            -- default problem sizes
+--   lua bench.lua 0.5        -- scale the problem sizes
+
+local scale = tonumber(arg and arg[1]) or 1
+
+loadstring = loadstring or load
+unpack = unpack or table.unpack
+
+local benchmarks = {
+  { "binarytrees.lua-2.lua", 14 },
+  { "fannkuchredux.lua",     9 },
+  { "fasta.lua",             250000 },
+  { "mandelbrot.lua",        400 },
+  { "spectralnorm.lua",      300 },
+}
+
+local write = io.write
+local clock = os.clock
+
+write(string.format("%-24s %10s\n", "benchmark", "seconds"))
+
+local total = 0
+for _, b in ipairs(benchmarks) do
+  local name, n = b[1], math.floor(b[2] * scale)
+  if name == "binarytrees.lua-2.lua" or name == "fannkuchredux.lua" then
+    -- these two grow exponentially, don't scale them linearly
+    n = b[2] + math.floor(math.log(scale) / math.log(2))
+  end
+
+  arg = { [0] = name, n }
+  io.write = function () end  -- silence the benchmark's own output
+  collectgarbage()
+  local t0 = clock()
+  dofile(name)
+  local t = clock() - t0
+  io.write = write
+
+  total = total + t
+  write(string.format("%-24s %10.2f\n", name .. " " .. n, t))
+end
+write(string.format("%-24s %10.2f\n\n", "total", total))
+
+-- Memory used by values stored in tables: an array of numbers, and a hash
+-- of string keys to numbers.
+local function kb (f)
+  collectgarbage()
+  collectgarbage("stop")
+  local before = collectgarbage("count")
+  local t = f()
+  local after = collectgarbage("count")
+  collectgarbage("restart")
+  return after - before, t
+end
+
+local N = math.floor(2^20 * scale)
+
+local array = kb(function ()
+  local t = {}
+  for i = 1, N do t[i] = i * 0.5 end
+  return t
+end)
+
+local keys = {}
+for i = 1, N / 4 do keys[i] = "k" .. i end
+local hash = kb(function ()
+  local t = {}
+  for i = 1, #keys do t[keys[i]] = i end
+  return t
+end)
+
+write(string.format("%-24s %10s\n", "table", "KB"))
+write(string.format("%-24s %10.0f\n", N .. " array slots", array))
+write(string.format("%-24s %10.0f\n", (N / 4) .. " hash nodes", hash))
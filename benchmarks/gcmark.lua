@@ -0,0 +1,43 @@
+-- Times full collections of a large heap of tables with a given number of
+-- marking threads. os.clock counts the CPU time of every thread, so run it
+-- under the shell's 'time' from the benchmarks directory:
+--
+--   for t in 1 2 4 8; do time lua gcmark.lua $t; done
+--
+--   lua gcmark.lua <threads> [scale] [collections]
+
+local threads = tonumber(arg and arg[1]) or 1
+local scale = tonumber(arg and arg[2]) or 1
+local collections = tonumber(arg and arg[3]) or 20
+
+-- Trees of small tables, like binarytrees, plus records holding strings and
+-- a few wide arrays, so there is both deep and broad structure to split up.
+local function tree(depth)
+  if depth == 0 then return { depth } end
+  return { depth, tree(depth - 1), tree(depth - 1) }
+end
+
+local heap = {}
+local trees = math.floor(32 * scale)
+for i = 1, trees do
+  heap[#heap + 1] = tree(14)
+end
+
+local records = {}
+for i = 1, math.floor(200000 * scale) do
+  records[i] = { id = i, name = "record" .. i, tags = { i % 7, i % 11 } }
+end
+heap[#heap + 1] = records
+
+collectgarbage("stop")
+collectgarbage()
+local kbytes = collectgarbage("count")
+
+collectgarbage("setmarkthreads", threads)
+local start = os.clock()
+for i = 1, collections do
+  collectgarbage()
+end
+
+print(string.format("%d threads, %d collections of %dK, %.2fs cpu",
+                    threads, collections, kbytes, os.clock() - start))
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "LuaOSThread.h"
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// The few atomic operations the parallel marker needs. All of them are full
+// barriers, and the read-modify-write ones return the value '*p' held before
+// the operation. Anything another thread changes with these is read with
+// luaAtomicLoad rather than through 'volatile' alone.
+
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+
+#pragma intrinsic(_InterlockedCompareExchange)
+#pragma intrinsic(_InterlockedExchangeAdd)
+#pragma intrinsic(_InterlockedOr)
+#pragma intrinsic(_InterlockedAnd)
+#pragma intrinsic(_InterlockedExchange)
+
+inline int luaAtomicLoad(volatile int* p) {
+  return (int)_InterlockedOr((volatile long*)p, 0);
+}
+
+inline void luaAtomicStore(volatile int* p, int value) {
+  _InterlockedExchange((volatile long*)p, value);
+}
+
+// Reads a word other threads may be setting bits in, with no barrier. Aligned
+// 32-bit volatile reads are atomic here.
+inline uint32_t luaAtomicPeek(const volatile uint32_t* p) {
+  return *p;
+}
+
+inline int luaAtomicCAS(volatile int* p, int expected, int desired) {
+  return (int)_InterlockedCompareExchange((volatile long*)p, desired, expected);
+}
+
+inline int luaAtomicAdd(volatile int* p, int delta) {
+  return (int)_InterlockedExchangeAdd((volatile long*)p, delta);
+}
+
+inline uint32_t luaAtomicOr(volatile uint32_t* p, uint32_t bits) {
+  return (uint32_t)_InterlockedOr((volatile long*)p, (long)bits);
+}
+
+inline uint32_t luaAtomicAnd(volatile uint32_t* p, uint32_t bits) {
+  return (uint32_t)_InterlockedAnd((volatile long*)p, (long)bits);
+}
+
+#else
+
+inline int luaAtomicLoad(volatile int* p) {
+  return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+inline void luaAtomicStore(volatile int* p, int value) {
+  __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+// Reads a word other threads may be setting bits in, with no barrier.
+inline uint32_t luaAtomicPeek(const volatile uint32_t* p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+inline int luaAtomicCAS(volatile int* p, int expected, int desired) {
+  return __sync_val_compare_and_swap(p, expected, desired);
+}
+
+inline int luaAtomicAdd(volatile int* p, int delta) {
+  return __sync_fetch_and_add(p, delta);
+}
+
+inline uint32_t luaAtomicOr(volatile uint32_t* p, uint32_t bits) {
+  return __sync_fetch_and_or(p, bits);
+}
+
+inline uint32_t luaAtomicAnd(volatile uint32_t* p, uint32_t bits) {
+  return __sync_fetch_and_and(p, bits);
+}
+
+#endif
+
+// Spin lock around a single int, zero when unlocked. After spinning for a
+// while it lets other threads run, in case the holder was preempted.
+class LuaSpinLock {
+public:
+
+  LuaSpinLock(volatile int& lock) : lock_(lock) {
+    for(int spins = 1; luaAtomicCAS(&lock_, 0, 1) != 0; spins++) {
+      if((spins % 64) == 0) LuaOSThread::YieldCPU();
+    }
+  }
+
+  ~LuaSpinLock() {
+    luaAtomicCAS(&lock_, 1, 0);
+  }
+
+private:
+  LuaSpinLock(const LuaSpinLock&);
+  LuaSpinLock& operator = (const LuaSpinLock&);
+
+  volatile int& lock_;
+};
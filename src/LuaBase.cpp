@@ -5,15 +5,22 @@
 
 #include <assert.h>
 
-void * LuaBase::operator new(size_t size) {
-  void* blob = luaM_alloc_nocheck(size);
-  if(blob && thread_G) {
-    thread_G->incGCDebt((int)size);
+void * LuaBase::operator new(size_t size, LuaVM* g) {
+  void* blob = luaM_alloc_nocheck(size, g);
+  if(blob && g) {
+    g->incGCDebt((int)size);
   }
   return blob;
 }
 
-void LuaBase::operator delete(void* blob) {
-  luaM_free(blob);
+void * LuaBase::operator new(size_t size) {
+  return operator new(size, thread_G);
 }
 
+void LuaBase::operator delete(void* blob, size_t size) {
+  luaM_free(blob, size);
+}
+
+void LuaBase::operator delete(void*, LuaVM*) {
+  assert(false);
+}
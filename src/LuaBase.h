@@ -1,8 +1,11 @@
-// LuaBase exists solely to ensure that all objects (eventually) have a virtual destructor, and
-// that they all get allocated through luaM_alloc/luaM_free.
+// LuaBase gives the VM's own bookkeeping objects a virtual destructor and
+// makes them allocate through luaM_alloc/luaM_free. Collectable objects
+// derive from LuaObject instead, which has no vtable.
 
 #pragma once
 
+class LuaVM;
+
 class LuaBase
 {
 public:
@@ -10,6 +13,12 @@ public:
   LuaBase() {}
   virtual ~LuaBase() {}
 
+  // Objects that belong to a VM are allocated with 'new (g) T(...)', which
+  // charges them to 'g' without looking up the current thread's VM.
+  void* operator new(size_t size, LuaVM* g);
   void* operator new(size_t size);
-  void operator delete(void*);
-};
\ No newline at end of file
+  void operator delete(void*, size_t size);
+
+  // Only called if a constructor throws, which none of them do.
+  void operator delete(void*, LuaVM* g);
+};
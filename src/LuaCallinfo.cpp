@@ -4,6 +4,23 @@
 #include "LuaProto.h"
 #include "LuaState.h"
 
+#include "lopcodes.h"
+
+
+LuaFrameBlock::LuaFrameBlock(LuaStack* stack, LuaStackFrame* previous, int size) {
+  frames_.resize_nocheck(size);
+  cframes_.resize_nocheck(size);
+  for(int i = 0; i < size; i++) {
+    LuaStackFrame* ci = &frames_[i];
+    ci->stack_ = stack;
+    ci->cframe_ = &cframes_[i];
+    ci->previous = (i == 0) ? previous : ci - 1;
+    ci->next = (i == size - 1) ? NULL : ci + 1;
+  }
+  if(previous) previous->next = first();
+}
+
+//------------------------------------------------------------------------------
 
 void LuaStackFrame::sanityCheck() {
   if(isLua()) {
@@ -46,7 +63,7 @@ int LuaStackFrame::getCurrentOp() {
   if(!isLua()) return -1;
 
   Instruction i = code_[savedpc];
-  return (i & 0x0000003F);
+  return GET_BASEOP(i);
 }
 
 int LuaStackFrame::getNextInstruction() {
@@ -57,7 +74,7 @@ int LuaStackFrame::getNextOp() {
   if(!isLua()) return -1;
 
   Instruction i = code_[savedpc+1];
-  return (i & 0x0000003F);
+  return GET_BASEOP(i);
 }
 
 LuaValue* LuaStackFrame::getConstants() const {
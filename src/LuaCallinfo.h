@@ -2,15 +2,41 @@
 
 #include "LuaBase.h"
 #include "LuaDefines.h"
+#include "LuaProto.h"
 #include "LuaStack.h"
 #include "LuaTypes.h"
 
 class LuaStack;
 
+/*
+** Parts of a call's state that only C functions use: continuations and
+** what lua_pcallk has to restore. Kept apart so the frames the VM touches
+** on every Lua call stay small.
+*/
+struct LuaCFrame {
+  LuaCFrame() {
+    continuation_ = NULL;
+    continuation_context_ = 0;
+    old_func_ = 0;
+    old_errfunc = 0;
+    old_allowhook = 0;
+    status = 0;
+  }
+
+  LuaCallback continuation_;  /* continuation in case of yields */
+  int continuation_context_;  /* context info. in case of yields */
+
+  ptrdiff_t old_func_;
+  ptrdiff_t old_errfunc;
+  int old_allowhook;
+  int status;
+};
+
+
 /*
 ** information about a call
 */
-class LuaStackFrame : public LuaBase {
+class LuaStackFrame {
 public:
 
   void sanityCheck();
@@ -26,6 +52,11 @@ public:
   int beginInstruction();
   void undoInstruction();
 
+  // The interpreter loop keeps its own program counter and only writes it
+  // back here when something (errors, hooks, calls) might look at it.
+  const Instruction* getCode() const { return code_; }
+  void setCurrentPC(int pc) { savedpc = pc; }
+
   int getCurrentPC();
   int getCurrentLine();
   int getCurrentInstruction();
@@ -35,6 +66,20 @@ public:
 
   void resetPC();
 
+  // Sets the frame up for a call to 'p' (which takes no varargs) sitting at
+  // 'func' with its arguments after it - the interpreter's shortcut around
+  // LuaStack::createLuaCall for Lua-to-Lua calls.
+  void initLua(StkId func, LuaProto* p, int results) {
+    nresults = results;
+    callstatus = CIST_LUA | CIST_REENTRY;
+    setFunc(func);
+    setBase(func + 1);
+    setTop(func + 1 + p->maxstacksize);
+    code_ = p->instructions_.begin();
+    constants_ = p->constants.begin();
+    savedpc = -1;
+  }
+
   const StkId getFunc() const { return stack_->begin() + func_index_; }
   const StkId getTop() const  { return stack_->begin() + top_index_; }
   const StkId getBase() const { return stack_->begin() + base_index_; }
@@ -51,45 +96,32 @@ public:
   int nresults;  /* expected number of results from this function */
   int callstatus;
 
-  // only for C functions
-  LuaCallback continuation_;  /* continuation in case of yields */
-  int continuation_context_;  /* context info. in case of yields */
-
-  ptrdiff_t old_func_;
-  ptrdiff_t old_errfunc;
-  int old_allowhook;
-  int status;
-
-protected:
-
-  // only for Lua functions
-  const Instruction* code_;
-  LuaValue* constants_;
-  int savedpc;
-  int line_;
+  LuaCFrame* cframe_;  /* state only C functions use */
 
   LuaStackFrame() {
-    stack_ = NULL;
-    func_index_ = 0;
-    top_index_ = 0;
     previous = NULL;
     next = NULL;
     nresults = 0;
     callstatus = 0;
-    base_index_ = 0;
+    cframe_ = NULL;
+    code_ = NULL;
+    constants_ = NULL;
     savedpc = -1;
-
-    continuation_ = NULL;
-    continuation_context_ = 0;
-
-    old_func_ = 0;
-    old_errfunc = 0;
-    old_allowhook = 0;
-    status = 0;
+    stack_ = NULL;
+    func_index_ = 0;
+    top_index_ = 0;
+    base_index_ = 0;
   }
-  ~LuaStackFrame() {}
+
+protected:
 
   friend class LuaStack;
+  friend class LuaFrameBlock;
+
+  // only for Lua functions
+  const Instruction* code_;
+  LuaValue* constants_;
+  int savedpc;
 
   LuaStack* stack_;
 
@@ -103,3 +135,30 @@ protected:
   int base_index_;
 };
 
+
+
+/*
+** Frames are allocated a block at a time - consecutive frames sit next to
+** each other in memory, and a block never moves, so pointers to frames
+** stay good while the call stack grows. LuaStack owns the blocks, chained
+** through the frames' previous/next links.
+*/
+class LuaFrameBlock : public LuaBase {
+public:
+  static const int kMinFrames = 4;
+  static const int kMaxFrames = 256;
+
+  LuaFrameBlock(LuaStack* stack, LuaStackFrame* previous, int size);
+
+  bool contains(const LuaStackFrame* ci) const {
+    return (ci >= frames_.begin()) && (ci < frames_.end());
+  }
+
+  LuaStackFrame* first() { return frames_.begin(); }
+  LuaStackFrame* last() { return frames_.end() - 1; }
+  int size() const { return (int)frames_.size(); }
+
+protected:
+  LuaVector<LuaStackFrame> frames_;
+  LuaVector<LuaCFrame> cframes_;
+};
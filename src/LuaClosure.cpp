@@ -1,18 +1,19 @@
 #include "LuaClosure.h"
 
 #include "LuaCollector.h"
+#include "LuaGlobals.h"
 #include "LuaProto.h"
 #include "LuaUpval.h"
 
 // Lua closure
-LuaClosure::LuaClosure(LuaProto* proto, int n) 
-: LuaObject(LUA_TLCL) {
-  linkGC(getGlobalGCList());
+LuaClosure::LuaClosure(LuaVM* g, LuaProto* proto, int n) 
+: LuaObject(LUA_TLCL, g) {
+  linkAllgc();
 
   isC = 0;
   nupvalues = n;
   pupvals_ = NULL;
-  ppupvals_ = (LuaUpvalue**)luaM_alloc_nocheck(n * sizeof(LuaValue*));
+  ppupvals_ = (LuaUpvalue**)luaM_alloc_nocheck(n * sizeof(LuaValue*), g);
   cfunction_ = NULL;
   proto_ = proto;
 
@@ -20,25 +21,25 @@ LuaClosure::LuaClosure(LuaProto* proto, int n)
 }
 
 // C closure
-LuaClosure::LuaClosure(LuaCallback func, int n) 
-: LuaObject(LUA_TCCL) {
-  linkGC(getGlobalGCList());
+LuaClosure::LuaClosure(LuaVM* g, LuaCallback func, int n) 
+: LuaObject(LUA_TCCL, g) {
+  linkAllgc();
 
   isC = 1;
   nupvalues = n;
-  pupvals_ = (LuaValue*)luaM_alloc_nocheck(n * sizeof(LuaValue));
+  pupvals_ = (LuaValue*)luaM_alloc_nocheck(n * sizeof(LuaValue), g);
   ppupvals_ = NULL;
   cfunction_ = func;
   proto_ = NULL;
 }
 
-LuaClosure::LuaClosure(LuaCallback func, LuaValue upval1)
-: LuaObject(LUA_TCCL) {
-  linkGC(getGlobalGCList());
+LuaClosure::LuaClosure(LuaVM* g, LuaCallback func, LuaValue upval1)
+: LuaObject(LUA_TCCL, g) {
+  linkAllgc();
 
   isC = 1;
   nupvalues = 1;
-  pupvals_ = (LuaValue*)luaM_alloc_nocheck(sizeof(LuaValue));
+  pupvals_ = (LuaValue*)luaM_alloc_nocheck(sizeof(LuaValue), g);
   ppupvals_ = NULL;
   cfunction_ = func;
   proto_ = NULL;
@@ -47,8 +48,8 @@ LuaClosure::LuaClosure(LuaCallback func, LuaValue upval1)
 }
 
 LuaClosure::~LuaClosure() {
-  luaM_free(pupvals_);
-  luaM_free(ppupvals_);
+  luaM_free(pupvals_, nupvalues * sizeof(LuaValue));
+  luaM_free(ppupvals_, nupvalues * sizeof(LuaValue*));
   pupvals_ = NULL;
   ppupvals_ = NULL;
 }
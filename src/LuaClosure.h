@@ -5,15 +5,18 @@
 class LuaClosure : public LuaObject {
 public:
 
-  LuaClosure(LuaProto* proto, int n);
-  LuaClosure(LuaCallback func, int n);
+  LuaClosure(LuaVM* g, LuaProto* proto, int n);
+  LuaClosure(LuaVM* g, LuaCallback func, int n);
 
-  LuaClosure(LuaCallback func, LuaValue upval1);
+  LuaClosure(LuaVM* g, LuaCallback func, LuaValue upval1);
 
   ~LuaClosure();
 
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int PropagateGC(LuaGCVisitor& visitor);
+  // C and Lua closures share pages.
+  void* operator new(size_t size, LuaVM* g) { return allocObject(size, g, LUA_TLCL); }
+
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
 
   int isC;
   int nupvalues;
@@ -1,10 +1,17 @@
 #include "LuaCollector.h"
 
 #include "LuaGlobals.h"
+#include "LuaMarker.h"
 #include "LuaObject.h" // for LuaGCVisitor
 #include "LuaString.h"
 #include "LuaValue.h"
 
+#include "lgc.h" // for GCPROMOTEAGE
+
+// Marking this many objects serially costs about as much as starting the
+// parallel marker's threads.
+static const int kSerialMarkBudget = 1000;
+
 void LuaCollector::ClearGraylists() {
   grayhead_.Clear();
   grayagain_.Clear();
@@ -13,6 +20,25 @@ void LuaCollector::ClearGraylists() {
   ephemeron_.Clear();
 }
 
+void LuaCollector::Propagate(LuaGraylist& list, LuaGCVisitor& v) {
+  bool parallel = (g_->gcmarkthreads > 1) && (g_->gckind == KGC_NORMAL);
+
+  // Start serially, small graphs aren't worth waking the other threads for.
+  int budget = kSerialMarkBudget;
+  while(!parallel || (budget-- > 0)) {
+    LuaObject* o = grayhead_.isEmpty() ? list.Pop() : grayhead_.Pop();
+    if(o == NULL) return;
+    o->PropagateGC(v);
+  }
+
+  if(grayhead_.isEmpty() && list.isEmpty()) return;
+
+  LuaParallelMarker marker(this, g_->gcmarkthreads);
+  marker.Seed(list);
+  marker.Seed(grayhead_);
+  marker.Run(v);
+}
+
 /*
 ** retraverse all gray lists. Because tables may be reinserted in other
 ** lists when traversed, traverse the original lists to avoid traversing
@@ -29,10 +55,10 @@ void LuaCollector::RetraverseGrays() {
   
   LuaGCVisitor v(this);
 
-  grayhead_.PropagateGC(v);
-  old_grayagain.PropagateGC(v);
-  old_weak.PropagateGC(v);
-  old_ephemeron.PropagateGC(v);
+  Propagate(grayhead_, v);
+  Propagate(old_grayagain, v);
+  Propagate(old_weak, v);
+  Propagate(old_ephemeron, v);
 }
 
 // TODO(aappleby): what the hell does this do?
@@ -54,13 +80,48 @@ void LuaCollector::ConvergeEphemerons() {
       // cause more things in ephemeron tables to turn gray, so we have to repeat.
       // the process until nothing gets turned gray.
       if (v.mark_count_) {
-        grayhead_.PropagateGC(v);
+        Propagate(grayhead_, v);
         changed = 1;  /* will have to revisit all ephemeron tables */
       }
     }
   } while (changed);
 }
 
+void LuaCollector::Remember(LuaObject* o) {
+  o->setAge(0);
+  if(o->isRemembered()) return;
+  o->setRemembered();
+  remembered_.push_back(o);
+}
+
+void LuaCollector::RemarkRemembered() {
+  LuaGCVisitor v(this);
+  size_t count = 0;
+  for(size_t i = 0; i < remembered_.size(); i++) {
+    LuaObject* o = remembered_[i];
+    if(o->getAge() >= GCPROMOTEAGE) {
+      o->clearRemembered();
+      continue;
+    }
+    o->setAge(o->getAge() + 1);
+
+    // Gray objects are on a gray list already.
+    if(o->isBlack()) {
+      o->setColor(g_->livecolor);
+      v.MarkObject(o);
+    }
+    remembered_[count++] = o;
+  }
+  remembered_.resize(count);
+}
+
+void LuaCollector::ForgetRemembered() {
+  for(size_t i = 0; i < remembered_.size(); i++) {
+    remembered_[i]->clearRemembered();
+  }
+  remembered_.clear();
+}
+
 //------------------------------------------------------------------------------
 
 void LuaGCVisitor::VisitString(LuaString* s) {
@@ -77,19 +138,26 @@ void LuaGCVisitor::MarkValue(LuaValue v) {
 
 void LuaGCVisitor::MarkObject(LuaObject* o) {
   if(o == NULL) return;
-  if(o->isGray()) {
+
+  LuaObject::Color c = o->getColor();
+  if(c == LuaObject::GRAY) {
     return;
   }
-  if(o->isBlack()) {
+  if(c == LuaObject::BLACK) {
     return;
   }
 
-  mark_count_++;
-
   if(!o->isFixed()) {
-    assert(o->isLiveColor());
+    assert(c == getVM()->livecolor);
+  }
+
+  // Another marker got to it first.
+  if(worker_ && !o->casColor(c, LuaObject::GRAY)) {
+    return;
   }
 
+  mark_count_++;
+
   o->VisitGC(*this);
   return;
 }
@@ -97,23 +165,38 @@ void LuaGCVisitor::MarkObject(LuaObject* o) {
 //------------------------------------------------------------------------------
 
 void LuaGCVisitor::PushGray(LuaObject* o) {
-  parent_->grayhead_.Push(o);
+  if(worker_) worker_->PushGray(o);
+  else parent_->grayhead_.Push(o);
 }
 
 void LuaGCVisitor::PushGrayAgain(LuaObject* o) {
-  parent_->grayagain_.Push(o);
+  if(worker_) worker_->grayagain_.Push(o);
+  else parent_->grayagain_.Push(o);
 }
 
 void LuaGCVisitor::PushWeak(LuaObject* o) {
-  parent_->weak_.Push(o);
+  if(worker_) worker_->weak_.Push(o);
+  else parent_->weak_.Push(o);
 }
 
 void LuaGCVisitor::PushAllWeak(LuaObject* o) {
-  parent_->allweak_.Push(o);
+  if(worker_) worker_->allweak_.Push(o);
+  else parent_->allweak_.Push(o);
 }
 
 void LuaGCVisitor::PushEphemeron(LuaObject* o) {
-  parent_->ephemeron_.Push(o);
+  if(worker_) worker_->ephemeron_.Push(o);
+  else parent_->ephemeron_.Push(o);
+}
+
+void LuaGCVisitor::Remember(LuaObject* o) {
+  if(worker_) worker_->remembered_.push_back(o);
+  else parent_->Remember(o);
+}
+
+void LuaGCVisitor::PushDeadSlots(LuaTable* t) {
+  std::vector<LuaTable*>& tables = worker_->deadslots_;
+  if(tables.empty() || (tables.back() != t)) tables.push_back(t);
 }
 
 //------------------------------------------------------------------------------
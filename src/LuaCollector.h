@@ -1,11 +1,20 @@
 #pragma once
 
+#include "LuaFreeThread.h"
 #include "LuaList.h" // for LuaGrayList
 
+#include <vector>
+
+class LuaMarkWorker;
+class LuaTable;
+class LuaVM;
+
 class LuaCollector {
 public:
 
-  LuaCollector() {
+  LuaCollector(LuaVM* g)
+  : g_(g),
+    free_thread_(g) {
   }
 
   ~LuaCollector() {
@@ -17,25 +26,55 @@ public:
   }
 
   void ClearGraylists();
+
+  // Propagates marks through the objects on 'list' and everything they
+  // lead to. Full and atomic collections use gcmarkthreads threads for it.
+  void Propagate(LuaGraylist& list, LuaGCVisitor& v);
+
   void RetraverseGrays();
   void ConvergeEphemerons();
 
+  // Adds an old object that may point at young ones to the remembered set,
+  // restarting its count of minor collections.
+  void Remember(LuaObject* o);
+
+  // Marks the remembered objects again for a minor collection, dropping
+  // the ones that have been there for GCPROMOTEAGE collections.
+  void RemarkRemembered();
+
+  // Empties the remembered set before a collection that marks everything.
+  void ForgetRemembered();
+
+  LuaVM* g_;              // VM this collector belongs to
+
   LuaGraylist grayhead_;  // Topmost list of gray objects
   LuaGraylist grayagain_; // list of objects to be traversed atomically
   LuaGraylist weak_;      // list of tables with weak values
   LuaGraylist ephemeron_; // list of ephemeron tables (weak keys)
   LuaGraylist allweak_;   // list of all-weak tables
+
+  std::vector<LuaObject*> remembered_; // old objects minor collections re-mark
+
+  LuaFreeThread free_thread_; // frees what the sweep finds dead
 };
 
 class LuaGCVisitor {
 public:
 
-  LuaGCVisitor(LuaCollector* parent)
+  // Visitors with a 'worker' belong to a parallel marking thread.
+  LuaGCVisitor(LuaCollector* parent, LuaMarkWorker* worker = NULL)
   : parent_(parent),
+    worker_(worker),
     mark_count_(0)
   {
   }
 
+  LuaVM* getVM() { return parent_->g_; }
+
+  // Other threads may be marking too, so objects can only be claimed by
+  // an atomic color change, and nothing shared may be written to.
+  bool isParallel() { return worker_ != NULL; }
+
   void VisitString   (LuaString* s);
 
   void MarkValue     (LuaValue v);
@@ -47,6 +86,12 @@ public:
   void PushAllWeak   (LuaObject* o);
   void PushEphemeron (LuaObject* o);
 
+  void Remember      (LuaObject* o);
+
+  // Tables whose dead slots a parallel traversal left in place.
+  void PushDeadSlots (LuaTable* t);
+
   LuaCollector* parent_;
+  LuaMarkWorker* worker_;
   int mark_count_;
 };
@@ -220,3 +220,43 @@ int luaO_str2d (const char *s, size_t len, double *result) {
   while (lisspace(unsigned char(*endptr))) endptr++;
   return (endptr == s + len);  /* OK if no trailing characters */
 }
+
+/*
+** Reads a decimal or hexadecimal integer (optionally signed and surrounded
+** by whitespace). Fails on anything that has a fractional part or exponent,
+** or that doesn't fit in 64 bits - those are left to luaO_str2d.
+*/
+int luaO_str2int (const char *s, size_t len, int64_t *result) {
+  const char* end = s + len;
+  uint64_t a = 0;
+  int empty = 1;
+  while (s < end && lisspace(unsigned char(*s))) s++;  /* skip initial spaces */
+  int neg = isneg(&s);
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {  /* hexa? */
+    s += 2;
+    for (; s < end && lisxdigit(unsigned char(*s)); s++) {
+      if (a >> 60) return 0;  /* overflow */
+      a = a * 16 + luaO_hexavalue(*s);
+      empty = 0;
+    }
+  }
+  else {
+    for (; s < end && lisdigit(unsigned char(*s)); s++) {
+      int d = *s - '0';
+      if (a > (UINT64_MAX - d) / 10) return 0;  /* overflow */
+      a = a * 10 + d;
+      empty = 0;
+    }
+  }
+  while (s < end && lisspace(unsigned char(*s))) s++;  /* skip trailing spaces */
+  if (empty || s != end) return 0;
+  if (neg) {
+    if (a > (uint64_t)INT64_MAX + 1) return 0;
+    *result = (int64_t)(0 - a);
+  }
+  else {
+    if (a > (uint64_t)INT64_MAX) return 0;
+    *result = (int64_t)a;
+  }
+  return 1;
+}
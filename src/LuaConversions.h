@@ -5,6 +5,7 @@
 
 #include <string>
 #include "stdarg.h"
+#include "stdint.h"
 
 int luaO_int2fb (unsigned int x);
 int luaO_fb2int (int x);
@@ -19,3 +20,73 @@ std::string StringPrintf(const char* fmt, ...);
 
 int luaO_str2d (const char *s, size_t len, double *result);
 int luaO_hexavalue (int c);
+int luaO_str2int (const char *s, size_t len, int64_t *result);
+
+//-----------------------------------------------------------------------------
+// Exact 64-bit integer arithmetic. Each of these returns 0 (and leaves
+// 'result' alone) if the result can't be represented as an integer, in which
+// case the caller should redo the operation in floating point. Results that
+// would be a negative zero in floating point count as unrepresentable too,
+// so integer and float arithmetic never disagree about a value.
+
+inline int luaO_addInt (int64_t a, int64_t b, int64_t *result) {
+  int64_t r = (int64_t)((uint64_t)a + (uint64_t)b);
+  if (((a ^ r) & (b ^ r)) < 0) return 0;
+  *result = r;
+  return 1;
+}
+
+inline int luaO_subInt (int64_t a, int64_t b, int64_t *result) {
+  int64_t r = (int64_t)((uint64_t)a - (uint64_t)b);
+  if (((a ^ b) & (a ^ r)) < 0) return 0;
+  *result = r;
+  return 1;
+}
+
+inline int luaO_mulInt (int64_t a, int64_t b, int64_t *result) {
+  if (a == 0 || b == 0) {
+    if ((a | b) < 0) return 0;  /* 0 * -n is -0 */
+    *result = 0;
+    return 1;
+  }
+  /* both operands fit in 32 bits - can't overflow */
+  if (((uint64_t)a + 0x80000000u) <= 0xFFFFFFFFu &&
+      ((uint64_t)b + 0x80000000u) <= 0xFFFFFFFFu) {
+    *result = a * b;
+    return 1;
+  }
+  if ((a == -1 && b == INT64_MIN) || (b == -1 && a == INT64_MIN)) return 0;
+  int64_t r = (int64_t)((uint64_t)a * (uint64_t)b);
+  if (r / b != a) return 0;
+  *result = r;
+  return 1;
+}
+
+/* floored modulo, matching 'a - floor(a/b)*b' */
+inline int luaO_modInt (int64_t a, int64_t b, int64_t *result) {
+  if (b == 0) return 0;  /* NaN */
+  if (b == -1) {
+    *result = 0;  /* avoids INT64_MIN % -1 */
+    return 1;
+  }
+  int64_t m = a % b;
+  if (m != 0 && (m ^ b) < 0) m += b;
+  *result = m;
+  return 1;
+}
+
+inline int luaO_unmInt (int64_t a, int64_t *result) {
+  if (a == 0 || a == INT64_MIN) return 0;  /* -0, overflow */
+  *result = -a;
+  return 1;
+}
+
+// Converts a double to an integer if it holds an integral value in range.
+inline int luaO_flt2int (double n, int64_t *result) {
+  /* also rejects NaN */
+  if (!(n >= -9223372036854775808.0 && n < 9223372036854775808.0)) return 0;
+  int64_t i = (int64_t)n;
+  if ((double)i != n) return 0;
+  *result = i;
+  return 1;
+}
@@ -0,0 +1,193 @@
+#include "LuaFreeThread.h"
+
+#include "LuaGlobals.h"
+#include "LuaObject.h"
+#include "LuaString.h"
+#include "LuaTable.h"
+
+#include "lmem.h"
+
+#include <assert.h>
+
+// Objects handed to the helper thread at a time.
+static const size_t kBatchSize = 1024;
+
+//-----------------------------------------------------------------------------
+
+LuaFreeThread::LuaFreeThread(LuaVM* g)
+: g_(g),
+  pending_(NULL),
+  inflight_(0),
+  stop_(false)
+{
+}
+
+LuaFreeThread::~LuaFreeThread() {
+  Stop();
+}
+
+//-----------------------------------------------------------------------------
+
+void LuaFreeThread::Free(LuaObject* o) {
+  bool inplace = !g_->gcfreethread ||
+                 (g_->gckind == KGC_EMERGENCY) ||
+                 o->isThread() ||
+                 o->isUpval();
+  if(inplace) {
+    LuaObject::destroy(o);
+    return;
+  }
+
+  // The parts of the destructors that touch the VM. The helper thread has
+  // no VM, so ~LuaObject and ~LuaTable skip them there.
+  g_->instanceCounts[o->type()]--;
+  if(o->isTable()) static_cast<LuaTable*>(o)->metaChanged();
+
+  Queue(o, 0);
+}
+
+void LuaFreeThread::FreeString(LuaString* s, size_t size) {
+  if(!g_->gcfreethread || (g_->gckind == KGC_EMERGENCY)) {
+    s->~LuaString();
+    luaM_free(s, size, g_);
+    return;
+  }
+
+  g_->instanceCounts[s->type()]--;
+  Queue(s, size);
+}
+
+void LuaFreeThread::Queue(LuaObject* o, size_t size) {
+  if(pending_ == NULL) {
+    pending_ = new Batch();
+    pending_->entries.reserve(kBatchSize);
+  }
+
+  Entry e = { o, size };
+  pending_->entries.push_back(e);
+
+  if(pending_->entries.size() >= kBatchSize) Flush();
+}
+
+//-----------------------------------------------------------------------------
+
+void LuaFreeThread::Flush() {
+  if(pending_ == NULL) return;
+
+  Batch* batch = pending_;
+  pending_ = NULL;
+
+  if(!thread_.isRunning() && !thread_.Start(ThreadEntry, this)) {
+    // No helper thread, so free the batch here. It was set up to be freed
+    // without a VM, so that's how it has to be done.
+    LuaVM* g = thread_G;
+    thread_G = NULL;
+    FreeBatch(batch);
+    thread_G = g;
+    luaM_settle(batch->tally, g_);
+    delete batch;
+    return;
+  }
+
+  // The heap has to be shared before the helper thread can free into it.
+  // It stays shared until every batch is back, and the helper reads the
+  // flag without a lock, so it's only set while no batch is out.
+  if(inflight_ == 0) g_->heap_.setShared(true);
+  inflight_++;
+
+  LuaMutexLock lock(mutex_);
+  todo_.push_back(batch);
+  work_.WakeAll();
+}
+
+void LuaFreeThread::Reconcile() {
+  if(inflight_ == 0) return;
+
+  std::vector<Batch*> finished;
+  {
+    LuaMutexLock lock(mutex_);
+    finished.swap(finished_);
+  }
+
+  for(size_t i = 0; i < finished.size(); i++) {
+    Batch* batch = finished[i];
+    size_t bytes = batch->tally.bytes;
+    luaM_settle(batch->tally, g_);
+
+    // Between collections the debt was set from a total that included
+    // this memory, so start the next collection when it would have.
+    if(g_->gcstate == GCSpause) {
+      g_->incGCDebt((int)(bytes / 100 * g_->gcpause));
+    }
+
+    delete batch;
+    inflight_--;
+  }
+
+  if(inflight_ == 0) g_->heap_.setShared(false);
+}
+
+void LuaFreeThread::Sync() {
+  Flush();
+  if(inflight_ == 0) return;
+  {
+    LuaMutexLock lock(mutex_);
+    while(finished_.size() < inflight_) done_.Wait(mutex_);
+  }
+  Reconcile();
+}
+
+void LuaFreeThread::Stop() {
+  Sync();
+  if(!thread_.isRunning()) return;
+  {
+    LuaMutexLock lock(mutex_);
+    stop_ = true;
+    work_.WakeAll();
+  }
+  thread_.Join();
+  stop_ = false;
+}
+
+//-----------------------------------------------------------------------------
+
+void LuaFreeThread::ThreadEntry(void* arg) {
+  static_cast<LuaFreeThread*>(arg)->ThreadMain();
+}
+
+void LuaFreeThread::ThreadMain() {
+  mutex_.Lock();
+  while(true) {
+    while(todo_.empty() && !stop_) work_.Wait(mutex_);
+    if(todo_.empty()) break;
+
+    Batch* batch = todo_.front();
+    todo_.erase(todo_.begin());
+
+    mutex_.Unlock();
+    FreeBatch(batch);
+    mutex_.Lock();
+
+    finished_.push_back(batch);
+    done_.WakeAll();
+  }
+  mutex_.Unlock();
+}
+
+void LuaFreeThread::FreeBatch(Batch* batch) {
+  assert(thread_G == NULL);
+  luaM_settally(&batch->tally);
+
+  for(size_t i = 0; i < batch->entries.size(); i++) {
+    Entry& e = batch->entries[i];
+    if(e.size) {
+      LuaString* s = static_cast<LuaString*>(e.object);
+      s->~LuaString();
+      luaM_free(s, e.size, NULL);
+    } else {
+      LuaObject::destroy(e.object);
+    }
+  }
+
+  luaM_settally(NULL);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "LuaOSThread.h"
+#include "lmem.h" // for LuaMemTally
+
+#include <stddef.h>
+#include <vector>
+
+class LuaObject;
+class LuaString;
+class LuaVM;
+
+//-----------------------------------------------------------------------------
+// Frees dead objects for the sweeper. With the VM's gcfreethread set, the
+// sweeper only unlinks them, and they are handed over in batches to a
+// helper thread that runs their destructors and gives their memory back.
+// The memory that thread frees is counted against the VM once the batch is
+// done, when the VM's own thread next calls Reconcile.
+//
+// Threads and upvalues are always freed right away, as destroying them
+// touches objects that may still be alive.
+
+class LuaFreeThread {
+public:
+
+  LuaFreeThread(LuaVM* g);
+  ~LuaFreeThread();
+
+  // 'o' must already be unlinked from its GC list.
+  void Free(LuaObject* o);
+
+  // Strings are allocated with their text, so they need their size.
+  void FreeString(LuaString* s, size_t size);
+
+  // Hands the objects freed so far to the helper thread.
+  void Flush();
+
+  // Counts the memory of batches the helper thread has finished.
+  void Reconcile();
+
+  // Waits for everything handed over to be freed, and counts it.
+  void Sync();
+
+  // Syncs and ends the helper thread.
+  void Stop();
+
+private:
+
+  struct Entry {
+    LuaObject* object;
+    size_t size;  // for strings, zero for everything else
+  };
+
+  struct Batch {
+    std::vector<Entry> entries;
+    LuaMemTally tally;
+  };
+
+  void Queue(LuaObject* o, size_t size);
+
+  static void ThreadEntry(void* arg);
+  void ThreadMain();
+  static void FreeBatch(Batch* batch);
+
+  LuaFreeThread(const LuaFreeThread&);
+  LuaFreeThread& operator = (const LuaFreeThread&);
+
+  LuaVM* g_;
+
+  // Only touched by the VM's thread.
+  Batch* pending_;  // objects not handed over yet
+  size_t inflight_; // batches handed over and not counted yet
+
+  LuaOSThread thread_;
+
+  LuaMutex mutex_;
+  LuaCondition work_; // something in todo_, or stop_ set
+  LuaCondition done_; // something in finished_
+  std::vector<Batch*> todo_;
+  std::vector<Batch*> finished_;
+  bool stop_;
+};
@@ -4,9 +4,17 @@
 #include "LuaString.h"
 #include "LuaTable.h"
 
+#include "lopt.h"
+
 #define LUAI_GCPAUSE	200  /* 200% */
 #define LUAI_GCMAJOR	200  /* 200% */
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
+#if !defined(LUAI_GCMARKTHREADS)
+#define LUAI_GCMARKTHREADS	1  /* mark on the calling thread only */
+#endif
+#if !defined(LUAI_GCFREETHREAD)
+#define LUAI_GCFREETHREAD	0  /* free dead objects while sweeping */
+#endif
 #define MINSTRTABSIZE	32
 
 #define MEMERRMSG       "not enough memory"
@@ -41,12 +49,10 @@ const char *const gk_tagmethod_names[] = {
 
 //------------------------------------------------------------------------------
 
-LuaList& getGlobalGCList() {
-  return thread_G->allgc;
-}
-
 LuaVM::LuaVM()
-: uvhead()
+: heap_(this),
+  gc_(this),
+  uvhead(NULL)
 {
   LuaVM* oldVM = thread_G;
   LuaThread* oldThread = thread_L;
@@ -57,6 +63,8 @@ LuaVM::LuaVM()
   GCdebt_ = 0;
   totalbytes_ = sizeof(LuaVM);
   call_depth_ = 0;
+  metaEpoch_ = 1;
+  optlevel_ = LUA_OPT_BASIC;
 
   livecolor = LuaObject::colorA;
   deadcolor = LuaObject::colorB;
@@ -70,6 +78,8 @@ LuaVM::LuaVM()
   gcpause = LUAI_GCPAUSE;
   gcmajorinc = LUAI_GCMAJOR;
   gcstepmul = LUAI_GCMUL;
+  gcmarkthreads = LUAI_GCMARKTHREADS;
+  gcfreethread = LUAI_GCFREETHREAD;
   lastmajormem = 0;
 
   panic = NULL;
@@ -85,15 +95,15 @@ LuaVM::LuaVM()
   thread_G = this;
 
   // Create the main thread
-  mainthread = new LuaThread(this);
+  mainthread = new (this) LuaThread(this);
   thread_L = mainthread;
 
   // Create global registry.
-  LuaTable* registry = new LuaTable(LUA_RIDX_LAST, 0);
+  LuaTable* registry = new (this) LuaTable(this, LUA_RIDX_LAST, 0);
   l_registry = LuaValue(registry);
 
   // Create global variable table.
-  LuaTable* globals = new LuaTable();
+  LuaTable* globals = new (this) LuaTable(this);
   registry->set(LuaValue(LUA_RIDX_GLOBALS), LuaValue(globals));
   l_globals = LuaValue(globals);
 
@@ -103,7 +113,7 @@ LuaVM::LuaVM()
   registry->set(LuaValue(LUA_RIDX_MAINTHREAD), LuaValue(mainthread));
 
   // Create global string table.
-  strings_ = new LuaStringTable();
+  strings_ = new LuaStringTable(this);
   strings_->Resize(MINSTRTABSIZE);  /* initial size of string table */
 
   // Create memory error message string.
@@ -145,7 +155,7 @@ LuaVM::~LuaVM() {
 
   luaC_freeallobjects();  /* collect all objects */
 
-  delete mainthread;
+  LuaObject::destroy(mainthread);
   mainthread = NULL;
   thread_L = NULL;
 
@@ -186,7 +196,7 @@ LuaTable* LuaVM::getRegistryTable(const char* name) {
 
   if(val.isTable()) return val.getTable();
 
-  LuaTable* newTable = new LuaTable();
+  LuaTable* newTable = new (this) LuaTable(this);
   registry->set(name, newTable);
   return newTable;
 }
@@ -2,7 +2,9 @@
 
 #include <vector>
 
+#include "LuaBase.h"
 #include "LuaCollector.h"
+#include "LuaHeap.h"
 #include "LuaList.h"
 #include "LuaUpval.h" // for uvhead
 #include "LuaValue.h" // for l_registry
@@ -39,6 +41,10 @@ public:
   LuaVM();
   ~LuaVM();
 
+  // Pool for this VM's small allocations. It's declared first so that it
+  // outlives every other member that might still hold memory from it.
+  LuaHeap heap_;
+
   // actual number of total bytes allocated
   size_t getTotalBytes() {
     return totalbytes_;
@@ -89,9 +95,9 @@ public:
   int gckind;  /* kind of GC running */
   int gcrunning;  /* true if GC is running */
 
-  //LuaObject *allgc;  /* list of all collectable objects */
-  //LuaObject* sweepcursor;
-  LuaList allgc;
+  // Objects that would be in the 'allgc' list are found through the object
+  // pages of 'heap_', and the sweep goes through them a page at a time.
+  LuaHeapPage* sweeppage;
 
   LuaList::iterator sweepgc2;
 
@@ -106,6 +112,8 @@ public:
   int gcpause;  /* size of pause between successive GCs */
   int gcmajorinc;  /* how much to wait for a major GC (only in gen. mode) */
   int gcstepmul;  /* GC `granularity' */
+  int gcmarkthreads;  /* threads marking in full and atomic collections */
+  int gcfreethread;  /* true if dead objects are freed on a helper thread */
 
   LuaCallback panic;  /* to be called in unprotected errors */
   LuaThread *mainthread;
@@ -117,6 +125,14 @@ public:
 
   int call_depth_;
 
+  // Bumped whenever a table that a method cache depends on changes, see
+  // LuaMethodCache.
+  uint64_t metaEpoch_;
+
+  // How hard the parser's bytecode optimizer works on new prototypes, see
+  // lopt.h.
+  int optlevel_;
+
   LuaAnchor* anchor_head_;
   LuaAnchor* anchor_tail_;
 
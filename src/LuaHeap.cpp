@@ -0,0 +1,248 @@
+#include "LuaHeap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Pages are allocated aligned to their own size.
+
+static void* allocPageMemory(size_t size) {
+#if defined(_MSC_VER)
+  return _aligned_malloc(size, size);
+#else
+  void* blob = NULL;
+  if(posix_memalign(&blob, size, size) != 0) return NULL;
+  return blob;
+#endif
+}
+
+static void freePageMemory(void* blob) {
+#if defined(_MSC_VER)
+  _aligned_free(blob);
+#else
+  ::free(blob);
+#endif
+}
+
+// Blocks start after the page header, and in object pages after the mark
+// bitmaps that follow it.
+static const size_t kObjectHeaderSize =
+  (LuaHeap::kHeaderSize + sizeof(LuaMarkBits) + LuaHeap::kGranularity - 1) & ~(LuaHeap::kGranularity - 1);
+
+//-----------------------------------------------------------------------------
+
+LuaHeap::LuaHeap(LuaVM* owner) {
+  owner_ = owner;
+  memset(partial_, 0, sizeof(partial_));
+  memset(pages_, 0, sizeof(pages_));
+  pageCount_ = 0;
+  shared_ = false;
+  concurrent_ = false;
+}
+
+// Whatever is left are the empty pages we kept around. Anything else would
+// be a block that outlived the VM that allocated it.
+LuaHeap::~LuaHeap() {
+  for(int k = 0; k < kNumKinds; k++) {
+    for(int i = 0; i < kNumClasses; i++) {
+      while(partial_[k][i]) {
+        LuaHeapPage* page = partial_[k][i];
+        assert(page->used_ == 0);
+        unlinkPartial(page);
+        releasePage(page);
+      }
+    }
+  }
+  assert(pageCount_ == 0);
+}
+
+LuaHeap* LuaHeap::fallback() {
+  // Never destroyed, blocks from it can be freed at any time.
+  static LuaHeap* heap = new LuaHeap();
+  return heap;
+}
+
+//-----------------------------------------------------------------------------
+
+void* LuaHeap::alloc(size_t size, int kind) {
+  if(shared_) {
+    LuaMutexLock lock(lock_);
+    return allocBlock(size, kind);
+  }
+  return allocBlock(size, kind);
+}
+
+void* LuaHeap::allocBlock(size_t size, int kind) {
+  assert(isSmall(size));
+  assert((kind >= 0) && (kind < kNumKinds));
+
+  int c = sizeClass(size);
+  LuaHeapPage* page = partial_[kind][c];
+  if(page == NULL) {
+    page = newPage(kind, c);
+    if(page == NULL) return NULL;
+  }
+
+  void* blob;
+  size_t blocksize = (size_t)(c + 1) * kGranularity;
+  if(page->freelist_) {
+    blob = page->freelist_;
+    page->freelist_ = *reinterpret_cast<void**>(blob);
+  } else {
+    blob = page->bump_;
+    page->bump_ += blocksize;
+  }
+  page->used_++;
+  page->idle_ = false;
+
+  // Full pages drop out of the list until something in them is freed.
+  if((page->freelist_ == NULL) && (page->bump_ + blocksize > page->end_)) {
+    unlinkPartial(page);
+  }
+
+  return blob;
+}
+
+void LuaHeap::free(void* blob) {
+  LuaHeapPage* page = pageOf(blob);
+  LuaHeap* heap = page->heap_;
+  if(heap->shared_) {
+    LuaMutexLock lock(heap->lock_);
+    heap->release(page, blob);
+    return;
+  }
+  heap->release(page, blob);
+}
+
+void LuaHeap::release(LuaHeapPage* page, void* blob) {
+  assert((uint8_t*)blob >= (uint8_t*)page + kHeaderSize);
+  assert((uint8_t*)blob < page->bump_);
+  assert(page->used_ > 0);
+
+  *reinterpret_cast<void**>(blob) = page->freelist_;
+  page->freelist_ = blob;
+  page->used_--;
+
+  if(!page->partial_) {
+    linkPartial(page);
+  }
+
+  // Give empty pages back, but keep the last one of each size class so a
+  // class that keeps allocating and freeing a few blocks doesn't churn.
+  // The sweep may be partway through an object page, so those are left
+  // for it to trim.
+  if((page->used_ == 0) && (page->prev_ || page->next_) && (page->kind_ == LUA_TNIL)) {
+    unlinkPartial(page);
+    releasePage(page);
+  }
+}
+
+void LuaHeap::trimPage(LuaHeapPage* page) {
+  assert(page->heap_ == this);
+  assert(page->kind_ != LUA_TNIL);
+
+  if(shared_) {
+    LuaMutexLock lock(lock_);
+    trim(page);
+    return;
+  }
+  trim(page);
+}
+
+void LuaHeap::trim(LuaHeapPage* page) {
+  if(page->used_ != 0) return;
+  if(page->idle_ && (page->prev_ || page->next_)) {
+    unlinkPartial(page);
+    releasePage(page);
+    return;
+  }
+  page->idle_ = true;
+}
+
+//-----------------------------------------------------------------------------
+
+LuaHeapPage* LuaHeap::firstObjectPage() {
+  for(int k = LUA_TNIL + 1; k < kNumKinds; k++) {
+    if(pages_[k]) return pages_[k];
+  }
+  return NULL;
+}
+
+LuaHeapPage* LuaHeap::nextObjectPage(LuaHeapPage* page) {
+  if(page->nextPage_) return page->nextPage_;
+  for(int k = page->kind_ + 1; k < kNumKinds; k++) {
+    if(pages_[k]) return pages_[k];
+  }
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+LuaHeapPage* LuaHeap::newPage(int kind, int sizeClass) {
+  void* blob = allocPageMemory(kPageSize);
+  if(blob == NULL) return NULL;
+
+  LuaHeapPage* page = reinterpret_cast<LuaHeapPage*>(blob);
+  page->heap_ = this;
+  page->prev_ = NULL;
+  page->next_ = NULL;
+  page->freelist_ = NULL;
+  page->bump_ = (uint8_t*)blob + ((kind == LUA_TNIL) ? kHeaderSize : kObjectHeaderSize);
+  page->end_ = (uint8_t*)blob + kPageSize;
+  page->kind_ = kind;
+  page->sizeClass_ = sizeClass;
+  page->used_ = 0;
+  page->partial_ = false;
+  page->idle_ = false;
+
+  // A block's bits stay clear until an object is made in it.
+  if(kind != LUA_TNIL) {
+    memset(LuaMarkBits::of(page), 0, sizeof(LuaMarkBits));
+  }
+
+  page->prevPage_ = NULL;
+  page->nextPage_ = pages_[kind];
+  if(pages_[kind]) pages_[kind]->prevPage_ = page;
+  pages_[kind] = page;
+
+  linkPartial(page);
+  pageCount_++;
+  return page;
+}
+
+void LuaHeap::releasePage(LuaHeapPage* page) {
+  assert(page->used_ == 0);
+  assert(!page->partial_);
+
+  if(page->prevPage_) page->prevPage_->nextPage_ = page->nextPage_;
+  else pages_[page->kind_] = page->nextPage_;
+  if(page->nextPage_) page->nextPage_->prevPage_ = page->prevPage_;
+
+  pageCount_--;
+  freePageMemory(page);
+}
+
+void LuaHeap::linkPartial(LuaHeapPage* page) {
+  assert(!page->partial_);
+  LuaHeapPage*& head = partial_[page->kind_][page->sizeClass_];
+  page->prev_ = NULL;
+  page->next_ = head;
+  if(head) head->prev_ = page;
+  head = page;
+  page->partial_ = true;
+}
+
+void LuaHeap::unlinkPartial(LuaHeapPage* page) {
+  assert(page->partial_);
+  if(page->prev_) page->prev_->next_ = page->next_;
+  else partial_[page->kind_][page->sizeClass_] = page->next_;
+  if(page->next_) page->next_->prev_ = page->prev_;
+  page->prev_ = NULL;
+  page->next_ = NULL;
+  page->partial_ = false;
+}
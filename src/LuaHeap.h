@@ -0,0 +1,186 @@
+#pragma once
+
+#include "LuaAtomic.h"
+#include "LuaOSThread.h"
+#include "LuaTypes.h" // for LUA_NUMTAGS
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class LuaHeap;
+class LuaVM;
+
+//-----------------------------------------------------------------------------
+// Small-object allocator. Blocks of up to kMaxSmallSize bytes are carved out
+// of 64k pages, each of which holds blocks of a single size class. Pages are
+// aligned to their size, so the page (and the heap that owns it) can be
+// found from a block's address alone - freeing a block doesn't need a
+// header or the current thread's VM.
+//
+// Each LuaVM owns a heap, so objects from different VMs never share pages,
+// and a block's VM can be found from its page as well.
+//
+// Pages also hold a single kind of block: plain memory, or collectable
+// objects of one LuaType. Object pages keep the collector's bits for their
+// objects in bitmaps after the page header (see LuaMarkBits), so the sweep
+// can go through a page's objects without touching the live ones.
+
+struct LuaHeapPage {
+  LuaHeap* heap_;
+  LuaHeapPage* prev_;
+  LuaHeapPage* next_;
+
+  // In the heap's list of all pages of the same kind.
+  LuaHeapPage* prevPage_;
+  LuaHeapPage* nextPage_;
+
+  void* freelist_;  // blocks that were freed
+  uint8_t* bump_;   // first block that was never handed out
+  uint8_t* end_;
+
+  int kind_;        // LuaType of the objects in it, LUA_TNIL for plain memory
+  int sizeClass_;
+  int used_;
+  bool partial_;    // in the heap's list of pages with free blocks
+  bool idle_;       // object page that was empty when last trimmed
+};
+
+class LuaHeap {
+public:
+
+  static const size_t kPageSize = 64 * 1024;
+  static const size_t kGranularity = 16;
+  static const size_t kMaxSmallSize = 512;
+  static const int kNumClasses = (int)(kMaxSmallSize / kGranularity);
+  static const int kNumKinds = LUA_NUMTAGS;
+
+  // Page header, rounded up to keep blocks 16-byte aligned.
+  static const size_t kHeaderSize =
+    (sizeof(LuaHeapPage) + kGranularity - 1) & ~(kGranularity - 1);
+
+  LuaHeap(LuaVM* owner = NULL);
+  ~LuaHeap();
+
+  static bool isSmall(size_t size) { return size <= kMaxSmallSize; }
+
+  // Size of the block actually handed out for a small request.
+  static size_t blockSize(size_t size) {
+    return size ? (size + kGranularity - 1) & ~(kGranularity - 1) : kGranularity;
+  }
+
+  // 'size' must be small. Blocks for collectable objects pass the object's
+  // type as 'kind'. Returns NULL if a new page can't be allocated.
+  void* alloc(size_t size, int kind = LUA_TNIL);
+
+  // Returns a small block to the heap it came from. Object pages stay
+  // around even when they empty, until the sweep trims them.
+  static void free(void* blob);
+
+  // While shared, blocks may be freed from another thread as well as the
+  // owner's, and every alloc and free takes the heap's lock. Only the
+  // owner's thread may change this, while no other thread is using the heap.
+  void setShared(bool shared) { shared_ = shared; }
+
+  // While set, several threads may be writing to the mark bitmaps at once,
+  // and changes to them have to be atomic.
+  void setConcurrent(bool concurrent) { concurrent_ = concurrent; }
+  bool isConcurrent() const { return concurrent_; }
+
+  // Heap used when there's no active VM.
+  static LuaHeap* fallback();
+
+  // VM that owns the heap a small block came from, NULL for the fallback
+  // heap.
+  static LuaVM* ownerOf(void* blob) { return pageOf(blob)->heap_->owner_; }
+
+  static LuaHeapPage* pageOf(const void* blob) {
+    return reinterpret_cast<LuaHeapPage*>((uintptr_t)blob & ~(uintptr_t)(kPageSize - 1));
+  }
+
+  // Object pages of every kind, in no particular order. Pages added while
+  // going through them come before the cursor.
+  LuaHeapPage* firstObjectPage();
+  LuaHeapPage* nextObjectPage(LuaHeapPage* page);
+
+  // Gives an object page back if nothing in it has been used since the
+  // last time it was trimmed. Pages emptied by one sweep are usually
+  // filled again before the next, so they're kept until then.
+  void trimPage(LuaHeapPage* page);
+
+  size_t getPageCount() const { return pageCount_; }
+
+private:
+
+  static int sizeClass(size_t size) {
+    return size ? (int)((size - 1) / kGranularity) : 0;
+  }
+
+  void* allocBlock(size_t size, int kind);
+
+  LuaHeapPage* newPage(int kind, int sizeClass);
+  void releasePage(LuaHeapPage* page);
+  void release(LuaHeapPage* page, void* blob);
+  void trim(LuaHeapPage* page);
+
+  void linkPartial(LuaHeapPage* page);
+  void unlinkPartial(LuaHeapPage* page);
+
+  LuaVM* owner_;
+  LuaHeapPage* partial_[kNumKinds][kNumClasses];
+  LuaHeapPage* pages_[kNumKinds];
+  size_t pageCount_;
+
+  bool shared_;
+  bool concurrent_;
+  LuaMutex lock_;
+};
+
+//-----------------------------------------------------------------------------
+// The collector's bits for the objects in an object page, one bit per
+// kGranularity bytes of the page. An object's bits are the ones for the
+// address it starts at, and objects are always at least that far apart.
+// What the bits mean is up to LuaObject and the sweep in lgc.cpp.
+
+struct LuaMarkBits {
+  static const int kBits = (int)(LuaHeap::kPageSize / LuaHeap::kGranularity);
+  static const int kWords = kBits / 32;
+
+  // They start right after the page header.
+  static LuaMarkBits* of(LuaHeapPage* page) {
+    return reinterpret_cast<LuaMarkBits*>(reinterpret_cast<uint8_t*>(page) + LuaHeap::kHeaderSize);
+  }
+  static LuaMarkBits* of(const void* object) { return of(LuaHeap::pageOf(object)); }
+
+  static int indexOf(const void* object) {
+    return (int)(((uintptr_t)object & (LuaHeap::kPageSize - 1)) / LuaHeap::kGranularity);
+  }
+
+  static void* objectAt(LuaHeapPage* page, int index) {
+    return reinterpret_cast<uint8_t*>(page) + index * LuaHeap::kGranularity;
+  }
+
+  // Parallel markers may be setting other bits in the same word.
+  static bool test(const uint32_t* plane, int index) {
+    return ((luaAtomicPeek(&plane[index >> 5]) >> (index & 31)) & 1) ? true : false;
+  }
+
+  // Lowest bit set in a nonzero word of a plane.
+  static int lowestBit(uint32_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctz(word);
+#endif
+  }
+
+  uint32_t swept_[kWords];   // in 'allgc', or any string in the page
+  uint32_t marked_[kWords];  // gray or black
+  uint32_t shade_[kWords];   // black if marked, otherwise which white
+  uint32_t old_[kWords];     // set along with the object's old flag
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <assert.h>
+#include <stdint.h>
 #include <vector>
 
 #define FIRST_RESERVED	257
@@ -31,7 +32,8 @@ enum RESERVED {
 struct Token {
  
   Token()
-  : reserved_(0) {
+  : isInteger_(false),
+    reserved_(0) {
   }
 
   Token& operator = (RESERVED id) {
@@ -52,6 +54,13 @@ struct Token {
   Token& operator = (double number) {
     id_ = TK_NUMBER;
     number_ = number;
+    isInteger_ = false;
+  }
+
+  void setInteger(int64_t integer) {
+    id_ = TK_NUMBER;
+    integer_ = integer;
+    isInteger_ = true;
   }
 
   void setString(const char* s, size_t len);
@@ -72,10 +81,17 @@ struct Token {
   int getId() const { return id_; }
   double getNumber() const { return number_; }
 
+  bool isInteger() const { return isInteger_; }
+  int64_t getInteger() const { assert(isInteger_); return integer_; }
+
 protected:
 
   int id_;
-  double number_;
+  union {
+    double number_;
+    int64_t integer_;
+  };
+  bool isInteger_;
 
   std::string text_;
   int reserved_;
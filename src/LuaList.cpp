@@ -3,33 +3,35 @@
 #include "LuaTable.h"
 
 void LuaGraylist::Clear() {
-  while(head_) Pop();
+  objects_.clear();
 }
 
 void LuaGraylist::Sweep() {
-  for (LuaObject* o = head_; o != NULL; o = o->getNextGray()) {
+  for (size_t i = 0; i < objects_.size(); i++) {
+    LuaObject* o = objects_[i];
     if(o->isTable()) {
-      LuaTable *t = dynamic_cast<LuaTable*>(o);
+      LuaTable *t = static_cast<LuaTable*>(o);
       t->SweepWhite();
     }
   }
 }
 
 void LuaGraylist::SweepKeys() {
-  for (LuaObject* o = head_; o != NULL; o = o->getNextGray()) {
+  for (size_t i = 0; i < objects_.size(); i++) {
+    LuaObject* o = objects_[i];
     if(o->isTable()) {
-      LuaTable *t = dynamic_cast<LuaTable*>(o);
+      LuaTable *t = static_cast<LuaTable*>(o);
       t->SweepWhiteKeys();
     }
   }
 }
 
 void LuaGraylist::SweepValues() {
-  for (LuaObject* o = head_; o != NULL; o = o->getNextGray()) {
+  for (size_t i = 0; i < objects_.size(); i++) {
+    LuaObject* o = objects_[i];
     if(o->isTable()) {
-      LuaTable *t = dynamic_cast<LuaTable*>(o);
+      LuaTable *t = static_cast<LuaTable*>(o);
       t->SweepWhiteVals();
     }
   }
 }
-
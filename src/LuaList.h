@@ -4,8 +4,13 @@
 
 #include <assert.h>
 
+#include <vector>
+
 //------------------------------------------------------------------------------
 
+// Singly linked, through the objects' own 'next_'. Objects only ever leave a
+// list from its head or through an iterator, so there's no back link.
+
 class LuaList {
 public:
 
@@ -22,7 +27,6 @@ public:
   LuaObject* getTail() { return tail_; }
 
   void Push(LuaObject* o) {
-    assert(o->getPrev() == NULL);
     assert(o->getNext() == NULL);
 
     if(head_ == NULL) {
@@ -30,7 +34,6 @@ public:
       tail_ = o;
     } else {
       o->setNext(head_);
-      head_->setPrev(o);
       head_ = o;
     }
   }
@@ -47,27 +50,29 @@ public:
     }
   }
 
+  // Links 'o' in right after 'prev', or at the head if 'prev' is NULL.
+  void Insert(LuaObject* prev, LuaObject* o) {
+    if(prev == NULL) {
+      Push(o);
+      return;
+    }
+
+    assert(o->getNext() == NULL);
+    o->setNext(prev->getNext());
+    prev->setNext(o);
+    if(tail_ == prev) tail_ = o;
+  }
+
   LuaObject* Pop() {
     if(head_ == NULL) {
       return NULL;
     }
 
     LuaObject* o = head_;
-    Detach(o);
-    return o;
-  }
-
-  void Detach(LuaObject* o) {
-    if(o == NULL) return;
-
-    if(head_ == o) head_ = o->getNext();
-    if(tail_ == o) tail_ = o->getPrev();
-
-    if(o->getPrev()) o->getPrev()->setNext(o->getNext());
-    if(o->getNext()) o->getNext()->setPrev(o->getPrev());
-
-    o->setPrev(NULL);
+    head_ = o->getNext();
+    if(head_ == NULL) tail_ = NULL;
     o->setNext(NULL);
+    return o;
   }
 
   void Swap(LuaList& l) {
@@ -98,11 +103,11 @@ public:
   class iterator {
   public:
     iterator()
-      : list_(NULL), object_(NULL) {
+      : list_(NULL), prev_(NULL), object_(NULL) {
     }
 
     iterator(LuaList* list)
-      : list_(list), object_(list->getHead()) {
+      : list_(list), prev_(NULL), object_(list->getHead()) {
     }
 
     LuaObject* get() { return object_; }
@@ -116,6 +121,7 @@ public:
     }
 
     iterator& operator ++() {
+      prev_ = object_;
       object_ = object_->getNext();
       return *this;
     }
@@ -133,14 +139,25 @@ public:
     LuaObject* pop() {
       if(object_ == NULL) return NULL;
 
+      // Objects pushed on the list while the iterator was parked at its head
+      // come before it, so the one in front has to be found again.
+      if(prev_ ? (prev_->getNext() != object_) : (list_->head_ != object_)) {
+        prev_ = list_->head_;
+        while(prev_->getNext() != object_) prev_ = prev_->getNext();
+      }
+
       LuaObject* old = object_;
-      object_ = object_->getNext();
-      list_->Detach(old);
+      object_ = old->getNext();
+      if(prev_) prev_->setNext(object_);
+      else      list_->head_ = object_;
+      if(list_->tail_ == old) list_->tail_ = prev_;
+      old->setNext(NULL);
       return old;
     }
 
   protected:
     LuaList* list_;
+    LuaObject* prev_;
     LuaObject* object_;
   };
 
@@ -155,12 +172,14 @@ protected:
 
 //------------------------------------------------------------------------------
 
+// Gray objects waiting to be propagated. Each object is on at most one of
+// these at a time, so they're kept in vectors rather than linked through the
+// objects.
+
 class LuaGraylist {
 public:
 
   LuaGraylist() {
-    head_ = NULL;
-    tail_ = NULL;
   }
 
   ~LuaGraylist() {
@@ -168,47 +187,36 @@ public:
   }
 
   void Swap(LuaGraylist& l) {
-    LuaObject* temp_head = head_;
-    LuaObject* temp_tail = tail_;
-    head_ = l.head_;
-    tail_ = l.tail_;
-    l.head_ = temp_head;
-    l.tail_ = temp_tail;
+    objects_.swap(l.objects_);
   }
 
   void Push(LuaObject* o) {
-    assert(o->getNextGray() == NULL);
     o->setColor(LuaObject::GRAY);
-
-    if(head_ == NULL) {
-      head_ = o;
-      tail_ = o;
-    } else {
-      o->setNextGray(head_);
-      head_ = o;
-    }
+    objects_.push_back(o);
   }
 
   LuaObject* Pop() {
-    if(head_ == NULL) {
+    if(objects_.empty()) {
       return NULL;
     }
 
-    if(head_ == tail_) {
-      LuaObject* o = head_;
-      head_ = NULL;
-      tail_ = NULL;
-      return o;
-    }
-
-    LuaObject* o = head_;
-    head_ = o->getNextGray();
-    o->setNextGray(NULL);
+    LuaObject* o = objects_.back();
+    objects_.pop_back();
     return o;
   }
 
-  bool isEmpty() { 
-    return head_ == NULL;
+  bool isEmpty() {
+    return objects_.empty();
+  }
+
+  // Moves all objects on 'l' to this list.
+  void Append(LuaGraylist& l) {
+    if(objects_.empty()) {
+      Swap(l);
+      return;
+    }
+    objects_.insert(objects_.end(), l.objects_.begin(), l.objects_.end());
+    l.objects_.clear();
   }
 
   void Clear();
@@ -216,7 +224,7 @@ public:
   // Propagate marks through all objects on this graylist, removing them
   // from the list as we go.
   void PropagateGC(LuaGCVisitor& visitor) {
-    while(head_) {
+    while(!objects_.empty()) {
       LuaObject *o = Pop();
       o->PropagateGC(visitor);
     }
@@ -225,8 +233,8 @@ public:
   typedef void (*traverseCB)(LuaObject* o);
 
   void Traverse(traverseCB c) {
-    for(LuaObject* o = head_; o; o = o->getNextGray()) {
-      c(o);
+    for(size_t i = 0; i < objects_.size(); i++) {
+      c(objects_[i]);
     }
   }
 
@@ -235,6 +243,5 @@ public:
   void SweepValues();
 
 private:
-  LuaObject* head_;
-  LuaObject* tail_;
-};
\ No newline at end of file
+  std::vector<LuaObject*> objects_;
+};
@@ -0,0 +1,195 @@
+#include "LuaMarker.h"
+
+#include "LuaAtomic.h"
+#include "LuaCollector.h"
+#include "LuaGlobals.h"
+#include "LuaObject.h"
+#include "LuaOSThread.h"
+#include "LuaTable.h"
+
+#include <assert.h>
+
+// A worker offers part of its stack to the others once it holds this many
+// gray objects.
+static const size_t kShareThreshold = 64;
+
+//-----------------------------------------------------------------------------
+
+static void markThreadEntry(void* arg) {
+  LuaMarkWorker* worker = static_cast<LuaMarkWorker*>(arg);
+  thread_G = worker->g_;
+  worker->Run();
+}
+
+//-----------------------------------------------------------------------------
+
+LuaMarkWorker::LuaMarkWorker()
+: marker_(NULL),
+  g_(NULL),
+  index_(0),
+  sharedLock_(0),
+  sharedSize_(0),
+  mark_count_(0)
+{
+}
+
+void LuaMarkWorker::Run() {
+  LuaGCVisitor visitor(marker_->collector_, this);
+  int workerCount = (int)marker_->workers_.size();
+
+  while(true) {
+    while(!stack_.empty()) {
+      LuaObject* o = stack_.back();
+      stack_.pop_back();
+      o->PropagateGC(visitor);
+
+      if((stack_.size() >= kShareThreshold) && (luaAtomicLoad(&sharedSize_) == 0)) {
+        Share();
+      }
+    }
+
+    if(Steal()) continue;
+
+    // Out of work. Only busy workers can share more, so once all of them
+    // are idle, marking is done.
+    luaAtomicAdd(&marker_->idle_, 1);
+
+    bool stole = false;
+    while(!stole) {
+      if(luaAtomicLoad(&marker_->idle_) == workerCount) {
+        mark_count_ += visitor.mark_count_;
+        return;
+      }
+
+      for(int i = 0; i < workerCount; i++) {
+        if(luaAtomicLoad(&marker_->workers_[i]->sharedSize_) == 0) continue;
+
+        luaAtomicAdd(&marker_->idle_, -1);
+        stole = Steal();
+        if(!stole) luaAtomicAdd(&marker_->idle_, 1);
+        break;
+      }
+
+      if(!stole) LuaOSThread::YieldCPU();
+    }
+  }
+}
+
+// Moves the bottom half of the stack, the objects found earliest and most
+// likely to lead to more work, to the shared queue.
+void LuaMarkWorker::Share() {
+  size_t half = stack_.size() / 2;
+
+  LuaSpinLock lock(sharedLock_);
+  shared_.insert(shared_.end(), stack_.begin(), stack_.begin() + half);
+  stack_.erase(stack_.begin(), stack_.begin() + half);
+  luaAtomicStore(&sharedSize_, (int)shared_.size());
+}
+
+// Takes work back from our own shared queue, or failing that, from the
+// other workers'.
+bool LuaMarkWorker::Steal() {
+  int workerCount = (int)marker_->workers_.size();
+  for(int i = 0; i < workerCount; i++) {
+    LuaMarkWorker* victim = marker_->workers_[(index_ + i) % workerCount];
+    if(TakeFrom(victim)) return true;
+  }
+  return false;
+}
+
+bool LuaMarkWorker::TakeFrom(LuaMarkWorker* victim) {
+  if(luaAtomicLoad(&victim->sharedSize_) == 0) return false;
+
+  LuaSpinLock lock(victim->sharedLock_);
+  std::vector<LuaObject*>& shared = victim->shared_;
+  if(shared.empty()) return false;
+
+  // Take everything from our own queue, half of anyone else's.
+  size_t count = (victim == this) ? shared.size() : (shared.size() + 1) / 2;
+  stack_.insert(stack_.end(), shared.end() - count, shared.end());
+  shared.resize(shared.size() - count);
+  luaAtomicStore(&victim->sharedSize_, (int)shared.size());
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+
+LuaParallelMarker::LuaParallelMarker(LuaCollector* collector, int threadCount)
+: collector_(collector),
+  idle_(0)
+{
+  for(int i = 0; i < threadCount; i++) {
+    LuaMarkWorker* worker = new LuaMarkWorker();
+    worker->marker_ = this;
+    worker->g_ = collector->g_;
+    worker->index_ = i;
+    workers_.push_back(worker);
+  }
+}
+
+LuaParallelMarker::~LuaParallelMarker() {
+  for(size_t i = 0; i < workers_.size(); i++) {
+    delete workers_[i];
+  }
+}
+
+void LuaParallelMarker::Seed(LuaGraylist& list) {
+  size_t i = 0;
+  while(!list.isEmpty()) {
+    workers_[i]->PushGray(list.Pop());
+    i = (i + 1) % workers_.size();
+  }
+}
+
+void LuaParallelMarker::Run(LuaGCVisitor& visitor) {
+  idle_ = 0;
+
+  // Workers set bits in the same mark bitmaps.
+  LuaHeap& heap = collector_->g_->heap_;
+  heap.setConcurrent(true);
+
+  for(size_t i = 1; i < workers_.size(); i++) {
+    // The first worker hasn't started yet, so a worker whose thread
+    // couldn't be created can hand its objects to it and count as idle.
+    if(!workers_[i]->thread_.Start(markThreadEntry, workers_[i])) {
+      std::vector<LuaObject*>& stack = workers_[i]->stack_;
+      workers_[0]->stack_.insert(workers_[0]->stack_.end(), stack.begin(), stack.end());
+      stack.clear();
+      luaAtomicAdd(&idle_, 1);
+    }
+  }
+
+  workers_[0]->Run();
+
+  for(size_t i = 1; i < workers_.size(); i++) {
+    workers_[i]->thread_.Join();
+  }
+  heap.setConcurrent(false);
+
+  Finish(visitor);
+}
+
+void LuaParallelMarker::Finish(LuaGCVisitor& visitor) {
+  for(size_t i = 0; i < workers_.size(); i++) {
+    LuaMarkWorker* worker = workers_[i];
+    assert(worker->stack_.empty() && worker->shared_.empty());
+
+    collector_->grayagain_.Append(worker->grayagain_);
+    collector_->weak_.Append(worker->weak_);
+    collector_->ephemeron_.Append(worker->ephemeron_);
+    collector_->allweak_.Append(worker->allweak_);
+
+    for(size_t j = 0; j < worker->deadslots_.size(); j++) {
+      worker->deadslots_[j]->SweepDeadSlots();
+    }
+    worker->deadslots_.clear();
+
+    for(size_t j = 0; j < worker->remembered_.size(); j++) {
+      collector_->Remember(worker->remembered_[j]);
+    }
+    worker->remembered_.clear();
+
+    visitor.mark_count_ += worker->mark_count_;
+    worker->mark_count_ = 0;
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "LuaList.h" // for LuaGraylist
+#include "LuaOSThread.h"
+
+#include <vector>
+
+class LuaCollector;
+class LuaGCVisitor;
+class LuaObject;
+class LuaParallelMarker;
+class LuaTable;
+class LuaVM;
+
+//-----------------------------------------------------------------------------
+// One marking thread. Gray objects it discovers go on its private stack;
+// when that gets deep and nobody has anything to steal, it moves half of
+// the stack to its shared queue, where idle workers can take it from.
+
+class LuaMarkWorker {
+public:
+
+  LuaMarkWorker();
+
+  void PushGray(LuaObject* o) { stack_.push_back(o); }
+
+  // Runs until every worker is out of gray objects.
+  void Run();
+
+  LuaParallelMarker* marker_;
+  LuaVM* g_;
+  int index_;
+
+  LuaOSThread thread_;
+
+  std::vector<LuaObject*> stack_;   // gray objects only this worker sees
+
+  std::vector<LuaObject*> shared_;  // gray objects others may steal
+  volatile int sharedLock_;
+  volatile int sharedSize_;
+
+  // Tables and threads to revisit, merged into the collector's lists
+  // once marking is done.
+  LuaGraylist grayagain_;
+  LuaGraylist weak_;
+  LuaGraylist ephemeron_;
+  LuaGraylist allweak_;
+
+  std::vector<LuaTable*> deadslots_;    // tables with dead slots to sweep
+  std::vector<LuaObject*> remembered_;  // old tables to remember
+
+  int mark_count_;
+
+private:
+
+  void Share();
+  bool Steal();
+  bool TakeFrom(LuaMarkWorker* victim);
+};
+
+//-----------------------------------------------------------------------------
+// Propagates marks through a gray list with several threads. Objects are
+// claimed by switching their color to gray atomically, so each one is
+// traversed by exactly one worker.
+
+class LuaParallelMarker {
+public:
+
+  LuaParallelMarker(LuaCollector* collector, int threadCount);
+  ~LuaParallelMarker();
+
+  // Hands the objects on 'list' out to the workers.
+  void Seed(LuaGraylist& list);
+
+  // Marks everything reachable from the seeded objects, using the calling
+  // thread as the first worker, then merges the workers' lists back into
+  // the collector and adds their mark counts to 'visitor'.
+  void Run(LuaGCVisitor& visitor);
+
+  LuaCollector* collector_;
+
+  std::vector<LuaMarkWorker*> workers_;
+  volatile int idle_;  // workers that have run out of work
+
+private:
+
+  void Finish(LuaGCVisitor& visitor);
+
+  LuaParallelMarker(const LuaParallelMarker&);
+  LuaParallelMarker& operator = (const LuaParallelMarker&);
+};
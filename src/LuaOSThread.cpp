@@ -0,0 +1,180 @@
+#include "LuaOSThread.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+// Condition variables need Vista.
+#if !defined(_WIN32_WINNT) || (_WIN32_WINNT < 0x0600)
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+LuaOSThread::LuaOSThread()
+: entry_(NULL),
+  arg_(NULL),
+  handle_(0)
+{
+}
+
+LuaOSThread::~LuaOSThread() {
+  assert(!isRunning());
+}
+
+#if defined(_MSC_VER)
+
+static DWORD WINAPI osThreadProc(LPVOID param) {
+  static_cast<LuaOSThread*>(param)->Run();
+  return 0;
+}
+
+bool LuaOSThread::Start(Entry entry, void* arg) {
+  assert(!isRunning());
+  entry_ = entry;
+  arg_ = arg;
+  handle_ = CreateThread(NULL, 0, osThreadProc, this, 0, NULL);
+  return handle_ != NULL;
+}
+
+void LuaOSThread::Join() {
+  if(!isRunning()) return;
+  WaitForSingleObject((HANDLE)handle_, INFINITE);
+  CloseHandle((HANDLE)handle_);
+  handle_ = 0;
+}
+
+void LuaOSThread::YieldCPU() {
+  SwitchToThread();
+}
+
+#else
+
+static void* osThreadProc(void* param) {
+  static_cast<LuaOSThread*>(param)->Run();
+  return NULL;
+}
+
+bool LuaOSThread::Start(Entry entry, void* arg) {
+  assert(!isRunning());
+  entry_ = entry;
+  arg_ = arg;
+  pthread_t* thread = new pthread_t;
+  if(pthread_create(thread, NULL, osThreadProc, this) != 0) {
+    delete thread;
+    return false;
+  }
+  handle_ = thread;
+  return true;
+}
+
+void LuaOSThread::Join() {
+  if(!isRunning()) return;
+  pthread_t* thread = static_cast<pthread_t*>(handle_);
+  pthread_join(*thread, NULL);
+  delete thread;
+  handle_ = 0;
+}
+
+void LuaOSThread::YieldCPU() {
+  sched_yield();
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+#if defined(_MSC_VER)
+
+LuaMutex::LuaMutex() {
+  CRITICAL_SECTION* cs = new CRITICAL_SECTION;
+  InitializeCriticalSection(cs);
+  impl_ = cs;
+}
+
+LuaMutex::~LuaMutex() {
+  CRITICAL_SECTION* cs = static_cast<CRITICAL_SECTION*>(impl_);
+  DeleteCriticalSection(cs);
+  delete cs;
+}
+
+void LuaMutex::Lock() {
+  EnterCriticalSection(static_cast<CRITICAL_SECTION*>(impl_));
+}
+
+void LuaMutex::Unlock() {
+  LeaveCriticalSection(static_cast<CRITICAL_SECTION*>(impl_));
+}
+
+LuaCondition::LuaCondition() {
+  CONDITION_VARIABLE* cv = new CONDITION_VARIABLE;
+  InitializeConditionVariable(cv);
+  impl_ = cv;
+}
+
+LuaCondition::~LuaCondition() {
+  delete static_cast<CONDITION_VARIABLE*>(impl_);
+}
+
+void LuaCondition::Wait(LuaMutex& mutex) {
+  SleepConditionVariableCS(static_cast<CONDITION_VARIABLE*>(impl_),
+                           static_cast<CRITICAL_SECTION*>(mutex.impl_),
+                           INFINITE);
+}
+
+void LuaCondition::WakeAll() {
+  WakeAllConditionVariable(static_cast<CONDITION_VARIABLE*>(impl_));
+}
+
+#else
+
+LuaMutex::LuaMutex() {
+  pthread_mutex_t* mutex = new pthread_mutex_t;
+  pthread_mutex_init(mutex, NULL);
+  impl_ = mutex;
+}
+
+LuaMutex::~LuaMutex() {
+  pthread_mutex_t* mutex = static_cast<pthread_mutex_t*>(impl_);
+  pthread_mutex_destroy(mutex);
+  delete mutex;
+}
+
+void LuaMutex::Lock() {
+  pthread_mutex_lock(static_cast<pthread_mutex_t*>(impl_));
+}
+
+void LuaMutex::Unlock() {
+  pthread_mutex_unlock(static_cast<pthread_mutex_t*>(impl_));
+}
+
+LuaCondition::LuaCondition() {
+  pthread_cond_t* cond = new pthread_cond_t;
+  pthread_cond_init(cond, NULL);
+  impl_ = cond;
+}
+
+LuaCondition::~LuaCondition() {
+  pthread_cond_t* cond = static_cast<pthread_cond_t*>(impl_);
+  pthread_cond_destroy(cond);
+  delete cond;
+}
+
+void LuaCondition::Wait(LuaMutex& mutex) {
+  pthread_cond_wait(static_cast<pthread_cond_t*>(impl_),
+                    static_cast<pthread_mutex_t*>(mutex.impl_));
+}
+
+void LuaCondition::WakeAll() {
+  pthread_cond_broadcast(static_cast<pthread_cond_t*>(impl_));
+}
+
+#endif
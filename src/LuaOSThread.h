@@ -0,0 +1,89 @@
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Operating system threads and the locks between them, for the collector's
+// helper threads. Lua code itself only ever runs on the thread that owns
+// its VM. (Not to be confused with LuaThread, which is a coroutine.)
+
+class LuaOSThread {
+public:
+
+  typedef void (*Entry)(void* arg);
+
+  LuaOSThread();
+  ~LuaOSThread();
+
+  // Returns false if the thread couldn't be created.
+  bool Start(Entry entry, void* arg);
+  void Join();
+
+  bool isRunning() const { return handle_ != 0; }
+
+  // Called on the new thread.
+  void Run() { entry_(arg_); }
+
+  // Gives the rest of this thread's time slice to another thread.
+  static void YieldCPU();
+
+private:
+
+  LuaOSThread(const LuaOSThread&);
+  LuaOSThread& operator = (const LuaOSThread&);
+
+  Entry entry_;
+  void* arg_;
+  void* handle_;
+};
+
+//-----------------------------------------------------------------------------
+
+class LuaMutex {
+public:
+
+  LuaMutex();
+  ~LuaMutex();
+
+  void Lock();
+  void Unlock();
+
+private:
+
+  friend class LuaCondition;
+
+  LuaMutex(const LuaMutex&);
+  LuaMutex& operator = (const LuaMutex&);
+
+  void* impl_;
+};
+
+class LuaMutexLock {
+public:
+
+  LuaMutexLock(LuaMutex& mutex) : mutex_(mutex) { mutex_.Lock(); }
+  ~LuaMutexLock() { mutex_.Unlock(); }
+
+private:
+
+  LuaMutexLock(const LuaMutexLock&);
+  LuaMutexLock& operator = (const LuaMutexLock&);
+
+  LuaMutex& mutex_;
+};
+
+class LuaCondition {
+public:
+
+  LuaCondition();
+  ~LuaCondition();
+
+  // 'mutex' must be locked, and is locked again when this returns.
+  void Wait(LuaMutex& mutex);
+  void WakeAll();
+
+private:
+
+  LuaCondition(const LuaCondition&);
+  LuaCondition& operator = (const LuaCondition&);
+
+  void* impl_;
+};
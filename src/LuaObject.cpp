@@ -1,10 +1,23 @@
 #include "LuaObject.h"
 
 #include "lgc.h"
+#include "lmem.h"
 #include "lstate.h"
 
+#include "LuaAtomic.h"
+#include "LuaClosure.h"
 #include "LuaGlobals.h"
-
+#include "LuaHeap.h"
+#include "LuaProto.h"
+#include "LuaState.h"
+#include "LuaString.h"
+#include "LuaTable.h"
+#include "LuaUpval.h"
+#include "LuaUserdata.h"
+
+#define AGEBITS		0  /* bits 0-1: age (only in generational mode) */
+#define AGEMASK		(3 << AGEBITS)
+#define REMEMBEREDBIT	2  /* object is in the remembered set */
 #define FINALIZEDBIT	3  /* object has been separated for finalization */
 #define SEPARATED	4  /* object is in 'finobj' list or in 'tobefnz' */
 #define OLDBIT		6  /* object is old (only in generational mode) */
@@ -14,152 +27,313 @@
 const LuaObject::Color LuaObject::colorA = WHITE0;
 const LuaObject::Color LuaObject::colorB = WHITE1;
 
-void *luaM_alloc_ (size_t size, int type, int pool);
+//------------------------------------------------------------------------------
+// The colors of paged objects are two bits in their page's bitmaps, 'marked'
+// and 'shade': white0 is 00, white1 01, gray 10 and black 11. While the
+// heap is concurrent, other markers may be changing bits in the same words.
+
+static void setBit(LuaHeapPage* page, uint32_t* plane, int index, bool value) {
+  uint32_t* word = &plane[index >> 5];
+  uint32_t mask = 1u << (index & 31);
+  if(page->heap_->isConcurrent()) {
+    if(value) luaAtomicOr(word, mask);
+    else      luaAtomicAnd(word, ~mask);
+  } else {
+    if(value) *word |= mask;
+    else      *word &= ~mask;
+  }
+}
+
+static bool isMarked(LuaObject::Color c) {
+  return (c == LuaObject::GRAY) || (c == LuaObject::BLACK);
+}
+
+static bool isShaded(LuaObject::Color c) {
+  return (c == LuaObject::WHITE1) || (c == LuaObject::BLACK);
+}
 
 //------------------------------------------------------------------------------
 
-LuaObject::LuaObject(LuaType type) {
-  prev_ = NULL;
+LuaObject::LuaObject(LuaType type, LuaVM* g) {
+  init(type, g, g != NULL);
+}
+
+LuaObject::LuaObject(LuaType type, LuaVM* g, bool paged) {
+  init(type, g, paged);
+}
+
+void LuaObject::init(LuaType type, LuaVM* g, bool paged) {
+  assert(g || !paged);
+
+  Color color = g ? g->livecolor : GRAY;
+
   next_ = NULL;
+  header_ = (uint32_t)type | (paged ? kPagedBit : 0);
+  if(!paged) header_ |= (uint32_t)color << kColorShift;
+
+  // The block may have held a dead object, so all of its bits are reset.
+  if(paged) {
+    LuaHeapPage* page = LuaHeap::pageOf(this);
+    LuaMarkBits* bits = LuaMarkBits::of(page);
+    int index = LuaMarkBits::indexOf(this);
+    setBit(page, bits->swept_, index, false);
+    setBit(page, bits->marked_, index, false);
+    setBit(page, bits->shade_, index, isShaded(color));
+    setBit(page, bits->old_, index, false);
+  }
 
-  prev_gray_ = NULL;
-  next_gray_ = NULL;
+  if(g) g->instanceCounts[type]++;
+}
 
-  flags_ = 0;
-  color_ = thread_G ? thread_G->livecolor : GRAY;
-  type_ = type;
+void* LuaObject::allocObject(size_t size, LuaVM* g, LuaType type) {
+  if(g == NULL) return luaM_alloc_nocheck(size, g);
 
-  if(thread_G) thread_G->instanceCounts[type_]++;
+  void* blob = luaM_allocobject(size, g, type);
+  if(blob) g->incGCDebt((int)size);
+  return blob;
 }
 
 LuaObject::~LuaObject() {
   assert(next_ == NULL);
-  assert(prev_ == NULL);
 
-  if(thread_G) thread_G->instanceCounts[type_]--;
+  if(thread_G) thread_G->instanceCounts[type()]--;
+}
+
+void LuaObject::destroy(LuaObject* o) {
+  if(o == NULL) return;
+  switch(o->type()) {
+    case LUA_TTABLE:   delete static_cast<LuaTable*>(o); break;
+    case LUA_TLCL:
+    case LUA_TCCL:     delete static_cast<LuaClosure*>(o); break;
+    case LUA_TUPVALUE: delete static_cast<LuaUpvalue*>(o); break;
+    case LUA_TBLOB:    delete static_cast<LuaBlob*>(o); break;
+    case LUA_TPROTO:   delete static_cast<LuaProto*>(o); break;
+    case LUA_TTHREAD:  delete static_cast<LuaThread*>(o); break;
+    default:           assert(false); break;
+  }
+}
+
+void LuaObject::operator delete(void* blob, size_t size) {
+  luaM_free(blob, size);
+}
+
+void LuaObject::operator delete(void*, LuaVM*) {
+  assert(false);
 }
 
 //------------------------------------------------------------------------------
 
 void LuaObject::linkGC(LuaList& gclist) {
-  assert(prev_ == NULL);
   assert(next_ == NULL);
 
   gclist.Push(this);
 }
 
-void LuaObject::linkGC(LuaList& list, LuaObject* prev, LuaObject* next) {
-  assert(prev_ == NULL);
-  assert(next_ == NULL);
+//------------------------------------------------------------------------------
 
-  if(prev == NULL) {
-    list.Push(this);
-    return;
-  }
+void LuaObject::linkAllgc() {
+  assert(isPaged() && !inAllgc());
+  LuaHeapPage* page = LuaHeap::pageOf(this);
+  setBit(page, LuaMarkBits::of(page)->swept_, LuaMarkBits::indexOf(this), true);
+}
 
-  if(next == NULL) {
-    list.PushTail(this);
-    return;
-  }
+void LuaObject::unlinkAllgc() {
+  assert(isPaged() && inAllgc());
+  LuaHeapPage* page = LuaHeap::pageOf(this);
+  setBit(page, LuaMarkBits::of(page)->swept_, LuaMarkBits::indexOf(this), false);
+}
 
-  prev_ = prev;
-  next_ = next;
+bool LuaObject::inAllgc() const {
+  if(!isPaged()) return false;
+  return LuaMarkBits::test(LuaMarkBits::of(this)->swept_, LuaMarkBits::indexOf(this));
+}
+
+//------------------------------------------------------------------------------
 
-  if(prev_) prev_->next_ = this;
-  if(next_) next_->prev_ = this;
+LuaObject::Color LuaObject::getColor() const {
+  if(isPaged()) return pagedColor(this);
+  return (Color)((header_ & kColorMask) >> kColorShift);
 }
 
-void LuaObject::unlinkGC(LuaList& list) {
-  list.Detach(this);
+LuaObject::Color LuaObject::pagedColor(const LuaObject* o) {
+  LuaMarkBits* bits = LuaMarkBits::of(o);
+  int index = LuaMarkBits::indexOf(o);
+  bool shade = LuaMarkBits::test(bits->shade_, index);
+  if(LuaMarkBits::test(bits->marked_, index)) {
+    return shade ? BLACK : GRAY;
+  }
+  return shade ? WHITE1 : WHITE0;
 }
 
-//------------------------------------------------------------------------------
+void LuaObject::setColor(Color c) {
+  if(!isPaged()) {
+    header_ = (header_ & ~kColorMask) | ((uint32_t)c << kColorShift);
+    return;
+  }
+
+  LuaHeapPage* page = LuaHeap::pageOf(this);
+  LuaMarkBits* bits = LuaMarkBits::of(page);
+  int index = LuaMarkBits::indexOf(this);
+  setBit(page, bits->marked_, index, isMarked(c));
+  setBit(page, bits->shade_, index, isShaded(c));
+}
 
 bool LuaObject::isBlack() {
-  return color_ == BLACK; 
+  return getColor() == BLACK; 
 }
 
 bool LuaObject::isWhite() {
-  if(thread_G && (color_ == thread_G->livecolor)) {
-    return true;
-  }
-  if(color_ == WHITE0) {
-    return true;
-  }
-  if(color_ == WHITE1) {
-    return true;
-  }
-  return false;
+  Color c = getColor();
+  return (c == WHITE0) || (c == WHITE1);
 }
 
 bool LuaObject::isGray() {
-  return color_ == GRAY;
+  return getColor() == GRAY;
 }
 
 bool LuaObject::isLiveColor() {
-  return color_ == thread_G->livecolor; 
+  return getColor() == thread_G->livecolor; 
 }
 
 bool LuaObject::isDeadColor() {
-  return color_ == thread_G->deadcolor;
+  return getColor() == thread_G->deadcolor;
 }
 
+// The color comes first, so the sweep only reads the flags of objects that
+// are about to be freed.
 bool LuaObject::isDead() {  
-  if(isFixed()) return false;
-  return color_ == thread_G->deadcolor;
+  if(getColor() != thread_G->deadcolor) return false;
+  return !isFixed();
+}
+
+bool LuaObject::casColor(Color expected, Color desired) {
+  if(!isPaged()) {
+    // The color shares its word with the flags, which markers don't change,
+    // so this only has to retry if another thread wrote the same color.
+    while(true) {
+      uint32_t old = header_;
+      if(((old & kColorMask) >> kColorShift) != (uint32_t)expected) return false;
+      uint32_t header = (old & ~kColorMask) | ((uint32_t)desired << kColorShift);
+      if(luaAtomicCAS((volatile int*)&header_, (int)old, (int)header) == (int)old) return true;
+    }
+  }
+
+  // Whoever sets the marked bit first owns the object. Nothing else looks
+  // at its shade until then.
+  assert(!isMarked(expected) && (desired == GRAY));
+  LuaMarkBits* bits = LuaMarkBits::of(this);
+  int index = LuaMarkBits::indexOf(this);
+  uint32_t mask = 1u << (index & 31);
+  if(luaAtomicOr(&bits->marked_[index >> 5], mask) & mask) return false;
+  luaAtomicAnd(&bits->shade_[index >> 5], ~mask);
+  return true;
 }
 
 //------------------------------------------------------------------------------
 // Clear existing color + old bits, set color to current white.
 
 void LuaObject::makeLive() {
-  clearOld();
-  color_ = thread_G->livecolor;
+  clearOldBit();
+  header_ &= ~(((1u << OLDBIT) | AGEMASK) << kFlagShift);
+  setColor(thread_G->livecolor);
 }
 
 //------------------------------------------------------------------------------
 
-void LuaObject::VisitGC(LuaGCVisitor&) {
-  // Should never be visiting the base class
-  assert(false);
+void LuaObject::VisitGC(LuaGCVisitor& visitor) {
+  switch(type()) {
+    case LUA_TSTRING:  static_cast<LuaString*>(this)->VisitGC(visitor); break;
+    case LUA_TTABLE:   static_cast<LuaTable*>(this)->VisitGC(visitor); break;
+    case LUA_TLCL:
+    case LUA_TCCL:     static_cast<LuaClosure*>(this)->VisitGC(visitor); break;
+    case LUA_TUPVALUE: static_cast<LuaUpvalue*>(this)->VisitGC(visitor); break;
+    case LUA_TBLOB:    static_cast<LuaBlob*>(this)->VisitGC(visitor); break;
+    case LUA_TPROTO:   static_cast<LuaProto*>(this)->VisitGC(visitor); break;
+    case LUA_TTHREAD:  static_cast<LuaThread*>(this)->VisitGC(visitor); break;
+    default:           assert(false); break;
+  }
 }
 
-int LuaObject::PropagateGC(LuaGCVisitor&) {
-  // Should never be propagating GC through the base class.
-  assert(false);
-  return 0;
+int LuaObject::PropagateGC(LuaGCVisitor& visitor) {
+  switch(type()) {
+    case LUA_TSTRING:  return static_cast<LuaString*>(this)->PropagateGC(visitor);
+    case LUA_TTABLE:   return static_cast<LuaTable*>(this)->PropagateGC(visitor);
+    case LUA_TLCL:
+    case LUA_TCCL:     return static_cast<LuaClosure*>(this)->PropagateGC(visitor);
+    case LUA_TUPVALUE: return static_cast<LuaUpvalue*>(this)->PropagateGC(visitor);
+    case LUA_TBLOB:    return static_cast<LuaBlob*>(this)->PropagateGC(visitor);
+    case LUA_TPROTO:   return static_cast<LuaProto*>(this)->PropagateGC(visitor);
+    case LUA_TTHREAD:  return static_cast<LuaThread*>(this)->PropagateGC(visitor);
+    default:           assert(false); return 0;
+  }
 }
 
 //------------------------------------------------------------------------------
 
-bool LuaObject::isFinalized()    { return flags_ & (1 << FINALIZEDBIT) ? true : false; }
-void LuaObject::setFinalized()   { flags_ |= (1 << FINALIZEDBIT); }
-void LuaObject::clearFinalized() { flags_ &= ~(1 << FINALIZEDBIT); }
+bool LuaObject::isFinalized()    { return testFlag(FINALIZEDBIT); }
+void LuaObject::setFinalized()   { setFlag(FINALIZEDBIT); }
+void LuaObject::clearFinalized() { clearFlag(FINALIZEDBIT); }
 
 // TODO(aappleby): change to SEPARATEDBIT
-bool LuaObject::isSeparated()    { return flags_ & (1 << SEPARATED) ? true : false; }
-void LuaObject::setSeparated()   { flags_ |= (1 << SEPARATED); }
-void LuaObject::clearSeparated() { flags_ &= ~(1 << SEPARATED); }
+bool LuaObject::isSeparated()    { return testFlag(SEPARATED); }
+void LuaObject::setSeparated()   { setFlag(SEPARATED); }
+void LuaObject::clearSeparated() { clearFlag(SEPARATED); }
 
-bool LuaObject::isFixed()        { return flags_ & (1 << FIXEDBIT) ? true : false; }
-void LuaObject::setFixed()       { flags_ |= (1 << FIXEDBIT); }
-void LuaObject::clearFixed()     { flags_ &= ~(1 << FIXEDBIT); }
+bool LuaObject::isFixed()        { return testFlag(FIXEDBIT); }
+void LuaObject::setFixed()       { setFlag(FIXEDBIT); }
+void LuaObject::clearFixed()     { clearFlag(FIXEDBIT); }
 
 /* MOVE OLD rule: whenever an object is moved to the beginning of
-   a GC list, its old bit must be cleared */
-bool LuaObject::isOld()          { return flags_ & (1 << OLDBIT) ? true : false; }
-void LuaObject::setOld()         { flags_ |= (1 << OLDBIT); }
-void LuaObject::clearOld()       { flags_ &= ~(1 << OLDBIT); }
+   a GC list, its old bit must be cleared. Old objects can point at it
+   without being remembered, so the next minor collection promotes it
+   again rather than letting it age from scratch. */
+bool LuaObject::isOld()          { return testFlag(OLDBIT); }
+
+// Paged objects mirror the flag in their page, so the sweep can tell old
+// objects apart without reading them.
+void LuaObject::setOld() {
+  setFlag(OLDBIT);
+  if(isPaged()) {
+    LuaHeapPage* page = LuaHeap::pageOf(this);
+    setBit(page, LuaMarkBits::of(page)->old_, LuaMarkBits::indexOf(this), true);
+  }
+}
+
+void LuaObject::clearOld() {
+  if(isOld()) setAge(GCPROMOTEAGE - 1);
+  clearOldBit();
+  clearFlag(OLDBIT);
+}
+
+void LuaObject::clearOldBit() {
+  if(isPaged() && isOld()) {
+    LuaHeapPage* page = LuaHeap::pageOf(this);
+    setBit(page, LuaMarkBits::of(page)->old_, LuaMarkBits::indexOf(this), false);
+  }
+}
+
+int LuaObject::getAge() {
+  return (int)(((header_ & kFlagMask) >> kFlagShift) & AGEMASK) >> AGEBITS;
+}
+
+void LuaObject::setAge(int age) {
+  header_ = (header_ & ~((uint32_t)AGEMASK << kFlagShift)) |
+            ((uint32_t)((age << AGEBITS) & AGEMASK) << kFlagShift);
+}
+
+bool LuaObject::isRemembered()    { return testFlag(REMEMBEREDBIT); }
+void LuaObject::setRemembered()   { setFlag(REMEMBEREDBIT); }
+void LuaObject::clearRemembered() { clearFlag(REMEMBEREDBIT); }
 
-bool LuaObject::isTestGray()     { return flags_ & (1 << TESTGRAYBIT) ? true : false; }
-void LuaObject::setTestGray()    { flags_ |= (1 << TESTGRAYBIT); }
-void LuaObject::clearTestGray()  { flags_ &= ~(1 << TESTGRAYBIT); }
+bool LuaObject::isTestGray()     { return testFlag(TESTGRAYBIT); }
+void LuaObject::setTestGray()    { setFlag(TESTGRAYBIT); }
+void LuaObject::clearTestGray()  { clearFlag(TESTGRAYBIT); }
 
 //------------------------------------------------------------------------------
 
-extern char** luaT_typenames;
+extern const char** luaT_typenames;
 const char * LuaObject::typeName() const {
-  return luaT_typenames[type_+1];
+  return luaT_typenames[type()+1];
 }
 
 //------------------------------------------------------------------------------
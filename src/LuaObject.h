@@ -1,16 +1,42 @@
 #pragma once
-#include "LuaBase.h"
 #include "LuaTypes.h"
 
-class LuaObject : public LuaBase {
+#include <stddef.h>
+
+//-----------------------------------------------------------------------------
+// Common header of all collectable objects: one GC link and one word that
+// holds the type tag, flags and (for objects that aren't paged) the color.
+// There's no vtable - the collector dispatches on the type tag, and objects
+// are only ever deleted with LuaObject::destroy, which knows their class.
+
+class LuaObject {
 public:
 
-  LuaObject(LuaType type);
-  virtual ~LuaObject();
+  // 'g' is the VM the object belongs to. It can be NULL for objects
+  // embedded in the VM itself, which are never collected. Objects with a VM
+  // are allocated in its heap's object pages (see allocObject).
+  LuaObject(LuaType type, LuaVM* g);
+
+  // Runs the destructor of the object's class and frees it, as delete would
+  // with a virtual destructor. Strings are freed by LuaStringTable instead.
+  static void destroy(LuaObject* o);
+
+  // Only called if a constructor throws, which none of them do.
+  void operator delete(void*, LuaVM* g);
+
+  void linkGC(LuaList& gclist);
 
-  virtual void linkGC(LuaList& gclist);
-  virtual void linkGC(LuaList& list, LuaObject* prev, LuaObject* next);
-  virtual void unlinkGC(LuaList& gclist);
+  // There's no 'allgc' list - the sweep finds the objects that would be in
+  // it by going through the object pages, and these set or clear the
+  // object's bit in its page. Objects in other lists ('finobj', 'tobefnz',
+  // open upvalues) must not be in 'allgc' as well.
+  void linkAllgc();
+  void unlinkAllgc();
+  bool inAllgc() const;
+
+  // True if the object is in an object page, and its color and old flag
+  // are kept in the page's bitmaps (see LuaMarkBits).
+  bool isPaged() const { return (header_ & kPagedBit) ? true : false; }
 
   enum Color {
     WHITE0 = 1,
@@ -22,8 +48,16 @@ public:
   static const Color colorA;
   static const Color colorB;
 
-  Color getColor() const { return color_; }
-  void setColor(Color c) { color_  = c; }
+  Color getColor() const;
+  void setColor(Color c);
+
+  // The color of a paged object, from its page's bitmaps alone.
+  static Color pagedColor(const LuaObject* o);
+
+  // Atomically changes the color from 'expected' to 'desired', returning
+  // false if some other thread changed it first. For paged objects it can
+  // only turn a white object gray.
+  bool casColor(Color expected, Color desired);
 
   bool isBlack();
   bool isWhite();
@@ -34,22 +68,23 @@ public:
 
   void makeLive();
 
-  virtual void VisitGC(LuaGCVisitor& visitor) = 0;
-  virtual int PropagateGC(LuaGCVisitor& visitor) = 0;
+  // Call the VisitGC or PropagateGC of the object's class.
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
 
   //----------
 
-  LuaType type() const { return type_; }
-  const char* typeName() const; 
+  LuaType type() const { return (LuaType)(header_ & kTypeMask); }
+  const char* typeName() const;
 
-  bool isString()   { return type_ == LUA_TSTRING; }
-  bool isTable()    { return type_ == LUA_TTABLE; }
-  bool isLClosure() { return type_ == LUA_TLCL; }
-  bool isCClosure() { return type_ == LUA_TCCL; }
-  bool isUserdata() { return type_ == LUA_TBLOB; }
-  bool isThread()   { return type_ == LUA_TTHREAD; }
-  bool isProto()    { return type_ == LUA_TPROTO; }
-  bool isUpval()    { return type_ == LUA_TUPVALUE; }
+  bool isString()   { return type() == LUA_TSTRING; }
+  bool isTable()    { return type() == LUA_TTABLE; }
+  bool isLClosure() { return type() == LUA_TLCL; }
+  bool isCClosure() { return type() == LUA_TCCL; }
+  bool isUserdata() { return type() == LUA_TBLOB; }
+  bool isThread()   { return type() == LUA_TTHREAD; }
+  bool isProto()    { return type() == LUA_TPROTO; }
+  bool isUpval()    { return type() == LUA_TUPVALUE; }
 
   //----------
   // Flag read/write
@@ -67,39 +102,66 @@ public:
   void clearFixed();
 
   bool isOld();
-  virtual void setOld();
+  void setOld();
   void clearOld();
 
+  // Minor collections a young object has survived. For an old object in
+  // the remembered set, minor collections since it was last written to.
+  int getAge();
+  void setAge(int age);
+
+  bool isRemembered();
+  void setRemembered();
+  void clearRemembered();
+
   bool isTestGray();
   void setTestGray();
   void clearTestGray();
 
   //----------
 
-  LuaObject* getPrev() const { return prev_; }
   LuaObject* getNext() const { return next_; }
 
-  LuaObject* getNextGray() const { return next_gray_; }
-
   //----------
 
+protected:
+
+  // Strings that are too big for an object page pass 'paged' false.
+  LuaObject(LuaType type, LuaVM* g, bool paged);
+
+  // Only destroy() deletes objects, through their own class.
+  ~LuaObject();
+
+  // Classes allocated with 'new (g)' use this for their operator new, so
+  // their objects go in object pages of 'type'. Collectable objects are all
+  // small enough for them.
+  static void* allocObject(size_t size, LuaVM* g, LuaType type);
+
+  // 'size' is that of the class being deleted, as destroy() always deletes
+  // through the object's own class.
+  void operator delete(void* blob, size_t size);
+
 private:
 
-  friend class LuaList;
-  friend class LuaGraylist;
+  // Layout of 'header_'.
+  static const uint32_t kTypeMask   = 0x000000FF;
+  static const int      kFlagShift  = 8;
+  static const uint32_t kFlagMask   = 0x0000FF00;
+  static const int      kColorShift = 16;
+  static const uint32_t kColorMask  = 0x00FF0000;
+  static const uint32_t kPagedBit   = 0x01000000;
 
-  void setPrev(LuaObject* o) { prev_ = o; }
-  void setNext(LuaObject* o) { next_ = o; }
+  void init(LuaType type, LuaVM* g, bool paged);
+  void clearOldBit();
 
-  void setNextGray(LuaObject* o) { next_gray_ = o; }
+  bool testFlag(int bit) const { return (header_ >> (kFlagShift + bit)) & 1 ? true : false; }
+  void setFlag(int bit)        { header_ |= (1u << (kFlagShift + bit)); }
+  void clearFlag(int bit)      { header_ &= ~(1u << (kFlagShift + bit)); }
 
-  LuaObject* prev_;
-  LuaObject* next_;
+  friend class LuaList;
 
-  LuaObject* prev_gray_;
-  LuaObject* next_gray_;
+  void setNext(LuaObject* o) { next_ = o; }
 
-  LuaType type_;
-  uint8_t flags_;
-  Color color_;
+  LuaObject* next_;  // link in the LuaList the object is on, if any
+  uint32_t header_;
 };
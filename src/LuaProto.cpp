@@ -3,8 +3,9 @@
 #include "LuaClosure.h"
 #include "LuaCollector.h"
 #include "LuaString.h"
+#include "lopcodes.h"
 
-LuaProto::LuaProto() : LuaObject(LUA_TPROTO) {
+LuaProto::LuaProto(LuaVM* g) : LuaObject(LUA_TPROTO, g) {
   cache = NULL;
   numparams = 0;
   is_vararg = false;
@@ -14,16 +15,13 @@ LuaProto::LuaProto() : LuaObject(LUA_TPROTO) {
   source = NULL;
 }
 
-void LuaProto::linkGC(LuaList& gclist) {
-  LuaObject::linkGC(gclist);
-}
-
-void LuaProto::linkGC(LuaList& list, LuaObject* prev, LuaObject* next) {
-  LuaObject::linkGC(list, prev, next);
-}
-
-void LuaProto::unlinkGC(LuaList& gclist) {
-  LuaObject::unlinkGC(gclist);
+void LuaProto::initCaches() {
+  int selfs = 0;
+  tableHints_.resize_nocheck(instructions_.size());
+  for(size_t pc = 0; pc < instructions_.size(); pc++) {
+    if(GET_OPCODE(instructions_[pc]) == OP_SELF) tableHints_[pc] = selfs++;
+  }
+  methodCaches_.resize_nocheck(selfs);
 }
 
 void LuaProto::VisitGC(LuaGCVisitor& visitor) {
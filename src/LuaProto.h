@@ -1,6 +1,7 @@
 #pragma once
 
 #include "LuaObject.h"
+#include "LuaValue.h"
 #include "LuaVector.h"
 
 /*
@@ -24,23 +25,38 @@ struct LocVar {
 };
 
 
+/*
+** Per-call-site cache for OP_SELF: the method found through the __index
+** chain of 'metatable', valid while the VM's metaEpoch_ is still 'epoch'.
+*/
+struct LuaMethodCache {
+  LuaMethodCache() : metatable(NULL), epoch(0), hint(0) {}
+
+  LuaTable* metatable;
+  uint64_t epoch;
+  LuaValue method;
+  int hint;  // slot hint for the receiver's own lookup
+};
+
+
 /*
 ** Function Prototypes
 */
 class LuaProto : public LuaObject {
 public:
-  LuaProto();
+  LuaProto(LuaVM* g);
 
-  virtual void linkGC(LuaList& gclist);
-  virtual void linkGC(LuaList& list, LuaObject* prev, LuaObject* next);
-  virtual void unlinkGC(LuaList& gclist);
+  void* operator new(size_t size, LuaVM* g) { return allocObject(size, g, LUA_TPROTO); }
 
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int  PropagateGC(LuaGCVisitor& visitor);
+  void VisitGC(LuaGCVisitor& visitor);
+  int  PropagateGC(LuaGCVisitor& visitor);
 
   const char* getLocalName(int local_number, int pc) const;
   const char* getUpvalName(int upval_number) const;
 
+  // Sets up the inline caches once the code is final.
+  void initCaches();
+
   inline int getLine(int pc) const {
     if(lineinfo.empty()) return 0;
     return lineinfo[pc];
@@ -52,6 +68,12 @@ public:
   LuaVector<LuaProto*> subprotos_; // functions defined inside the function
   LuaVector<LocVar> locvars; // information about local variables (debug information)
   LuaVector<Upvaldesc> upvalues; // upvalue information
+
+  // Inline caches for table accesses with constant string keys, one per
+  // instruction - the hash slot the key was found in last time. See
+  // LuaTable::findHinted. For OP_SELF it's an index into methodCaches_.
+  LuaVector<int> tableHints_;
+  LuaVector<LuaMethodCache> methodCaches_;
   
   // Creating a separate closure every time we want to invoke a function is
   // wasteful, so Lua stores the most recently used closure and re-uses it
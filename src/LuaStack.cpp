@@ -12,14 +12,20 @@
 
 LuaStack::LuaStack() {
   top_ = NULL;
-  callinfo_head_ = new LuaStackFrame();
-  callinfo_head_->stack_ = this;
+  // Room for a few blocks; the vector doubles when they're all in use and
+  // never shrinks, so dropping blocks doesn't allocate. The first block
+  // only holds the base frame, so an idle thread (a dead coroutine, say)
+  // doesn't keep more than that.
+  frameBlocks_.resize_nocheck(4);
+  frameBlocks_[0] = new LuaFrameBlock(this, NULL, 1);
+  blockCount_ = 1;
+  callinfo_head_ = frameBlocks_[0]->first();
   callinfo_ = callinfo_head_;
 }
 
 LuaStack::~LuaStack() {
   assert(open_upvals_.isEmpty());
-  delete callinfo_head_;
+  freeFrameBlocks(0);
   callinfo_head_ = NULL;
 }
 
@@ -34,7 +40,6 @@ void LuaStack::init() {
 
   /* initialize first ci */
   LuaStackFrame* ci = callinfo_head_;
-  ci->next = ci->previous = NULL;
   ci->callstatus = 0;
   ci->setFunc(getTop());
   top_++;
@@ -89,15 +94,9 @@ void LuaStack::free() {
     return;  
   }
   
-  // free the entire 'ci' list
+  // free all frames but the first block's
   callinfo_ = callinfo_head_;
-  LuaStackFrame *ci = callinfo_head_->next;
-  while (ci != NULL) {
-    LuaStackFrame* next = ci->next;
-    luaM_free(ci);
-    ci = next;
-  }
-  callinfo_head_->next = NULL;
+  freeFrameBlocks(1);
 
   clear();
 }
@@ -329,14 +328,20 @@ void LuaStack::checkArgs(int count) {
 
 //------------------------------------------------------------------------------
 
+// Blocks after the first start at kMinFrames and double in size up to
+// kMaxFrames, so a deep call stack doesn't need many of them and a
+// coroutine that never calls deep stays small.
 LuaStackFrame* LuaStack::extendCallinfo() {
-  LuaStackFrame *ci = new LuaStackFrame();
-  ci->stack_ = this;
   assert(callinfo_->next == NULL);
-  callinfo_->next = ci;
-  ci->previous = callinfo_;
-  ci->next = NULL;
-  return ci;
+  int n = blockCount_;
+  int size = std::max(frameBlocks_[n - 1]->size() * 2, (int)LuaFrameBlock::kMinFrames);
+  size = std::min(size, (int)LuaFrameBlock::kMaxFrames);
+  if (n == (int)frameBlocks_.size()) {
+    frameBlocks_.resize_nocheck(n * 2);
+  }
+  frameBlocks_[n] = new LuaFrameBlock(this, callinfo_, size);
+  blockCount_ = n + 1;
+  return callinfo_->next;
 }
 
 LuaStackFrame* LuaStack::nextCallinfo() {
@@ -347,19 +352,35 @@ LuaStackFrame* LuaStack::nextCallinfo() {
   }
 }
 
+// Drops the blocks past the one the current frame is in. The collector
+// calls this, also from the emergency collection run when memory is over
+// the limit, so it must not allocate.
 void LuaStack::sweepCallinfo() {
-  LuaStackFrame *ci = callinfo_;
-  LuaStackFrame *next = ci->next;
-  ci->next = NULL;
-  while ((ci = next) != NULL) {
-    next = ci->next;
-    delete ci;
+  int n = blockCount_;
+  int keep = n;
+  while (!frameBlocks_[keep - 1]->contains(callinfo_)) keep--;
+  if (keep < n) freeFrameBlocks(keep);
+}
+
+// Deletes all blocks after the first 'keep' ones. 'frameBlocks_' keeps its
+// size unless all of them go.
+void LuaStack::freeFrameBlocks(int keep) {
+  int n = blockCount_;
+  for (int i = keep; i < n; i++) {
+    delete frameBlocks_[i];
+    frameBlocks_[i] = NULL;
+  }
+  if (keep > 0) {
+    frameBlocks_[keep - 1]->last()->next = NULL;
+  } else {
+    frameBlocks_.clear();
   }
+  blockCount_ = keep;
 }
 
 //------------------------------------------------------------------------------
 
-LuaUpvalue* LuaStack::createUpvalFor(StkId level) {
+LuaUpvalue* LuaStack::createUpvalFor(LuaVM* g, StkId level) {
   LuaUpvalue* prev = NULL;
   LuaUpvalue* next = (LuaUpvalue*)open_upvals_.begin().get();
 
@@ -382,36 +403,32 @@ LuaUpvalue* LuaStack::createUpvalFor(StkId level) {
   }
 
   /* not found: create a new one */
-  LuaUpvalue *uv = new LuaUpvalue();
-  uv->linkGC(open_upvals_, prev, next);
+  LuaUpvalue *uv = new (g) LuaUpvalue(g);
+  open_upvals_.Insert(prev, uv);
   uv->v = level;  /* current value lives in the stack */
 
-  // TODO(aappleby): Is there any way to break this dependency on the global state?  
-  uv->uprev = &thread_G->uvhead;  /* double link it in `uvhead' list */
-  uv->unext = thread_G->uvhead.unext;
+  uv->uprev = &g->uvhead;  /* double link it in `uvhead' list */
+  uv->unext = g->uvhead.unext;
   uv->unext->uprev = uv;
-  thread_G->uvhead.unext = uv;
+  g->uvhead.unext = uv;
 
   assert(uv->unext->uprev == uv && uv->uprev->unext == uv);
   return uv;
 }
 
-void LuaStack::closeUpvals(StkId level) {
+void LuaStack::closeUpvals(LuaVM* g, StkId level) {
   LuaUpvalue *uv;
 
   while (!open_upvals_.isEmpty()) {
-    uv = dynamic_cast<LuaUpvalue*>(open_upvals_.getHead());
+    uv = static_cast<LuaUpvalue*>(open_upvals_.getHead());
     if(uv->v < level) break;
 
     assert(!uv->isBlack() && uv->v != &uv->value);
 
-    //open_upvals_ = uv->next_;  /* remove from `open' list */
-    //if(uv->next_) uv->next_->prev_ = NULL;
-    //uv->next_ = NULL;
-    uv->unlinkGC(open_upvals_);
+    open_upvals_.Pop();  /* remove from `open' list */
 
     if (uv->isDead())
-      delete uv;
+      LuaObject::destroy(uv);
     else {
       uv->unlink();  /* remove upvalue from 'uvhead' list */
 
@@ -419,7 +436,7 @@ void LuaStack::closeUpvals(StkId level) {
       uv->v = &uv->value;  /* now current value lives here */
       
       /* link upvalue into 'allgc' list */
-      uv->linkGC(thread_G->allgc);
+      uv->linkAllgc();
 
       // check color (and invariants) for an upvalue that was closed,
       // i.e., moved into the 'allgc' list
@@ -427,15 +444,15 @@ void LuaStack::closeUpvals(StkId level) {
       assert(!uv->isBlack());
 
       if (uv->isGray()) {
-        if (thread_G->keepInvariant()) {
+        if (g->keepInvariant()) {
           uv->clearOld();  /* see MOVE OLD rule */
           uv->setColor(LuaObject::BLACK);  /* it is being visited now */
 
-          LuaGCVisitor visitor(&thread_G->gc_);
+          LuaGCVisitor visitor(&g->gc_);
           visitor.MarkValue(*uv->v);
         }
         else {
-          assert(thread_G->isSweepPhase());
+          assert(g->isSweepPhase());
           uv->makeLive();
         }
       }
@@ -528,7 +545,7 @@ void LuaStack::sanityCheck() {
   // All open upvals must be open and must be non-black.
   //for (LuaObject* uvo = open_upvals_; uvo != NULL; uvo = uvo->getNext()) {
   for(LuaList::iterator it = open_upvals_.begin(); it; ++it) {
-    LuaUpvalue *uv = dynamic_cast<LuaUpvalue*>(it.get());
+    LuaUpvalue *uv = static_cast<LuaUpvalue*>(it.get());
     assert(uv->v != &uv->value);
     assert(!uv->isBlack());
   }
@@ -4,6 +4,8 @@
 #include "LuaValue.h"
 #include "LuaVector.h"
 
+class LuaFrameBlock;
+
 //------------------------------------------------------------------------------
 
 class LuaStack : public LuaVector<LuaValue> {
@@ -63,10 +65,10 @@ public:
   LuaResult createLuaCall(int nargs, int nresults);
 
   //----------
-  // Upvalue support
+  // Upvalue support. 'g' is the VM that owns this stack.
 
-  LuaUpvalue* createUpvalFor(StkId level);
-  void closeUpvals(StkId level);
+  LuaUpvalue* createUpvalFor(LuaVM* g, StkId level);
+  void closeUpvals(LuaVM* g, StkId level);
 
   //----------
 
@@ -88,12 +90,19 @@ public:
 
   LuaStackFrame* callinfo_head_;  /* LuaStackFrame for first level (C calling Lua) */
 
+  // Storage for the frames, see LuaFrameBlock. The first 'blockCount_'
+  // entries are in use and there's always at least one - the first block
+  // holds callinfo_head_.
+  LuaVector<LuaFrameBlock*> frameBlocks_;
+  int blockCount_;
+
   LuaValue* top_;
 
 protected:
 
   LuaResult grow2(int size);
   LuaStackFrame* extendCallinfo();
+  void freeFrameBlocks(int keep);
 
   int countInUse();
   void realloc(int newsize);
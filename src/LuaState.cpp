@@ -14,9 +14,9 @@ LuaResult luaG_runerror (const char *fmt, ...);
 
 //-----------------------------------------------------------------------------
 
-LuaThread::LuaThread(LuaVM* g) : LuaObject(LUA_TTHREAD) {
+LuaThread::LuaThread(LuaVM* g) : LuaObject(LUA_TTHREAD, g) {
   l_G = g;
-  linkGC(l_G->allgc);
+  linkAllgc();
 
   oldpc = -1;
   hookmask = 0;
@@ -33,9 +33,9 @@ LuaThread::LuaThread(LuaVM* g) : LuaObject(LUA_TTHREAD) {
   stack_.init();  /* init stack */
 }
 
-LuaThread::LuaThread(LuaThread* parent_thread) : LuaObject(LUA_TTHREAD) {
+LuaThread::LuaThread(LuaThread* parent_thread) : LuaObject(LUA_TTHREAD, parent_thread->l_G) {
   l_G = parent_thread->l_G;
-  linkGC(l_G->allgc);
+  linkAllgc();
 
   oldpc = -1;
   hookmask = 0;
@@ -59,7 +59,7 @@ LuaThread::LuaThread(LuaThread* parent_thread) : LuaObject(LUA_TTHREAD) {
 
 LuaThread::~LuaThread() {
 
-  stack_.closeUpvals(stack_.begin());
+  stack_.closeUpvals(l_G, stack_.begin());
   assert(stack_.open_upvals_.isEmpty());
 
   if(l_G) {
@@ -137,7 +137,7 @@ void LuaThread::restoreState(LuaExecutionState s, int status, int nresults) {
 
     // Restore the stack to where it was before the call
     StkId oldtop = stack_.atIndex(s.old_top);
-    stack_.closeUpvals(oldtop);
+    stack_.closeUpvals(l_G, oldtop);
     stack_.top_ = oldtop;
 
     // Put the error object on the restored stack
@@ -23,8 +23,10 @@ public:
   LuaThread(LuaThread* parent_thread);
   ~LuaThread();
 
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int PropagateGC(LuaGCVisitor& visitor);
+  void* operator new(size_t size, LuaVM* g) { return allocObject(size, g, LUA_TTHREAD); }
+
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
 
   LuaExecutionState saveState(StkId top);
   void restoreState(LuaExecutionState s, int status, int nresults);
@@ -1,40 +1,45 @@
 #include "LuaString.h"
 
 #include "LuaGlobals.h"
+#include "MurmurHash3.h"
 
 #include "llimits.h"
 
+#include <algorithm>
+#include <new>
+
 //-----------------------------------------------------------------------------
 
+// Hashes every byte of the string - sampling only some of them makes long
+// strings that share most of their characters (paths, URLs) collide.
 uint32_t hashString(const char* str, size_t len) {
-  uint32_t hash = (uint32_t)len;
-
-  size_t step = (len>>5)+1;  // if string is too long, don't hash all its chars
-  for (size_t l1 = len; l1 >= step; l1 -= step) {
-    hash = hash ^ ((hash<<5)+(hash>>2) + (unsigned char)str[l1-1]);
-  }
-
+  uint32_t hash;
+  MurmurHash3_x86_32(str, (int)len, (uint32_t)len, &hash);
   return hash;
 }
 
 //-----------------------------------------------------------------------------
 // LuaString
 
-LuaString::LuaString(uint32_t hash, const char* str, int len)
-: LuaObject(LUA_TSTRING),
-  buf_(NULL),
-  hash_(hash),
+LuaString::LuaString(LuaVM* g, const char* str, int len, bool paged)
+: LuaObject(LUA_TSTRING, g, paged),
+  hash_(0),
+  hashed_(false),
   len_(len)
 {
-  buf_ = (char*)luaM_alloc_nocheck(len_+1);
-  memcpy(buf_, str, len*sizeof(char));
-  buf_[len_] = '\0'; // terminating null
+  char* buf = reinterpret_cast<char*>(this + 1);
+  memcpy(buf, str, len*sizeof(char));
+  buf[len_] = '\0'; // terminating null
 }
 
 LuaString::~LuaString() {
-  luaM_free(buf_);
-  buf_ = NULL;
-  len_ = NULL;
+}
+
+bool LuaString::equals(const LuaString* s) const {
+  if(s == this) return true;
+  if(!isLong() || (s->len_ != len_)) return false;
+  if(hashed_ && s->hashed_ && (hash_ != s->hash_)) return false;
+  return memcmp(c_str(), s->c_str(), len_) == 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -51,19 +56,30 @@ int LuaString::PropagateGC(LuaGCVisitor&) {
 //-----------------------------------------------------------------------------
 // Stringtable
 
-LuaStringTable::LuaStringTable() {
+// Slots visited per call to Sweep().
+static const int kSweepSlots = 8;
+
+LuaStringTable::LuaStringTable(LuaVM* g) {
+  g_ = g;
   nuse_ = 0;
+  ntombs_ = 0;
+  sweepCursor_ = 0;
 }
 
 LuaStringTable::~LuaStringTable() {
 }
 
 LuaString* LuaStringTable::find(uint32_t hash, const char *str, size_t len) {
-  LuaList& l = hash_[hash & (hash_.size()-1)];
+  uint32_t mask = (uint32_t)hash_.size() - 1;
 
-  for(LuaList::iterator it = l.begin(); it; ++it) {
-    LuaString *ts = dynamic_cast<LuaString*>(it.get());
-    if(ts->getHash() != hash) continue;
+  // The table is never full, so there's always an empty slot to stop at.
+  for(uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    const Slot& slot = hash_[i];
+    if(slot.string == NULL) return NULL;
+    if(slot.hash != hash) continue;
+    if(!isLive(slot)) continue;
+
+    LuaString* ts = slot.string;
     if(ts->getLen() != len) continue;
 
     if (memcmp(str, ts->c_str(), len * sizeof(char)) == 0) {
@@ -71,34 +87,38 @@ LuaString* LuaStringTable::find(uint32_t hash, const char *str, size_t len) {
       return ts;
     }
   }
-  return NULL;
+}
+
+void LuaStringTable::insert(uint32_t hash, LuaString* s, bool paged) {
+  uint32_t mask = (uint32_t)hash_.size() - 1;
+
+  for(uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot& slot = hash_[i];
+    if(isLive(slot)) continue;
+    if(slot.string == tombstone()) ntombs_--;
+    slot.hash = hash;
+    slot.paged = paged;
+    slot.string = s;
+    return;
+  }
 }
 
 //-----------------------------------------------------------------------------
 
 void LuaStringTable::Resize(int newsize) {
-  int oldsize = (int)hash_.size();
-
-  LuaVector<LuaList> newhash;
+  LuaVector<Slot> newhash;
   newhash.resize_nocheck(newsize);
+  newhash.swap(hash_);
+  ntombs_ = 0;
 
   /* rehash */
-  for (int i=0; i < oldsize; i++) {
-    LuaList& oldlist = hash_[i];
-
-    while (!oldlist.isEmpty()) {
-      LuaString* s = (LuaString*)oldlist.Pop();
-      unsigned int hash = s->getHash();
-
-      LuaList& newlist = newhash[hash & (newsize-1)];
-      newlist.Push(s);
-
-      s->clearOld();  /* see MOVE OLD rule */
-    }
+  for (int i=0; i < (int)newhash.size(); i++) {
+    if(!isLive(newhash[i])) continue;
+    LuaString* s = newhash[i].string;
+    insert(newhash[i].hash, s, newhash[i].paged);
+    s->clearOld();  /* see MOVE OLD rule */
   }
 
-  hash_.swap(newhash);
-
   sweepCursor_ = 0;
 }
 
@@ -113,68 +133,135 @@ LuaString* LuaStringTable::Create(const char* str) {
 }
 
 LuaString* LuaStringTable::Create(const char *str, int len) {
+  if (len <= LUAI_MAXSHORTLEN) return Intern(str, len);
+
+  // Long strings get a private copy that isn't hashed until it's used as a
+  // table key.
+  LuaString* new_string = allocString(str, len);
+  new_string->linkGC(longStrings_);
+  return new_string;
+}
+
+LuaString* LuaStringTable::Intern(const char *str, int len) {
   uint32_t hash = hashString(str,len);
 
   LuaString* old_string = find(hash, str, len);
   if(old_string) {
-    if(old_string->isDead()) old_string->makeLive();
+    // Resurrect it if the sweep hasn't reached it yet.
+    if(old_string->getColor() == g_->deadcolor) {
+      old_string->clearOld();
+      old_string->setColor(g_->livecolor);
+    }
     return old_string;
   }
 
-  if ((nuse_ >= (uint32_t)hash_.size()) && (hash_.size() <= MAX_INT/2)) {
-    Resize(hash_.size() * 2);
+  // Keep the table at most 3/4 full, counting tombstones. If it's mostly
+  // tombstones, rehashing at the same size is enough.
+  if ((nuse_ + ntombs_ + 1) * 4 > (uint32_t)hash_.size() * 3) {
+    if (((nuse_ + 1) * 2 > (uint32_t)hash_.size()) && (hash_.size() <= MAX_INT/2)) {
+      Resize(hash_.size() * 2);
+    } else {
+      Resize(hash_.size());
+    }
   }
-  
-  LuaString* new_string = new LuaString(hash, str, len);
 
-  LuaList& list = hash_[hash & (hash_.size() - 1)];
-  new_string->linkGC(list);
+  LuaString* new_string = allocString(str, len);
+  new_string->hash_ = hash;
+  new_string->hashed_ = true;
+
+  insert(hash, new_string, new_string->isPaged());
   nuse_++;
   return new_string;
 }
 
+// The string's bytes go in the same block as the header, so it's built in
+// place with ::new. Strings that fit go in the heap's string pages, where
+// the sweep turns them white again.
+LuaString* LuaStringTable::allocString(const char* str, int len) {
+  size_t size = LuaString::allocSize(len);
+  bool paged = luaM_pooled(size);
+  void* blob = paged ? luaM_allocobject(size, g_, LUA_TSTRING) : luaM_alloc_nocheck(size, g_);
+  g_->incGCDebt((int)size);
+  LuaString* s = ::new (blob) LuaString(g_, str, len, paged);
+  if(paged) s->linkAllgc();
+  return s;
+}
+
+void LuaStringTable::freeString(LuaString* s) {
+  if(s->isPaged()) s->unlinkAllgc();
+  g_->gc_.free_thread_.FreeString(s, LuaString::allocSize(s->getLen()));
+}
+
+void LuaStringTable::destroy(LuaString* s) {
+  size_t size = LuaString::allocSize(s->getLen());
+  if(s->isPaged()) s->unlinkAllgc();
+  s->~LuaString();
+  luaM_free(s, size, g_);
+}
+
 //-----------------------------------------------------------------------------
 
 bool LuaStringTable::Sweep(bool generational) {
+  int size = (int)hash_.size();
+
+  if(sweepCursor_ < size) {
+    int end = std::min(sweepCursor_ + kSweepSlots, size);
+    for(; sweepCursor_ < end; sweepCursor_++) {
+      Slot& slot = hash_[sweepCursor_];
+      if(!isLive(slot)) continue;
+
+      // Live strings in pages are turned white by the page sweep, so
+      // they're only read here in generational mode.
+      LuaString* s = slot.string;
+      LuaObject::Color c = slot.paged ? LuaObject::pagedColor(s) : s->getColor();
+      if ((c == g_->deadcolor) && !s->isFixed()) {
+        slot.string = tombstone();
+        ntombs_++;
+        freeString(s);
+        nuse_--;
+      }
+      else if(generational) {
+        s->setOld();
+      }
+      else if(!slot.paged) {
+        s->makeLive();
+      }
+    }
 
-  if(sweepCursor_ >= (int)hash_.size()) sweepCursor_ = 0;
-
-  LuaList::iterator it = hash_[sweepCursor_].begin();
+    if(sweepCursor_ == size) longCursor_ = longStrings_.begin();
+    return false;
+  }
 
-  while(it) {
-    if (it->isDead()) {
-      LuaObject* dead = it;
-      it.pop();
-      delete dead;
-      nuse_--;
+  // Then the long strings that weren't interned.
+  for(int i = 0; longCursor_ && (i < kSweepSlots); i++) {
+    if (longCursor_->isDead()) {
+      freeString(static_cast<LuaString*>(longCursor_.pop()));
     }
     else {
       if(generational) {
-        if (it->isOld()) break;
-        it->setOld();
+        longCursor_->setOld();
       }
       else {
-        it->makeLive();
+        longCursor_->makeLive();
       }
-      ++it;
+      ++longCursor_;
     }
   }
 
-  sweepCursor_++;
-
-  return sweepCursor_ == (int)hash_.size();
+  return !longCursor_;
 }
 
 //-----------------------------------------------------------------------------
 
 void LuaStringTable::Shrink() {
-  if (nuse_ < (uint32_t)(hash_.size() / 2)) {
+  if ((nuse_ < (uint32_t)(hash_.size() / 4)) && (hash_.size() > 32)) {
     Resize(hash_.size() / 2);
   }
 }
 
 void LuaStringTable::RestartSweep() {
   sweepCursor_ = 0;
+  longCursor_ = LuaList::iterator();
 }
 
 //-----------------------------------------------------------------------------
@@ -182,16 +269,19 @@ void LuaStringTable::RestartSweep() {
 void LuaStringTable::Clear() {
 
   for(int i = 0; i < (int)hash_.size(); i++) {
-    LuaList& l = hash_[i];
+    Slot& slot = hash_[i];
+    if(isLive(slot)) destroy(slot.string);
+    slot = Slot();
+  }
 
-    while(!l.isEmpty()) {
-      LuaObject* dead = l.Pop();
-      delete dead;
-    }
+  while(!longStrings_.isEmpty()) {
+    destroy(static_cast<LuaString*>(longStrings_.Pop()));
   }
 
   nuse_ = 0;
+  ntombs_ = 0;
   sweepCursor_ = 0;
+  longCursor_ = LuaList::iterator();
 }
 
 //-----------------------------------------------------------------------------
@@ -2,9 +2,12 @@
 #include "LuaList.h"
 #include "LuaObject.h"
 #include "LuaVector.h"
+#include "llimits.h"
 
 class LuaStringTable;
 
+uint32_t hashString(const char* str, size_t len);
+
 /*
 ** Header for string value; string bytes follow the end of this structure
 */
@@ -13,36 +16,69 @@ public:
 
   ~LuaString();
 
-  size_t getLen() const { return len_; }
-  const char* c_str() const { return buf_; }
-
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int PropagateGC(LuaGCVisitor& visitor);
+  // Strings are allocated and freed by LuaStringTable, never with new and
+  // delete - the block also holds the string's bytes.
+  void operator delete(void*, size_t) { assert(false); }
 
-  uint32_t getHash() const { return hash_; }
+  size_t getLen() const { return len_; }
+  const char* c_str() const { return reinterpret_cast<const char*>(this + 1); }
+
+  // Short strings are always interned, so two of them are equal only if
+  // they're the same object. Long ones can have several copies and are
+  // compared by contents.
+  bool isLong() const { return len_ > LUAI_MAXSHORTLEN; }
+  bool equals(const LuaString* s) const;
+
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
+
+  // Long strings that weren't interned are only hashed if something asks.
+  uint32_t getHash() const {
+    if(!hashed_) {
+      hash_ = hashString(c_str(), len_);
+      hashed_ = true;
+    }
+    return hash_;
+  }
 
 protected:
 
-  LuaString(uint32_t hash, const char* str, int len);
+  LuaString(LuaVM* g, const char* str, int len, bool paged);
   
   friend class LuaStringTable;
 
-  char* buf_;
-  uint32_t hash_;
+  // Size of the block holding the header, the bytes and a terminating null.
+  static size_t allocSize(size_t len) { return sizeof(LuaString) + len + 1; }
+
+  mutable uint32_t hash_;
+  mutable bool hashed_;
   size_t len_;  /* number of characters in string */
 
 };
 
+//-----------------------------------------------------------------------------
+// The string table is a flat, open-addressed hash of interned strings. Each
+// slot holds a string and its hash so most mismatches are rejected without
+// touching the string itself. Slots of swept strings are left as tombstones
+// until the next resize.
+//
+// Long strings that aren't interned skip the table and go in a list of
+// their own, which is swept after it.
+
 class LuaStringTable {
 public:
 
-  LuaStringTable();
+  LuaStringTable(LuaVM* g);
   ~LuaStringTable();
 
   LuaString* Create(const std::string& str);
   LuaString* Create(const char* str);
   LuaString* Create(const char* str, int len);
 
+  // Interns the string whatever its length. The parser uses this for names,
+  // which it compares by address.
+  LuaString* Intern(const char* str, int len);
+
   void Resize(int newsize);
   void Shrink();
   void Clear();
@@ -53,13 +89,40 @@ public:
   // These are used only by ltests.cpp
   int getStringCount() const { return nuse_; }
   int getHashSize() const { return (int)hash_.size(); }
-  LuaString* getStringAt(int index) { return (LuaString*)hash_[index].begin().get(); }
+  LuaString* getStringAt(int index) { return isLive(hash_[index]) ? hash_[index].string : NULL; }
 
 protected:
 
-  LuaVector<LuaList> hash_;
+  // 'paged' is the string's isPaged(), kept here so the sweep doesn't have
+  // to read live strings to find their colors.
+  struct Slot {
+    Slot() : hash(0), paged(false), string(NULL) {}
+    uint32_t hash;
+    bool paged;
+    LuaString* string;
+  };
+
+  static LuaString* tombstone() { return reinterpret_cast<LuaString*>(1); }
+  static bool isLive(const Slot& slot) { return slot.string > tombstone(); }
+
+  // The VM new strings are charged to and get their colors from.
+  LuaVM* g_;
+
+  LuaVector<Slot> hash_;
   uint32_t nuse_;
+  uint32_t ntombs_;
   int sweepCursor_;
 
+  LuaList longStrings_;
+  LuaList::iterator longCursor_;
+
   LuaString* find(uint32_t hash, const char* str, size_t len);
+  void insert(uint32_t hash, LuaString* s, bool paged);
+
+  LuaString* allocString(const char* str, int len);
+
+  // Hands a dead string to the sweeper's free thread.
+  void freeString(LuaString* s);
+
+  void destroy(LuaString* s);
 };
@@ -1,9 +1,23 @@
 #include "LuaTable.h"
 
 #include "LuaCollector.h"
+#include "LuaConversions.h"
 #include "LuaGlobals.h"
 #include "LuaString.h"
 
+#include "ltm.h"
+
+#include <limits.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define LUA_TABLE_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 /*
 ** max size of array part is 2^MAXBITS
 */
@@ -27,110 +41,280 @@ int luaO_ceillog2 (unsigned int x) {
   return l + log_2[x];
 }
 
+//-----------------------------------------------------------------------------
+// Float keys with integral values are stored as integer keys, so that t[1]
+// and t[1.0] (and t[0] and t[-0]) refer to the same slot.
+
+static inline LuaValue normalizeKey(LuaValue key) {
+  if(key.isFloat()) {
+    int64_t i;
+    if(luaO_flt2int(key.getNumber(), &i)) return LuaValue(i);
+  }
+  return key;
+}
+
+
+//-----------------------------------------------------------------------------
+// Control bytes and group matching for the hash part. A full slot's control
+// byte is the low 7 bits of its key's hash, so the high bit marks empty and
+// deleted slots.
+
+static const int kGroupSize = 16;
+static const uint8_t kEmpty = 0x80;
+static const uint8_t kDeleted = 0xFE;
+
+static inline uint32_t hashH1(uint32_t hash) { return hash >> 7; }
+static inline uint8_t  hashH2(uint32_t hash) { return (uint8_t)(hash & 0x7F); }
+
+// Returns a bitmask of the bytes in the group equal to 'b'.
+static inline uint32_t matchByte(const uint8_t* group, uint8_t b) {
+#if defined(LUA_TABLE_SSE2)
+  __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+  uint32_t mask = 0;
+  for(int i = 0; i < kGroupSize; i++) {
+    if(group[i] == b) mask |= (1u << i);
+  }
+  return mask;
+#endif
+}
+
+// Returns a bitmask of the empty and deleted bytes in the group.
+static inline uint32_t matchFree(const uint8_t* group) {
+#if defined(LUA_TABLE_SSE2)
+  __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+  return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+  uint32_t mask = 0;
+  for(int i = 0; i < kGroupSize; i++) {
+    if(group[i] & 0x80) mask |= (1u << i);
+  }
+  return mask;
+#endif
+}
+
+static inline int lowestBit(uint32_t mask) {
+  assert(mask);
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int)index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// Number of keys a hash part with 'capacity' slots may hold. Every probed
+// group must contain an empty slot for lookups to terminate - tables of up
+// to 4 slots always see some of the unused mirror bytes, bigger ones are
+// kept at most 7/8 full.
+static int maxEntries(int capacity) {
+  if(capacity <= 4) return capacity;
+  return capacity - (capacity >> 3);
+}
+
+static int capacityFor(int entries) {
+  if(entries <= 0) return 0;
+  int capacity = 1;
+  while(maxEntries(capacity) < entries) capacity <<= 1;
+  return capacity;
+}
+
 //-----------------------------------------------------------------------------
 
-LuaTable::LuaTable(int arrayLength, int hashLength) 
-: LuaObject(LUA_TTABLE),
-  lastfree(-1) {
+LuaTable::LuaTable(LuaVM* g, int arrayLength, int hashLength) 
+: LuaObject(LUA_TTABLE, g),
+  growthLeft_(0),
+  nextCursor_(0),
+  lengthHint_(0),
+  tmAbsent_(0),
+  metaWatched_(false) {
   metatable = NULL;
-  linkGC(getGlobalGCList());
+  linkAllgc();
 
   if(arrayLength || hashLength) {
     resize(arrayLength, hashLength);
   }
 }
 
+// A new table could be allocated at the same address and then be mistaken
+// for this one by a method cache.
+LuaTable::~LuaTable() {
+  // Tables freed on the free thread had this done when they were swept.
+  if(thread_G) metaChanged();
+}
+
+void LuaTable::metaChanged() {
+  if(metaWatched_) thread_G->metaEpoch_++;
+}
+
 //-----------------------------------------------------------------------------
 
+// '#t' can return any border - an n where t[n] is non-nil (or n is 0) and
+// t[n+1] is nil. set() keeps lengthHint_ on the border that appending to
+// or popping from the end of the table leaves behind, so the usual case is
+// checking two slots. Anything else falls back to the same search luaH_getn
+// does and remembers the result.
+
 int LuaTable::getLength() {
-  int start = 30;
-  int cursor = 0;
-  
-  // Exponential search up (starting at 32) until we find a nil,
-  for(int j = 5; j < 30; j++) {
-    LuaValue v = get(LuaValue(1 << j));
-    if(v.isNone() || v.isNil()) {
-      start = j-1;
-      break;
-    }
+  int64_t j = lengthHint_;
+  if(((j == 0) || getInt(j).isNotNil()) && getInt(j + 1).isNil()) {
+    return (int)j;
   }
 
-  // then binary search below it to find the end.
-  for(int i = start; i >= 0; i--) {
-    int step = (1 << i);
-    LuaValue v = get(LuaValue(cursor+step));
-    if(!v.isNone() && !v.isNil()) {
-      cursor += step;
+  lengthHint_ = findBorder();
+  return lengthHint_;
+}
+
+int LuaTable::findBorder() {
+  int asize = (int)array_.size();
+
+  // If the array part ends in a nil there's a border inside it, binary
+  // search for it.
+  if((asize > 0) && array_[asize - 1].isNil()) {
+    int i = 0;
+    int j = asize;
+    while(j - i > 1) {
+      int m = (i + j) / 2;
+      if(array_[m - 1].isNil()) j = m;
+      else i = m;
+    }
+    return i;
+  }
+
+  if(keys_.empty()) return asize;
+
+  // Otherwise double past the array part until we find a nil, then binary
+  // search back.
+  int64_t i = asize;
+  int64_t j = i + 1;
+  while(getInt(j).isNotNil()) {
+    i = j;
+    if(j > INT_MAX / 2) {
+      // Pathological table, fall back to a linear search.
+      int k = 1;
+      while(getInt(k).isNotNil()) k++;
+      return k - 1;
     }
+    j *= 2;
   }
 
-  return cursor;
+  while(j - i > 1) {
+    int64_t m = (i + j) / 2;
+    if(getInt(m).isNil()) j = m;
+    else i = m;
+  }
+  return (int)i;
 }
 
-//-----------------------------------------------------------------------------
-
-LuaTable::Node* LuaTable::findBin(LuaValue key) {
-  if(hash_.empty()) return NULL;
+// Returns nil rather than None for missing keys.
+LuaValue LuaTable::getInt(int64_t key) {
+  // lua index -> c index
+  uint64_t index = (uint64_t)key - 1;
+  if(index < array_.size()) return array_[index];
 
-  uint32_t hash = key.hashValue();
-  uint32_t mask = (uint32_t)hash_.size() - 1;
-
-  return &hash_[hash & mask];
+  LuaValue k(key);
+  int slot = findSlot(k, k.hashValue());
+  if(slot < 0) return LuaValue::Nil();
+  return vals_[slot];
 }
 
-LuaTable::Node* LuaTable::findBin(int key) {
-  if(hash_.empty()) return NULL;
+//-----------------------------------------------------------------------------
+// Probing. Groups are visited in triangular steps (pos, pos+16, pos+48...),
+// which covers every group of a power-of-two sized table.
 
-  LuaValue key2(key);
-  uint32_t hash = key2.hashValue();
-  uint32_t mask = (uint32_t)hash_.size() - 1;
+int LuaTable::findSlot(LuaValue key, uint32_t hash) const {
+  if(keys_.empty()) return -1;
 
-  return &hash_[hash & mask];
-}
+  uint32_t mask = (uint32_t)keys_.size() - 1;
+  uint32_t pos = hashH1(hash) & mask;
+  uint8_t h2 = hashH2(hash);
 
-//-----------------------------------------------------------------------------
+  for(uint32_t step = kGroupSize;; step += kGroupSize) {
+    const uint8_t* group = ctrl_.begin() + pos;
 
-LuaTable::Node* LuaTable::findNode(LuaValue key) {
-  if(hash_.empty()) return NULL;
+    for(uint32_t match = matchByte(group, h2); match; match &= match - 1) {
+      uint32_t slot = (pos + lowestBit(match)) & mask;
+      if(keys_[slot] == key) return (int)slot;
+    }
 
-  for(Node* node = findBin(key); node; node = node->next) {
-    if(node->i_key == key) return node;
+    if(matchByte(group, kEmpty)) return -1;
+    pos = (pos + step) & mask;
   }
+}
 
-  return NULL;
+// Returns -1 if a table smaller than a group has no free slot left. Bigger
+// tables always have one, see maxEntries().
+int LuaTable::findInsertSlot(uint32_t hash) const {
+  assert(!keys_.empty());
+
+  uint32_t capacity = (uint32_t)keys_.size();
+  uint32_t mask = capacity - 1;
+  uint32_t pos = hashH1(hash) & mask;
+
+  for(uint32_t step = kGroupSize;; step += kGroupSize) {
+    uint32_t match = matchFree(ctrl_.begin() + pos);
+    if(capacity < kGroupSize) {
+      // A small table fits in a single group, but the bytes past its mirror
+      // are always empty - ignore them.
+      match &= (1u << capacity) - 1;
+      if(!match) return -1;
+    }
+    if(match) return (int)((pos + lowestBit(match)) & mask);
+    pos = (pos + step) & mask;
+  }
 }
 
-LuaTable::Node* LuaTable::findNode(int key) {
-  if(hash_.empty()) return NULL;
+void LuaTable::setCtrl(int slot, uint8_t c) {
+  int capacity = (int)keys_.size();
+  ctrl_[slot] = c;
+  // Mirror the first kGroupSize slots past the end of the table.
+  if(slot < kGroupSize) ctrl_[capacity + slot] = c;
+}
 
-  for(Node* node = findBin(key); node; node = node->next) {
-    if(node->i_key == key) return node;
-  }
+void LuaTable::insertNew(LuaValue key, LuaValue val) {
+  uint32_t hash = key.hashValue();
+  int slot = findInsertSlot(hash);
+  assert(slot >= 0);
+  if(ctrl_[slot] == kEmpty) {
+    assert(growthLeft_ > 0);
+    growthLeft_--;
+  }
+  setCtrl(slot, hashH2(hash));
+  keys_[slot] = key;
+  vals_[slot] = val;
+}
 
-  return NULL;
+void LuaTable::killSlot(int slot) {
+  keys_[slot] = LuaValue::Nil();
+  vals_[slot] = LuaValue::Nil();
+  setCtrl(slot, kDeleted);
 }
 
 //-----------------------------------------------------------------------------
-// Linear index <-> key-val conversion, used to (inefficiently) implement
-// lua_next.
+// Linear index <-> key-val conversion. Index 0 to getArraySize()-1 is the
+// array part, the rest are hash slots.
 
 int LuaTable::getTableIndexSize() const {
-  return (int)(array_.size() + hash_.size());
+  return (int)(array_.size() + keys_.size());
 }
 
 bool LuaTable::keyToTableIndex(LuaValue key, int& outIndex) {
+  key = normalizeKey(key);
+
   if(key.isInteger()) {
-    int index = key.getInteger() - 1; // lua index -> c index
-    if((index >= 0) && (index < (int)array_.size())) {
-      outIndex = index;
+    uint64_t index = (uint64_t)key.getInteger() - 1; // lua index -> c index
+    if(index < array_.size()) {
+      outIndex = (int)index;
       return true;
     }
   }
 
-  Node* node = findNode(key);
-  if(node == NULL) return false;
+  int slot = findSlot(key, key.hashValue());
+  if(slot < 0) return false;
   
-  outIndex = (int)(node - hash_.begin()) + (int)array_.size();
+  outIndex = slot + (int)array_.size();
   return true;
 }
 
@@ -143,9 +327,9 @@ bool LuaTable::tableIndexToKeyVal(int index, LuaValue& outKey, LuaValue& outVal)
   }
 
   index -= (int)array_.size();
-  if(index < (int)hash_.size()) {
-    outKey = hash_[index].i_key;
-    outVal = hash_[index].i_val;
+  if(index < (int)keys_.size()) {
+    outKey = keys_[index];
+    outVal = vals_[index];
     return true;
   }
 
@@ -153,48 +337,87 @@ bool LuaTable::tableIndexToKeyVal(int index, LuaValue& outKey, LuaValue& outVal)
 }
 
 //-----------------------------------------------------------------------------
+// Stateful iteration.
 
-LuaValue LuaTable::get(LuaValue key) {
-  if(key.isNil()) return LuaValue::None();
+bool LuaTable::iterate(int& cursor, LuaValue& outKey, LuaValue& outVal) {
+  int asize = (int)array_.size();
 
-  if(key.isInteger()) {
-    // lua index -> c index
-    int intkey = key.getInteger();
-    int index = intkey - 1;
-    if((index >= 0) && (index < (int)array_.size())) {
-      return array_[index];
-    }
+  for(; cursor < asize; cursor++) {
+    if(array_[cursor].isNil()) continue;
+    outKey = LuaValue(cursor + 1); // c index -> lua index
+    outVal = array_[cursor];
+    cursor++;
+    return true;
+  }
 
-    // Important - if the integer wasn't in the array, we have convert it
-    // back into a LuaValue key in order to catch the negative-zero case.
-    key = intkey;
+  int end = asize + (int)keys_.size();
+  for(; cursor < end; cursor++) {
+    int slot = cursor - asize;
+    if(vals_[slot].isNil()) continue;
+    outKey = keys_[slot];
+    outVal = vals_[slot];
+    cursor++;
+    return true;
   }
 
-  // Non-integer key, search the hash table.
+  return false;
+}
+
+// The cursor left by the previous call is checked first - when the caller
+// passes back the key we just returned, which is what pairs() does, this
+// never has to hash the key.
+int LuaTable::next(LuaValue key, LuaValue& outKey, LuaValue& outVal) {
+  int cursor = 0;
 
-  if(hash_.empty()) return LuaValue::None();
+  if(!key.isNil()) {
+    key = normalizeKey(key);
 
-  Node* node = findBin(key);
+    int last = nextCursor_ - 1;
+    int asize = (int)array_.size();
+    bool hit;
+    if(last < 0) {
+      hit = false;
+    } else if(last < asize) {
+      hit = key.isInteger() && (key.getInteger() == last + 1);
+    } else {
+      hit = (last - asize < (int)keys_.size()) && (keys_[last - asize] == key);
+    }
 
-  for(; node; node = node->next) {
-    if(node->i_key == key) {
-      return node->i_val;
+    if(hit) {
+      cursor = nextCursor_;
+    } else {
+      int index;
+      if(!keyToTableIndex(key, index)) return -1;
+      cursor = index + 1;
     }
   }
 
-  return LuaValue::None();
+  bool found = iterate(cursor, outKey, outVal);
+  nextCursor_ = cursor;
+  return found ? 1 : 0;
 }
 
 //-----------------------------------------------------------------------------
 
-LuaTable::Node* LuaTable::getFreeNode() {
-  while (lastfree > 0) {
-    lastfree--;
-    Node* last = &hash_[lastfree];
-    if (last->i_key.isNil())
-      return last;
+LuaValue LuaTable::get(LuaValue key) {
+  if(key.isNil()) return LuaValue::None();
+
+  key = normalizeKey(key);
+
+  if(key.isInteger()) {
+    // lua index -> c index
+    uint64_t index = (uint64_t)key.getInteger() - 1;
+    if(index < array_.size()) {
+      return array_[index];
+    }
   }
-  return NULL;
+
+  // Non-integer key, search the hash table.
+
+  int slot = findSlot(key, key.hashValue());
+  if(slot < 0) return LuaValue::None();
+
+  return vals_[slot];
 }
 
 //-----------------------------------------------------------------------------
@@ -208,59 +431,65 @@ void LuaTable::set(LuaValue key, LuaValue val) {
   }
 
   // Check for NaN keys
-  if (key.isNumber()) {
+  if (key.isFloat()) {
     double n = key.getNumber();
     if(n != n) {
       assert(false);
     }
   }
 
+  key = normalizeKey(key);
+
+  metaChanged();
+
+  // Writing anything that could be a metamethod name invalidates the
+  // absence cache.
+  if(key.isString()) {
+    const char* s = key.getString()->c_str();
+    if((s[0] == '_') && (s[1] == '_')) tmAbsent_ = 0;
+  }
+
   // Check for integer key
   if(key.isInteger()) {
+    // Keep the length hint on the border an append or a pop leaves.
+    int64_t n = key.getInteger();
+    if(val.isNil()) {
+      if((n > 0) && (n <= lengthHint_)) lengthHint_ = (int)(n - 1);
+    } else {
+      if((n == (int64_t)lengthHint_ + 1) && (n < INT_MAX)) lengthHint_ = (int)n;
+    }
+
     // Lua index -> C index
-    int index = key.getInteger() - 1;
-    if((index >= 0) && (index < (int)array_.size())) {
+    uint64_t index = (uint64_t)n - 1;
+    if(index < array_.size()) {
       array_[index] = val;
       return;
     }
   }
 
-  // Not an integer key, or integer doesn't fall in the array. Is there
-  // already a node in the hash table for it?
-  Node* node = findNode(key);
-  if(node) {
-    node->i_val = val;
-    return;
-  }
-  
-  // No node for that key. Can we just put the key in its primary position?
-  Node* primary_node = findBin(key);
-  if(primary_node && primary_node->i_val.isNil()) {
-    primary_node->i_key = key;
-    primary_node->i_val = val;
+  // Not an integer key, or integer doesn't fall in the array. Is the key
+  // already in the hash part?
+  uint32_t hash = key.hashValue();
+  int slot = findSlot(key, hash);
+  if(slot >= 0) {
+    vals_[slot] = val;
     return;
   }
 
-  // Nope, primary position occupied. Get a free node in the hash_
-  Node *new_node = getFreeNode();
+  // Assigning nil to a missing key doesn't need to create it.
+  if(val.isNil()) return;
 
-  // If there are no free nodes, rehash to make space for the key and repeat.
-  if (new_node == NULL) {
+  // If there's no free slot for a new key, rehash to make space for it and
+  // repeat.
+  int free = keys_.empty() ? -1 : findInsertSlot(hash);
+  if((free < 0) || ((growthLeft_ == 0) && (ctrl_[free] == kEmpty))) {
     int arraysize, hashsize;
     computeOptimalSizes(key, arraysize, hashsize);
     resize(arraysize, hashsize);
     return set(key,val);
   }
 
-  // Otherwise, move the old contents of the primary node to the new node
-  new_node->i_key = primary_node->i_key;
-  new_node->i_val = primary_node->i_val;
-  new_node->next = primary_node->next;
-
-  // and put our new key-val in the primary node.
-  primary_node->i_key = key;
-  primary_node->i_val = val;
-  primary_node->next = new_node;
+  insertNew(key, val);
 }
 
 //-----------------------------------------------------------------------------
@@ -293,17 +522,17 @@ LuaValue LuaTable::findKey( LuaValue val ) {
     if(array_[i] == val) return LuaValue(i+1);
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    if(hash_[i].i_val == val) return hash_[i].i_key;
+  for(int i = 0; i < (int)vals_.size(); i++) {
+    if(vals_[i] == val) return keys_[i];
   }
 
   return LuaValue::None();
 }
 
 LuaValue LuaTable::findKeyString( LuaValue val ) {
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    if(!hash_[i].i_key.isString()) continue;
-    if(hash_[i].i_val == val) return hash_[i].i_key;
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(!keys_[i].isString()) continue;
+    if(vals_[i] == val) return keys_[i];
   }
 
   return LuaValue::None();
@@ -313,9 +542,9 @@ LuaValue LuaTable::findKeyString( LuaValue val ) {
 
 void countKey(LuaValue key, int* logtable) {
   if(key.isInteger()) {
-    int k = key.getInteger();
+    int64_t k = key.getInteger();
     if((0 < k) && (k <= MAXASIZE)) {
-      logtable[luaO_ceillog2(k)]++;
+      logtable[luaO_ceillog2((unsigned int)k)]++;
     }
   }
 }
@@ -334,15 +563,13 @@ void LuaTable::computeOptimalSizes(LuaValue newkey, int& outArraySize, int& outH
     totalKeys++;
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    LuaValue& key = hash_[i].i_key;
-    LuaValue& val = hash_[i].i_val;
-    if(val.isNil()) continue;
-    countKey(key, logtable);
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(vals_[i].isNil()) continue;
+    countKey(keys_[i], logtable);
     totalKeys++;
   }
 
-  countKey(newkey, logtable);
+  countKey(normalizeKey(newkey), logtable);
   totalKeys++;
 
   int bestSize = 0;
@@ -378,46 +605,63 @@ void LuaTable::computeOptimalSizes(LuaValue newkey, int& outArraySize, int& outH
 
 int LuaTable::resize(int nasize, int nhsize) {
   int oldasize = (int)array_.size();
-  //int oldhsize = (int)hash_.size();
 
   // Allocate temporary storage for the resize before we modify the table
-  LuaVector<Node> temphash;
   LuaVector<LuaValue> temparray;
+  LuaVector<uint8_t> tempctrl;
+  LuaVector<LuaValue> tempkeys;
+  LuaVector<LuaValue> tempvals;
 
   if(nasize) {
     temparray.resize_nocheck(nasize);
-    memcpy(temparray.begin(), array_.begin(), std::min(oldasize, nasize) * sizeof(LuaValue));
+    std::copy(array_.begin(), array_.begin() + std::min(oldasize, nasize), temparray.begin());
   }
 
-  if (nhsize) {
-    int lsize = luaO_ceillog2(nhsize);
-    nhsize = 1 << lsize;
-    temphash.resize_nocheck(nhsize);
+  int capacity = capacityFor(nhsize);
+  if (capacity) {
+    tempctrl.resize_nocheck(capacity + kGroupSize);
+    tempkeys.resize_nocheck(capacity);
+    tempvals.resize_nocheck(capacity);
+    memset(tempctrl.begin(), kEmpty, capacity + kGroupSize);
   }
 
   // Memory allocated, swap and reinsert
   temparray.swap(array_);
-  temphash.swap(hash_);
-  lastfree = (int)hash_.size(); // all positions are free
+  tempctrl.swap(ctrl_);
+  tempkeys.swap(keys_);
+  tempvals.swap(vals_);
+  growthLeft_ = maxEntries(capacity);
 
-  // Move array overflow to hash_
+  // Move array overflow to the hash part
   for(int i = (int)array_.size(); i < (int)temparray.size(); i++) {
     if (!temparray[i].isNil()) {
-      set(LuaValue(i+1), temparray[i]);
+      insertNew(LuaValue(i+1), temparray[i]);
     }
   }
 
-  // And finally re-insert the saved nodes.
-  for (int i = (int)temphash.size() - 1; i >= 0; i--) {
-    Node* old = &temphash[i];
-    if (!old->i_val.isNil()) {
-      set(old->i_key, old->i_val);
+  // And finally re-insert the saved keys, which may now belong in the
+  // array part.
+  for (int i = 0; i < (int)tempkeys.size(); i++) {
+    if (tempvals[i].isNil()) continue;
+
+    LuaValue key = tempkeys[i];
+    if(key.isInteger()) {
+      uint64_t index = (uint64_t)key.getInteger() - 1;
+      if(index < array_.size()) {
+        array_[index] = tempvals[i];
+        continue;
+      }
     }
+    insertNew(key, tempvals[i]);
   }
 
   return LUA_OK;
 }
 
+int LuaTable::resizeArray(int nasize) {
+  return resize(nasize, maxEntries((int)keys_.size()));
+}
+
 //-----------------------------------------------------------------------------
 
 int LuaTable::traverse(LuaTable::nodeCallback c, void* blob) {
@@ -427,12 +671,11 @@ int LuaTable::traverse(LuaTable::nodeCallback c, void* blob) {
     temp = i + 1; // c index -> lua index;
     c(temp,array_[i],blob);
   }
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-    c(n.i_key, n.i_val, blob);
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    c(keys_[i], vals_[i], blob);
   }
 
-  return TRAVCOST + (int)array_.size() + 2 * (int)hash_.size();
+  return TRAVCOST + (int)array_.size() + 2 * (int)keys_.size();
 }
 
 //-----------------------------------------------------------------------------
@@ -447,11 +690,9 @@ void LuaTable::VisitGC(LuaGCVisitor& visitor) {
     }
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-
-    if(n.i_key.isString()) n.i_key.getObject()->setColor(LuaObject::GRAY);
-    if(n.i_val.isString()) n.i_val.getObject()->setColor(LuaObject::GRAY);
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(keys_[i].isString()) keys_[i].getObject()->setColor(LuaObject::GRAY);
+    if(vals_[i].isString()) vals_[i].getObject()->setColor(LuaObject::GRAY);
   }
 }
 
@@ -464,7 +705,11 @@ int LuaTable::PropagateGC(LuaGCVisitor& visitor) {
   bool weakval = false;
 
   if(metatable) {
-    LuaValue mode = metatable->get("__mode");
+    // Other markers may be reading the metatable too, so it can't be
+    // written to from a parallel traversal.
+    LuaValue mode = visitor.isParallel()
+                    ? fasttm_nocache(visitor.getVM(), metatable, TM_MODE)
+                    : fasttm2(visitor.getVM(), metatable, TM_MODE);
 
     if(mode.isString()) {
       weakkey = (strchr(mode.getString()->c_str(), 'k') != NULL);
@@ -498,24 +743,26 @@ int LuaTable::PropagateGC(LuaGCVisitor& visitor) {
 int LuaTable::PropagateGC_Strong(LuaGCVisitor& visitor) {
   setColor(BLACK);
 
+  // An old table only gets here outside the remembered set if it used to
+  // be weak, and it may be left holding young objects.
+  if(isOld() && !isRemembered()) visitor.Remember(this);
+
   for(int i = 0; i < (int)array_.size(); i++) {
     visitor.MarkValue(array_[i]);
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-
-    if(n.i_val.isNil()) {
-      if (n.i_key.isWhite()) {
-        n.i_key = LuaValue::Nil();
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(vals_[i].isNil()) {
+      if (keys_[i].isWhite()) {
+        killDeadSlot(visitor, i);
       }
     } else {
-      visitor.MarkValue(n.i_key);
-      visitor.MarkValue(n.i_val);
+      visitor.MarkValue(keys_[i]);
+      visitor.MarkValue(vals_[i]);
     }
   }
 
-  return TRAVCOST + (int)array_.size() + 2 * (int)hash_.size();
+  return TRAVCOST + (int)array_.size() + 2 * (int)keys_.size();
 }
 
 //----------
@@ -527,18 +774,16 @@ int LuaTable::PropagateGC_WeakValues(LuaGCVisitor& visitor) {
     if(array_[i].isLiveColor()) hasDeadValues = true;
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-
+  for(int i = 0; i < (int)keys_.size(); i++) {
     // Sweep dead keys with no values, mark all other
     // keys.
-    if(n.i_val.isNil() && n.i_key.isWhite()) {
-      n.i_key = LuaValue::Nil();
+    if(vals_[i].isNil() && keys_[i].isWhite()) {
+      killDeadSlot(visitor, i);
     } else {
-      visitor.MarkValue(n.i_key);
+      visitor.MarkValue(keys_[i]);
     }
 
-    if(n.i_val.isLiveColor()) hasDeadValues = true;
+    if(vals_[i].isLiveColor()) hasDeadValues = true;
   }
 
   if (hasDeadValues) {
@@ -548,7 +793,7 @@ int LuaTable::PropagateGC_WeakValues(LuaGCVisitor& visitor) {
     visitor.PushGrayAgain(this);
   }
 
-  return TRAVCOST + (int)hash_.size();
+  return TRAVCOST + (int)keys_.size();
 }
 
 //----------
@@ -564,27 +809,25 @@ int LuaTable::PropagateGC_Ephemeron(LuaGCVisitor& visitor) {
     }
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-
+  for(int i = 0; i < (int)keys_.size(); i++) {
     // sweep keys for nil values
-    if (n.i_val.isNil()) {
-      if (n.i_key.isWhite()) {
-        n.i_key = LuaValue::Nil();
+    if (vals_[i].isNil()) {
+      if (keys_[i].isWhite()) {
+        killDeadSlot(visitor, i);
       }
       continue;
     }
 
-    if (n.i_key.isLiveColor()) {
+    if (keys_[i].isLiveColor()) {
       hasDeadKeys = true;
      
-      if (n.i_val.isLiveColor()) {
+      if (vals_[i].isLiveColor()) {
         propagate = true;
       }
     } else {
       // Key is marked, mark the value if it's white.
-      if (n.i_val.isWhite()) {
-        visitor.MarkValue(n.i_val);
+      if (vals_[i].isWhite()) {
+        visitor.MarkValue(vals_[i]);
       }
     }
   }
@@ -597,28 +840,46 @@ int LuaTable::PropagateGC_Ephemeron(LuaGCVisitor& visitor) {
     visitor.PushGrayAgain(this);
   }
 
-  return TRAVCOST + (int)array_.size() + (int)hash_.size();
+  return TRAVCOST + (int)array_.size() + (int)keys_.size();
+}
+
+//----------
+// A parallel traversal leaves dead slots for SweepDeadSlots, as removing
+// them while another marker is looking the table up isn't safe.
+
+void LuaTable::killDeadSlot(LuaGCVisitor& visitor, int slot) {
+  if(visitor.isParallel()) {
+    visitor.PushDeadSlots(this);
+  } else {
+    killSlot(slot);
+  }
+}
+
+void LuaTable::SweepDeadSlots() {
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(vals_[i].isNil() && keys_[i].isWhite()) {
+      killSlot(i);
+    }
+  }
 }
 
 //----------
 
 void LuaTable::SweepWhite() {
+  metaChanged();
   for (int i = 0; i < (int)array_.size(); i++) {
     if (array_[i].isLiveColor()) {
       array_[i] = LuaValue::Nil();
     }
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-
-    if(n.i_key.isLiveColor()) {
-      n.i_key = LuaValue::Nil();
-      n.i_val = LuaValue::Nil();
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(keys_[i].isLiveColor()) {
+      killSlot(i);
     }
 
-    if(n.i_val.isLiveColor()) {
-      n.i_val = LuaValue::Nil();
+    if(vals_[i].isLiveColor()) {
+      vals_[i] = LuaValue::Nil();
     }
   }
 }
@@ -626,11 +887,10 @@ void LuaTable::SweepWhite() {
 //----------
 
 void LuaTable::SweepWhiteKeys() {
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-    if(n.i_key.isLiveColor()) {
-      n.i_val = LuaValue::Nil();
-      n.i_key = LuaValue::Nil();
+  metaChanged();
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(keys_[i].isLiveColor()) {
+      killSlot(i);
     }
   }
 }
@@ -638,20 +898,20 @@ void LuaTable::SweepWhiteKeys() {
 //----------
 
 void LuaTable::SweepWhiteVals() {
+  metaChanged();
   for (int i = 0; i < (int)array_.size(); i++) {
     if (array_[i].isLiveColor()) {
       array_[i] = LuaValue::Nil();
     }
   }
 
-  for(int i = 0; i < (int)hash_.size(); i++) {
-    Node& n = hash_[i];
-    if(!n.i_val.isLiveColor()) continue;
+  for(int i = 0; i < (int)keys_.size(); i++) {
+    if(!vals_[i].isLiveColor()) continue;
 
     // White value. If key was white, key goes away too.
-    n.i_val = LuaValue::Nil();
-    if (n.i_key.isWhite()) {
-      n.i_key = LuaValue::Nil();
+    vals_[i] = LuaValue::Nil();
+    if (keys_[i].isWhite()) {
+      killSlot(i);
     }
   }
 }
@@ -8,22 +8,34 @@ class LuaTable;
 class LuaTable : public LuaObject {
 public:
 
-  LuaTable(int arrayLength = 0, int hashLength = 0);
+  LuaTable(LuaVM* g, int arrayLength = 0, int hashLength = 0);
+  ~LuaTable();
+
+  void* operator new(size_t size, LuaVM* g) { return allocObject(size, g, LUA_TTABLE); }
 
   int getLength();
 
   bool hasArray() { return !array_.empty(); }
-  bool hasHash()  { return !hash_.empty(); }
+  bool hasHash()  { return !keys_.empty(); }
 
   // Converts key to/from linear table index.
   int  getTableIndexSize  () const;
   bool keyToTableIndex    (LuaValue key, int& outIndex);
   bool tableIndexToKeyVal (int index, LuaValue& outKey, LuaValue& outValue);
 
+  // Returns the first non-nil entry at or after linear index 'cursor' and
+  // moves the cursor past it. Start at 0, returns false at the end.
+  bool iterate(int& cursor, LuaValue& outKey, LuaValue& outVal);
+
+  // Finds the entry after 'key', or the first one if key is nil. Returns 1
+  // if there is one, 0 at the end of the table and -1 if key isn't in the
+  // table.
+  int next(LuaValue key, LuaValue& outKey, LuaValue& outVal);
+
   // Would be nice if I could remove these, but nextvar.lua fails
   // if I remove the optimization in OP_SETLIST that uses them.
   int getArraySize() const { return (int)array_.size(); }
-  int getHashSize() const { return (int)hash_.size(); }
+  int getHashSize() const { return (int)keys_.size(); }
 
   // Main get/set methods, which we'll gradually be transitioning to.
   LuaValue get(LuaValue key);
@@ -31,43 +43,70 @@ public:
 
   void set(int key, LuaValue val) { set( LuaValue(key), val); }
 
-  // This creates dependencies, but it's used everywhere.
+  // This creates dependencies, but it's used everywhere. The key strings
+  // are created in the current thread's VM, so these are for library setup
+  // and the API - code that runs often should look keys up as LuaStrings.
   LuaValue get(const char* key);
   void     set(const char* key, LuaValue val);
   void     set(const char* key, const char* val);
 
+  // Returns the value slot for a string key, or NULL if the key isn't in
+  // the table. 'hint' is the slot the caller found the key in last time -
+  // if the key is still there the lookup is a single compare, otherwise
+  // the hint is updated. The returned pointer is invalidated by any set().
+  LuaValue* findHinted(const LuaValue& key, int& hint) {
+    assert(key.isString());
+    if(((size_t)hint < keys_.size()) && (keys_[hint] == key)) return &vals_[hint];
+    int slot = findSlot(key, key.hashValue());
+    if(slot < 0) return NULL;
+    hint = slot;
+    return &vals_[slot];
+  }
+
+  // Returns the array part slot for integer key 'n', or NULL if the key is
+  // outside the array part.
+  LuaValue* arraySlot(int64_t n) {
+    uint64_t index = (uint64_t)n - 1;
+    return (index < array_.size()) ? &array_[(size_t)index] : NULL;
+  }
+
   // Reverse lookup, O(N).
   LuaValue findKey(LuaValue val);
   LuaValue findKeyString(LuaValue val);
   
-  // This is used in a few places
+  // This is used in a few places. 'hashsize' is the number of entries the
+  // hash part must be able to hold, not its capacity.
   int resize(int arrayssize, int hashsize);
 
+  // Resizes the array part, keeping the capacity of the hash part.
+  int resizeArray(int arraysize);
+
   //----------
   // Test support, not used in actual VM
 
   int getArraySize() { return (int)array_.size(); }
-  int getHashSize()  { return (int)hash_.size(); }
+  int getHashSize()  { return (int)keys_.size(); }
 
   void getArrayElement ( int index, LuaValue& outVal ) {
     outVal = array_[index];
   }
 
   void getHashElement ( int index, LuaValue& outKey, LuaValue& outVal ) {
-    outKey = hash_[index].i_key;
-    outVal = hash_[index].i_val;
+    outKey = keys_[index];
+    outVal = vals_[index];
   }
 
   //----------
   // Garbage collection support, should probably be split out into a subclass
 
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int PropagateGC(LuaGCVisitor& visitor);
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
 
   int PropagateGC_Strong(LuaGCVisitor& visitor);
   int PropagateGC_WeakValues(LuaGCVisitor& visitor);
   int PropagateGC_Ephemeron(LuaGCVisitor& visitor);
 
+  void SweepDeadSlots();
   void SweepWhite();
   void SweepWhiteKeys();
   void SweepWhiteVals();
@@ -78,39 +117,73 @@ public:
   typedef void (*nodeCallback)(const LuaValue& key, const LuaValue& value, void* blob);
   int traverse(LuaTable::nodeCallback c, void* blob);
 
+  //----------
+  // Metamethod absence cache, for tables used as metatables. Bit 'event' is
+  // set once a lookup found that metamethod missing, and all bits are
+  // cleared whenever a key starting with "__" is written.
+
+  bool tmAbsent(int event) const { return (tmAbsent_ & (1u << event)) != 0; }
+  void setTmAbsent(int event) { tmAbsent_ |= (1u << event); }
+
+  //----------
+  // Method caches (see LuaMethodCache) depend on the contents of the
+  // metatables and __index tables they were filled from. Those tables are
+  // watched, and any change to one bumps the VM's metaEpoch_.
+
+  bool isMetaWatched() const { return metaWatched_; }
+  void setMetaWatched() { metaWatched_ = true; }
+  void metaChanged();
+
   //----------
 
   LuaTable *metatable;
 
 protected:
 
-  class Node {
-  public:
-    LuaValue i_val;
-    LuaValue i_key;
-    Node *next;  /* for chaining */
-  };
-
   LuaVector<LuaValue> array_;
-  LuaVector<Node> hash_;
 
-  int lastfree;
+  // The hash part is an open-addressed, Swiss-table style hash. Each slot
+  // has a control byte - empty, deleted, or the low 7 bits of the key's
+  // hash - and slots are probed 16 control bytes at a time. ctrl_ has
+  // kGroupSize extra bytes at the end that mirror the first ones, so a
+  // group can be loaded from any slot without wrapping around. Keys and
+  // values live in their own arrays, indexed by slot.
+  LuaVector<uint8_t> ctrl_;
+  LuaVector<LuaValue> keys_;
+  LuaVector<LuaValue> vals_;
 
-  // Returns the node matching the key.
-  Node* findNode(LuaValue key);
-  Node* findNode(int key);
+  // Number of empty slots that can still be filled before a rehash.
+  int growthLeft_;
 
-  // Returns the node where the key would go.
-  Node* findBin(LuaValue key);
-  Node* findBin(int key);
+  // Linear index following the entry last returned by next().
+  int nextCursor_;
 
-  //----------
+  // Where getLength() expects to find a border, see getLength().
+  int lengthHint_;
 
-  Node* getFreeNode();
+  uint32_t tmAbsent_;  // one bit per TMS, TM_N must stay <= 32
 
-  void computeOptimalSizes(LuaValue newkey, int& arraysize, int& hashsize);
+  bool metaWatched_;
+
+  int findBorder();
+  LuaValue getInt(int64_t key);
 
-  LuaValue* newKey(const LuaValue* key);
+  // Returns the slot holding the key, or -1. The key must be normalized.
+  int findSlot(LuaValue key, uint32_t hash) const;
+
+  // Returns the first empty or deleted slot in the key's probe sequence.
+  int findInsertSlot(uint32_t hash) const;
+
+  void setCtrl(int slot, uint8_t c);
+
+  // Adds a key that isn't already in the table, there must be room for it.
+  void insertNew(LuaValue key, LuaValue val);
+
+  // Removes a slot's key and value and leaves a tombstone in its place.
+  void killSlot(int slot);
+  void killDeadSlot(LuaGCVisitor& visitor, int slot);
+
+  void computeOptimalSizes(LuaValue newkey, int& arraysize, int& hashsize);
 
   //----------
 
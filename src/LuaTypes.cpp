@@ -11,11 +11,12 @@ LuaResult luaG_runerror (const char *fmt, ...);
 __declspec(thread) LuaThread* thread_L = NULL;
 __declspec(thread) LuaVM* thread_G = NULL;
 
-char* luaT_typenames_[] = {
+const char* luaT_typenames_[] = {
   "nil",
   "no value",
   "boolean",
   "number",
+  "number",
   "userdata",
   "function",
 
@@ -39,7 +40,7 @@ const char* objtypename(const LuaValue* v) {
   return luaT_typenames_[v->type()];
 }
 
-char** luaT_typenames = &luaT_typenames_[0];
+const char** luaT_typenames = &luaT_typenames_[0];
 
 LuaStringTable* getGlobalStringtable() {
   return thread_G->strings_;
@@ -38,12 +38,13 @@ typedef std::vector<std::string> ErrorList;
 
 //-----------------------------------------------------------------------------
 
-void  luaM_free(void * blob);
-
-LuaList& getGlobalGCList();
+void  luaM_free(void * blob, size_t size);
 
 //-----------------------------------------------------------------------------
 
+// The thread and VM the public API was last entered with. Internal code is
+// handed its VM explicitly instead - reading these is slow on platforms
+// where thread-locals live behind a function call (PIC code on Linux).
 extern __declspec(thread) LuaThread* thread_L;
 extern __declspec(thread) LuaVM* thread_G;
 
@@ -78,19 +79,20 @@ enum LuaType {
   LUA_TNONE     = 1,   // None - invalid value, what you get if you read past the end of an array.
   LUA_TBOOLEAN  = 2,   // Boolean
   LUA_TNUMBER   = 3,   // Double-precision floating point number
-  LUA_TPOINTER  = 4,   // User-supplied void*
-  LUA_TCALLBACK = 5,   // C function pointer, used like a callback.
-
-  LUA_TSTRING   = 6,   // String
-  LUA_TTABLE    = 7,   // LuaTable
-  LUA_TTHREAD   = 8,   // One execution state, like a thread.
-  LUA_TPROTO    = 9,   // Function prototype, contains VM opcodes
-  LUA_TLCL      = 10,  // Lua closure
-  LUA_TCCL      = 11,  // C closure - function pointer with persistent state
-  LUA_TUPVALUE  = 12,  // Persistent state object for C and Lua closuers
-  LUA_TBLOB     = 13,  // User-supplied blob of bytes
-
-  LUA_NUMTAGS   = 14,
+  LUA_TINTEGER  = 4,   // 64-bit integer. Same Lua type as LUA_TNUMBER, see LuaValue::type()
+  LUA_TPOINTER  = 5,   // User-supplied void*
+  LUA_TCALLBACK = 6,   // C function pointer, used like a callback.
+
+  LUA_TSTRING   = 7,   // String
+  LUA_TTABLE    = 8,   // LuaTable
+  LUA_TTHREAD   = 9,   // One execution state, like a thread.
+  LUA_TPROTO    = 10,  // Function prototype, contains VM opcodes
+  LUA_TLCL      = 11,  // Lua closure
+  LUA_TCCL      = 12,  // C closure - function pointer with persistent state
+  LUA_TUPVALUE  = 13,  // Persistent state object for C and Lua closuers
+  LUA_TBLOB     = 14,  // User-supplied blob of bytes
+
+  LUA_NUMTAGS   = 15,
 };
 
 /*
@@ -2,7 +2,7 @@
 
 #include "LuaCollector.h"
 
-LuaUpvalue::LuaUpvalue() : LuaObject(LUA_TUPVALUE) {
+LuaUpvalue::LuaUpvalue(LuaVM* g) : LuaObject(LUA_TUPVALUE, g) {
   v = &value;
   uprev = NULL;
   unext = NULL;
@@ -8,13 +8,15 @@
 class LuaUpvalue : public LuaObject {
 public:
 
-  LuaUpvalue();
+  LuaUpvalue(LuaVM* g);
   ~LuaUpvalue();
 
+  void* operator new(size_t size, LuaVM* g) { return allocObject(size, g, LUA_TUPVALUE); }
+
   void unlink();
 
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int PropagateGC(LuaGCVisitor& visitor);
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
 
   LuaValue *v;  /* points to stack or to its own value */
 
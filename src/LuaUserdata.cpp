@@ -1,20 +1,21 @@
 #include "LuaUserdata.h"
 
 #include "LuaCollector.h"
+#include "LuaGlobals.h"
 #include "LuaTable.h"
 
 #include "lmem.h"
 
-LuaBlob::LuaBlob(size_t len) : LuaObject(LUA_TBLOB) {
-  linkGC(getGlobalGCList());
-  buf_ = (uint8_t*)luaM_alloc_nocheck(len);
+LuaBlob::LuaBlob(LuaVM* g, size_t len) : LuaObject(LUA_TBLOB, g) {
+  linkAllgc();
+  buf_ = (uint8_t*)luaM_alloc_nocheck(len, g);
   len_ = len;
   metatable_ = NULL;
   env_ = NULL;
 }
 
 LuaBlob::~LuaBlob() {
-  luaM_free(buf_);
+  luaM_free(buf_, len_);
   buf_ = NULL;
   len_ = NULL;
 }
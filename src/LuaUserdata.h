@@ -7,11 +7,13 @@
 class LuaBlob : public LuaObject {
 public:
 
-  LuaBlob(size_t len);
+  LuaBlob(LuaVM* g, size_t len);
   ~LuaBlob();
 
-  virtual void VisitGC(LuaGCVisitor& visitor);
-  virtual int PropagateGC(LuaGCVisitor& visitor);
+  void* operator new(size_t size, LuaVM* g) { return allocObject(size, g, LUA_TBLOB); }
+
+  void VisitGC(LuaGCVisitor& visitor);
+  int PropagateGC(LuaGCVisitor& visitor);
 
   LuaTable* metatable_;
   LuaTable* env_;
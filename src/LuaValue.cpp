@@ -6,6 +6,7 @@
 #include "LuaString.h"
 
 int luaO_str2d (const char *s, size_t len, double *result);
+int luaO_str2int (const char *s, size_t len, int64_t *result);
 
 //-----------------------------------------------------------------------------
 
@@ -35,6 +36,11 @@ LuaValue LuaValue::convertToNumber() const {
   if(isString()) {
     LuaString* s = getString();
 
+    int64_t iresult;
+    if(luaO_str2int(s->c_str(), s->getLen(), &iresult)) {
+      return LuaValue(iresult);
+    }
+
     double result;
     if(luaO_str2d(s->c_str(), s->getLen(), &result)) {
       return LuaValue(result);
@@ -46,13 +52,19 @@ LuaValue LuaValue::convertToNumber() const {
 
 //-----------------------------------------------------------------------------
 
-LuaValue LuaValue::convertToString() const {
+LuaValue LuaValue::convertToString(LuaVM* g) const {
   if(isString()) return *this;
 
+  if (isInteger()) {
+    char s[32];
+    sprintf(s, "%lld", (long long)getInteger());
+    return LuaValue(g->strings_->Create(s));
+  }
+
   if (isNumber()) {
     char s[32];
     sprintf(s, "%.14g", getNumber());
-    return LuaValue(thread_G->strings_->Create(s));
+    return LuaValue(g->strings_->Create(s));
   }
 
   return None();
@@ -62,38 +74,44 @@ LuaValue LuaValue::convertToString() const {
 
 void LuaValue::sanityCheck() const {
   if(isCollectable()) {
-    assert(type_ == object_->type());
-    assert(!object_->isDead());
+    assert(tag() == objectValue()->type());
+    assert(!objectValue()->isDead());
   }
 }
 
 void LuaValue::typeCheck() const {
   if(isCollectable()) {
-    assert(type_ == object_->type());
+    assert(tag() == objectValue()->type());
   }
 }
 
-extern char** luaT_typenames;
+extern const char** luaT_typenames;
 const char * LuaValue::typeName() const {
-  return luaT_typenames[type_];
+  return luaT_typenames[tag()];
 }
 
 //-----------------------------------------------------------------------------
 
 bool LuaValue::isWhite() const {
   if(!isCollectable()) return false;
-  return object_->isWhite();
+  return objectValue()->isWhite();
 }
 
 bool LuaValue::isLiveColor() const {
   if(!isCollectable()) return false;
-  return object_->isLiveColor();
+  return objectValue()->isLiveColor();
 }
 
 //-----------------------------------------------------------------------------
 
 uint32_t LuaValue::hashValue() const {
+  // Copies of a long string have to hash alike.
+  if(isString() && getString()->isLong()) return getString()->getHash();
   return hash64(halves_.lowbytes_, halves_.highbytes_);
 }
 
+bool LuaValue::stringEquals(LuaValue const& v) const {
+  return getString()->equals(v.getString());
+}
+
 //-----------------------------------------------------------------------------
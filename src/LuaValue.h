@@ -2,61 +2,89 @@
 
 #include "LuaObject.h"
 #include "LuaTypes.h"
+#include "luaconf.h"
 
 #include <assert.h>
 
+//-----------------------------------------------------------------------------
+// LuaValue has two storage layouts, selected by LUA_NANBOXING in luaconf.h.
+//
+// The default layout is a 64-bit payload union followed by a LuaType tag,
+// 16 bytes per value after padding.
+//
+// The NaN-boxed layout is a single 8-byte word. Anything below
+// 0xFFF1000000000000 is a plain double (all NaNs are canonicalized to
+// 0x7FF8000000000000 so they can't collide with a tag). Anything above it
+// carries the type in its top 16 bits (0xFFF1 + LuaType) and a 48-bit
+// payload in the rest - pointers, booleans and integers in the range
+// [-2^47, 2^47). Integers outside that range are stored as doubles, which
+// makes their arithmetic behave like stock Lua 5.2 again.
+
 class LuaValue {
 public:
 
   LuaValue() {
-    type_ = LUA_TNIL;
-    bytes_ = 0;
+    setTagged(LUA_TNIL, 0);
   }
 
   LuaValue(LuaType type, uint64_t data) {
-    type_ = type;
-    bytes_ = data;
+    setTagged(type, data);
   }
 
   LuaValue(const LuaValue& v) {
-    type_ = v.type_;
-    bytes_ = v.bytes_;
+    copy(v);
   }
 
   static LuaValue Nil()   { return LuaValue(LUA_TNIL, 0); }
   static LuaValue None()  { return LuaValue(LUA_TNONE, 0); }
   static LuaValue Pointer(const void* p) { return LuaValue(LUA_TPOINTER, (uint64_t)p); }
 
-  LuaValue(LuaObject* o)  { type_ = o->type(); bytes_ = 0; object_ = o; }
-  LuaValue(bool v)        { type_ = LUA_TBOOLEAN; bytes_ = v ? 1 : 0; }
-  LuaValue(LuaCallback f) { type_ = LUA_TCALLBACK; bytes_ = 0; callback_ = f; }
-
-  LuaValue(float v)       { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(double v)      { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(int8_t v)      { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(uint8_t v)     { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(int16_t v)     { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(uint16_t v)    { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(int32_t v)     { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(uint32_t v)    { type_ = LUA_TNUMBER; number_ = v; }
-  LuaValue(int64_t v)     { type_ = LUA_TNUMBER; number_ = (double)v; }
-  LuaValue(uint64_t v)    { type_ = LUA_TNUMBER; number_ = (double)v; }
+  LuaValue(LuaObject* o)  { setObject(o); }
+  LuaValue(bool v)        { setTagged(LUA_TBOOLEAN, v ? 1 : 0); }
+  LuaValue(LuaCallback f) { setCallback(f); }
+
+  LuaValue(float v)       { setFloat(v); }
+  LuaValue(double v)      { setFloat(v); }
+
+  // Integers keep their exact value. Only unsigned 64-bit values too large
+  // for an int64_t fall back to being stored as a double.
+  LuaValue(int8_t v)      { setInteger(v); }
+  LuaValue(uint8_t v)     { setInteger(v); }
+  LuaValue(int16_t v)     { setInteger(v); }
+  LuaValue(uint16_t v)    { setInteger(v); }
+  LuaValue(int32_t v)     { setInteger(v); }
+  LuaValue(uint32_t v)    { setInteger(v); }
+  LuaValue(int64_t v)     { setInteger(v); }
+  LuaValue(uint64_t v) {
+    if(v <= (uint64_t)INT64_MAX) {
+      setInteger((int64_t)v);
+    } else {
+      setFloat((double)v);
+    }
+  }
 
   // Assignment operators
 
-  void operator = (LuaObject* o) { type_ = o->type(); bytes_ = 0; object_ = o; }
-  void operator = (LuaValue v)   { type_ = v.type_; bytes_ = v.bytes_; }
-  void operator = (double v)     { type_ = LUA_TNUMBER; number_ = v; }
-  void operator = (int v)        { type_ = LUA_TNUMBER; number_ = (double)v; }
-  void operator = (size_t v)     { type_ = LUA_TNUMBER; number_ = (double)v; }
-  void operator = (int64_t v)    { type_ = LUA_TNUMBER; number_ = (double)v; }
-  void operator = (bool v)       { type_ = LUA_TBOOLEAN; bytes_ = v ? 1 : 0; }
+  void operator = (LuaObject* o) { setObject(o); }
+  void operator = (LuaValue v)   { copy(v); }
+  void operator = (double v)     { setFloat(v); }
+  void operator = (int v)        { setInteger(v); }
+  void operator = (size_t v)     { *this = LuaValue((uint64_t)v); }
+  void operator = (int64_t v)    { setInteger(v); }
+  void operator = (bool v)       { setTagged(LUA_TBOOLEAN, v ? 1 : 0); }
 
   // Comparison operators.
 
   // This will return false for positive and negative zero, that's a known issue.
+  // Identical bits mean equal values; the only other way two values can be
+  // equal is as two copies of the same long string.
   bool operator == (LuaValue const& v) const {
-    return (type_ == v.type_) && (bytes_ == v.bytes_);
+#if defined(LUA_NANBOXING)
+    if(bytes_ == v.bytes_) return true;
+#else
+    if((type_ == v.type_) && (bytes_ == v.bytes_)) return true;
+#endif
+    return isString() && v.isString() && stringEquals(v);
   }
 
   bool operator != (LuaValue const& v) const {
@@ -65,35 +93,53 @@ public:
 
   // stuff
 
+#if defined(LUA_NANBOXING)
+  bool isCollectable() const  { return bytes_ >= tagBits(LUA_TSTRING); }
+#else
   bool isCollectable() const  { return type_ >= LUA_TSTRING; }
-  bool isFunction() const     { return (type_ == LUA_TCCL) || (type_ == LUA_TLCL) || (type_ == LUA_TCALLBACK); }
-
-  bool isNil() const          { return type_ == LUA_TNIL; }
-  bool isNotNil() const       { return type_ != LUA_TNIL; }
-  bool isNone() const         { return type_ == LUA_TNONE; }
-
-  bool isBool() const         { return type_ == LUA_TBOOLEAN; }
-  bool isNumber() const       { return type_ == LUA_TNUMBER; }
-  bool isInteger() const      { return isNumber() && (number_ == (int)number_); }
-
-  bool isPointer() const      { return type_ == LUA_TPOINTER; }
-  bool isString() const       { return type_ == LUA_TSTRING; }
-  bool isTable() const        { return type_ == LUA_TTABLE; }
-  bool isBlob() const         { return type_ == LUA_TBLOB; }
-  bool isThread() const       { return type_ == LUA_TTHREAD; }
-  bool isUpval() const        { return type_ == LUA_TUPVALUE; }
-  bool isProto() const        { return type_ == LUA_TPROTO; }
-
-  bool isClosure() const      { return (type_ == LUA_TCCL) || (type_ == LUA_TLCL); }
-  bool isCClosure() const     { return type_ == LUA_TCCL; }
-  bool isLClosure() const     { return type_ == LUA_TLCL; }
-  bool isCallback() const     { return type_ == LUA_TCALLBACK; }
+#endif
+  bool isFunction() const     { return hasTag(LUA_TCCL) || hasTag(LUA_TLCL) || hasTag(LUA_TCALLBACK); }
+
+  bool isNil() const          { return hasTag(LUA_TNIL); }
+  bool isNotNil() const       { return !hasTag(LUA_TNIL); }
+  bool isNone() const         { return hasTag(LUA_TNONE); }
+
+  bool isBool() const         { return hasTag(LUA_TBOOLEAN); }
+  // Numbers are either doubles (isFloat) or 64-bit integers (isInteger).
+  bool isNumber() const       { return isFloat() || isInteger(); }
+#if defined(LUA_NANBOXING)
+  bool isFloat() const        { return bytes_ < tagBits(LUA_TNIL); }
+#else
+  bool isFloat() const        { return type_ == LUA_TNUMBER; }
+#endif
+  bool isInteger() const      { return hasTag(LUA_TINTEGER); }
+
+  // True if 'v' stays an integer when stored in a LuaValue - with
+  // LUA_NANBOXING, integers outside [-2^47, 2^47) become doubles.
+#if defined(LUA_NANBOXING)
+  static bool fitsInteger(int64_t v) { return (v >= -((int64_t)1 << 47)) && (v < ((int64_t)1 << 47)); }
+#else
+  static bool fitsInteger(int64_t)   { return true; }
+#endif
+
+  bool isPointer() const      { return hasTag(LUA_TPOINTER); }
+  bool isString() const       { return hasTag(LUA_TSTRING); }
+  bool isTable() const        { return hasTag(LUA_TTABLE); }
+  bool isBlob() const         { return hasTag(LUA_TBLOB); }
+  bool isThread() const       { return hasTag(LUA_TTHREAD); }
+  bool isUpval() const        { return hasTag(LUA_TUPVALUE); }
+  bool isProto() const        { return hasTag(LUA_TPROTO); }
+
+  bool isClosure() const      { return hasTag(LUA_TCCL) || hasTag(LUA_TLCL); }
+  bool isCClosure() const     { return hasTag(LUA_TCCL); }
+  bool isLClosure() const     { return hasTag(LUA_TLCL); }
+  bool isCallback() const     { return hasTag(LUA_TCALLBACK); }
 
   // A 'true' value is either a true boolean or a non-Nil.
   // TODO(aappleby): this means that a None is true... might want to fix that.
   bool isTrue() const {
     if(isBool()) {
-      return bytes_ ? true : false;
+      return payload() ? true : false;
     } else {
       return !isNil();
     }
@@ -102,7 +148,7 @@ public:
   // A 'false' value is either a false boolean or a Nil.
   bool isFalse() const {
     if(isBool()) {
-      return bytes_ ? false : true;
+      return payload() ? false : true;
     } else {
       return isNil();
     }
@@ -112,7 +158,7 @@ public:
   // These conversion operations return None if they fail.
 
   LuaValue convertToNumber() const;
-  LuaValue convertToString() const;
+  LuaValue convertToString(LuaVM* g) const;
 
   //----------
 
@@ -121,24 +167,26 @@ public:
 
   //----------
 
-  bool         getBool() const      { assert(isBool()); return bytes_ ? true : false; }
-  int          getInteger() const   { assert(isNumber()); return (int)number_; }
-  double       getNumber() const    { assert(isNumber()); return number_; }
-  LuaObject*   getObject() const    { assert(isCollectable()); return object_; }
-  LuaClosure*  getClosure()         { assert(isClosure()); return reinterpret_cast<LuaClosure*>(object_); }
-  LuaClosure*  getCClosure()        { assert(isCClosure()); return reinterpret_cast<LuaClosure*>(object_); }
-  LuaClosure*  getLClosure()        { assert(isLClosure()); return reinterpret_cast<LuaClosure*>(object_); }
-  LuaString*   getString() const    { assert(isString()); return reinterpret_cast<LuaString*>(object_); }
-  LuaTable*    getTable() const     { assert(isTable()); return reinterpret_cast<LuaTable*>(object_); }
-  LuaBlob*     getBlob() const      { assert(isBlob()); return reinterpret_cast<LuaBlob*>(object_); }
-  void*        getPointer() const   { assert(isPointer()); return pointer_; }
-  LuaThread*   getThread() const    { assert(isThread()); return reinterpret_cast<LuaThread*>(object_); }
-  LuaCallback  getCallback() const  { assert(isCallback()); return callback_; }
+  bool         getBool() const      { assert(isBool()); return payload() ? true : false; }
+  int64_t      getInteger() const   { assert(isInteger()); return integerValue(); }
+  double       getNumber() const    { assert(isNumber()); return isInteger() ? (double)integerValue() : number_; }
+  LuaObject*   getObject() const    { assert(isCollectable()); return objectValue(); }
+  LuaClosure*  getClosure()         { assert(isClosure()); return reinterpret_cast<LuaClosure*>(objectValue()); }
+  LuaClosure*  getCClosure()        { assert(isCClosure()); return reinterpret_cast<LuaClosure*>(objectValue()); }
+  LuaClosure*  getLClosure()        { assert(isLClosure()); return reinterpret_cast<LuaClosure*>(objectValue()); }
+  LuaString*   getString() const    { assert(isString()); return reinterpret_cast<LuaString*>(objectValue()); }
+  LuaTable*    getTable() const     { assert(isTable()); return reinterpret_cast<LuaTable*>(objectValue()); }
+  LuaBlob*     getBlob() const      { assert(isBlob()); return reinterpret_cast<LuaBlob*>(objectValue()); }
+  void*        getPointer() const   { assert(isPointer()); return pointerValue(); }
+  LuaThread*   getThread() const    { assert(isThread()); return reinterpret_cast<LuaThread*>(objectValue()); }
+  LuaCallback  getCallback() const  { assert(isCallback()); return callbackValue(); }
   uint64_t     getRawBytes() const  { return bytes_; }
 
   //----------
 
-  LuaType type() const  { return type_; }
+  // Integers are a representation detail - as far as Lua code and the C API
+  // are concerned they're just numbers.
+  LuaType type() const  { LuaType t = tag(); return (t == LUA_TINTEGER) ? LUA_TNUMBER : t; }
   const char* typeName() const;
 
   void sanityCheck() const;
@@ -148,11 +196,92 @@ public:
 
 private:
 
+  bool stringEquals(LuaValue const& v) const;
+
+#if defined(LUA_NANBOXING)
+
+  //----------
+  // NaN-boxed storage, see the comment at the top of the file.
+
+  static uint64_t tagBits(LuaType t) { return (uint64_t)(0xFFF1 + t) << 48; }
+  static uint64_t payloadMask()      { return 0x0000FFFFFFFFFFFFull; }
+
+  LuaType tag() const {
+    if(bytes_ < tagBits(LUA_TNIL)) return LUA_TNUMBER;
+    return (LuaType)((bytes_ >> 48) - 0xFFF1);
+  }
+
+  bool hasTag(LuaType t) const { return (bytes_ >> 48) == (uint64_t)(0xFFF1 + t); }
+
+  uint64_t payload() const { return bytes_ & payloadMask(); }
+
+  void copy(const LuaValue& v) { bytes_ = v.bytes_; }
+
+  void setTagged(LuaType t, uint64_t data) {
+    assert((data & ~payloadMask()) == 0);
+    bytes_ = tagBits(t) | data;
+  }
+
+  void setFloat(double v) {
+    number_ = v;
+    if(v != v) bytes_ = 0x7FF8000000000000ull;
+  }
+
+  void setInteger(int64_t v) {
+    if(fitsInteger(v)) {
+      bytes_ = tagBits(LUA_TINTEGER) | ((uint64_t)v & payloadMask());
+    } else {
+      setFloat((double)v);
+    }
+  }
+
+  void setObject(LuaObject* o)   { setTagged(o->type(), (uint64_t)(uintptr_t)o); }
+  void setCallback(LuaCallback f) { setTagged(LUA_TCALLBACK, (uint64_t)(uintptr_t)f); }
+
+  // Shift the payload up against the sign bit and back down to sign-extend it.
+  int64_t     integerValue() const  { return (int64_t)(bytes_ << 16) >> 16; }
+  LuaObject*  objectValue() const   { return reinterpret_cast<LuaObject*>((uintptr_t)payload()); }
+  void*       pointerValue() const  { return reinterpret_cast<void*>((uintptr_t)payload()); }
+  LuaCallback callbackValue() const { return reinterpret_cast<LuaCallback>((uintptr_t)payload()); }
+
+  union {
+    double number_;
+    uint64_t bytes_;
+    struct {
+      uint32_t lowbytes_;
+      uint32_t highbytes_;
+    } halves_;
+  };
+
+#else
+
+  //----------
+  // Tagged-union storage.
+
+  LuaType tag() const          { return type_; }
+  bool hasTag(LuaType t) const { return type_ == t; }
+
+  uint64_t payload() const { return bytes_; }
+
+  void copy(const LuaValue& v) { type_ = v.type_; bytes_ = v.bytes_; }
+
+  void setTagged(LuaType t, uint64_t data) { type_ = t; bytes_ = data; }
+  void setFloat(double v)                  { type_ = LUA_TNUMBER; number_ = v; }
+  void setInteger(int64_t v)               { type_ = LUA_TINTEGER; integer_ = v; }
+  void setObject(LuaObject* o)             { type_ = o->type(); bytes_ = 0; object_ = o; }
+  void setCallback(LuaCallback f)          { type_ = LUA_TCALLBACK; bytes_ = 0; callback_ = f; }
+
+  int64_t     integerValue() const  { return integer_; }
+  LuaObject*  objectValue() const   { return object_; }
+  void*       pointerValue() const  { return pointer_; }
+  LuaCallback callbackValue() const { return callback_; }
+
   union {
     LuaObject* object_;
     void* pointer_;
     LuaCallback callback_;
     double number_;
+    int64_t integer_;
     uint64_t bytes_;
     struct {
       uint32_t lowbytes_;
@@ -161,4 +290,6 @@ private:
   };
 
   LuaType type_;
+
+#endif
 };
@@ -3,6 +3,7 @@
 #include "LuaDefines.h"
 #include <algorithm>
 #include <assert.h>
+#include <new>
 
 #include "lmem.h"
 
@@ -46,11 +47,18 @@ public:
     if(blob == NULL) return false;
     T* newbuf = reinterpret_cast<T*>(blob);
     if(size_) {
-      memcpy(newbuf, buf_, sizeof(T) * std::min(size_,newsize));
-      luaM_free(buf_);
+      // Copy-construct the kept elements instead of memcpy-ing them, as
+      // LuaValue and LuaMethodCache aren't trivially copyable.
+      size_t keep = std::min(size_,newsize);
+      for(size_t i = 0; i < keep; i++) {
+        new (&newbuf[i]) T(buf_[i]);
+      }
+      luaM_free(buf_, sizeof(T) * size_);
     }
-    if(newsize > size_) {
-      memset(&newbuf[size_], 0 , sizeof(T) * (newsize - size_));
+    // Value-initialize new elements rather than memset-ing them - with
+    // LUA_NANBOXING an all-zero LuaValue is 0.0, not nil.
+    for(size_t i = size_; i < newsize; i++) {
+      new (&newbuf[i]) T();
     }
     buf_ = newbuf;
     size_ = newsize;
@@ -59,7 +67,7 @@ public:
 
   void clear ( void )
   {
-    if(size_) luaM_free(buf_);
+    if(size_) luaM_free(buf_, sizeof(T) * size_);
     buf_ = NULL;
     size_ = 0;
   }
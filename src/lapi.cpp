@@ -240,6 +240,7 @@ int lua_rawequal (LuaThread *L, int index1, int index2) {
   LuaValue v2 = L->stack_.at(index2);
   if(v1.isNone()) return 0;
   if(v2.isNone()) return 0;
+  if(v1.isNumber() && v2.isNumber()) return luaO_numeq(v1, v2);
   return (v1 == v2);
 }
 
@@ -257,7 +258,7 @@ void  lua_arith (LuaThread *L, int op) {
   o1 = L->stack_.top_ - 2;
   o2 = L->stack_.top_ - 1;
   if (o1->isNumber() && o2->isNumber()) {
-    o1[0] = luaO_arith(op, o1->getNumber(), o2->getNumber());
+    o1[0] = luaO_arith(op, *o1, *o2);
   }
   else
     luaV_arith(L, o1, o1, o2, cast(TMS, op - LUA_OPADD + TM_ADD));
@@ -301,6 +302,7 @@ ptrdiff_t lua_tointegerx (LuaThread *L, int idx, int *isnum) {
 
   if(v2.isNumber()) {
     if (isnum) *isnum = 1;
+    if(v2.isInteger()) return (ptrdiff_t)v2.getInteger();
     return (ptrdiff_t)v2.getNumber();
   } else {
     if(isnum) *isnum = 0;
@@ -316,6 +318,7 @@ uint32_t lua_tounsignedx (LuaThread *L, int idx, int *isnum) {
 
   if(v2.isNumber()) {
     if (isnum) *isnum = 1;
+    if(v2.isInteger()) return (uint32_t)v2.getInteger();
     return (uint32_t)v2.getNumber();
   } else {
     if(isnum) *isnum = 0;
@@ -347,11 +350,7 @@ const char *lua_tolstring (LuaThread *L, int idx, size_t *len) {
     return NULL;
   }
 
-  double n = o->getNumber();
-
-  char s[LUAI_MAXNUMBER2STR];
-  int l = lua_number2str(s, n);
-  *o = thread_G->strings_->Create(s,l);
+  *o = o->convertToString(G(L));
 
   o = index2addr(L, idx);  /* luaC_checkGC may reallocate the stack */
   if(o == NULL) return NULL;
@@ -497,7 +496,7 @@ void lua_pushcclosure (LuaThread *L, LuaCallback fn, int n) {
 
   if(n == 1) {
     L->stack_.top_ -= 1;
-    LuaClosure* cl = new LuaClosure(fn, L->stack_.top_[0]);
+    LuaClosure* cl = new (G(L)) LuaClosure(G(L), fn, L->stack_.top_[0]);
     L->stack_.push(LuaValue(cl));
     return;
   }
@@ -505,7 +504,7 @@ void lua_pushcclosure (LuaThread *L, LuaCallback fn, int n) {
   L->stack_.checkArgs(n);
   api_check(n <= MAXUPVAL, "upvalue index too large");
 
-  LuaClosure *cl = new LuaClosure(fn, n);
+  LuaClosure *cl = new (G(L)) LuaClosure(G(L), fn, n);
   L->stack_.top_ -= n;
   while (n--) {
     cl->pupvals_[n] = L->stack_.top_[n];
@@ -639,23 +638,12 @@ void lua_rawgetp (LuaThread *L, int idx, const void *p) {
 void lua_createtable (LuaThread *L, int narray, int nrec) {
   THREAD_CHECK(L);
 
-  LuaTable* t = new LuaTable(narray, nrec);
+  LuaTable* t = new (G(L)) LuaTable(G(L), narray, nrec);
   L->stack_.push(t);
 }
 
 LuaTable* lua_getmetatable(LuaValue v) {
-  int type = v.type();
-  switch (type) {
-
-    case LUA_TTABLE:
-      return v.getTable()->metatable;
-
-    case LUA_TBLOB:
-      return v.getBlob()->metatable_;
-
-    default:
-      return thread_G->base_metatables_[type];
-  }
+  return luaT_getmetatable(thread_G, v);
 }
 
 int lua_getmetatable (LuaThread *L, int objindex) {
@@ -664,7 +652,7 @@ int lua_getmetatable (LuaThread *L, int objindex) {
   int res;
   obj = index2addr(L, objindex);
   if(obj == NULL) return 0;
-  LuaTable* mt = lua_getmetatable(*obj);
+  LuaTable* mt = luaT_getmetatable(G(L), *obj);
   if (mt == NULL)
     res = 0;
   else {
@@ -791,6 +779,7 @@ int lua_setmetatable (LuaThread *L, int objindex) {
   // else overrides the _global_ metatable.
 
   if(obj.isTable()) {
+    obj.getTable()->metaChanged();
     obj.getTable()->metatable = mt;
     if (mt) {
       luaC_barrierback(obj.getObject(), meta);
@@ -809,6 +798,7 @@ int lua_setmetatable (LuaThread *L, int objindex) {
   }
 
   thread_G->base_metatables_[obj.type()] = mt;
+  thread_G->metaEpoch_++;
   return 1;
 }
 
@@ -829,8 +819,8 @@ void checkresults(LuaThread* L, int nargs, int nresults) {
 int lua_getctx (LuaThread *L, int *ctx) {
   THREAD_CHECK(L);
   if (L->stack_.callinfo_->callstatus & CIST_YIELDED) {
-    if (ctx) *ctx = L->stack_.callinfo_->continuation_context_;
-    return L->stack_.callinfo_->status;
+    if (ctx) *ctx = L->stack_.callinfo_->cframe_->continuation_context_;
+    return L->stack_.callinfo_->cframe_->status;
   }
   else return LUA_OK;
 }
@@ -896,7 +886,7 @@ int lua_pcall (LuaThread *L, int nargs, int nresults, int errfunc) {
     // is thrown before we leave this try() block - otherwise the exception will get
     // thrown in the parent context, which may not be what the user expects.
 
-    l_memcontrol.checkLimit();
+    l_memcontrol.checkLimit(G(L));
   }
   catch(LuaResult error) {
     result = error;
@@ -930,13 +920,13 @@ int lua_pcallk (LuaThread *L, int nargs, int nresults, int errfunc,
 
   // prepare continuation (call is already protected by 'resume')
   LuaStackFrame *ci = L->stack_.callinfo_;
-  ci->continuation_ = k;  /* save continuation */
-  ci->continuation_context_ = ctx;  /* save context */
+  ci->cframe_->continuation_ = k;  /* save continuation */
+  ci->cframe_->continuation_context_ = ctx;  /* save context */
 
   /* save information for error recovery */
-  ci->old_func_ = L->stack_.indexOf(func);
-  ci->old_allowhook = L->allowhook;
-  ci->old_errfunc = L->errfunc;
+  ci->cframe_->old_func_ = L->stack_.indexOf(func);
+  ci->cframe_->old_allowhook = L->allowhook;
+  ci->cframe_->old_errfunc = L->errfunc;
 
   L->errfunc = errfunc_index;
 
@@ -944,7 +934,7 @@ int lua_pcallk (LuaThread *L, int nargs, int nresults, int errfunc,
   luaD_call(L, nargs, nresults, 1);  /* do the call */
   ci->callstatus &= ~CIST_YPCALL;
 
-  L->errfunc = ci->old_errfunc;
+  L->errfunc = ci->cframe_->old_errfunc;
   return LUA_OK;
 }
 
@@ -1018,12 +1008,14 @@ int lua_gc (LuaThread *L, int what, int data) {
       if (g->gckind == KGC_GEN) {  /* generational mode? */
         res = (g->lastmajormem == 0);  /* 1 if will do major collection */
         luaC_forcestep();  /* do a single step */
+        g->gc_.free_thread_.Sync();  /* count what it freed */
       }
       else {
         while (data-- >= 0) {
           luaC_forcestep();
           if (g->gcstate == GCSpause) {  /* end of cycle? */
             res = 1;  /* signal it */
+            g->gc_.free_thread_.Sync();  /* count what it freed */
             break;
           }
         }
@@ -1045,6 +1037,17 @@ int lua_gc (LuaThread *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCSETMARKTHREADS: {
+      res = g->gcmarkthreads;
+      g->gcmarkthreads = (data < 1) ? 1 : data;
+      break;
+    }
+    case LUA_GCSETFREETHREAD: {
+      res = g->gcfreethread;
+      g->gcfreethread = (data != 0);
+      if (!g->gcfreethread) g->gc_.free_thread_.Stop();
+      break;
+    }
     case LUA_GCISRUNNING: {
       res = g->gcrunning;
       break;
@@ -1081,22 +1084,17 @@ int lua_next (LuaThread* L, int idx) {
 
   LuaValue key = L->stack_.pop();
 
-  int start = -1;
-  if(!key.isNil()) {
-    bool found = t->keyToTableIndex(key,start);
-    if(!found) {
-      result = luaG_runerror("invalid key to 'next'");
-      handleResult(result);
-    }
+  LuaValue nextKey, nextVal;
+  int found = t->next(key, nextKey, nextVal);
+  if(found < 0) {
+    result = luaG_runerror("invalid key to 'next'");
+    handleResult(result);
   }
 
-  for(int cursor = start+1; cursor < t->getTableIndexSize(); cursor++) {
-    LuaValue key, val;
-    if(t->tableIndexToKeyVal(cursor,key,val) && !val.isNil()) {
-      L->stack_.push(key);
-      L->stack_.push(val);
-      return 1;
-    }
+  if(found) {
+    L->stack_.push(nextKey);
+    L->stack_.push(nextVal);
+    return 1;
   }
 
   return 0;
@@ -1137,7 +1135,7 @@ void *lua_newuserdata (LuaThread *L, size_t size) {
     throwError(LUA_ERRMEM);
   }
 
-  LuaBlob* u = new LuaBlob(size);
+  LuaBlob* u = new (G(L)) LuaBlob(G(L), size);
   L->stack_.push(u);
 
   return u->buf_;
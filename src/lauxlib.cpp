@@ -26,6 +26,7 @@
 #include "lua.h"
 
 #include "lauxlib.h"
+#include "lgc.h"
 #include "lmem.h"
 
 #include "lstate.h" // for THREAD_CHECK
@@ -592,20 +593,22 @@ int luaL_ref(LuaThread* L) {
   if(val.isNil()) return LUA_REFNIL;
 
   LuaValue ref1 = registry->get(LuaValue(freelist));
-  int ref = ref1.isInteger() ? ref1.getInteger() : 0;
+  int ref = ref1.isInteger() ? (int)ref1.getInteger() : 0;
 
   if (ref != 0) {  // any free element?
     LuaValue temp = registry->get( LuaValue(ref) );
     registry->set( LuaValue(freelist), temp );
-    registry->set( LuaValue(ref), val );
-    return ref;
   }
   else  {
     // no free elements, get a new reference.
     ref = (int)registry->getLength() + 1;
-    registry->set( LuaValue(ref), val );
-    return ref;
   }
+
+  // The registry is usually already marked, so it needs the same barrier
+  // as lua_rawseti.
+  registry->set( LuaValue(ref), val );
+  luaC_barrierback(registry, val);
+  return ref;
 }
 
 void luaL_unref(LuaThread* L, int ref) {
@@ -177,10 +177,12 @@ static int luaB_collectgarbage (LuaThread *L) {
   THREAD_CHECK(L);
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "setmajorinc", "isrunning", "generational", "incremental", NULL};
+    "setmajorinc", "isrunning", "generational", "incremental",
+    "setmarkthreads", "setfreethread", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCSETMAJORINC, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCSETMAJORINC, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,
+    LUA_GCSETMARKTHREADS, LUA_GCSETFREETHREAD};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   int ex = luaL_optint(L, 2, 0);
   int res = lua_gc(L, o, ex);
@@ -191,7 +193,7 @@ static int luaB_collectgarbage (LuaThread *L) {
       lua_pushinteger(L, b);
       return 2;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCISRUNNING: case LUA_GCSETFREETHREAD: {
       lua_pushboolean(L, res);
       return 1;
     }
@@ -232,7 +234,7 @@ static int pairsmeta (LuaThread *L, const char *method, int iszero,
 }
 
 
-static int luaB_next (LuaThread *L) {
+int luaB_next (LuaThread *L) {
   THREAD_CHECK(L);
   luaL_checktype(L, 1, LUA_TTABLE);
   L->stack_.setTopIndex(2);  /* create a 2nd argument if there isn't one */
@@ -316,7 +318,7 @@ LuaResult run_reader(LuaThread* L, std::string& out) {
     LuaValue v = L->stack_.at(-1);
     if (v.isNil()) break;
 
-    v = v.convertToString();
+    v = v.convertToString(G(L));
     if (v.isNone()) return LUA_ERRRUN;
 
     const char* chunk = v.getString()->c_str();
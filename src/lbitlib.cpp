@@ -224,7 +224,7 @@ static const luaL_Reg bitlib[] = {
 int luaopen_bit32 (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = bitlib; cursor->name; cursor++) {
     lib->set( cursor->name, cursor->func );
   }
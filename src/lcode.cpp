@@ -9,6 +9,7 @@
 
 #define lcode_c
 
+#include "LuaConversions.h"
 #include "LuaProto.h"
 #include "LuaState.h"
 
@@ -35,7 +36,6 @@ static int isnumeral(expdesc *e) {
 
 
 void luaK_nil (FuncState *fs, int from, int n) {
-  THREAD_CHECK(fs->L);
   Instruction *previous;
   int l = from + n - 1;  /* last register to set nil */
   if (fs->pc > fs->lasttarget) {  /* no jumps to current position? */
@@ -58,7 +58,6 @@ void luaK_nil (FuncState *fs, int from, int n) {
 
 
 int luaK_jump (FuncState *fs) {
-  THREAD_CHECK(fs->L);
   int jpc = fs->jpc;  /* save list of jumps to here */
   int j;
   fs->jpc = NO_JUMP;
@@ -69,13 +68,11 @@ int luaK_jump (FuncState *fs) {
 
 
 void luaK_ret (FuncState *fs, int first, int nret) {
-  THREAD_CHECK(fs->L);
   luaK_codeABC(fs, OP_RETURN, first, nret+1, 0);
 }
 
 
 static int condjump (FuncState *fs, OpCode op, int A, int B, int C) {
-  THREAD_CHECK(fs->L);
   luaK_codeABC(fs, op, A, B, C);
   return luaK_jump(fs);
 }
@@ -83,7 +80,6 @@ static int condjump (FuncState *fs, OpCode op, int A, int B, int C) {
 
 static void fixjump (FuncState *fs, int pc, int dest) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(fs->L);
   Instruction *jmp = &fs->f->instructions_[pc];
   int offset = dest-(pc+1);
   assert(dest != NO_JUMP);
@@ -100,14 +96,12 @@ static void fixjump (FuncState *fs, int pc, int dest) {
 ** optimizations with consecutive instructions not in the same basic block).
 */
 int luaK_getlabel (FuncState *fs) {
-  THREAD_CHECK(fs->L);
   fs->lasttarget = fs->pc;
   return fs->pc;
 }
 
 
 static int getjump (FuncState *fs, int pc) {
-  THREAD_CHECK(fs->L);
   int offset = GETARG_sBx(fs->f->instructions_[pc]);
   if (offset == NO_JUMP)  /* point to itself represents end of list */
     return NO_JUMP;  /* end of list */
@@ -117,7 +111,6 @@ static int getjump (FuncState *fs, int pc) {
 
 
 static Instruction *getjumpcontrol (FuncState *fs, int pc) {
-  THREAD_CHECK(fs->L);
   Instruction *pi = &fs->f->instructions_[pc];
   if (pc >= 1 && testTMode(GET_OPCODE(*(pi-1))))
     return pi-1;
@@ -131,7 +124,6 @@ static Instruction *getjumpcontrol (FuncState *fs, int pc) {
 ** (or produce an inverted value)
 */
 static int need_value (FuncState *fs, int list) {
-  THREAD_CHECK(fs->L);
   for (; list != NO_JUMP; list = getjump(fs, list)) {
     Instruction i = *getjumpcontrol(fs, list);
     if (GET_OPCODE(i) != OP_TESTSET) return 1;
@@ -141,7 +133,6 @@ static int need_value (FuncState *fs, int list) {
 
 
 static int patchtestreg (FuncState *fs, int node, int reg) {
-  THREAD_CHECK(fs->L);
   Instruction *i = getjumpcontrol(fs, node);
   if (GET_OPCODE(*i) != OP_TESTSET)
     return 0;  /* cannot patch other instructions */
@@ -155,7 +146,6 @@ static int patchtestreg (FuncState *fs, int node, int reg) {
 
 
 static void removevalues (FuncState *fs, int list) {
-  THREAD_CHECK(fs->L);
   for (; list != NO_JUMP; list = getjump(fs, list))
       patchtestreg(fs, list, NO_REG);
 }
@@ -163,7 +153,6 @@ static void removevalues (FuncState *fs, int list) {
 
 static void patchlistaux (FuncState *fs, int list, int vtarget, int reg,
                           int dtarget) {
-  THREAD_CHECK(fs->L);
   while (list != NO_JUMP) {
     int next = getjump(fs, list);
     if (patchtestreg(fs, list, reg))
@@ -176,14 +165,12 @@ static void patchlistaux (FuncState *fs, int list, int vtarget, int reg,
 
 
 static void dischargejpc (FuncState *fs) {
-  THREAD_CHECK(fs->L);
   patchlistaux(fs, fs->jpc, fs->pc, NO_REG, fs->pc);
   fs->jpc = NO_JUMP;
 }
 
 
 void luaK_patchlist (FuncState *fs, int list, int target) {
-  THREAD_CHECK(fs->L);
   if (target == fs->pc)
     luaK_patchtohere(fs, list);
   else {
@@ -194,7 +181,6 @@ void luaK_patchlist (FuncState *fs, int list, int target) {
 
 
 void luaK_patchclose (FuncState *fs, int list, int level) {
-  THREAD_CHECK(fs->L);
   level++;  /* argument is +1 to reserve 0 as non-op */
   while (list != NO_JUMP) {
     int next = getjump(fs, list);
@@ -208,14 +194,12 @@ void luaK_patchclose (FuncState *fs, int list, int level) {
 
 
 void luaK_patchtohere (FuncState *fs, int list) {
-  THREAD_CHECK(fs->L);
   luaK_getlabel(fs);
   luaK_concat(fs, &fs->jpc, list);
 }
 
 
 void luaK_concat (FuncState *fs, int *l1, int l2) {
-  THREAD_CHECK(fs->L);
   if (l2 == NO_JUMP) return;
   else if (*l1 == NO_JUMP)
     *l1 = l2;
@@ -230,7 +214,6 @@ void luaK_concat (FuncState *fs, int *l1, int l2) {
 
 
 static int luaK_code (FuncState *fs, Instruction i) {
-  THREAD_CHECK(fs->L);
   LuaProto *f = fs->f;
   dischargejpc(fs);  /* `pc' will change */
   /* put new instruction in code array */
@@ -249,7 +232,6 @@ static int luaK_code (FuncState *fs, Instruction i) {
 
 
 int luaK_codeABC (FuncState *fs, OpCode o, int a, int b, int c) {
-  THREAD_CHECK(fs->L);
   assert(getOpMode(o) == iABC);
   assert(getBMode(o) != OpArgN || b == 0);
   assert(getCMode(o) != OpArgN || c == 0);
@@ -259,7 +241,6 @@ int luaK_codeABC (FuncState *fs, OpCode o, int a, int b, int c) {
 
 
 int luaK_codeABx (FuncState *fs, OpCode o, int a, unsigned int bc) {
-  THREAD_CHECK(fs->L);
   assert(getOpMode(o) == iABx || getOpMode(o) == iAsBx);
   assert(getCMode(o) == OpArgN);
   assert(a <= MAXARG_A && bc <= MAXARG_Bx);
@@ -268,14 +249,12 @@ int luaK_codeABx (FuncState *fs, OpCode o, int a, unsigned int bc) {
 
 
 static int codeextraarg (FuncState *fs, int a) {
-  THREAD_CHECK(fs->L);
   assert(a <= MAXARG_Ax);
   return luaK_code(fs, CREATE_Ax(OP_EXTRAARG, a));
 }
 
 
 int luaK_codek (FuncState *fs, int reg, int k) {
-  THREAD_CHECK(fs->L);
   if (k <= MAXARG_Bx)
     return luaK_codeABx(fs, OP_LOADK, reg, k);
   else {
@@ -288,7 +267,6 @@ int luaK_codek (FuncState *fs, int reg, int k) {
 
 void luaK_checkstack (FuncState *fs, int n) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(fs->L);
   int newstack = fs->freereg + n;
   if (newstack > fs->f->maxstacksize) {
     if (newstack >= MAXSTACK) {
@@ -301,14 +279,12 @@ void luaK_checkstack (FuncState *fs, int n) {
 
 
 void luaK_reserveregs (FuncState *fs, int n) {
-  THREAD_CHECK(fs->L);
   luaK_checkstack(fs, n);
   fs->freereg += n;
 }
 
 
 static void freereg (FuncState *fs, int reg) {
-  THREAD_CHECK(fs->L);
   if (!ISK(reg) && reg >= fs->nactvar) {
     fs->freereg--;
     assert(reg == fs->freereg);
@@ -317,14 +293,12 @@ static void freereg (FuncState *fs, int reg) {
 
 
 static void freeexp (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   if (e->k == VNONRELOC)
     freereg(fs, e->info);
 }
 
 
 static int addk (FuncState *fs, LuaValue *key, LuaValue *v) {
-  THREAD_CHECK(fs->L);
   LuaValue idx = fs->constant_map->get(*key);
   LuaProto *f = fs->f;
   int k, oldsize;
@@ -359,22 +333,24 @@ static int addk (FuncState *fs, LuaValue *key, LuaValue *v) {
 
 
 int luaK_stringK (FuncState *fs, LuaString *s) {
-  THREAD_CHECK(fs->L);
   LuaValue o;
   o = s;
   return addk(fs, &o, &o);
 }
 
 // TODO(aappleby): negative zero and NaN stuff here, investigate.
-int luaK_numberK (FuncState *fs, double r) {
-  THREAD_CHECK(fs->L);
+int luaK_numberK (FuncState *fs, LuaValue r) {
   int n;
   LuaThread *L = fs->L;
-  LuaValue o = LuaValue(r);
-  if (r == 0 || (r != r)) {  /* handle -0 and NaN */
+  LuaValue o = r;
+  int64_t i;
+  double d = r.isFloat() ? r.getNumber() : 0;
+  if (r.isFloat() && (luaO_flt2int(d, &i) || (d != d))) {
+    /* handle -0, NaN and integral floats (which would collide with the
+       integer of the same value in the constant map) */
     /* use raw representation as key to avoid numeric problems */
     
-    LuaString* s = thread_G->strings_->Create((char *)&r, sizeof(r));
+    LuaString* s = G(L)->strings_->Create((char *)&d, sizeof(d));
     LuaResult result = L->stack_.push_reserve2(LuaValue(s));
     handleResult(result);
 
@@ -389,7 +365,6 @@ int luaK_numberK (FuncState *fs, double r) {
 
 
 static int boolK (FuncState *fs, int b) {
-  THREAD_CHECK(fs->L);
   LuaValue o;
   o = b ? true : false;
   return addk(fs, &o, &o);
@@ -397,7 +372,6 @@ static int boolK (FuncState *fs, int b) {
 
 
 static int nilK (FuncState *fs) {
-  THREAD_CHECK(fs->L);
   LuaValue k, v;
   /* cannot use nil as key; instead use table itself to represent nil */
   k = fs->constant_map;
@@ -406,7 +380,6 @@ static int nilK (FuncState *fs) {
 
 
 void luaK_setreturns (FuncState *fs, expdesc *e, int nresults) {
-  THREAD_CHECK(fs->L);
   if (e->k == VCALL) {  /* expression is an open function call? */
     SETARG_C(getcode(fs, e), nresults+1);
   }
@@ -419,7 +392,6 @@ void luaK_setreturns (FuncState *fs, expdesc *e, int nresults) {
 
 
 void luaK_setoneret (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   if (e->k == VCALL) {  /* expression is an open function call? */
     e->k = VNONRELOC;
     e->info = GETARG_A(getcode(fs, e));
@@ -432,7 +404,6 @@ void luaK_setoneret (FuncState *fs, expdesc *e) {
 
 
 void luaK_dischargevars (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   switch (e->k) {
     case VLOCAL: {
       e->k = VNONRELOC;
@@ -444,11 +415,12 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
       break;
     }
     case VINDEXED: {
-      OpCode op = OP_GETTABUP;  /* assume 't' is in an upvalue */
+      int field = luaK_isKstr(fs, e->idx);
+      OpCode op = field ? OP_GETUPFIELD : OP_GETTABUP;  /* assume 't' is in an upvalue */
       freereg(fs, e->idx);
       if (e->vt == VLOCAL) {  /* 't' is in a register? */
         freereg(fs, e->tr);
-        op = OP_GETTABLE;
+        op = field ? OP_GETFIELD : OP_GETTABLE;
       }
       e->info = luaK_codeABC(fs, op, 0, e->tr, e->idx);
       e->k = VRELOCABLE;
@@ -465,14 +437,12 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
 
 
 static int code_label (FuncState *fs, int A, int b, int jump) {
-  THREAD_CHECK(fs->L);
   luaK_getlabel(fs);  /* those instructions may be jump targets */
   return luaK_codeABC(fs, OP_LOADBOOL, A, b, jump);
 }
 
 
 static void discharge2reg (FuncState *fs, expdesc *e, int reg) {
-  THREAD_CHECK(fs->L);
   luaK_dischargevars(fs, e);
   switch (e->k) {
     case VNIL: {
@@ -512,7 +482,6 @@ static void discharge2reg (FuncState *fs, expdesc *e, int reg) {
 
 
 static void discharge2anyreg (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   if (e->k != VNONRELOC) {
     luaK_reserveregs(fs, 1);
     discharge2reg(fs, e, fs->freereg-1);
@@ -521,7 +490,6 @@ static void discharge2anyreg (FuncState *fs, expdesc *e) {
 
 
 static void exp2reg (FuncState *fs, expdesc *e, int reg) {
-  THREAD_CHECK(fs->L);
   discharge2reg(fs, e, reg);
   if (e->k == VJMP)
     luaK_concat(fs, &e->t, e->info);  /* put this jump in `t' list */
@@ -546,7 +514,6 @@ static void exp2reg (FuncState *fs, expdesc *e, int reg) {
 
 
 void luaK_exp2nextreg (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   luaK_dischargevars(fs, e);
   freeexp(fs, e);
   luaK_reserveregs(fs, 1);
@@ -555,7 +522,6 @@ void luaK_exp2nextreg (FuncState *fs, expdesc *e) {
 
 
 int luaK_exp2anyreg (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   luaK_dischargevars(fs, e);
   if (e->k == VNONRELOC) {
     if (!hasjumps(e)) return e->info;  /* exp is already in a register */
@@ -570,14 +536,12 @@ int luaK_exp2anyreg (FuncState *fs, expdesc *e) {
 
 
 void luaK_exp2anyregup (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   if (e->k != VUPVAL || hasjumps(e))
     luaK_exp2anyreg(fs, e);
 }
 
 
 void luaK_exp2val (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   if (hasjumps(e))
     luaK_exp2anyreg(fs, e);
   else
@@ -586,7 +550,6 @@ void luaK_exp2val (FuncState *fs, expdesc *e) {
 
 
 int luaK_exp2RK (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   luaK_exp2val(fs, e);
   switch (e->k) {
     case VTRUE:
@@ -617,7 +580,6 @@ int luaK_exp2RK (FuncState *fs, expdesc *e) {
 
 
 void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
-  THREAD_CHECK(fs->L);
   switch (var->k) {
     case VLOCAL: {
       freeexp(fs, ex);
@@ -630,7 +592,11 @@ void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
       break;
     }
     case VINDEXED: {
-      OpCode op = (var->vt == VLOCAL) ? OP_SETTABLE : OP_SETTABUP;
+      OpCode op;
+      if (luaK_isKstr(fs, var->idx))
+        op = (var->vt == VLOCAL) ? OP_SETFIELD : OP_SETUPFIELD;
+      else
+        op = (var->vt == VLOCAL) ? OP_SETTABLE : OP_SETTABUP;
       int e = luaK_exp2RK(fs, ex);
       luaK_codeABC(fs, op, var->tr, var->idx, e);
       break;
@@ -645,7 +611,6 @@ void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
 
 
 void luaK_self (FuncState *fs, expdesc *e, expdesc *key) {
-  THREAD_CHECK(fs->L);
   int ereg;
   luaK_exp2anyreg(fs, e);
   ereg = e->info;  /* register where 'e' was placed */
@@ -659,7 +624,6 @@ void luaK_self (FuncState *fs, expdesc *e, expdesc *key) {
 
 
 static void invertjump (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   Instruction *pc = getjumpcontrol(fs, e->info);
   assert(testTMode(GET_OPCODE(*pc)) && GET_OPCODE(*pc) != OP_TESTSET &&
                                            GET_OPCODE(*pc) != OP_TEST);
@@ -668,7 +632,6 @@ static void invertjump (FuncState *fs, expdesc *e) {
 
 
 static int jumponcond (FuncState *fs, expdesc *e, int cond) {
-  THREAD_CHECK(fs->L);
   if (e->k == VRELOCABLE) {
     Instruction ie = getcode(fs, e);
     if (GET_OPCODE(ie) == OP_NOT) {
@@ -684,7 +647,6 @@ static int jumponcond (FuncState *fs, expdesc *e, int cond) {
 
 
 void luaK_goiftrue (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   int pc;  /* pc of last jump */
   luaK_dischargevars(fs, e);
   switch (e->k) {
@@ -709,7 +671,6 @@ void luaK_goiftrue (FuncState *fs, expdesc *e) {
 
 
 void luaK_goiffalse (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   int pc;  /* pc of last jump */
   luaK_dischargevars(fs, e);
   switch (e->k) {
@@ -733,7 +694,6 @@ void luaK_goiffalse (FuncState *fs, expdesc *e) {
 
 
 static void codenot (FuncState *fs, expdesc *e) {
-  THREAD_CHECK(fs->L);
   luaK_dischargevars(fs, e);
   switch (e->k) {
     case VNIL: case VFALSE: {
@@ -769,7 +729,6 @@ static void codenot (FuncState *fs, expdesc *e) {
 
 
 void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
-  THREAD_CHECK(fs->L);
   assert(!hasjumps(t));
   t->tr = t->info;
   t->idx = luaK_exp2RK(fs, k);
@@ -779,20 +738,29 @@ void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
 }
 
 
+/* is 'rk' a string constant? */
+int luaK_isKstr (FuncState *fs, int rk) {
+  return ISK(rk) && fs->f->constants[INDEXK(rk)].isString();
+}
+
+
+/* is 'rk' a numeric constant? */
+static int isKnum (FuncState *fs, int rk) {
+  return ISK(rk) && fs->f->constants[INDEXK(rk)].isNumber();
+}
+
+
 static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
-  double r;
   if (!isnumeral(e1) || !isnumeral(e2)) return 0;
-  if ((op == OP_DIV || op == OP_MOD) && e2->nval == 0)
+  if ((op == OP_DIV || op == OP_MOD) && e2->nval.getNumber() == 0)
     return 0;  /* do not attempt to divide by 0 */
-  r = luaO_arith(op - OP_ADD + LUA_OPADD, e1->nval, e2->nval);
-  e1->nval = r;
+  e1->nval = luaO_arith(op - OP_ADD + LUA_OPADD, e1->nval, e2->nval);
   return 1;
 }
 
 
 static void codearith (FuncState *fs, OpCode op,
                        expdesc *e1, expdesc *e2, int line) {
-  THREAD_CHECK(fs->L);
   if (constfolding(op, e1, e2))
     return;
   else {
@@ -806,6 +774,9 @@ static void codearith (FuncState *fs, OpCode op,
       freeexp(fs, e2);
       freeexp(fs, e1);
     }
+    /* register plus/minus a numeric constant */
+    if ((op == OP_ADD || op == OP_SUB) && !ISK(o1) && isKnum(fs, o2))
+      op = (op == OP_ADD) ? OP_ADDK : OP_SUBK;
     e1->info = luaK_codeABC(fs, op, 0, o1, o2);
     e1->k = VRELOCABLE;
     luaK_fixline(fs, line);
@@ -815,7 +786,6 @@ static void codearith (FuncState *fs, OpCode op,
 
 static void codecomp (FuncState *fs, OpCode op, int cond, expdesc *e1,
                                                           expdesc *e2) {
-  THREAD_CHECK(fs->L);
   int o1 = luaK_exp2RK(fs, e1);
   int o2 = luaK_exp2RK(fs, e2);
   freeexp(fs, e2);
@@ -825,19 +795,24 @@ static void codecomp (FuncState *fs, OpCode op, int cond, expdesc *e1,
     temp = o1; o1 = o2; o2 = temp;  /* o1 <==> o2 */
     cond = 1;
   }
+  if (op == OP_EQ) {
+    if (ISK(o1) && !ISK(o2)) {  /* keep the constant on the right */
+      int temp = o1; o1 = o2; o2 = temp;
+    }
+    if (ISK(o2) && !ISK(o1)) op = OP_EQK;
+  }
   e1->info = condjump(fs, op, cond, o1, o2);
   e1->k = VJMP;
 }
 
 
 void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e, int line) {
-  THREAD_CHECK(fs->L);
   expdesc e2;
   e2.t = e2.f = NO_JUMP; e2.k = VKNUM; e2.nval = 0;
   switch (op) {
     case OPR_MINUS: {
       if (isnumeral(e))  /* minus constant? */
-        e->nval = -e->nval;  /* fold it */
+        e->nval = luaO_arith(LUA_OPUNM, e->nval, e->nval);  /* fold it */
       else {
         luaK_exp2anyreg(fs, e);
         codearith(fs, OP_UNM, e, &e2, line);
@@ -856,7 +831,6 @@ void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e, int line) {
 
 
 void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
-  THREAD_CHECK(fs->L);
   switch (op) {
     case OPR_AND: {
       luaK_goiftrue(fs, v);
@@ -885,7 +859,6 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
 
 void luaK_posfix (FuncState *fs, BinOpr op,
                   expdesc *e1, expdesc *e2, int line) {
-  THREAD_CHECK(fs->L);
   switch (op) {
     case OPR_AND: {
       assert(e1->t == NO_JUMP);  /* list must be closed */
@@ -934,14 +907,12 @@ void luaK_posfix (FuncState *fs, BinOpr op,
 
 
 void luaK_fixline (FuncState *fs, int line) {
-  THREAD_CHECK(fs->L);
   fs->f->lineinfo[fs->pc - 1] = line;
 }
 
 
 void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(fs->L);
   int c =  (nelems - 1)/LFIELDS_PER_FLUSH + 1;
   int b = (tostore == LUA_MULTRET) ? 0 : tostore;
   assert(tostore != 0);
@@ -55,13 +55,14 @@ void luaK_nil (FuncState *fs, int from, int n);
 void luaK_reserveregs (FuncState *fs, int n);
 void luaK_checkstack (FuncState *fs, int n);
 int luaK_stringK (FuncState *fs, LuaString *s);
-int luaK_numberK (FuncState *fs, double r);
+int luaK_numberK (FuncState *fs, LuaValue r);
 void luaK_dischargevars (FuncState *fs, expdesc *e);
 int luaK_exp2anyreg (FuncState *fs, expdesc *e);
 void luaK_exp2anyregup (FuncState *fs, expdesc *e);
 void luaK_exp2nextreg (FuncState *fs, expdesc *e);
 void luaK_exp2val (FuncState *fs, expdesc *e);
 int luaK_exp2RK (FuncState *fs, expdesc *e);
+int luaK_isKstr (FuncState *fs, int rk);
 void luaK_self (FuncState *fs, expdesc *e, expdesc *key);
 void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k);
 void luaK_goiftrue (FuncState *fs, expdesc *e);
@@ -192,7 +192,7 @@ static const luaL_Reg co_funcs[] = {
 int luaopen_coroutine (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = co_funcs; cursor->name; cursor++) {
     lib->set( cursor->name, cursor->func );
   }
@@ -167,7 +167,7 @@ static int db_getinfo (LuaThread *L) {
     return luaL_argerror(L, arg+2, "invalid option");
   }
 
-  LuaTable* t = new LuaTable(0, 2);
+  LuaTable* t = new (G(L)) LuaTable(G(L), 0, 2);
   L->stack_.push(LuaValue(t));
  
   t->set("source",          ar.source2.c_str());
@@ -483,7 +483,7 @@ static const luaL_Reg dblib[] = {
 int luaopen_debug (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = dblib; cursor->name; cursor++) {
     lib->set( cursor->name, cursor->func );
   }
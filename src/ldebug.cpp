@@ -107,7 +107,6 @@ static const char *findvararg (LuaStackFrame *ci, int n, StkId *pos) {
 
 static const char *findlocal (LuaThread *L, LuaStackFrame *ci, int n,
                               StkId *pos) {
-  THREAD_CHECK(L);
   const char *name = NULL;
   StkId base;
   if (ci->isLua()) {
@@ -183,13 +182,12 @@ static void funcinfo (LuaDebug *ar, LuaClosure *cl) {
 
 
 static void collectvalidlines (LuaThread *L, LuaClosure *f) {
-  THREAD_CHECK(L);
   if (f == NULL || f->isC) {
     LuaResult result = L->stack_.push_reserve2(LuaValue::Nil());
     handleResult(result);
   }
   else {
-    LuaTable* t = new LuaTable();  /* new table to store active lines */
+    LuaTable* t = new (G(L)) LuaTable(G(L));  /* new table to store active lines */
     LuaResult result = L->stack_.push_reserve2(LuaValue(t));
     handleResult(result);
 
@@ -205,7 +203,6 @@ static void collectvalidlines (LuaThread *L, LuaClosure *f) {
 
 static int auxgetinfo (LuaThread *L, const char *what, LuaDebug *ar,
                     LuaClosure *f, LuaStackFrame *ci) {
-  THREAD_CHECK(L);
   int status = 1;
   for (; *what; what++) {
     switch (*what) {
@@ -341,7 +338,7 @@ static int findsetreg (LuaProto *p, int lastpc, int reg) {
   int setreg = -1;  /* keep last instruction that changed 'reg' */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->instructions_[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     int a = GETARG_A(i);
     switch (op) {
       case OP_LOADNIL: {
@@ -397,7 +394,7 @@ const char *getobjname2 (LuaProto *p, int lastpc, int reg, std::string& name) {
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->instructions_[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -406,10 +403,12 @@ const char *getobjname2 (LuaProto *p, int lastpc, int reg, std::string& name) {
         break;
       }
       case OP_GETTABUP:
-      case OP_GETTABLE: {
+      case OP_GETTABLE:
+      case OP_GETUPFIELD:
+      case OP_GETFIELD: {
         int k = GETARG_C(i);  /* key index */
         int t = GETARG_B(i);  /* table index */
-        const char *vn = (op == OP_GETTABLE)  /* name of indexed variable */
+        const char *vn = (op == OP_GETTABLE || op == OP_GETFIELD)  /* name of indexed variable */
                          ? p->getLocalName(t + 1, pc)
                          : p->getUpvalName(t);
         kname2(p, pc, k, name);
@@ -441,12 +440,11 @@ const char *getobjname2 (LuaProto *p, int lastpc, int reg, std::string& name) {
 }
 
 const char* getfuncname2 (LuaThread *L, LuaStackFrame *ci, std::string& name) {
-  THREAD_CHECK(L);
   TMS tm;
   LuaProto *p = ci->getFunc()->getLClosure()->proto_;  /* calling function */
   int pc = ci->getCurrentPC();  /* calling instruction index */
   Instruction i = p->instructions_[pc];  /* calling instruction */
-  switch (GET_OPCODE(i)) {
+  switch (GET_BASEOP(i)) {
     case OP_CALL:
     case OP_TAILCALL:  /* get function name */
       return getobjname2(p, pc, GETARG_A(i), name);
@@ -457,12 +455,19 @@ const char* getfuncname2 (LuaThread *L, LuaStackFrame *ci, std::string& name) {
     /* all other instructions can call only through metamethods */
     case OP_SELF:
     case OP_GETTABUP:
-    case OP_GETTABLE: tm = TM_INDEX; break;
+    case OP_GETTABLE:
+    case OP_GETUPFIELD:
+    case OP_GETFIELD: tm = TM_INDEX; break;
     case OP_SETTABUP:
-    case OP_SETTABLE: tm = TM_NEWINDEX; break;
-    case OP_EQ: tm = TM_EQ; break;
-    case OP_ADD: tm = TM_ADD; break;
-    case OP_SUB: tm = TM_SUB; break;
+    case OP_SETTABLE:
+    case OP_SETUPFIELD:
+    case OP_SETFIELD: tm = TM_NEWINDEX; break;
+    case OP_EQ:
+    case OP_EQK: tm = TM_EQ; break;
+    case OP_ADD:
+    case OP_ADDK: tm = TM_ADD; break;
+    case OP_SUB:
+    case OP_SUBK: tm = TM_SUB; break;
     case OP_MUL: tm = TM_MUL; break;
     case OP_DIV: tm = TM_DIV; break;
     case OP_MOD: tm = TM_MOD; break;
@@ -41,14 +41,12 @@ void checkresults(LuaThread* L, int nargs, int nresults);
 */
 
 static LuaValue geterrorobj (LuaThread *L, int errcode ) {
-  THREAD_CHECK(L);
-  if(errcode == LUA_ERRMEM) return LuaValue(thread_G->memerrmsg);
-  if(errcode == LUA_ERRERR) return LuaValue(thread_G->strings_->Create("error in error handling"));
+  if(errcode == LUA_ERRMEM) return LuaValue(G(L)->memerrmsg);
+  if(errcode == LUA_ERRERR) return LuaValue(G(L)->strings_->Create("error in error handling"));
   return L->stack_.top(-1);
 }
 
 static void seterrorobj (LuaThread *L, int errcode, StkId oldtop) {
-  THREAD_CHECK(L);
   LuaValue errobj = geterrorobj(L,errcode);
   L->stack_.setTop(oldtop);
   L->stack_.push_nocheck(errobj);
@@ -57,7 +55,6 @@ static void seterrorobj (LuaThread *L, int errcode, StkId oldtop) {
 /* }====================================================== */
 
 void luaD_hook (LuaThread *L, int event, int line) {
-  THREAD_CHECK(L);
   LuaHook hook = L->hook;
   if (hook && L->allowhook) {
     LuaStackFrame *ci = L->stack_.callinfo_;
@@ -94,10 +91,9 @@ void luaD_hook (LuaThread *L, int event, int line) {
 
 static LuaResult  tryfuncTM (LuaThread *L, int funcindex) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
 
   LuaValue* func = &L->stack_[funcindex];
-  LuaValue tm = luaT_gettmbyobj2(*func, TM_CALL);
+  LuaValue tm = luaT_gettmbyobj2(G(L), *func, TM_CALL);
 
   if (!tm.isFunction()) {
     result = luaG_typeerror(func, "call");
@@ -119,7 +115,6 @@ static LuaResult  tryfuncTM (LuaThread *L, int funcindex) {
 
 LuaResult luaD_precall2 (LuaThread *L, int funcindex, int nresults) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
 
   LuaValue func = L->stack_[funcindex];
 
@@ -162,7 +157,6 @@ LuaResult luaD_precall2 (LuaThread *L, int funcindex, int nresults) {
 }
 
 void luaD_postcall (LuaThread *L, StkId firstResult, int /*nresults2*/) {
-  THREAD_CHECK(L);
 
   LuaStackFrame *ci = L->stack_.callinfo_;
 
@@ -206,7 +200,6 @@ void luaD_postcall (LuaThread *L, StkId firstResult, int /*nresults2*/) {
 */
 void luaD_call (LuaThread *L, int nargs, int nResults, int allowyield) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
   api_check(L->status == LUA_OK, "cannot do calls on non-normal thread");
 
   //L->stack_.checkArgs(nargs+1);
@@ -247,8 +240,8 @@ void lua_callk (LuaThread *L, int nargs, int nresults, int ctx, LuaCallback k) {
   checkresults(L, nargs, nresults);
 
   if (k != NULL && L->nonyieldable_count_ == 0) {  /* need to prepare continuation? */
-    L->stack_.callinfo_->continuation_ = k;  /* save continuation */
-    L->stack_.callinfo_->continuation_context_ = ctx;  /* save context */
+    L->stack_.callinfo_->cframe_->continuation_ = k;  /* save continuation */
+    L->stack_.callinfo_->cframe_->continuation_context_ = ctx;  /* save context */
     luaD_call(L, nargs, nresults, 1);  /* do the call */
   }
   else {
@@ -263,9 +256,8 @@ void lua_callk (LuaThread *L, int nargs, int nresults, int ctx, LuaCallback k) {
 
 
 static void finishCcall (LuaThread *L) {
-  THREAD_CHECK(L);
   LuaStackFrame *ci = L->stack_.callinfo_;
-  assert(ci->continuation_ != NULL);  /* must have a continuation */
+  assert(ci->cframe_->continuation_ != NULL);  /* must have a continuation */
   assert(L->nonyieldable_count_ == 0);
 
   /* finish 'luaD_call' */
@@ -275,12 +267,12 @@ static void finishCcall (LuaThread *L) {
   /* call continuation function */
   if (!(ci->callstatus & CIST_STAT)) {
     /* no call status? */
-    ci->status = LUA_YIELD;  /* 'default' status */
+    ci->cframe_->status = LUA_YIELD;  /* 'default' status */
   }
-  assert(ci->status != LUA_OK);
+  assert(ci->cframe_->status != LUA_OK);
   ci->callstatus = (ci->callstatus & ~(CIST_YPCALL | CIST_STAT)) | CIST_YIELDED;
   
-  int n = (*ci->continuation_)(L);
+  int n = (*ci->cframe_->continuation_)(L);
 
   L->stack_.checkArgs(n);
 
@@ -290,7 +282,6 @@ static void finishCcall (LuaThread *L) {
 
 
 static void unroll (LuaThread *L, void *ud) {
-  THREAD_CHECK(L);
   UNUSED(ud);
   for (int depth = 0;; depth++) {
     if (L->stack_.callinfoEmpty()) {
@@ -310,23 +301,22 @@ static void unroll (LuaThread *L, void *ud) {
 
 
 static int recover (LuaThread *L, int status) {
-  THREAD_CHECK(L);
   StkId oldtop;
   LuaStackFrame *ci = L->stack_.findProtectedCall();
   if (ci == NULL) return 0;  /* no recovery point */
   /* "finish" luaD_pcall */
-  oldtop = L->stack_.atIndex(ci->old_func_);
-  L->stack_.closeUpvals(oldtop);
+  oldtop = L->stack_.atIndex(ci->cframe_->old_func_);
+  L->stack_.closeUpvals(G(L), oldtop);
   seterrorobj(L, status, oldtop);
   L->stack_.callinfo_ = ci;
-  L->allowhook = ci->old_allowhook;
+  L->allowhook = ci->cframe_->old_allowhook;
   L->nonyieldable_count_ = 0;  /* should be zero to be yieldable */
 
   L->stack_.shrink();
 
-  L->errfunc = ci->old_errfunc;
+  L->errfunc = ci->cframe_->old_errfunc;
   ci->callstatus |= CIST_STAT;  /* call has error status */
-  ci->status = status;  /* (here it is) */
+  ci->cframe_->status = status;  /* (here it is) */
   return 1;  /* continue running the coroutine */
 }
 
@@ -337,12 +327,11 @@ static int recover (LuaThread *L, int status) {
 ** error handler and should not kill the coroutine.)
 */
 static l_noret resume_error (LuaThread *L, const char *msg, StkId firstArg) {
-  THREAD_CHECK(L);
 
   L->stack_.top_ = firstArg;  /* remove args from the stack */
 
   /* push error message */
-  LuaString* s = thread_G->strings_->Create(msg);
+  LuaString* s = G(L)->strings_->Create(msg);
   LuaResult result = L->stack_.push_reserve2(LuaValue(s));
   handleResult(result);
 
@@ -356,7 +345,6 @@ static l_noret resume_error (LuaThread *L, const char *msg, StkId firstArg) {
 static void resume_coroutine (LuaThread *L, int nargs) {
   LuaResult result = LUA_OK;
 
-  THREAD_CHECK(L);
 
   StkId firstArg = L->stack_.top_ - nargs;
 
@@ -393,13 +381,13 @@ static void resume_coroutine (LuaThread *L, int nargs) {
   }
 
   // 'common' yield
-  L->stack_.callinfo_->setFunc(L->stack_.atIndex(L->stack_.callinfo_->old_func_));
+  L->stack_.callinfo_->setFunc(L->stack_.atIndex(L->stack_.callinfo_->cframe_->old_func_));
 
-  if (L->stack_.callinfo_->continuation_ != NULL) {  /* does it have a continuation? */
+  if (L->stack_.callinfo_->cframe_->continuation_ != NULL) {  /* does it have a continuation? */
     int n;
-    L->stack_.callinfo_->status = LUA_YIELD;  /* 'default' status */
+    L->stack_.callinfo_->cframe_->status = LUA_YIELD;  /* 'default' status */
     L->stack_.callinfo_->callstatus |= CIST_YIELDED;
-    n = (*L->stack_.callinfo_->continuation_)(L);  /* call continuation */
+    n = (*L->stack_.callinfo_->cframe_->continuation_)(L);  /* call continuation */
     L->stack_.checkArgs(n);
     firstArg = L->stack_.top_ - n;  /* yield results come from continuation */
   }
@@ -482,8 +470,8 @@ int lua_yield (LuaThread *L, int nresults) {
   L->status = LUA_YIELD;
 
   if (!ci->isLua()) {
-    ci->continuation_ = NULL;
-    ci->old_func_ = L->stack_.indexOf(ci->getFunc());  /* save current 'func' */
+    ci->cframe_->continuation_ = NULL;
+    ci->cframe_->old_func_ = L->stack_.indexOf(ci->getFunc());  /* save current 'func' */
     ci->setFunc(L->stack_.top_ - nresults - 1);  /* protect stack below results */
     throwError(LUA_YIELD);
   }
@@ -515,10 +503,10 @@ int lua_yieldk (LuaThread *L, int nresults, int ctx, LuaCallback k) {
     return 0;  /* return to 'luaD_hook' */
   }
 
-  L->stack_.callinfo_->continuation_ = k;
-  L->stack_.callinfo_->continuation_context_ = ctx;  /* save context */
+  L->stack_.callinfo_->cframe_->continuation_ = k;
+  L->stack_.callinfo_->cframe_->continuation_context_ = ctx;  /* save context */
 
-  L->stack_.callinfo_->old_func_ = L->stack_.indexOf(L->stack_.callinfo_->getFunc());  /* save current 'func' */
+  L->stack_.callinfo_->cframe_->old_func_ = L->stack_.indexOf(L->stack_.callinfo_->getFunc());  /* save current 'func' */
   L->stack_.callinfo_->setFunc(L->stack_.top_ - nresults - 1);  /* protect stack below results */
 
   throwError(LUA_YIELD);
@@ -530,7 +518,6 @@ int lua_yieldk (LuaThread *L, int nresults, int ctx, LuaCallback k) {
 */
 
 static LuaResult checkmode (LuaThread *L, const char *mode, const char *x) {
-  THREAD_CHECK(L);
   if (mode) {
     if(strchr(mode, x[0]) == NULL) {
       luaO_pushfstring(L, "attempt to load a %s chunk (mode is " LUA_QS ")", x, mode);
@@ -542,7 +529,6 @@ static LuaResult checkmode (LuaThread *L, const char *mode, const char *x) {
 
 int luaD_protectedparser (LuaThread *L, Zio *z, const char *name, const char *mode) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
   LuaExecutionState s = L->saveState(L->stack_.top_);
   L->nonyieldable_count_++;  /* cannot yield during parsing */
 
@@ -581,12 +567,13 @@ int luaD_protectedparser (LuaThread *L, Zio *z, const char *name, const char *mo
     return result;
   }
 
-  LuaClosure* cl = new LuaClosure(new_proto, (int)new_proto->upvalues.size());
+  LuaVM* g = G(L);
+  LuaClosure* cl = new (g) LuaClosure(g, new_proto, (int)new_proto->upvalues.size());
   L->stack_.top_[-1] = LuaValue(cl);
   // initialize upvalues
   for (int i = 0; i < (int)new_proto->upvalues.size(); i++) {
-    cl->ppupvals_[i] = new LuaUpvalue();
-    cl->ppupvals_[i]->linkGC(getGlobalGCList());
+    cl->ppupvals_[i] = new (g) LuaUpvalue(g);
+    cl->ppupvals_[i]->linkAllgc();
   }
 
   L->restoreState(s, result, 0);
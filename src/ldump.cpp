@@ -14,6 +14,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -52,6 +53,11 @@ static void DumpNumber(double x, DumpState* D)
  DumpVar(x,D);
 }
 
+static void DumpInteger(int64_t x, DumpState* D)
+{
+ DumpVar(x,D);
+}
+
 static void DumpVector(const void* b, int n, size_t size, DumpState* D)
 {
  DumpInt(n,D);
@@ -73,7 +79,18 @@ static void DumpString(const LuaString* s, DumpState* D)
  }
 }
 
-#define DumpCode(f,D)	 DumpVector(&f->instructions_[0],(int)f->instructions_.size(),sizeof(Instruction),D)
+/* quickened instructions are dumped as their generic form */
+static void DumpCode(const LuaProto* f, DumpState* D)
+{
+ int n=(int)f->instructions_.size();
+ DumpInt(n,D);
+ for (int pc=0; pc<n; pc++)
+ {
+  Instruction i=f->instructions_[pc];
+  SET_OPCODE(i,GET_BASEOP(i));
+  DumpVar(i,D);
+ }
+}
 
 static void DumpFunction(const LuaProto* f, DumpState* D);
 
@@ -84,10 +101,12 @@ static void DumpConstants(const LuaProto* f, DumpState* D)
   for(int i=0; i < n; i++)
   {
     LuaValue v = f->constants[i];
-    DumpChar(v.type(),D);
+    DumpChar(v.isInteger() ? LUA_TINTEGER : v.type(),D);
 
     if(v.isBool()) {
       DumpChar(v.getBool() ? 1 : 0,D);
+    } else if(v.isInteger()) {
+      DumpInteger(v.getInteger(),D);
     } else if(v.isNumber()) {
       DumpNumber(v.getNumber(),D);
     } else if(v.isString()) {
@@ -156,7 +175,6 @@ static void DumpHeader(DumpState* D)
 */
 int luaU_dump (LuaThread* L, const LuaProto* f, lua_Writer w, void* data, int strip)
 {
- THREAD_CHECK(L);
  DumpState D;
  D.L=L;
  D.writer=w;
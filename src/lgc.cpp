@@ -78,6 +78,8 @@ void luaC_barrier (LuaObject *o, LuaValue value) {
   if (keepinvariant(g)) {  // must keep invariant?
     LuaGCVisitor visitor(&g->gc_);
     visitor.MarkObject(v);  // restore invariant
+    // 'v' may stay young, so the next minor collections must see 'o' too
+    if (o->isOld()) g->gc_.Remember(o);
   }
   else {  // sweep phase
     assert(issweepphase(g));
@@ -102,7 +104,9 @@ void luaC_barrierback (LuaObject *o, LuaValue v) {
 
   assert(o->isTable());
 
-  thread_G->gc_.grayagain_.Push(o);
+  LuaVM *g = thread_G;
+  g->gc_.grayagain_.Push(o);
+  if (o->isOld()) g->gc_.Remember(o);
 }
 
 
@@ -125,7 +129,9 @@ void luaC_barrierproto (LuaProto *p, LuaClosure* c) {
     luaC_barrier(p, LuaValue(c));
   }
   else {  // use a backward barrier
-    thread_G->gc_.grayagain_.Push(p);
+    LuaVM *g = thread_G;
+    g->gc_.grayagain_.Push(p);
+    if (p->isOld()) g->gc_.Remember(p);
   }
 }
 
@@ -142,11 +148,14 @@ void luaC_barrierproto (LuaProto *p, LuaClosure* c) {
 
 
 /*
-** mark root set and reset all gray lists, to start a new
-** incremental (or full) collection
+** mark root set, to start a new collection. Incremental (or full)
+** collections reset all gray lists first; generational mode keeps them,
+** as threads and weak tables stay gray from one collection to the next.
 */
 static void markroot (LuaVM *g) {
-  g->gc_.ClearGraylists();
+  if (!isgenerational(g)) {
+    g->gc_.ClearGraylists();
+  }
 
   LuaGCVisitor visitor(&g->gc_);
 
@@ -220,13 +229,13 @@ bool sweepListNormal2 (LuaList::iterator& it, size_t count) {
     if (it->isDead()) {  /* is 'curr' dead? */
       LuaObject* dead = it;
       it.pop();
-      delete dead;
+      thread_G->gc_.free_thread_.Free(dead);
     }
     else {
       if (it->isThread()) {
         /* sweep thread's upvalues */
         LuaObject* o = it;
-        sweepthread(dynamic_cast<LuaThread*>(o));
+        sweepthread(static_cast<LuaThread*>(o));
       }
       /* update marks */
       it->makeLive();
@@ -243,11 +252,11 @@ bool sweepListGenerational2 (LuaList::iterator& it, size_t count) {
     if (it->isDead()) {  /* is 'curr' dead? */
       LuaObject* dead = it;
       it.pop();
-      delete dead;
+      thread_G->gc_.free_thread_.Free(dead);
     }
     else {
       if (it->isThread()) {
-        sweepthread(dynamic_cast<LuaThread*>(it.get()));  /* sweep thread's upvalues */
+        sweepthread(static_cast<LuaThread*>(it.get()));  /* sweep thread's upvalues */
       }
       if (it->isOld()) {
         return true;
@@ -269,10 +278,162 @@ bool sweeplist (LuaList::iterator& it, size_t count) {
   }
 }
 
+/*
+** sweep the young objects at the head of 'list' in generational mode.
+** Survivors age by one collection and are turned white again, so the next
+** minor collection traces them. Once they reach GCPROMOTEAGE they keep
+** their mark and move to the end of the list as old objects, which keeps
+** the old ones together at the tail. Gray objects (threads, weak tables)
+** are retraversed by every collection, so they are promoted right away.
+*/
+static bool sweepyoung (LuaList& list, LuaList::iterator& it, size_t count) {
+  LuaVM *g = thread_G;
+  while(it) {
+    if(count-- <= 0) return false;
+
+    if (it->isDead()) {
+      LuaObject* dead = it;
+      it.pop();
+      g->gc_.free_thread_.Free(dead);
+      continue;
+    }
+
+    if (it->isThread()) {
+      sweepthread(static_cast<LuaThread*>(it.get()));  /* sweep thread's upvalues */
+    }
+    if (it->isOld()) {
+      return true;
+    }
+
+    LuaObject* o = it;
+    if (!o->isGray() && o->getAge() + 1 < GCPROMOTEAGE) {
+      o->setAge(o->getAge() + 1);
+      o->setColor(g->livecolor);
+      ++it;
+      continue;
+    }
+
+    it.pop();
+    o->setOld();
+    list.PushTail(o);
+    // Young objects it points at are white again.
+    if (o->isBlack()) g->gc_.Remember(o);
+  }
+  return true;
+}
+
+static bool sweepgclist (LuaList& list, LuaList::iterator& it, size_t count) {
+  if(isgenerational(thread_G)) {
+    return sweepyoung(list, it, count);
+  } else {
+    return sweepListNormal2(it, count);
+  }
+}
+
+/*
+** sweep the objects of one page that are in 'allgc', working on its
+** bitmaps a word at a time. Unmarked objects of the dead white are freed.
+** In non-generational mode the others are turned white in the bitmaps
+** alone, and only old ones have to be read, to clear their flag. In
+** generational mode old objects are left alone and young survivors age or
+** are promoted as in 'sweepyoung', which has to read each of them. Strings
+** are only turned white; the string table frees them and ages them in
+** generational mode. Returns how many objects were read.
+*/
+static int sweepobjectpage (LuaVM *g, LuaHeapPage *page) {
+  bool generational = isgenerational(g);
+  bool strings = (page->kind_ == LUA_TSTRING);
+  if (strings && generational) return 0;
+
+  LuaMarkBits *bits = LuaMarkBits::of(page);
+  uint32_t deadshade = (g->deadcolor == LuaObject::WHITE1) ? ~0u : 0u;
+  int touched = 0;
+
+  for (int w = 0; w < LuaMarkBits::kWords; w++) {
+    uint32_t members = bits->swept_[w];
+    if (generational) members &= ~bits->old_[w];
+    if (members == 0) continue;
+
+    uint32_t dead = 0;
+    if (!strings) {
+      dead = members & ~bits->marked_[w] & ~(bits->shade_[w] ^ deadshade);
+    }
+    for (uint32_t m = dead; m; m &= m - 1) {
+      uint32_t bit = m & (0u - m);
+      int index = w * 32 + LuaMarkBits::lowestBit(m);
+      LuaObject *o = static_cast<LuaObject*>(LuaMarkBits::objectAt(page, index));
+      touched++;
+      if (o->isFixed()) {
+        dead &= ~bit;
+        continue;
+      }
+      bits->swept_[w] &= ~bit;
+      g->gc_.free_thread_.Free(o);
+    }
+
+    uint32_t survivors = members & ~dead;
+    if (survivors == 0) continue;
+
+    uint32_t touch = generational ? survivors : (survivors & bits->old_[w]);
+    if (page->kind_ == LUA_TTHREAD) touch = survivors;
+
+    for (uint32_t m = touch; m; m &= m - 1) {
+      int index = w * 32 + LuaMarkBits::lowestBit(m);
+      LuaObject *o = static_cast<LuaObject*>(LuaMarkBits::objectAt(page, index));
+      touched++;
+      if (o->isThread()) {
+        sweepthread(static_cast<LuaThread*>(o));  /* sweep thread's upvalues */
+      }
+      if (!generational) {
+        o->makeLive();
+      }
+      else if (!o->isGray() && o->getAge() + 1 < GCPROMOTEAGE) {
+        o->setAge(o->getAge() + 1);
+        o->setColor(g->livecolor);
+      }
+      else {
+        o->setOld();
+        // Young objects it points at are white again.
+        if (o->isBlack()) g->gc_.Remember(o);
+      }
+    }
+
+    if (!generational) {
+      /* everything else turns white, without being read */
+      bits->marked_[w] &= ~survivors;
+      bits->shade_[w] = (bits->shade_[w] & ~survivors) | (~deadshade & survivors);
+    }
+  }
+  return touched;
+}
+
+/*
+** delete every object in 'allgc'. Deleting threads closes their upvalues,
+** which puts those in 'allgc', so it goes around until nothing is left.
+*/
+static void deleteallgc (LuaVM *g) {
+  bool deleted = true;
+  while (deleted) {
+    deleted = false;
+    for (LuaHeapPage *page = g->heap_.firstObjectPage(); page;
+         page = g->heap_.nextObjectPage(page)) {
+      if (page->kind_ == LUA_TSTRING) continue;
+      LuaMarkBits *bits = LuaMarkBits::of(page);
+      for (int i = 0; i < LuaMarkBits::kBits; i++) {
+        if (!LuaMarkBits::test(bits->swept_, i)) continue;
+        LuaObject *o = static_cast<LuaObject*>(LuaMarkBits::objectAt(page, i));
+        o->unlinkAllgc();
+        LuaObject::destroy(o);
+        deleted = true;
+      }
+    }
+  }
+}
+
 void deletelist (LuaList& list) {
   while(!list.isEmpty()) {
     LuaObject* o = list.Pop();
-    delete o;
+    LuaObject::destroy(o);
   }
 }
 
@@ -293,7 +454,7 @@ static void runOneFinalizer (int propagateerrors) {
   assert(o->isFinalized());
 
   /* return it to 'allgc' list */
-  o->linkGC(g->allgc);
+  o->linkAllgc();
 
   /* mark that it is not in 'tobefnz' */
   o->clearSeparated();
@@ -304,7 +465,7 @@ static void runOneFinalizer (int propagateerrors) {
   }
 
   // Get the finalizer from it.
-  LuaValue tm = luaT_gettmbyobj2(o, TM_GC);
+  LuaValue tm = luaT_gettmbyobj2(g, o, TM_GC);
   if(!tm.isFunction()) return;
 
   // Call the finalizer (with a bit of difficulty)
@@ -381,11 +542,11 @@ void luaC_checkfinalizer (LuaObject *o, LuaTable *mt) {
   if(o->isSeparated()) return;
   if(o->isFinalized()) return;
   
-  LuaValue tm = fasttm2(mt, TM_GC);
+  LuaValue tm = fasttm2(g, mt, TM_GC);
   if(tm.isNone() || tm.isNil()) return;
 
   // Remove the object from the global GC list and add it to the 'finobj' list.
-  o->unlinkGC(g->allgc);
+  o->unlinkAllgc();
   
   //o->next_ = g->finobj;
   //g->finobj = o;
@@ -412,7 +573,6 @@ void luaC_checkfinalizer (LuaObject *o, LuaTable *mt) {
 ** change GC mode
 */
 void luaC_changemode (LuaThread *L, int mode) {
-  THREAD_CHECK(L);
   LuaVM *g = G(L);
   if (mode == g->gckind) return;  /* nothing to change */
   if (mode == KGC_GEN) {  /* change to generational mode */
@@ -422,6 +582,7 @@ void luaC_changemode (LuaThread *L, int mode) {
     g->gckind = KGC_GEN;
   }
   else {  /* change to incremental mode */
+    g->gc_.ForgetRemembered();
     /* sweep all objects to turn them back to white
        (as white has not changed, nothing extra will be collected) */
     g->strings_->RestartSweep();
@@ -445,6 +606,8 @@ static void callallpendingfinalizers (int propagateerrors) {
 
 
 void luaC_freeallobjects () {
+  thread_G->gc_.free_thread_.Stop();
+
   // separate all objects with finalizers
   separatetobefnz(1);
   assert(thread_G->finobj.isEmpty());
@@ -454,8 +617,9 @@ void luaC_freeallobjects () {
   callallpendingfinalizers(0);
 
   // finalizers can create objs. in 'finobj'
+  thread_G->gc_.remembered_.clear();
   deletelist(thread_G->finobj);
-  deletelist(thread_G->allgc);
+  deleteallgc(thread_G);
 
   // free all string lists
   thread_G->strings_->Clear();
@@ -502,6 +666,11 @@ static void atomic () {
     }
   }
 
+  /* old objects that may point at young ones */
+  if (isgenerational(g)) {
+    g->gc_.RemarkRemembered();
+  }
+
   /* traverse objects caught by write barrier and by 'remarkupvals' */
   g->gc_.RetraverseGrays();
   g->gc_.ConvergeEphemerons();
@@ -522,7 +691,7 @@ static void atomic () {
   
   /* remark, to propagate `preserveness' */
   LuaGCVisitor v(&g->gc_);
-  g->gc_.grayhead_.PropagateGC(v);
+  g->gc_.Propagate(g->gc_.grayhead_, v);
   g->gc_.ConvergeEphemerons();
 
   /* at this point, all resurrected objects are marked. */
@@ -547,10 +716,9 @@ static ptrdiff_t singlestep () {
   LuaVM *g = thread_G;
   switch (g->gcstate) {
     case GCSpause: {
-      if (!isgenerational(g)) {
-        // start a new collection
-        markroot(g);
-      }
+      // start a new collection. In generational mode this marks the
+      // roots again, as they may be young survivors that were turned white.
+      markroot(g);
       // in any case, root must be marked
       assert(!g->mainthread->isWhite());
       assert(!g->l_registry.isWhite());
@@ -584,25 +752,30 @@ static ptrdiff_t singlestep () {
       }
     }
     case GCSsweepudata: {
-      bool done = sweeplist(g->sweepgc2, GCSWEEPMAX);
+      bool done = sweepgclist(g->finobj, g->sweepgc2, GCSWEEPMAX);
       if (!done) {
         return GCSWEEPMAX*GCSWEEPCOST;
       }
       else {
-        g->sweepgc2 = g->allgc.begin();
+        g->sweeppage = g->heap_.firstObjectPage();
         g->gcstate = GCSsweep;
         return GCSWEEPCOST;
       }
     }
     case GCSsweep: {
-      bool done = sweeplist(g->sweepgc2, GCSWEEPMAX);
-
-      if (!done) {
-        return GCSWEEPMAX*GCSWEEPCOST;
+      LuaHeapPage* page = g->sweeppage;
+      if (page) {
+        // Pages made from here on hold only live objects, and come before
+        // the cursor.
+        g->sweeppage = g->heap_.nextObjectPage(page);
+        int touched = sweepobjectpage(g, page);
+        g->heap_.trimPage(page);
+        return (1 + touched) * GCSWEEPCOST;
       }
       else {
         // Last but not least, sweep the main thread
         sweepthread(g->mainthread);
+        g->gc_.free_thread_.Flush();
         
         // We have swept everything. If this is not an emergency, try and
         // save some RAM by reducing the size of our internal buffers.
@@ -640,6 +813,8 @@ static void generationalcollection () {
   else {
     luaC_runtilstate(~bitmask(GCSpause));  /* run complete cycle */
     luaC_runtilstate(bitmask(GCSpause));
+    /* start the next one, marking the roots that were turned white */
+    luaC_runtilstate(bitmask(GCSpropagate));
     if (g->getTotalBytes() > g->lastmajormem/100 * g->gcmajorinc)
       g->lastmajormem = 0;  /* signal for a major collection */
   }
@@ -677,6 +852,9 @@ void luaC_forcestep () {
   for (i = 0; i < GCFINALIZENUM && (!g->tobefnz.isEmpty()); i++) {
     runOneFinalizer(1);
   }
+
+  // Count the memory the free thread has given back since the last step
+  g->gc_.free_thread_.Reconcile();
 }
 
 /*
@@ -702,6 +880,9 @@ void luaC_fullgc (int isemergency) {
     callallpendingfinalizers(1);
   }
 
+  /* everything is marked from the roots */
+  g->gc_.ForgetRemembered();
+
   if (keepinvariant(g)) {  /* marking phase? */
     /* must sweep all objects to turn them back to white
        (as white has not changed, nothing will be collected) */
@@ -715,6 +896,11 @@ void luaC_fullgc (int isemergency) {
 
   /* run entire collector */
   luaC_runtilstate(~bitmask(GCSpause));
+  {
+    /* mark everything in one go, so it can be done in parallel */
+    LuaGCVisitor v(&g->gc_);
+    g->gc_.Propagate(g->gc_.grayhead_, v);
+  }
   luaC_runtilstate(bitmask(GCSpause));
 
   if (origkind == KGC_GEN) {  /* generational mode? */
@@ -723,6 +909,7 @@ void luaC_fullgc (int isemergency) {
   }
 
   g->gckind = origkind;
+  g->gc_.free_thread_.Sync();  /* count everything that was freed */
   g->setGCDebt(stddebt(g));
 
   // do not run finalizers during emergency GC
@@ -31,8 +31,12 @@
 ** Some notes about garbage-collected objects:  All objects in Lua must
 ** be kept somehow accessible until being freed.
 **
-** Lua keeps most objects linked in list g->allgc. The link uses field
-** 'next' of the common header.
+** Most objects are in 'allgc', which here is not a list: each VM's
+** objects live in object pages of its heap, one type per page, and the
+** page's bitmaps record which of them are in 'allgc' along with their
+** colors and old flags (see LuaMarkBits). The sweep goes through the pages
+** a word of bits at a time, reading only the objects it frees or that need
+** more than their colors changed.
 **
 ** Strings are kept in several lists headed by the array g->strt.hash.
 **
@@ -66,6 +70,17 @@
 */
 #define keepinvariant(g)  (isgenerational(g) || (g->gcstate <= GCSatomic))
 
+/*
+** In generational mode, objects stay young (at the head of their GC list)
+** until they have survived GCPROMOTEAGE minor collections; young survivors
+** are turned white again after each one. Old objects are only traversed
+** by a minor collection while they are in the remembered set, which holds
+** the ones that may point at young objects: those hit by a write barrier
+** and those just promoted. They leave it after GCPROMOTEAGE collections,
+** when anything young they pointed at has been promoted too.
+*/
+#define GCPROMOTEAGE	2
+
 
 void luaC_step();
 
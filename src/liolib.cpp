@@ -48,26 +48,12 @@
 ** after that initial structure).
 */
 
-class LuaFile;
+struct LuaFile;
 
 typedef void (*FileCloser)(LuaFile*);
 
-class LuaFile : public LuaBlob
-{
-public:
-
-  LuaFile() : LuaBlob(0) {
-    f = NULL;
-    closef = NULL;
-    closef2 = NULL;
-  }
-
-  virtual ~LuaFile() {
-  }
-
-  FILE* getHandle() {
-  }
-
+// Kept in the buffer of a plain userdata.
+struct LuaFile {
   FILE *f;  /* stream (NULL for incompletely created streams) */
   LuaCallback closef;  /* to close stream (NULL for closed streams) */
   FileCloser closef2;
@@ -81,7 +67,7 @@ LuaFile* getFile(LuaThread* L, int index) {
   THREAD_CHECK(L);
   void *p = luaL_testudata(L, index, LUA_FILEHANDLE);
   if (p == NULL) typeerror(L, index, LUA_FILEHANDLE);
-  return dynamic_cast<LuaFile*>(L->stack_.at(index).getBlob());
+  return (LuaFile*)p;
 }
 
 #define isclosed(p)	((p)->closef == NULL)
@@ -140,9 +126,14 @@ static FILE *tofile (LuaThread *L) {
 static LuaFile* newprefile (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaFile* u = new LuaFile();
+  LuaBlob* u = new (G(L)) LuaBlob(G(L), sizeof(LuaFile));
   L->stack_.push(u);
 
+  LuaFile* p = (LuaFile*)u->buf_;
+  p->f = NULL;
+  p->closef = NULL;
+  p->closef2 = NULL;
+
   // TODO(aappleby): Files are closed in the finalizer, and just setting
   // the metatable_ field doesn't put the file on the finalization list -
   // we have to make sure they're on the 'finobj' list and marked as
@@ -150,13 +141,13 @@ static LuaFile* newprefile (LuaThread *L) {
   LuaTable* meta = L->l_G->getRegistryTable(LUA_FILEHANDLE);
   u->metatable_ = meta;
 
-  u->unlinkGC(L->l_G->allgc);
+  u->unlinkAllgc();
   //u->next_ = L->l_G->finobj;
   //L->l_G->finobj = u;
   L->l_G->finobj.Push(u);
   u->setSeparated();
   
-  return u;
+  return p;
 }
 
 
@@ -705,7 +696,7 @@ static void createstdfile (LuaThread *L, FILE *f, const char *k,
 int luaopen_io (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = iolib; cursor->name; cursor++) {
     lib->set( cursor->name, cursor->func );
   }
@@ -124,6 +124,12 @@ static LuaResult read_numeral (LexState *ls, Token* token) {
   save(ls, '\0');
   buffreplace(ls, '.', ls->decpoint);  /* follow locale for decimal point */
 
+  int64_t itemp;
+  if (luaO_str2int(ls->lexer_.getBuffer(), ls->lexer_.getLen() - 1, &itemp)) {
+    token->setInteger(itemp);
+    return result;
+  }
+
   double temp;
   int ok = luaO_str2d(ls->lexer_.getBuffer(), ls->lexer_.getLen() - 1, &temp);
   if (!ok) {
@@ -50,6 +50,18 @@
 
 
 
+/*
+** maximum length for short strings, that is, strings that are always
+** internalized. Longer strings are only internalized when the parser
+** creates them, everything else gets a private copy that is compared by
+** contents. (Cannot be smaller than reserved words or tags for
+** metamethods; #("function") = 8, #("__newindex") = 10.)
+*/
+#if !defined(LUAI_MAXSHORTLEN)
+#define LUAI_MAXSHORTLEN	40
+#endif
+
+
 /* maximum stack for a Lua function */
 #define MAXSTACK	250
 
@@ -245,7 +245,7 @@ static const luaL_Reg mathlib[] = {
 int luaopen_math (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = mathlib; cursor->name; cursor++) {
     lib->set( cursor->name, LuaValue(cursor->func) );
   }
@@ -12,6 +12,7 @@
 
 #include "LuaTypes.h"
 #include "LuaGlobals.h"
+#include "LuaHeap.h"
 
 #include "lmem.h"
 
@@ -30,12 +31,12 @@ bool Memcontrol::canAlloc(size_t size) {
   return (mem_total + size) <= mem_limit;
 }
 
-void Memcontrol::checkLimit() {
+void Memcontrol::checkLimit(LuaVM* g) {
   if(mem_total <= mem_limit) return;
 
   // Limit in place and we're over it. Try running an emergency garbage
   // collection cycle.
-  if (thread_G && thread_G->gcrunning) {
+  if (g && g->gcrunning) {
     luaC_fullgc(1);
   }
 
@@ -47,48 +48,130 @@ void Memcontrol::checkLimit() {
 
 //-----------------------------------------------------------------------------
 
-#define MARK		0x55  /* 01010101 (a nice pattern) */
-#define MARKSIZE	16  /* size of marks after each block */
+// Blocks of up to LuaHeap::kMaxSmallSize bytes come from the active VM's
+// pooled heap, bigger ones from malloc. Callers pass the size back in when
+// freeing, so release builds don't need a header on each block. Debug builds
+// keep one to check that size.
 
+#if !defined(NDEBUG)
+#define LUA_MEMHEADER
+#endif
+
+#if defined(LUA_MEMHEADER)
 struct Header {
   uint64_t size;
   uint64_t type;
 };
+static const size_t kHeaderSize = sizeof(Header);
+#else
+static const size_t kHeaderSize = 0;
+#endif
+
+// The number of bytes a request actually uses, which is what gets counted
+// against the memory limit and the VM's total.
+static size_t blockSize(size_t size) {
+  size_t total = size + kHeaderSize;
+  return LuaHeap::isSmall(total) ? LuaHeap::blockSize(total) : total;
+}
 
-void *luaM_alloc_nocheck (size_t size) {
+bool luaM_pooled(size_t size) {
+  return LuaHeap::isSmall(size + kHeaderSize);
+}
 
-  uint8_t* buf = (uint8_t*)malloc(16 + size + MARKSIZE);
-  assert(buf);
+static void* allocBlock(size_t size, LuaVM* g, int kind) {
+  size_t total = size + kHeaderSize;
 
-  //memset(buf + 16, -MARK, size);
-  //memset(buf + 16 + size, MARK, MARKSIZE);
+  uint8_t* buf;
+  if(LuaHeap::isSmall(total)) {
+    LuaHeap* heap = g ? &g->heap_ : LuaHeap::fallback();
+    buf = (uint8_t*)heap->alloc(total, kind);
+  } else {
+    buf = (uint8_t*)malloc(total);
+  }
+  assert(buf);
 
+  size_t bytes = blockSize(size);
   l_memcontrol.mem_blocks++;
-  l_memcontrol.mem_total += (uint32_t)size;
+  l_memcontrol.mem_total += bytes;
   l_memcontrol.mem_max = std::max(l_memcontrol.mem_max, l_memcontrol.mem_total);
 
-  if(thread_G) thread_G->incTotalBytes((int)size);
+  if(g) g->incTotalBytes((int)bytes);
 
+#if defined(LUA_MEMHEADER)
   Header *block = reinterpret_cast<Header*>(buf);
   block->size = size;
-
   return block + 1;
+#else
+  return buf;
+#endif
+}
+
+void *luaM_alloc_nocheck (size_t size, LuaVM* g) {
+  return allocBlock(size, g, LUA_TNIL);
+}
+
+void* luaM_allocobject(size_t size, LuaVM* g, LuaType type) {
+  assert(g && luaM_pooled(size));
+  return allocBlock(size, g, type);
+}
+
+static __declspec(thread) LuaMemTally* thread_tally = NULL;
+
+void luaM_free(void * blob, size_t size, LuaVM* g) {
+  if(blob == NULL) return;
+
+  uint8_t* buf = reinterpret_cast<uint8_t*>(blob) - kHeaderSize;
+#if defined(LUA_MEMHEADER)
+  assert(reinterpret_cast<Header*>(buf)->size == size);
+#endif
+
+  size_t bytes = blockSize(size);
+  if(thread_tally) {
+    thread_tally->blocks++;
+    thread_tally->bytes += bytes;
+  } else {
+    l_memcontrol.mem_blocks--;
+    l_memcontrol.mem_total -= bytes;
+
+    if(g) g->incTotalBytes(-(int)bytes);
+  }
+
+  if(LuaHeap::isSmall(size + kHeaderSize)) {
+    LuaHeap::free(buf);
+  } else {
+    free(buf);
+  }
+}
+
+void *luaM_alloc_nocheck (size_t size) {
+  return luaM_alloc_nocheck(size, thread_G);
 }
 
-void luaM_free(void * blob) {
+// Small blocks were charged to the VM that owns their heap, which the page
+// header records.
+void luaM_free(void * blob, size_t size) {
   if(blob == NULL) return;
-  Header* block = reinterpret_cast<Header*>(blob) - 1;
-  
-  l_memcontrol.mem_blocks--;
-  l_memcontrol.mem_total -= (size_t)block->size;
-
-  if(thread_G) thread_G->incTotalBytes(-(int)block->size);
-
-  //uint8_t* buf = reinterpret_cast<uint8_t*>(block);
-  //uint8_t* mark = buf + 16 + block->size;
-  //for (int i = 0; i < MARKSIZE; i++) assert(mark[i] == MARK);
-  
-  free(block);
+  if(LuaHeap::isSmall(size + kHeaderSize)) {
+    uint8_t* buf = reinterpret_cast<uint8_t*>(blob) - kHeaderSize;
+    luaM_free(blob, size, LuaHeap::ownerOf(buf));
+  } else {
+    luaM_free(blob, size, thread_G);
+  }
+}
+
+void luaM_settally(LuaMemTally* tally) {
+  thread_tally = tally;
+}
+
+// Everything in a tally was charged to 'g'.
+void luaM_settle(LuaMemTally& tally, LuaVM* g) {
+  l_memcontrol.mem_blocks -= tally.blocks;
+  l_memcontrol.mem_total -= tally.bytes;
+
+  if(g) g->incTotalBytes(-(int)tally.bytes);
+
+  tally.blocks = 0;
+  tally.bytes = 0;
 }
 
 //-----------------------------------------------------------------------------
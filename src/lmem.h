@@ -7,17 +7,22 @@
 #ifndef lmem_h
 #define lmem_h
 
-//#include <stddef.h>
+#include <stddef.h>
 #include <assert.h>
 
+#include "LuaTypes.h" // for LuaType
+
+class LuaVM;
+
 /* memory allocator control variables */
 struct Memcontrol {
   Memcontrol();
 
   bool canAlloc(size_t size);
 
-  // THROWS AN EXCEPTION if the memory limit has been exceeded.
-  void checkLimit();
+  // THROWS AN EXCEPTION if the memory limit has been exceeded. 'g' is the
+  // VM whose collector gets a chance to free something first.
+  void checkLimit(LuaVM* g);
 
   size_t mem_blocks;
   size_t mem_total;
@@ -27,9 +32,42 @@ struct Memcontrol {
 
 extern Memcontrol l_memcontrol;
 
+// Blocks are charged to 'g', which may be NULL for memory that doesn't
+// belong to any VM.
+void* luaM_alloc_nocheck(size_t size, LuaVM* g);
+
+// Collectable objects of 'type' go in heap pages of their own, which have
+// mark bitmaps for them. 'size' must be pooled and 'g' can't be NULL.
+void* luaM_allocobject(size_t size, LuaVM* g, LuaType type);
+
+// True if a block of 'size' comes out of the VM's heap pages rather than
+// malloc.
+bool  luaM_pooled(size_t size);
+
+// 'size' must be the size the block was allocated with, 'g' the VM it was
+// charged to.
+void  luaM_free(void * blob, size_t size, LuaVM* g);
+
+// Compatibility forms for code that doesn't have its VM at hand. Allocation
+// charges the current thread's VM; freeing finds the VM through the heap
+// page for small blocks and only falls back to the current thread's VM for
+// big ones.
 void* luaM_alloc_nocheck(size_t size);
+void  luaM_free(void * blob, size_t size);
+
+// Memory freed by a thread other than the VM's own. While a tally is set,
+// frees on the calling thread are counted in it instead of being taken off
+// l_memcontrol and the VM's total, which only the VM's thread may touch;
+// that thread settles the tally with luaM_settle later.
+struct LuaMemTally {
+  LuaMemTally() : blocks(0), bytes(0) {}
+
+  size_t blocks;
+  size_t bytes;
+};
 
-void  luaM_free(void * blob);
+void  luaM_settally(LuaMemTally* tally);
+void  luaM_settle(LuaMemTally& tally, LuaVM* g);
 
 #endif
 
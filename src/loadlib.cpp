@@ -261,7 +261,7 @@ static void **ll_register (LuaThread *L, const char *path) {
     plib = (void**)val.getBlob()->buf_;
   }
   else {  /* no entry yet; create one */
-    LuaBlob* newBlob = new LuaBlob(sizeof(void*));
+    LuaBlob* newBlob = new (G(L)) LuaBlob(G(L), sizeof(void*));
 
     plib = (void **)newBlob->buf_;
     *plib = NULL;
@@ -570,24 +570,24 @@ int luaopen_package (LuaThread *L) {
   THREAD_CHECK(L);
 
   /* create new type _LOADLIB */
-  LuaTable* meta = new LuaTable();
+  LuaTable* meta = new (G(L)) LuaTable(G(L));
   meta->set("__gc", gctm);
   L->l_G->getRegistry()->set("_LOADLIB", meta);
 
 
   /* create `package' table */
-  LuaTable* package = new LuaTable(0, 2);
+  LuaTable* package = new (G(L)) LuaTable(G(L), 0, 2);
   package->set("loadlib", ll_loadlib);
   package->set("searchpath", ll_searchpath);
 
   L->stack_.push( LuaValue(package) );
 
   /* create 'searchers' table */
-  LuaTable* search = new LuaTable(4, 0);
-  search->set( 1, new LuaClosure(searcher_preload,package) );
-  search->set( 2, new LuaClosure(searcher_Lua,package) );
-  search->set( 3, new LuaClosure(searcher_C,package) );
-  search->set( 4, new LuaClosure(searcher_Croot,package) );
+  LuaTable* search = new (G(L)) LuaTable(G(L), 4, 0);
+  search->set( 1, new (G(L)) LuaClosure(G(L), searcher_preload,package) );
+  search->set( 2, new (G(L)) LuaClosure(G(L), searcher_Lua,package) );
+  search->set( 3, new (G(L)) LuaClosure(G(L), searcher_C,package) );
+  search->set( 4, new (G(L)) LuaClosure(G(L), searcher_Croot,package) );
 
   /* put it in field 'searchers' */
   package->set("searchers", search);
@@ -616,7 +616,7 @@ int luaopen_package (LuaThread *L) {
 
   // put 'require' in the globals table
   LuaTable* globals = L->l_G->getGlobals();
-  globals->set("require", new LuaClosure(ll_require,package));
+  globals->set("require", new (G(L)) LuaClosure(G(L), ll_require,package));
 
   loadedModules->set("package", package);
   globals->set("package", package);
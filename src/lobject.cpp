@@ -43,16 +43,102 @@ double luaO_arith (int op, double v1, double v2) {
   }
 }
 
+/*
+** Arithmetic on two numbers. Integer operands stay integers as long as the
+** result is exactly representable; division and exponentiation (and any
+** integer result that doesn't fit) are always done in floating point.
+*/
+LuaValue luaO_arith (int op, LuaValue v1, LuaValue v2) {
+  assert(v1.isNumber() && v2.isNumber());
+  if (v1.isInteger() && v2.isInteger()) {
+    int64_t a = v1.getInteger();
+    int64_t b = v2.getInteger();
+    int64_t r;
+    switch (op) {
+      case LUA_OPADD: if (luaO_addInt(a, b, &r)) return LuaValue(r); break;
+      case LUA_OPSUB: if (luaO_subInt(a, b, &r)) return LuaValue(r); break;
+      case LUA_OPMUL: if (luaO_mulInt(a, b, &r)) return LuaValue(r); break;
+      case LUA_OPMOD: if (luaO_modInt(a, b, &r)) return LuaValue(r); break;
+      case LUA_OPUNM: if (luaO_unmInt(a, &r)) return LuaValue(r); break;
+      default: break;
+    }
+  }
+  return LuaValue(luaO_arith(op, v1.getNumber(), v2.getNumber()));
+}
+
+//-----------------------------------------------------------------------------
+// Number comparisons. Integers and floats are compared by exact value - an
+// integer above 2^53 is not equal to the nearest double.
+
+#define TWO63 9223372036854775808.0
+
+int luaO_numeq (LuaValue v1, LuaValue v2) {
+  if (v1.isInteger() && v2.isInteger()) return v1.getInteger() == v2.getInteger();
+  if (v1.isFloat() && v2.isFloat()) return v1.getNumber() == v2.getNumber();
+
+  if (v1.isFloat()) std::swap(v1, v2);
+  int64_t i;
+  return luaO_flt2int(v2.getNumber(), &i) && (i == v1.getInteger());
+}
+
+/* i < f  <=>  i < ceil(f) */
+static int LTintflt (int64_t i, double f) {
+  if (f != f) return 0;
+  if (f >= TWO63) return 1;
+  if (f > -TWO63) return i < (int64_t)ceil(f);
+  return 0;
+}
+
+/* i <= f  <=>  i <= floor(f) */
+static int LEintflt (int64_t i, double f) {
+  if (f != f) return 0;
+  if (f >= TWO63) return 1;
+  if (f >= -TWO63) return i <= (int64_t)floor(f);
+  return 0;
+}
+
+/* f < i  <=>  floor(f) < i */
+static int LTfltint (double f, int64_t i) {
+  if (f != f) return 0;
+  if (f >= TWO63) return 0;
+  if (f >= -TWO63) return (int64_t)floor(f) < i;
+  return 1;
+}
+
+/* f <= i  <=>  ceil(f) <= i */
+static int LEfltint (double f, int64_t i) {
+  if (f != f) return 0;
+  if (f >= TWO63) return 0;
+  if (f > -TWO63) return (int64_t)ceil(f) <= i;
+  return 1;
+}
+
+int luaO_numlt (LuaValue v1, LuaValue v2) {
+  if (v1.isInteger()) {
+    if (v2.isInteger()) return v1.getInteger() < v2.getInteger();
+    return LTintflt(v1.getInteger(), v2.getNumber());
+  }
+  if (v2.isInteger()) return LTfltint(v1.getNumber(), v2.getInteger());
+  return v1.getNumber() < v2.getNumber();
+}
+
+int luaO_numle (LuaValue v1, LuaValue v2) {
+  if (v1.isInteger()) {
+    if (v2.isInteger()) return v1.getInteger() <= v2.getInteger();
+    return LEintflt(v1.getInteger(), v2.getNumber());
+  }
+  if (v2.isInteger()) return LEfltint(v1.getNumber(), v2.getInteger());
+  return v1.getNumber() <= v2.getNumber();
+}
+
 void pushstr(LuaThread* L, const std::string& s) {
-  THREAD_CHECK(L);
-  LuaString* s2 = thread_G->strings_->Create(s.c_str(), s.size());
+  LuaString* s2 = G(L)->strings_->Create(s.c_str(), s.size());
   LuaResult result = L->stack_.push_reserve2(s2);
   handleResult(result);
 }
 
 static void pushstr (LuaThread *L, const char *str, int l) {
-  THREAD_CHECK(L);
-  LuaString* s = thread_G->strings_->Create(str, l);
+  LuaString* s = G(L)->strings_->Create(str, l);
   LuaResult result = L->stack_.push_reserve2(s);
   handleResult(result);
 }
@@ -69,7 +155,6 @@ const char *luaO_pushvfstring (const char *fmt, va_list argp) {
 }
 
 const char *luaO_pushfstring (LuaThread *L, const char *fmt, ...) {
-  THREAD_CHECK(L);
   const char *msg;
   va_list argp;
   va_start(argp, fmt);
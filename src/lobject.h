@@ -23,6 +23,11 @@
 
 
 double luaO_arith (int op, double v1, double v2);
+LuaValue luaO_arith (int op, LuaValue v1, LuaValue v2);
+
+int luaO_numeq (LuaValue v1, LuaValue v2);
+int luaO_numlt (LuaValue v1, LuaValue v2);
+int luaO_numle (LuaValue v1, LuaValue v2);
 const char *luaO_pushvfstring (const char *fmt, va_list argp);
 const char *luaO_pushfstring (LuaThread *L, const char *fmt, ...);
 
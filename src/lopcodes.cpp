@@ -51,6 +51,20 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "SETLIST",
   "CLOSURE",
   "VARARG",
+  "GETFIELD",
+  "SETFIELD",
+  "GETUPFIELD",
+  "SETUPFIELD",
+  "ADDK",
+  "SUBK",
+  "EQK",
+  "ADD_NN",
+  "SUB_NN",
+  "MUL_NN",
+  "LT_NN",
+  "LE_NN",
+  "GETTABLE_AI",
+  "SETTABLE_AI",
   "EXTRAARG",
   NULL
 };
@@ -99,6 +113,34 @@ const uint8_t luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgU, OpArgU, iABC)		/* OP_SETLIST */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETFIELD */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETFIELD */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETUPFIELD */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETUPFIELD */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_ADDK */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_SUBK */
+ ,opmode(1, 0, OpArgR, OpArgK, iABC)		/* OP_EQK */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADD_NN */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUB_NN */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MUL_NN */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LT_NN */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LE_NN */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE_AI */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETTABLE_AI */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		  /* OP_EXTRAARG */
 };
 
+
+
+OpCode luaP_baseop (OpCode op) {
+  switch (op) {
+    case OP_ADD_NN: return OP_ADD;
+    case OP_SUB_NN: return OP_SUB;
+    case OP_MUL_NN: return OP_MUL;
+    case OP_LT_NN: return OP_LT;
+    case OP_LE_NN: return OP_LE;
+    case OP_GETTABLE_AI: return OP_GETTABLE;
+    case OP_SETTABLE_AI: return OP_SETTABLE;
+    default: return op;
+  }
+}
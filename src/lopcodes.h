@@ -221,6 +221,23 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
+OP_GETFIELD,/*	A B C	R(A) := R(B)[K(C)]				*/
+OP_SETFIELD,/*	A B C	R(A)[K(B)] := RK(C)				*/
+OP_GETUPFIELD,/* A B C	R(A) := UpValue[B][K(C)]			*/
+OP_SETUPFIELD,/* A B C	UpValue[A][K(B)] := RK(C)			*/
+OP_ADDK,/*	A B C	R(A) := R(B) + K(C)				*/
+OP_SUBK,/*	A B C	R(A) := R(B) - K(C)				*/
+OP_EQK,/*	A B C	if ((R(B) == K(C)) ~= A) then pc++		*/
+
+OP_ADD_NN,/*	A B C	R(A) := RK(B) + RK(C)	(numbers)		*/
+OP_SUB_NN,/*	A B C	R(A) := RK(B) - RK(C)	(numbers)		*/
+OP_MUL_NN,/*	A B C	R(A) := RK(B) * RK(C)	(numbers)		*/
+OP_LT_NN,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++ (numbers)	*/
+OP_LE_NN,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++ (numbers)	*/
+OP_GETTABLE_AI,/* A B C	R(A) := R(B)[RK(C)]	(table, integer key)	*/
+OP_SETTABLE_AI,/* A B C	R(A)[RK(B)] := RK(C)	(table, integer key)	*/
+
+
 OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 };
 
@@ -245,6 +262,16 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) In OP_LOADKX, the next 'instruction' is always EXTRAARG.
 
+  (*) K(x) arguments are encoded like RK(x) with the constant bit set. The
+  key of OP_GETFIELD, OP_SETFIELD, OP_GETUPFIELD and OP_SETUPFIELD is always
+  a string, and the constant of OP_ADDK and OP_SUBK is always a number.
+
+  (*) The opcodes with a type suffix are never generated by the compiler.
+  The interpreter rewrites a generic instruction into one of them in place
+  once it has seen the operand types (quickening), and back when the
+  types change. Anything that looks at code from outside the interpreter
+  should use GET_BASEOP, and dumped code never contains them.
+
   (*) For comparisons, A specifies what condition the test should accept
   (true or false).
 
@@ -280,6 +307,11 @@ extern const uint8_t luaP_opmodes[NUM_OPCODES];
 
 extern const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+/* generic opcode for a quickened one, any other opcode is returned as is */
+OpCode luaP_baseop (OpCode op);
+
+#define GET_BASEOP(i)	luaP_baseop(GET_OPCODE(i))
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
@@ -0,0 +1,606 @@
+/*
+** Bytecode optimizer for finished function prototypes
+** See Copyright Notice in lua.h
+*/
+
+#include "LuaGlobals.h"
+#include "LuaProto.h"
+#include "LuaString.h"
+
+#include <string>
+#include <vector>
+
+#include "lgc.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lopt.h"
+
+/*
+** The passes work on the code vector directly. A pass that wants to drop
+** instructions only flags them; 'compact' then squeezes them out and fixes
+** jump offsets, line info and local variable ranges in one go.
+*/
+
+typedef std::vector<char> Flags;
+
+/* passes are re-run while they find something, up to this many times */
+#define MAXROUNDS	8
+
+
+static int jumpTarget (Instruction i, int pc) {
+  return pc + 1 + GETARG_sBx(i);
+}
+
+
+/* instructions with an sBx jump offset */
+static bool isJump (OpCode op) {
+  return op == OP_JMP || op == OP_FORPREP || op == OP_FORLOOP ||
+         op == OP_TFORLOOP;
+}
+
+
+/* does the instruction (conditionally) skip over the next one? */
+static bool isSkipper (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return testTMode(op) || (op == OP_LOADBOOL && GETARG_C(i) != 0);
+}
+
+
+/* is the next instruction an OP_EXTRAARG owned by this one? */
+static bool hasExtraArg (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return op == OP_LOADKX || (op == OP_SETLIST && GETARG_C(i) == 0);
+}
+
+
+/* does control never fall through to the next instruction? */
+static bool endsBlock (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return isJump(op) || isSkipper(i) || op == OP_RETURN ||
+         op == OP_TAILCALL;
+}
+
+
+/* instructions that other instructions jump or skip to */
+static void findTargets (LuaProto *f, Flags &target) {
+  int n = (int)f->instructions_.size();
+  target.assign(n + 1, 0);
+  for (int pc = 0; pc < n; pc++) {
+    Instruction i = f->instructions_[pc];
+    if (isJump(GET_OPCODE(i)))
+      target[jumpTarget(i, pc)] = 1;
+    if (isSkipper(i) && pc + 2 <= n)
+      target[pc + 2] = 1;
+  }
+}
+
+
+/*
+** Registers [first, last] that the instruction may write; 'last' < 'first'
+** if none. Calls and open-ended results clobber everything up to the top
+** of the frame.
+*/
+static void writtenRegs (LuaProto *f, Instruction i, int &first, int &last) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int top = f->maxstacksize - 1;
+  first = a;
+  last = a;
+  switch (op) {
+    case OP_LOADNIL: last = a + GETARG_B(i); break;
+    case OP_SELF: last = a + 1; break;
+    case OP_CONCAT: {
+      if (GETARG_B(i) < first) first = GETARG_B(i);
+      if (GETARG_C(i) > last) last = GETARG_C(i);
+      break;
+    }
+    case OP_CALL: case OP_TAILCALL: last = top; break;
+    case OP_TFORCALL: first = a + 3; last = top; break;
+    case OP_VARARG: last = (GETARG_B(i) == 0) ? top : a + GETARG_B(i) - 2; break;
+    case OP_FORPREP: last = a + 2; break;
+    case OP_FORLOOP: last = a + 3; break;
+    case OP_TFORLOOP: break;
+    default: {
+      if (!testAMode(op)) last = first - 1;
+      break;
+    }
+  }
+  if (last > top) last = top;
+}
+
+
+/* registers captured as upvalues by the closures 'f' creates */
+static void findCaptured (LuaProto *f, Flags &captured) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  captured.assign(f->maxstacksize, 0);
+  for (int pc = 0; pc < n; pc++) {
+    if (GET_OPCODE(code[pc]) != OP_CLOSURE) continue;
+    LuaProto *p = f->subprotos_[GETARG_Bx(code[pc])];
+    for (int u = 0; u < (int)p->upvalues.size(); u++) {
+      if (p->upvalues[u].instack) captured[p->upvalues[u].idx] = 1;
+    }
+  }
+}
+
+
+/*
+** Can the instruction run Lua code - a call, a metamethod, or a finalizer
+** from a collection step? That code can change locals of this function
+** through the debug library.
+*/
+static bool mayRunCode (OpCode op) {
+  switch (op) {
+    case OP_MOVE: case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL:
+    case OP_LOADNIL: case OP_GETUPVAL: case OP_SETUPVAL: case OP_NOT:
+    case OP_JMP: case OP_TEST: case OP_TESTSET: case OP_RETURN:
+    case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP: case OP_EXTRAARG:
+      return false;
+    default:
+      return true;
+  }
+}
+
+
+/* index of constant 'v' in 'f', adding it if needed; -1 if there's no room */
+static int addConstant (LuaProto *f, LuaValue v) {
+  int n = (int)f->constants.size();
+  for (int k = 0; k < n; k++) {
+    LuaValue c = f->constants[k];
+    if (c.isInteger() == v.isInteger() && c == v)
+      return k;
+  }
+  if (n >= MAXARG_Bx) return -1;
+  f->constants.resize_nocheck(n + 1);
+  f->constants[n] = v;
+  luaC_barrier(f, v);
+  return n;
+}
+
+
+/*
+** Remove instructions flagged in 'removed', retargeting jumps to the next
+** instruction that survives. Returns the number of instructions removed.
+*/
+static int compact (LuaProto *f, Flags &removed) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  /* the instruction after a kept skipper and the argument of a kept owner
+     of an OP_EXTRAARG must stay, as must the final return */
+  for (int pc = 0; pc < n - 1; pc++) {
+    if (!removed[pc] && (isSkipper(code[pc]) || hasExtraArg(code[pc])))
+      removed[pc + 1] = 0;
+  }
+  removed[n - 1] = 0;
+  std::vector<int> newpc(n + 1);
+  int j = 0;
+  for (int pc = 0; pc < n; pc++) {
+    newpc[pc] = j;
+    if (!removed[pc]) j++;
+  }
+  newpc[n] = j;
+  if (j == n) return 0;
+  for (int pc = 0; pc < n; pc++) {
+    if (!removed[pc] && isJump(GET_OPCODE(code[pc])))
+      SETARG_sBx(code[pc], newpc[jumpTarget(code[pc], pc)] - newpc[pc] - 1);
+  }
+  bool lines = !f->lineinfo.empty();
+  for (int pc = 0; pc < n; pc++) {
+    if (removed[pc]) continue;
+    code[newpc[pc]] = code[pc];
+    if (lines) f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+  }
+  f->instructions_.resize_nocheck(j);
+  if (lines) f->lineinfo.resize_nocheck(j);
+  for (int v = 0; v < (int)f->locvars.size(); v++) {
+    LocVar &lv = f->locvars[v];
+    lv.startpc = newpc[lv.startpc];
+    lv.endpc = newpc[lv.endpc];
+  }
+  return n - j;
+}
+
+
+/*
+** Retarget jumps that land on an unconditional jump (one that closes no
+** upvalues) to its final destination.
+*/
+static int threadJumps (LuaProto *f) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  int changes = 0;
+  for (int pc = 0; pc < n; pc++) {
+    if (GET_OPCODE(code[pc]) != OP_JMP) continue;
+    int dest = jumpTarget(code[pc], pc);
+    for (int hops = 0; hops < n; hops++) {  /* guard against jump cycles */
+      Instruction i = code[dest];
+      if (GET_OPCODE(i) != OP_JMP || GETARG_A(i) != 0) break;
+      int next = jumpTarget(i, dest);
+      if (next == dest) break;
+      dest = next;
+    }
+    if (dest != jumpTarget(code[pc], pc)) {
+      SETARG_sBx(code[pc], dest - pc - 1);
+      changes++;
+    }
+  }
+  return changes;
+}
+
+
+/*
+** Jumps to the next instruction, 'MOVE A A' and nil loads into registers
+** that are already nil. At full level also the second half of 'MOVE A B;
+** MOVE B A' when B is a local - for a temporary, the MOVE is what tells
+** the debug info which local the value came from.
+** Registers a closure captures are never known to be nil, as the closure
+** can assign them, and nothing is known after an instruction that may run
+** Lua code.
+*/
+static void removeNoops (LuaProto *f, int level, Flags &removed) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  int nreg = f->maxstacksize;
+  Flags target;
+  findTargets(f, target);
+  Flags captured;
+  findCaptured(f, captured);
+  Flags isnil(nreg, 0);  /* registers known to hold nil in this block */
+  for (int pc = 0; pc < n; pc++) {
+    Instruction i = code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (target[pc] || (pc > 0 && endsBlock(code[pc - 1])))
+      isnil.assign(nreg, 0);
+    switch (op) {
+      case OP_JMP: {
+        if (GETARG_A(i) == 0 && GETARG_sBx(i) == 0)
+          removed[pc] = 1;
+        continue;
+      }
+      case OP_MOVE: {
+        int a = GETARG_A(i), b = GETARG_B(i);
+        if (a == b) {
+          removed[pc] = 1;
+          continue;
+        }
+        if (level >= LUA_OPT_FULL && pc + 1 < n && !target[pc + 1] &&
+            code[pc + 1] == CREATE_ABC(OP_MOVE, b, a, 0) &&
+            f->getLocalName(b + 1, pc + 1) != NULL)
+          removed[pc + 1] = 1;
+        break;
+      }
+      case OP_LOADNIL: {
+        int a = GETARG_A(i), b = GETARG_B(i);
+        bool known = true;
+        for (int r = a; r <= a + b; r++) {
+          if (!isnil[r]) known = false;
+          isnil[r] = !captured[r];
+        }
+        if (known)
+          removed[pc] = 1;
+        continue;
+      }
+      default: break;
+    }
+    if (mayRunCode(op)) {
+      isnil.assign(nreg, 0);
+      continue;
+    }
+    int first, last;
+    writtenRegs(f, i, first, last);
+    for (int r = first; r <= last; r++) isnil[r] = 0;
+  }
+}
+
+
+/* instructions reachable from the entry point without going through 'avoid' */
+static void findReachable (LuaProto *f, int avoid, Flags &reached) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  reached.assign(n, 0);
+  std::vector<int> work;
+  work.push_back(0);
+  while (!work.empty()) {
+    int pc = work.back();
+    work.pop_back();
+    if (pc >= n || pc == avoid || reached[pc]) continue;
+    reached[pc] = 1;
+    Instruction i = code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_JMP: case OP_FORPREP:
+        work.push_back(jumpTarget(i, pc));
+        break;
+      case OP_FORLOOP: case OP_TFORLOOP:
+        work.push_back(jumpTarget(i, pc));
+        work.push_back(pc + 1);
+        break;
+      case OP_RETURN:
+        break;
+      default: {
+        if (hasExtraArg(i)) {
+          reached[pc + 1] = 1;
+          work.push_back(pc + 2);
+        }
+        else if (isSkipper(i)) {
+          if (testTMode(GET_OPCODE(i))) work.push_back(pc + 1);
+          work.push_back(pc + 2);
+        }
+        else
+          work.push_back(pc + 1);
+        break;
+      }
+    }
+  }
+}
+
+
+/* flag every instruction that can't be reached from the entry point */
+static void removeUnreachable (LuaProto *f, Flags &removed) {
+  int n = (int)f->instructions_.size();
+  Flags reached;
+  findReachable(f, -1, reached);
+  for (int pc = 0; pc < n; pc++) {
+    if (!reached[pc]) removed[pc] = 1;
+  }
+}
+
+
+/*
+** Values of registers that hold a constant for their whole life: written
+** exactly once, by a constant load, and neither a parameter nor captured
+** as an upvalue (a closure could change it behind our back). The value is
+** only good at instructions the load dominates; 'early' holds, per
+** register, those that can run before it.
+*/
+struct RegConstants {
+  Flags known;
+  std::vector<LuaValue> value;
+  std::vector<Flags> early;
+
+  bool has (int r, int pc) const {
+    return known[r] && !early[r][pc];
+  }
+
+  bool get (LuaProto *f, int rk, int pc, LuaValue &v) const {
+    if (ISK(rk)) {
+      v = f->constants[INDEXK(rk)];
+      return true;
+    }
+    if (!has(rk, pc)) return false;
+    v = value[rk];
+    return true;
+  }
+};
+
+
+static void findConstants (LuaProto *f, RegConstants &rc) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  int nreg = f->maxstacksize;
+  std::vector<int> writer(nreg, -1);
+  Flags multi;
+  findCaptured(f, multi);
+  for (int r = 0; r < f->numparams && r < nreg; r++) multi[r] = 1;
+  for (int pc = 0; pc < n; pc++) {
+    int first, last;
+    writtenRegs(f, code[pc], first, last);
+    for (int r = first; r <= last; r++) {
+      if (writer[r] < 0) writer[r] = pc;
+      else multi[r] = 1;
+    }
+  }
+  rc.known.assign(nreg, 0);
+  rc.value.assign(nreg, LuaValue::Nil());
+  rc.early.resize(nreg);
+  for (int r = 0; r < nreg; r++) {
+    if (multi[r] || writer[r] < 0) continue;
+    Instruction i = code[writer[r]];
+    switch (GET_OPCODE(i)) {
+      case OP_LOADK: rc.value[r] = f->constants[GETARG_Bx(i)]; break;
+      case OP_LOADBOOL: {
+        if (GETARG_C(i) != 0) continue;
+        rc.value[r] = LuaValue(GETARG_B(i) != 0);
+        break;
+      }
+      case OP_LOADNIL: {
+        if (GETARG_B(i) != 0) continue;
+        break;
+      }
+      default: continue;
+    }
+    rc.known[r] = 1;
+    findReachable(f, writer[r], rc.early[r]);
+  }
+}
+
+
+static bool isKstr (LuaProto *f, int rk) {
+  return ISK(rk) && f->constants[INDEXK(rk)].isString();
+}
+
+
+/* pick the specialized form of an instruction whose operands became
+   constants (the same choices lcode makes) */
+static void respecialize (LuaProto *f, Instruction &i) {
+  int b = GETARG_B(i), c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_GETTABLE: if (isKstr(f, c)) SET_OPCODE(i, OP_GETFIELD); break;
+    case OP_GETTABUP: if (isKstr(f, c)) SET_OPCODE(i, OP_GETUPFIELD); break;
+    case OP_SETTABLE: if (isKstr(f, b)) SET_OPCODE(i, OP_SETFIELD); break;
+    case OP_SETTABUP: if (isKstr(f, b)) SET_OPCODE(i, OP_SETUPFIELD); break;
+    case OP_EQ: {
+      if (ISK(b) && !ISK(c)) {  /* constant goes on the right */
+        SETARG_B(i, c);
+        SETARG_C(i, b);
+      }
+      if (!ISK(GETARG_B(i)) && ISK(GETARG_C(i))) SET_OPCODE(i, OP_EQK);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/* outcome of a comparison between constants: 1 true, 0 false, -1 unknown */
+static int foldCompare (OpCode op, LuaValue l, LuaValue r) {
+  switch (op) {
+    case OP_EQ: case OP_EQK:
+      if (l.isNumber() && r.isNumber()) return luaO_numeq(l, r);
+      return l == r;
+    case OP_LT:
+      if (l.isNumber() && r.isNumber()) return luaO_numlt(l, r);
+      return -1;
+    case OP_LE:
+      if (l.isNumber() && r.isNumber()) return luaO_numle(l, r);
+      return -1;
+    default:
+      return -1;
+  }
+}
+
+
+/*
+** A test at 'pc' whose outcome is known. If its jump is always taken the
+** test goes and the jump stays; if never taken both go (unless something
+** else jumps straight to the jump).
+*/
+static void foldTest (int pc, bool jumps, Flags &removed, Flags &target) {
+  if (jumps)
+    removed[pc] = 1;
+  else if (!target[pc + 1])
+    removed[pc] = removed[pc + 1] = 1;
+}
+
+
+/*
+** 'LOADK B s1; ...; LOADK C sn; CONCAT A B C' with nothing jumping into
+** the middle becomes 'LOADK A s1..sn'. Any of the loads can also be a
+** MOVE from a register holding a constant string.
+*/
+static int foldConcat (LuaProto *f, int pc, const RegConstants &rc,
+                       Flags &removed, Flags &target) {
+  Instruction *code = f->instructions_.begin();
+  Instruction i = code[pc];
+  int b = GETARG_B(i), c = GETARG_C(i);
+  int first = pc - (c - b + 1);
+  if (first < 0) return 0;
+  std::string buf;
+  for (int r = b; r <= c; r++) {
+    int at = first + (r - b);
+    Instruction load = code[at];
+    if (removed[at] || GETARG_A(load) != r) return 0;
+    if (at > first && target[at]) return 0;
+    LuaValue s;
+    if (GET_OPCODE(load) == OP_LOADK)
+      s = f->constants[GETARG_Bx(load)];
+    else if (GET_OPCODE(load) != OP_MOVE || !rc.get(f, GETARG_B(load), at, s))
+      return 0;
+    if (!s.isString()) return 0;
+    buf.append(s.getString()->c_str(), s.getString()->getLen());
+  }
+  if (target[pc]) return 0;
+  LuaString *ts = thread_G->strings_->Create(buf.data(), (int)buf.size());
+  int k = addConstant(f, LuaValue(ts));
+  if (k < 0) return 0;
+  for (int at = first; at < pc; at++) removed[at] = 1;
+  code[pc] = CREATE_ABx(OP_LOADK, GETARG_A(i), k);
+  return 1;
+}
+
+
+/*
+** Arithmetic errors name the local that held a bad operand, which they
+** can only do while the operand is still read from its register.
+*/
+static bool namesOperands (OpCode op) {
+  return op >= OP_ADD && op <= OP_POW;
+}
+
+
+/*
+** Replace reads of registers that hold a constant with the constant where
+** an operand can be one, and fold the tests and concatenations that then
+** only involve constants. MOVEs from those registers stay, so the debug
+** info still names the local a value came from.
+*/
+static int propagateConstants (LuaProto *f, Flags &removed) {
+  Instruction *code = f->instructions_.begin();
+  int n = (int)f->instructions_.size();
+  int changes = 0;
+  RegConstants rc;
+  findConstants(f, rc);
+  Flags target;
+  findTargets(f, target);
+  for (int pc = 0; pc < n; pc++) {
+    Instruction &i = code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (removed[pc]) continue;
+    if (getOpMode(op) == iABC && !namesOperands(op)) {
+      int b = GETARG_B(i), c = GETARG_C(i);
+      if (getBMode(op) == OpArgK && !ISK(b) && rc.has(b, pc)) {
+        int k = addConstant(f, rc.value[b]);
+        if (k >= 0 && k <= MAXINDEXRK) {
+          SETARG_B(i, RKASK(k));
+          changes++;
+        }
+      }
+      if (getCMode(op) == OpArgK && !ISK(c) && rc.has(c, pc)) {
+        int k = addConstant(f, rc.value[c]);
+        if (k >= 0 && k <= MAXINDEXRK) {
+          SETARG_C(i, RKASK(k));
+          changes++;
+        }
+      }
+      respecialize(f, i);
+      op = GET_OPCODE(i);
+    }
+    switch (op) {
+      case OP_TEST: {
+        int a = GETARG_A(i);
+        if (rc.has(a, pc)) {
+          bool skips = rc.value[a].isFalse() == (GETARG_C(i) != 0);
+          foldTest(pc, !skips, removed, target);
+        }
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: case OP_EQK: {
+        LuaValue l, r;
+        if (rc.get(f, GETARG_B(i), pc, l) &&
+            rc.get(f, GETARG_C(i), pc, r)) {
+          int res = foldCompare(op, l, r);
+          if (res >= 0)
+            foldTest(pc, res == GETARG_A(i), removed, target);
+        }
+        break;
+      }
+      case OP_CONCAT: {
+        changes += foldConcat(f, pc, rc, removed, target);
+        break;
+      }
+      default: break;
+    }
+  }
+  return changes;
+}
+
+
+void luaK_optimize (LuaProto *f, int level) {
+  if (level <= LUA_OPT_NONE || f->instructions_.empty()) return;
+  /* passes report rewrites, removals are counted by 'compact' (which may
+     have to keep some of the instructions a pass asked for) */
+  for (int round = 0; round < MAXROUNDS; round++) {
+    int changes = threadJumps(f);
+    Flags removed(f->instructions_.size(), 0);
+    if (level >= LUA_OPT_FULL) {
+      changes += propagateConstants(f, removed);
+      changes += compact(f, removed);
+      removed.assign(f->instructions_.size(), 0);
+    }
+    removeNoops(f, level, removed);
+    changes += compact(f, removed);
+    removed.assign(f->instructions_.size(), 0);
+    removeUnreachable(f, removed);
+    changes += compact(f, removed);
+    if (changes == 0) break;
+  }
+}
@@ -0,0 +1,27 @@
+/*
+** Bytecode optimizer for finished function prototypes
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lopt_h
+#define lopt_h
+
+class LuaProto;
+
+/*
+** Optimization levels. Level 1 only does transformations that can't
+** change what a debugger sees in locals: jump threading, removal of
+** no-op jumps, moves and nil loads, and unreachable code. Level 2 also
+** propagates constants held in registers that are written exactly once,
+** folds comparisons and concatenations of constants and drops the
+** branches that can never be taken. It leaves alone the reads that let
+** error messages name a local, so those don't change either.
+*/
+#define LUA_OPT_NONE	0
+#define LUA_OPT_BASIC	1
+#define LUA_OPT_FULL	2
+
+/* rewrites 'f' in place; runs once per prototype, before initCaches */
+void luaK_optimize (LuaProto *f, int level);
+
+#endif
@@ -339,7 +339,7 @@ static const luaL_Reg syslib[] = {
 int luaopen_os (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = syslib; cursor->name; cursor++) {
     lib->set( cursor->name, LuaValue(cursor->func) );
   }
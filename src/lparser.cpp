@@ -22,6 +22,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lopt.h"
 #include "lparser.h"
 #include "lstate.h"
 
@@ -160,7 +161,7 @@ static LuaResult check_match (LexState *ls, int what, int who, int where) {
 */
 LuaString *luaX_newstring (LexState *ls, const char *str, size_t l) {
 
-  LuaString* ts = thread_G->strings_->Create(str, l);  /* create new string */
+  LuaString* ts = G(ls->fs->L)->strings_->Intern(str, l);  /* create new string */
 
   // TODO(aappleby): Save string in 'ls->fs->h'. Why it does so exactly this way, I don't
   // know. Will have to investigate in the future.
@@ -539,7 +540,7 @@ static void enterblock (FuncState *fs, BlockCnt *bl, uint8_t isloop) {
 */
 static LuaResult breaklabel (LexState *ls) {
   LuaResult result = LUA_OK;
-  LuaString* n = thread_G->strings_->Create("break");
+  LuaString* n = G(ls->fs->L)->strings_->Create("break");
   int l = newlabelentry(ls, &ls->dyd->label, n, 0, ls->fs->pc);
   result = findgotos(ls, &ls->dyd->label.arr[l]);
   return result;
@@ -632,8 +633,8 @@ static LuaResult open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->firstlocal = ls->dyd->actvar.n;
   fs->bl = NULL;
 
-  LuaProto* f = new LuaProto();
-  f->linkGC(getGlobalGCList());
+  LuaProto* f = new (G(L)) LuaProto(G(L));
+  f->linkAllgc();
 
   /* anchor prototype (to avoid being collected) */
   result = L->stack_.push_reserve2(LuaValue(f));
@@ -643,7 +644,7 @@ static LuaResult open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   f->source = fs->L->l_G->strings_->Create(ls->lexer_.getSource());
   f->maxstacksize = 2;  /* registers 0/1 are always valid */
 
-  fs->constant_map = new LuaTable();
+  fs->constant_map = new (G(L)) LuaTable(G(L));
   /* anchor table of constants (to avoid being collected) */
   
   result = L->stack_.push_reserve2(LuaValue(fs->constant_map));
@@ -671,6 +672,8 @@ static LuaResult close_func (LexState *ls) {
   f->subprotos_.resize_nocheck(fs->num_protos);
   f->locvars.resize_nocheck(fs->nlocvars);
   f->upvalues.resize_nocheck(fs->num_upvals);
+  luaK_optimize(f, G(L)->optlevel_);
+  f->initCaches();
 
   assert(fs->bl == NULL);
   ls->fs = fs->prev;
@@ -809,7 +812,8 @@ static LuaResult recfield (LexState *ls, struct ConsControl *cc) {
   rkkey = luaK_exp2RK(fs, &key);
   result = expr(ls, &val);
   if(result != LUA_OK) return result;
-  luaK_codeABC(fs, OP_SETTABLE, cc->t->info, rkkey, luaK_exp2RK(fs, &val));
+  luaK_codeABC(fs, luaK_isKstr(fs, rkkey) ? OP_SETFIELD : OP_SETTABLE,
+               cc->t->info, rkkey, luaK_exp2RK(fs, &val));
   fs->freereg = reg;  /* free registers */
   return result;
 }
@@ -1039,8 +1043,7 @@ static LuaResult explist (LexState *ls, expdesc *v, int& out) {
 static LuaResult funcargs2 (LexState *ls, expdesc *f, int line) {
   LuaResult result = LUA_OK;
   FuncState *fs = ls->fs;
-  expdesc args;
-  memset(&args,0,sizeof(args));
+  expdesc args = expdesc();
   int base, nparams;
   switch (ls->t.getId()) {
     case '(': {  /* funcargs -> `(' [ explist ] `)' */
@@ -1185,7 +1188,10 @@ static LuaResult simpleexp (LexState *ls, expdesc *v) {
   switch (ls->t.getId()) {
     case TK_NUMBER: {
       init_exp(v, VKNUM, 0);
-      v->nval = ls->t.getNumber();
+      if (ls->t.isInteger())
+        v->nval = ls->t.getInteger();
+      else
+        v->nval = ls->t.getNumber();
       break;
     }
     case TK_STRING: {
@@ -1481,7 +1487,7 @@ static LuaResult gotostat (LexState *ls, int pc) {
   else {
     result = luaX_next(ls);  /* skip break */
     if(result != LUA_OK) return result;
-    label = thread_G->strings_->Create("break");
+    label = G(ls->fs->L)->strings_->Create("break");
   }
   g = newlabelentry(ls, &ls->dyd->gt, label, line, pc);
   result = findlabel(ls, g, temp);  /* close it if label already defined */
@@ -2115,7 +2121,6 @@ LuaResult luaY_parser2 (LuaThread *L,
                         const char *name, 
                         LuaProto*& out) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
 
   LuaLog log;
   LexState lexstate(&log);
@@ -2126,7 +2131,7 @@ LuaResult luaY_parser2 (LuaThread *L,
   BlockCnt bl;
   LuaString* tname = NULL;
 
-  tname = thread_G->strings_->Create(name);
+  tname = G(L)->strings_->Create(name);
   /* push name to protect it */
   result = L->stack_.push_reserve2(LuaValue(tname));
   if(result != LUA_OK) {
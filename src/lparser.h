@@ -43,7 +43,7 @@ struct expdesc {
   int tr;  /* table (register or upvalue) */
   int vt;  /* whether 't' is register (VLOCAL) or upvalue (VUPVAL) */
   int info;  /* for generic use */
-  double nval;  /* for VKNUM */
+  LuaValue nval;  /* for VKNUM */
   int t;  /* patch list of `exit when true' */
   int f;  /* patch list of `exit when false' */
 };
@@ -25,7 +25,7 @@
 LuaThread *lua_newthread (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaThread* L1 = new LuaThread(L);
+  LuaThread* L1 = new (G(L)) LuaThread(L);
   L->stack_.push(LuaValue(L1));
 
   return L1;
@@ -995,7 +995,7 @@ int luaopen_string (LuaThread *L) {
   LuaVM* vm = L->l_G;
 
   // Create the library table
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (vm) LuaTable(vm);
 
   // Add all the library functions to it
   for(const luaL_Reg* cursor = strlib; cursor->name; cursor++) {
@@ -1003,7 +1003,7 @@ int luaopen_string (LuaThread *L) {
   }
 
   // Create an empty metatable,
-  LuaTable* meta = new LuaTable();
+  LuaTable* meta = new (vm) LuaTable(vm);
 
   // set the string library as the '__index' metamethod.
   meta->set( "__index", lib );
@@ -269,7 +269,7 @@ static const luaL_Reg tab_funcs[] = {
 int luaopen_table (LuaThread *L) {
   THREAD_CHECK(L);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = tab_funcs; cursor->name; cursor++) {
     lib->set( cursor->name, cursor->func );
   }
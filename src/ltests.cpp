@@ -68,7 +68,8 @@ static int testobjref1 (LuaVM *g, LuaObject *f, LuaObject *t) {
   if (t->isDead()) return 0;
 
   if (isgenerational(g)) {
-    return !(f->isBlack() && t->isLiveColor());
+    /* remembered objects are marked again by the next minor collection */
+    return !(f->isBlack() && t->isLiveColor()) || f->isRemembered();
   }
 
   if (issweepphase(g)) return 1;
@@ -77,22 +78,13 @@ static int testobjref1 (LuaVM *g, LuaObject *f, LuaObject *t) {
 }
 
 
-static void printobj (LuaVM *g, LuaObject *o) {
-  int i = -1;
-  int index = 0;
-  for(LuaList::iterator it = g->allgc.begin(); it; ++it, ++index) {
-    if(it == o) {
-      i = index;
-      break;
-    }
-  }
-
+static void printobj (LuaVM *, LuaObject *o) {
   char c = 'g';
   if(o->isDead()) c = 'd';
   if(o->isBlack()) c = 'b';
   if(o->isWhite()) c = 'w';
 
-  printf("%d:%s(%p)-%c", i, o->typeName(), (void *)o, c);
+  printf("%s(%p)-%c", o->typeName(), (void *)o, c);
 }
 
 
@@ -193,7 +185,7 @@ static void checkobject (LuaVM *g, LuaObject *o) {
   }
 
   if(o->isUpval()) {
-    LuaUpvalue *uv = dynamic_cast<LuaUpvalue*>(o);
+    LuaUpvalue *uv = static_cast<LuaUpvalue*>(o);
     assert(uv->v == &uv->value);  /* must be closed */
     assert(!o->isGray());  /* closed upvalues are never gray */
     checkvalref(g, o, uv->v);
@@ -201,24 +193,24 @@ static void checkobject (LuaVM *g, LuaObject *o) {
   }
 
   if(o->isUserdata()) {
-    LuaTable *mt = dynamic_cast<LuaBlob*>(o)->metatable_;
+    LuaTable *mt = static_cast<LuaBlob*>(o)->metatable_;
     if (mt) checkobjref(g, o, mt);
     return;
   }
 
   if(o->isTable()) {
-    checktable(g, dynamic_cast<LuaTable*>(o));
+    checktable(g, static_cast<LuaTable*>(o));
     return;
   }
 
   if(o->isThread()) {
-    LuaThread* l = dynamic_cast<LuaThread*>(o);
+    LuaThread* l = static_cast<LuaThread*>(o);
     assert(l);
     return;
   }
 
   if(o->isLClosure() || o->isCClosure()) {
-    LuaClosure* c = dynamic_cast<LuaClosure*>(o);
+    LuaClosure* c = static_cast<LuaClosure*>(o);
     if(c->isC) {
       checkCClosure(g, c);
     } else {
@@ -228,7 +220,7 @@ static void checkobject (LuaVM *g, LuaObject *o) {
   }
 
   if(o->isProto()) {
-    checkproto(g, dynamic_cast<LuaProto*>(o));
+    checkproto(g, static_cast<LuaProto*>(o));
     return;
   }
 
@@ -249,7 +241,6 @@ void CheckGraylistCB(LuaObject* o) {
   assert(o->isGray());
   assert(!o->isTestGray());
   o->setTestGray();
-  o = o->getNextGray();
 }
 
 static void markTestGrays (LuaVM *g) {
@@ -278,6 +269,17 @@ static void checkold (LuaVM *g, LuaObject *o) {
   }
 }
 
+/* objects in 'allgc' are in no particular order, so only the flags of
+   each are checked */
+static void checkoldobj (LuaVM *g, LuaObject *o) {
+  if (o->isOld()) assert(isgenerational(g));
+  if (o->isGray()) {
+    assert(!keepinvariant(g) || o->isTestGray());
+    o->clearTestGray();
+  }
+  assert(!o->isTestGray());
+}
+
 static void checkold (LuaVM *g, LuaList& list) {
   int isold = 0;
   for(LuaList::iterator it = list.begin(); it; ++it) {
@@ -312,10 +314,19 @@ int lua_checkmemory (LuaThread *L) {
     markTestGrays(g);
   }
 
-  checkold(g, g->allgc);
-  for(LuaList::iterator it = g->allgc.begin(); it; ++it) {
-    checkobject(g, it);
-    assert(!it->isSeparated());
+  for (LuaHeapPage *page = g->heap_.firstObjectPage(); page;
+       page = g->heap_.nextObjectPage(page)) {
+    if (page->kind_ == LUA_TSTRING) continue;
+    LuaMarkBits *bits = LuaMarkBits::of(page);
+    for (int i = 0; i < LuaMarkBits::kBits; i++) {
+      if (!LuaMarkBits::test(bits->swept_, i)) continue;
+      LuaObject *o = static_cast<LuaObject*>(LuaMarkBits::objectAt(page, i));
+      assert(o->type() == page->kind_ || (o->isCClosure() && page->kind_ == LUA_TLCL));
+      assert(LuaMarkBits::test(bits->old_, i) == o->isOld());
+      checkoldobj(g, o);
+      checkobject(g, o);
+      assert(!o->isSeparated());
+    }
   }
   /* check 'finobj' list */
   checkold(g, g->finobj);
@@ -333,8 +344,7 @@ int lua_checkmemory (LuaThread *L) {
     assert(!it->isDead() && it->isSeparated());
     assert(it->isUserdata() || it->isTable());
 
-    if(it->getNext()) assert(it->getNext()->getPrev() == it);
-    if(it->getPrev()) assert(it->getPrev()->getNext() == it);
+    if(it->getNext() == NULL) assert(g->tobefnz.getTail() == it);
   }
   /* check 'uvhead' list */
   for (uv = g->uvhead.unext; uv != &g->uvhead; uv = uv->unext) {
@@ -454,6 +464,17 @@ static int get_limits (LuaThread *L) {
 }
 
 
+/* returns the bytecode optimization level; sets it if given one */
+static int opt_level (LuaThread *L) {
+  THREAD_CHECK(L);
+  int old = thread_G->optlevel_;
+  if (!lua_isnone(L, 1))
+    thread_G->optlevel_ = luaL_checkint(L, 1);
+  lua_pushinteger(L, old);
+  return 1;
+}
+
+
 static int mem_query (LuaThread *L) {
   THREAD_CHECK(L);
   if (lua_isnone(L, 1)) {
@@ -511,6 +532,9 @@ static int get_gccolor (LuaThread *L) {
     if (lo->isOld()) {
       lua_pushliteral(L, "/old"); n++;
     }
+    if (lo->isRemembered()) {
+      lua_pushliteral(L, "/remembered"); n++;
+    }
     lua_concat(L, n);
   }
   return 1;
@@ -588,14 +612,13 @@ static int string_query (LuaThread *L) {
     return 2;
   }
   else if (s < tb->getHashSize()) {
-    LuaObject *ts;
-    int n = 0;
-    for (ts = tb->getStringAt(s); ts; ts = ts->getNext()) {
+    LuaString *ts = tb->getStringAt(s);
+    if (ts) {
       LuaResult result = L->stack_.push_reserve2(LuaValue(ts));
       handleResult(result);
-      n++;
+      return 1;
     }
-    return n;
+    return 0;
   }
   return 0;
 }
@@ -616,7 +639,7 @@ static int getref (LuaThread *L) {
   int level = L->stack_.getTopIndex();
   
   LuaValue key = L->stack_.top_[-1];
-  int ref = key.isInteger() ? key.getInteger() : 0;
+  int ref = key.isInteger() ? (int)key.getInteger() : 0;
   LuaTable* registry = L->l_G->getRegistry();
   LuaValue val = registry->get( LuaValue(ref) );
   if(val.isNone()) val = LuaValue::Nil();
@@ -1312,7 +1335,7 @@ static int runC (LuaThread *L, LuaThread *L1, const char *pc) {
         result = 0;
       }
       else {
-        LuaTable* newTable = new LuaTable();
+        LuaTable* newTable = new (G(L)) LuaTable(G(L));
         registry->set(tempstring, newTable);
         L1->stack_.push(newTable);
         result = 1;
@@ -1506,6 +1529,7 @@ static const struct luaL_Reg tests_funcs[] = {
   {"newstate", newstate},
   {"newuserdata", newuserdata},
   {"num2int", num2int},
+  {"optlevel", opt_level},
   {"pushuserdata", pushuserdata},
   {"querystr", string_query},
   {"querytab", table_query},
@@ -1535,7 +1559,7 @@ int luaopen_test (LuaThread *L) {
   lua_atpanic(L, &tpanic);
   atexit(checkfinalmem);
 
-  LuaTable* lib = new LuaTable();
+  LuaTable* lib = new (G(L)) LuaTable(G(L));
   for(const luaL_Reg* cursor = tests_funcs; cursor->name; cursor++) {
     lib->set( cursor->name, LuaValue(cursor->func) );
   }
@@ -15,24 +15,59 @@
 #include "lstate.h"
 #include "ltm.h"
 
-LuaTable* lua_getmetatable (LuaValue v);
+LuaTable* luaT_getmetatable (LuaVM* g, LuaValue v) {
+  int type = v.type();
+  switch (type) {
 
-LuaValue luaT_gettmbyobj2 (LuaValue v, TMS event) {
-  LuaTable* mt = lua_getmetatable(v);
+    case LUA_TTABLE:
+      return v.getTable()->metatable;
+
+    case LUA_TBLOB:
+      return v.getBlob()->metatable_;
+
+    default:
+      return g->base_metatables_[type];
+  }
+}
+
+LuaValue luaT_gettmbyobj2 (LuaVM* g, LuaValue v, TMS event) {
+  LuaTable* mt = luaT_getmetatable(g, v);
   if(mt == NULL) return LuaValue::None();
-  LuaValue temp(thread_G->tagmethod_names_[event]);
-  return mt->get(temp);
+  if(mt->tmAbsent(event)) return LuaValue::None();
+
+  LuaValue temp(g->tagmethod_names_[event]);
+  LuaValue tm = mt->get(temp);
+  if (tm.isNone() || tm.isNil()) mt->setTmAbsent(event);
+  return tm;
 }
 
-LuaValue fasttm2 ( LuaTable* table, TMS tag) {
+LuaValue fasttm2 (LuaVM* g, LuaTable* table, TMS tag) {
   if(table == NULL) return LuaValue::None();
 
-  LuaValue temp(thread_G->tagmethod_names_[tag]);
+  assert(tag <= TM_EQ);
+  if(table->tmAbsent(tag)) return LuaValue::None();
+
+  LuaValue temp(g->tagmethod_names_[tag]);
   LuaValue tm = table->get(temp);
 
-  assert(tag <= TM_EQ);
   if (tm.isNone() || tm.isNil()) {  /* no tag method? */
+    table->setTmAbsent(tag);
     return LuaValue::None();
   }
   else return tm;
 }
+
+// Same as fasttm2, but doesn't cache a missing tag method in 'table', so
+// parallel markers can call it while others are reading the same table.
+LuaValue fasttm_nocache (LuaVM* g, LuaTable* table, TMS tag) {
+  if(table == NULL) return LuaValue::None();
+
+  assert(tag <= TM_EQ);
+  if(table->tmAbsent(tag)) return LuaValue::None();
+
+  LuaValue temp(g->tagmethod_names_[tag]);
+  LuaValue tm = table->get(temp);
+
+  if (tm.isNone() || tm.isNil()) return LuaValue::None();
+  else return tm;
+}
@@ -14,7 +14,9 @@
 const char* ttypename(int tag);
 const char* objtypename(const LuaValue* v);
 
-LuaValue luaT_gettmbyobj2 (LuaValue v, TMS event);
-LuaValue fasttm2 ( LuaTable* table, TMS tag);
+LuaTable* luaT_getmetatable (LuaVM* g, LuaValue v);
+LuaValue luaT_gettmbyobj2 (LuaVM* g, LuaValue v, TMS event);
+LuaValue fasttm2 (LuaVM* g, LuaTable* table, TMS tag);
+LuaValue fasttm_nocache (LuaVM* g, LuaTable* table, TMS tag);
 
 #endif
@@ -453,7 +453,7 @@ static int handle_luainit (LuaThread *L) {
 
 
 static int pmain (LuaThread *L) {
-  int argc = L->stack_.at(1).getInteger();
+  int argc = (int)L->stack_.at(1).getInteger();
   char **argv = (char **)L->stack_.at(2).getPointer();
   int script;
   int args[num_has];
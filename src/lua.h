@@ -202,6 +202,8 @@ int  (lua_resume) (LuaThread *L, LuaThread *from, int narg);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCSETMARKTHREADS	12
+#define LUA_GCSETFREETHREAD	13
 
 int (lua_gc) (LuaThread *L, int what, int data);
 
@@ -5,6 +5,7 @@
 */
 
 #include "LuaClosure.h"
+#include "LuaGlobals.h"
 #include "LuaProto.h"
 #include "LuaState.h"
 
@@ -19,6 +20,7 @@
 #include "lauxlib.h"
 
 #include "lobject.h"
+#include "lopt.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -31,6 +33,7 @@ static void PrintFunction(const LuaProto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int optlevel=LUA_OPT_BASIC;	/* bytecode optimization level */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -58,6 +61,7 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
+  "  -O[n]    optimize bytecode at level n (0 to 2, default 1; -O is -O2)\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -95,6 +99,13 @@ static int doargs(int argc, char* argv[])
     usage(LUA_QL("-o") " needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (argv[i][1]=='O')		/* optimization level */
+  {
+   const char* level=argv[i]+2;
+   if (*level==0) optlevel=LUA_OPT_FULL;
+   else if (level[0]>='0' && level[0]<='2' && level[1]==0) optlevel=level[0]-'0';
+   else usage(argv[i]);
+  }
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -159,6 +170,7 @@ static int pmain(LuaThread* L)
  const LuaProto* f;
  int i;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
+ G(L)->optlevel_=optlevel;
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
@@ -253,6 +265,11 @@ static void PrintConstant(const LuaProto* f, int i)
     return;
   }
 
+  if(v.isInteger()) {
+    printf("%lld",(long long)v.getInteger());
+    return;
+  }
+
   if(v.isNumber()) {
     printf(LUA_NUMBER_FMT,v.getNumber());
     return;
@@ -316,25 +333,32 @@ static void PrintCode(const LuaProto* f)
     printf("\t; %s",UPVALNAME(b));
     break;
    case OP_GETTABUP:
+   case OP_GETUPFIELD:
     printf("\t; %s",UPVALNAME(b));
     if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
     break;
    case OP_SETTABUP:
+   case OP_SETUPFIELD:
     printf("\t; %s",UPVALNAME(a));
     if (ISK(b)) { printf(" "); PrintConstant(f,INDEXK(b)); }
     if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
     break;
    case OP_GETTABLE:
+   case OP_GETFIELD:
    case OP_SELF:
     if (ISK(c)) { printf("\t; "); PrintConstant(f,INDEXK(c)); }
     break;
    case OP_SETTABLE:
+   case OP_SETFIELD:
    case OP_ADD:
    case OP_SUB:
+   case OP_ADDK:
+   case OP_SUBK:
    case OP_MUL:
    case OP_DIV:
    case OP_POW:
    case OP_EQ:
+   case OP_EQK:
    case OP_LT:
    case OP_LE:
     if (ISK(b) || ISK(c))
@@ -158,6 +158,17 @@
 
 /* }================================================================== */
 
+/*
+@@ LUA_NANBOXING stores each LuaValue as a single NaN-boxed 8-byte word
+@@ instead of a 16-byte tagged union.
+** CHANGE it (define it) to roughly halve the size of stacks and tables.
+** Integers are then limited to 48 bits (larger ones are stored as
+** floats) and pointers must fit in 48 bits, which holds for x64 and ARM64
+** user space.
+*/
+/* #define LUA_NANBOXING */
+
+
 /*
 @@ LUAI_MAXSTACK limits the size of the Lua stack.
 ** CHANGE it if you need a different limit. This limit is arbitrary;
@@ -14,6 +14,9 @@
 
 int (luaopen_base) (LuaThread *L);
 
+/* the base library's 'next', which the VM special-cases in generic fors */
+int (luaB_next) (LuaThread *L);
+
 #define LUA_COLIBNAME	"coroutine"
 int (luaopen_coroutine) (LuaThread *L);
 
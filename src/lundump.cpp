@@ -20,7 +20,7 @@
 #include "lundump.h"
 #include "lzio.h"
 
-static void LoadFunction(Zio* z, LuaProto*& out);
+static void LoadFunction(LuaVM* g, Zio* z, LuaProto*& out);
 
 template<class T>
 void LoadVector(Zio* z, LuaVector<T>& v) {
@@ -29,7 +29,7 @@ void LoadVector(Zio* z, LuaVector<T>& v) {
   z->read(v.begin(), n * sizeof(T));
 }
 
-static LuaString* LoadString(Zio* z)
+static LuaString* LoadString(LuaVM* g, Zio* z)
 {
   size_t size = z->read<size_t>();
   if (size==0) {
@@ -39,11 +39,11 @@ static LuaString* LoadString(Zio* z)
     std::vector<char> buf;
     buf.resize(size);
     z->read(&buf[0],size * sizeof(char));
-    return thread_G->strings_->Create(&buf[0], size-1); /* remove trailing '\0' */
+    return g->strings_->Create(&buf[0], size-1); /* remove trailing '\0' */
   }
 }
 
-static void LoadConstants(Zio* z, LuaProto* f)
+static void LoadConstants(LuaVM* g, Zio* z, LuaProto* f)
 {
   int n = z->read<int>();
   f->constants.resize_nocheck(n);
@@ -61,8 +61,11 @@ static void LoadConstants(Zio* z, LuaProto* f)
     case LUA_TNUMBER:
       f->constants[i] = z->read<double>();
       break;
+    case LUA_TINTEGER:
+      f->constants[i] = z->read<int64_t>();
+      break;
     case LUA_TSTRING:
-      f->constants[i] = LoadString(z);
+      f->constants[i] = LoadString(g, z);
       break;
     default:
       f->constants[i] = LuaValue::Nil();
@@ -72,7 +75,7 @@ static void LoadConstants(Zio* z, LuaProto* f)
   n = z->read<int>();
   f->subprotos_.resize_nocheck(n);
   for (int i=0; i < n; i++) {
-    LoadFunction(z, f->subprotos_[i]);
+    LoadFunction(g, z, f->subprotos_[i]);
   }
 }
 
@@ -87,9 +90,9 @@ static void LoadUpvalues(Zio* z, LuaProto* f)
   }
 }
 
-static void LoadDebug(Zio* z, LuaProto* f)
+static void LoadDebug(LuaVM* g, Zio* z, LuaProto* f)
 {
-  f->source = LoadString(z);
+  f->source = LoadString(g, z);
 
   LoadVector(z, f->lineinfo);
 
@@ -98,21 +101,21 @@ static void LoadDebug(Zio* z, LuaProto* f)
 
   for (int i=0; i < n; i++)
   {
-    f->locvars[i].varname = LoadString(z);
+    f->locvars[i].varname = LoadString(g, z);
     f->locvars[i].startpc = z->read<int>();
     f->locvars[i].endpc = z->read<int>();
   }
 
   n = z->read<int>();
   for (int i=0; i < n; i++) {
-    f->upvalues[i].name = LoadString(z);
+    f->upvalues[i].name = LoadString(g, z);
   }
 }
 
-static void LoadFunction(Zio* z, LuaProto*& out)
+static void LoadFunction(LuaVM* g, Zio* z, LuaProto*& out)
 {
-  LuaProto* f = new LuaProto();
-  f->linkGC(getGlobalGCList());
+  LuaProto* f = new (g) LuaProto(g);
+  f->linkAllgc();
 
   f->linedefined = z->read<int>();
   f->lastlinedefined = z->read<int>();
@@ -122,10 +125,11 @@ static void LoadFunction(Zio* z, LuaProto*& out)
   f->maxstacksize = z->read<uint8_t>();
 
   LoadVector(z, f->instructions_);
+  f->initCaches();
 
-  LoadConstants(z, f);
+  LoadConstants(g, z, f);
   LoadUpvalues(z,f);
-  LoadDebug(z,f);
+  LoadDebug(g, z, f);
 
   out = f;
 }
@@ -142,7 +146,6 @@ static void LoadFunction(Zio* z, LuaProto*& out)
 LuaResult luaU_undump (LuaThread* L, Zio* Z, const char* name, LuaProto*& out)
 {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
   if (*name=='@' || *name=='=') {
     name=name+1;
   }
@@ -179,7 +182,7 @@ LuaResult luaU_undump (LuaThread* L, Zio* Z, const char* name, LuaProto*& out)
   }
 
   LuaProto* p = NULL;
-  LoadFunction(Z, p);
+  LoadFunction(G(L), Z, p);
 
   if (Z->error()) {
     luaO_pushfstring(L, "%s: truncated precompiled chunk",name);
@@ -192,7 +195,7 @@ LuaResult luaU_undump (LuaThread* L, Zio* Z, const char* name, LuaProto*& out)
 
 #define MYINT(s)	(s[0]-'0')
 #define VERSION		MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR)
-#define FORMAT		0		/* this is the official format */
+#define FORMAT		1		/* official format plus our own opcodes */
 
 /*
 * make header for precompiled chunks
@@ -19,6 +19,7 @@
 #define lvm_c
 
 #include "lua.h"
+#include "lualib.h"
 
 #include "ldebug.h"
 #include "ldo.h"
@@ -33,14 +34,11 @@
 #define MAXTAGLOOP	100
 
 // Converts value to string in-place, returning 1 if successful.
-int luaV_tostring (LuaValue* v) {
+int luaV_tostring (LuaThread *L, LuaValue* v) {
   if(v->isString()) return 1;
 
   if (v->isNumber()) {
-    double n = v->getNumber();
-    char s[LUAI_MAXNUMBER2STR];
-    int l = lua_number2str(s, n);
-    *v = thread_G->strings_->Create(s, l);
+    *v = v->convertToString(G(L));
     return 1;
   }
 
@@ -50,7 +48,6 @@ int luaV_tostring (LuaValue* v) {
 
 static void callTM (LuaThread *L, const LuaValue *f, const LuaValue *p1,
                     const LuaValue *p2, LuaValue *p3, int hasres) {
-  THREAD_CHECK(L);
   ptrdiff_t result = L->stack_.indexOf(p3);
   L->stack_.push_nocheck(*f); // push function
   L->stack_.push_nocheck(*p1); // 1st argument
@@ -75,7 +72,6 @@ static void callTM3 (LuaThread *L,
                      LuaValue p1,
                      LuaValue p2,
                      LuaValue& result) {
-  THREAD_CHECK(L);
 
   L->stack_.push_nocheck(f); // push function
   L->stack_.push_nocheck(p1); // 1st argument
@@ -93,7 +89,6 @@ static void callTM1 (LuaThread *L,
                      LuaValue arg1,
                      LuaValue arg2,
                      LuaValue arg3) {
-  THREAD_CHECK(L);
 
   L->stack_.push_nocheck(func);
   L->stack_.push_nocheck(arg1);
@@ -107,7 +102,6 @@ static void callTM1 (LuaThread *L,
 }
 
 LuaResult luaV_gettable2 (LuaThread *L, LuaValue source, LuaValue key, LuaValue& outResult) {
-  THREAD_CHECK(L);
   LuaValue tagmethod;
 
   for (int loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -127,9 +121,9 @@ LuaResult luaV_gettable2 (LuaThread *L, LuaValue source, LuaValue key, LuaValue&
     // (if object is a table) or throws an error (if object is not a table)
 
     if(source.isTable()) {
-      tagmethod = fasttm2(source.getTable()->metatable, TM_INDEX);
+      tagmethod = fasttm2(G(L), source.getTable()->metatable, TM_INDEX);
     } else {
-      tagmethod = luaT_gettmbyobj2(source, TM_INDEX);
+      tagmethod = luaT_gettmbyobj2(G(L), source, TM_INDEX);
     }
 
     if(tagmethod.isNone() || tagmethod.isNil()) {
@@ -165,7 +159,6 @@ LuaResult luaV_gettable2 (LuaThread *L, LuaValue source, LuaValue key, LuaValue&
 // Very dangerous, need to replace.
 
 void luaV_gettable (LuaThread *L, const LuaValue *source, LuaValue *key, StkId outResult) {
-  THREAD_CHECK(L);
 
   int stackIndex = (int)(outResult - L->stack_.begin());
 
@@ -184,7 +177,6 @@ void luaV_gettable (LuaThread *L, const LuaValue *source, LuaValue *key, StkId o
 
 void luaV_settable (LuaThread *L, const LuaValue *t2, LuaValue *key, StkId val) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
   int loop;
   LuaValue cursor = *t2;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -218,7 +210,7 @@ void luaV_settable (LuaThread *L, const LuaValue *t2, LuaValue *key, StkId val)
       }
 
       /* previous value is nil; must check the metamethod */
-      LuaValue tagmethod = fasttm2(h->metatable, TM_NEWINDEX);
+      LuaValue tagmethod = fasttm2(G(L), h->metatable, TM_NEWINDEX);
       if (tagmethod.isNil() || tagmethod.isNone()) {
         // no metamethod, add (key,val) to table
         if(key->isNil()) {
@@ -255,7 +247,7 @@ void luaV_settable (LuaThread *L, const LuaValue *t2, LuaValue *key, StkId val)
     }
     else {
       /* not a table; check metamethod */
-      LuaValue tagmethod = luaT_gettmbyobj2(cursor, TM_NEWINDEX);
+      LuaValue tagmethod = luaT_gettmbyobj2(G(L), cursor, TM_NEWINDEX);
       if (tagmethod.isNone() || tagmethod.isNil()) {
         result = luaG_typeerror(&cursor, "index");
         handleResult(result);
@@ -277,10 +269,9 @@ void luaV_settable (LuaThread *L, const LuaValue *t2, LuaValue *key, StkId val)
 
 static int call_binTM (LuaThread *L, const LuaValue *p1, const LuaValue *p2,
                        StkId res, TMS event) {
-  THREAD_CHECK(L);
-  LuaValue tm = luaT_gettmbyobj2(*p1, event);  /* try first operand */
+  LuaValue tm = luaT_gettmbyobj2(G(L), *p1, event);  /* try first operand */
   if (tm.isNone() || tm.isNil())
-    tm = luaT_gettmbyobj2(*p2, event);  /* try second operand */
+    tm = luaT_gettmbyobj2(G(L), *p2, event);  /* try second operand */
   if (tm.isNone() || tm.isNil()) return 0;
   callTM(L, &tm, p1, p2, res, 1);
   return 1;
@@ -289,11 +280,10 @@ static int call_binTM (LuaThread *L, const LuaValue *p1, const LuaValue *p2,
 
 LuaValue get_equalTM (LuaThread *L, LuaTable *mt1, LuaTable *mt2,
                                   TMS event) {
-  THREAD_CHECK(L);
-  LuaValue tm1 = fasttm2(mt1, event);
+  LuaValue tm1 = fasttm2(G(L), mt1, event);
   if (tm1.isNone() || tm1.isNil()) return LuaValue::None();  /* no metamethod */
   if (mt1 == mt2) return tm1;  /* same metatables => same metamethods */
-  LuaValue tm2 = fasttm2(mt2, event);
+  LuaValue tm2 = fasttm2(G(L), mt2, event);
   if (tm2.isNone() || tm2.isNil()) return LuaValue::None();  /* no metamethod */
   if (tm1 == tm2)  /* same metamethods? */
     return tm1;
@@ -303,7 +293,6 @@ LuaValue get_equalTM (LuaThread *L, LuaTable *mt1, LuaTable *mt2,
 
 static int call_orderTM (LuaThread *L, const LuaValue *p1, const LuaValue *p2,
                          TMS event) {
-  THREAD_CHECK(L);
   if (!call_binTM(L, p1, p2, L->stack_.top_, event))
     return -1;  /* no metamethod */
   else
@@ -334,10 +323,9 @@ static int l_strcmp (const LuaString *ls, const LuaString *rs) {
 
 
 int luaV_lessthan (LuaThread *L, const LuaValue *l, const LuaValue *r) {
-  THREAD_CHECK(L);
 
   if (l->isNumber() && r->isNumber()) {
-    return l->getNumber() < r->getNumber();
+    return luaO_numlt(*l, *r);
   }
 
   if (l->isString() && r->isString()) {
@@ -354,10 +342,9 @@ int luaV_lessthan (LuaThread *L, const LuaValue *l, const LuaValue *r) {
 
 
 int luaV_lessequal (LuaThread *L, const LuaValue *l, const LuaValue *r) {
-  THREAD_CHECK(L);
 
   if (l->isNumber() && r->isNumber()) {
-    return l->getNumber() <= r->getNumber();
+    return luaO_numle(*l, *r);
   }
 
   if (l->isString() && r->isString()) {
@@ -380,20 +367,19 @@ int luaV_lessequal (LuaThread *L, const LuaValue *l, const LuaValue *r) {
 ** equality of Lua values. L == NULL means raw equality (no metamethods)
 */
 int luaV_equalobj_ (LuaThread *L, const LuaValue *t1, const LuaValue *t2) {
-  THREAD_CHECK(L);
   if(t1->type() != t2->type()) {
     return 0;
   }
 
   if(t1->isNumber()) {
-    return t1->getNumber() == t2->getNumber();
+    return luaO_numeq(*t1, *t2);
   }
 
-  if(t1->getRawBytes() == t2->getRawBytes()) {
+  if(*t1 == *t2) {
     return 1;
   }
 
-  // Types match, raw bytes don't match. If the objects are tables or
+  // Types match, values aren't the same. If the objects are tables or
   // userdata, try the tag methods.
 
   if(L == NULL) {
@@ -427,7 +413,6 @@ int luaV_equalobj_ (LuaThread *L, const LuaValue *t1, const LuaValue *t2) {
 
 void luaV_concat (LuaThread *L, int total) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
   assert(total >= 2);
   do {
     StkId top = L->stack_.top_;
@@ -443,7 +428,7 @@ void luaV_concat (LuaThread *L, int total) {
     }
 
     int tostring_result = 0;
-    tostring_result = luaV_tostring(top-1);
+    tostring_result = luaV_tostring(L, top-1);
 
     if (!tostring_result) {
       if (!call_binTM(L, top-2, top-1, top-2, TM_CONCAT)) {
@@ -455,7 +440,7 @@ void luaV_concat (LuaThread *L, int total) {
     }
 
     if (top[-1].getString()->getLen() == 0) { /* second operand is empty? */
-      luaV_tostring(top-2);
+      luaV_tostring(L, top-2);
       total -= n-1;  /* got 'n' strings to create 1 new */
       L->stack_.top_ -= n-1;  /* popped 'n' strings and pushed one */
       continue;
@@ -474,7 +459,7 @@ void luaV_concat (LuaThread *L, int total) {
     /* collect total length */
     for (i = 1; i < total; i++) {
       {
-        LuaValue temp = top[-i-1].convertToString();
+        LuaValue temp = top[-i-1].convertToString(G(L));
         if(temp.isNone()) break;
         top[-i-1] = temp;
       }
@@ -495,7 +480,7 @@ void luaV_concat (LuaThread *L, int total) {
       tl += l;
     } while (--i > 0);
 
-    top[-n] = thread_G->strings_->Create(&G(L)->buff[0], tl);
+    top[-n] = G(L)->strings_->Create(&G(L)->buff[0], tl);
 
     total -= n-1;  /* got 'n' strings to create 1 new */
     L->stack_.top_ -= n-1;  /* popped 'n' strings and pushed one */
@@ -505,14 +490,13 @@ void luaV_concat (LuaThread *L, int total) {
 
 void luaV_objlen (LuaThread *L, StkId ra, const LuaValue *rb) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
 
   if(rb->isString()) {
     ra[0] = rb->getString()->getLen();
     return;
   }
 
-  LuaValue tagmethod = luaT_gettmbyobj2(*rb, TM_LEN);
+  LuaValue tagmethod = luaT_gettmbyobj2(G(L), *rb, TM_LEN);
   if (!tagmethod.isNone()) {
     callTM(L, &tagmethod, rb, rb, ra, 1);
     return;
@@ -531,7 +515,6 @@ void luaV_objlen (LuaThread *L, StkId ra, const LuaValue *rb) {
 
 void luaV_arith (LuaThread *L, StkId ra, const LuaValue *rb, const LuaValue *rc, TMS op) {
   LuaResult result = LUA_OK;
-  THREAD_CHECK(L);
 
   LuaValue nb = rb->convertToNumber();
 
@@ -554,8 +537,23 @@ void luaV_arith (LuaThread *L, StkId ra, const LuaValue *rb, const LuaValue *rc,
   }
 
   int arithop = op - TM_ADD + LUA_OPADD;
-  double res = luaO_arith(arithop, nb.getNumber(), nc.getNumber());
-  *ra = res;
+  *ra = luaO_arith(arithop, nb, nc);
+}
+
+
+/*
+** Converts a numeric for-loop limit to an integer. Float limits are clipped
+** towards the loop's direction (floor for ascending loops, ceil for
+** descending ones); fails if the result doesn't fit in an integer.
+*/
+static int forlimit (LuaValue limit, int64_t step, int64_t *result) {
+  if (limit.isInteger()) {
+    *result = limit.getInteger();
+    return 1;
+  }
+  double f = limit.getNumber();
+  f = (step < 0) ? ceil(f) : floor(f);
+  return luaO_flt2int(f, result);
 }
 
 
@@ -591,15 +589,15 @@ static void pushclosure (LuaThread *L,
                          LuaUpvalue **encup,
                          StkId base,
                          StkId ra) {
-  THREAD_CHECK(L);
 
-  LuaClosure *ncl = new LuaClosure(p, (int)p->upvalues.size());
+  LuaVM* g = G(L);
+  LuaClosure *ncl = new (g) LuaClosure(g, p, (int)p->upvalues.size());
 
   *ra = LuaValue(ncl);  /* anchor new closure in stack */
   for (int i = 0; i < (int)p->upvalues.size(); i++) {  /* fill in its upvalues */
     if (p->upvalues[i].instack) {
       /* upvalue refers to local variable? */
-      ncl->ppupvals_[i] = thread_L->stack_.createUpvalFor(base + p->upvalues[i].idx);
+      ncl->ppupvals_[i] = L->stack_.createUpvalFor(g, base + p->upvalues[i].idx);
     }
     else {
       /* get upvalue from enclosing function */
@@ -616,7 +614,6 @@ static void pushclosure (LuaThread *L,
 ** finish execution of an opcode interrupted by an yield
 */
 void luaV_finishOp (LuaThread *L) {
-  THREAD_CHECK(L);
   LuaStackFrame *ci = L->stack_.callinfo_;
   StkId base = ci->getBase();
 
@@ -625,16 +622,17 @@ void luaV_finishOp (LuaThread *L) {
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
     case OP_MOD: case OP_POW: case OP_UNM: case OP_LEN:
-    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF: {
+    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF:
+    case OP_GETUPFIELD: case OP_GETFIELD: case OP_ADDK: case OP_SUBK: {
       base[GETARG_A(inst)] = L->stack_.pop();
       break;
     }
-    case OP_LE: case OP_LT: case OP_EQ: {
+    case OP_LE: case OP_LT: case OP_EQ: case OP_EQK: {
       int res = L->stack_.pop().isTrue();
       /* metamethod should not be called when operand is K */
       assert(!ISK(GETARG_B(inst)));
       /* "<=" using "<" instead? */
-      LuaValue tm = luaT_gettmbyobj2(base[GETARG_B(inst)], TM_LE);
+      LuaValue tm = luaT_gettmbyobj2(G(L), base[GETARG_B(inst)], TM_LE);
       if (op == OP_LE && (tm.isNone() || tm.isNil())) {
         res = !res;  /* invert result */
       }
@@ -670,6 +668,7 @@ void luaV_finishOp (LuaThread *L) {
       break;
     }
     case OP_TAILCALL: case OP_SETTABUP:  case OP_SETTABLE:
+    case OP_SETUPFIELD: case OP_SETFIELD:
       break;
     default: assert(0);
   }
@@ -688,387 +687,691 @@ void luaV_finishOp (LuaThread *L) {
 #define RKB(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
 #define RKC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgK, ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
 
+#define KB(i)	check_exp(ISK(GETARG_B(i)), k+INDEXK(GETARG_B(i)))
+#define KC(i)	check_exp(ISK(GETARG_C(i)), k+INDEXK(GETARG_C(i)))
+
+// 'pc' always points at the instruction _after_ the one being executed, which
+// is what the stack frame expects to see in 'savedpc' plus one.
+#define savepc()      ci->setCurrentPC(cast_int(pc - code) - 1)
+#define updatebase()  (base = ci->getBase())
+
+// Anything that can throw, call out to a function or metamethod, or run the
+// collector has to go through Protect - the callee may read the saved pc or
+// reallocate the stack out from under 'base'.
+#define Protect(x)    { savepc(); x; updatebase(); }
+
+// Hands over to the interpreter instance for the current hook mask if it
+// isn't this one, see VMPlain. Only used between instructions, with 'pc'
+// pointing at the next one to run.
+#define safepoint() \
+  if (vmPolicyFor(L->hookmask) != Policy::kId) { savepc(); return RR_SWITCH; }
+
+// Inline cache for the instruction being executed, see cachedGet.
+#define HINT()        (hints[pc - code - 1])
+
+// Tests are always followed by a JMP. When the test says to take it, it's
+// done right away instead of dispatching to OP_JMP.
+#define donextjump() { \
+  Instruction ji = *pc; \
+  int ja = GETARG_A(ji); \
+  int offset = GETARG_sBx(ji); \
+  assert(GET_OPCODE(ji) == OP_JMP); \
+  if (ja > 0) L->stack_.closeUpvals(G(L), base + ja - 1); \
+  pc += offset + 1; \
+  if (offset < 0) { checkGC(); safepoint(); } \
+}
+
+// Rewrites the instruction being executed into another form of the same
+// operation, see "quickening" in lopcodes.h. Protos belong to a single VM,
+// so their code can be patched in place.
+#define quicken(o)    SET_OPCODE(*const_cast<Instruction*>(pc - 1), o)
+
+// Collector steps and the memory limit are only checked at allocation sites
+// and on backward branches instead of before every instruction.
+#define checkGC() \
+  if ((G(L)->getGCDebt() > 0) || (l_memcontrol.mem_total > l_memcontrol.mem_limit)) { \
+    Protect( if (G(L)->getGCDebt() > 0) luaC_step(); l_memcontrol.checkLimit(G(L)); ) \
+  }
+
+//-----------------------------------------------------------------------------
+// Dispatch. Where the compiler lets us take the address of a label (GCC and
+// Clang) every handler ends with its own indirect jump to the next handler,
+// which predicts much better than funnelling every opcode through one switch.
+// Everything else (MSVC) gets the plain switch.
+
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE 1
+#else
+#define LUA_USE_JUMPTABLE 0
+#endif
+
+#define vmfetch() { \
+  i = *(pc++); \
+  if (Policy::kTrace) { \
+    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) { savepc(); traceexec(L); updatebase(); } \
+  } else if (Policy::kCount) { \
+    if (--L->hookcount == 0) { savepc(); counthook(L); updatebase(); } \
+  } \
+}
+
+#if LUA_USE_JUMPTABLE
+#define vmdispatch(o)  goto *disptab[o];
+#define vmcase(l)      L_##l:
+#define vmbreak        vmfetch(); vmdispatch(GET_OPCODE(i));
+#else
+#define vmdispatch(o)  switch(o)
+#define vmcase(l)      case l:
+#define vmbreak        break
+#endif
+
+//-----------------------------------------------------------------------------
+// Inline caches. Table accesses with a constant string key - globals, fields,
+// method lookups - remember which hash slot the key was found in, so the
+// next execution can check that slot directly instead of probing. The hint
+// is checked against the key itself, so it can't go stale: a rehash or a
+// different table with another layout just costs one normal lookup.
+//
+// Only raw hits with a non-nil value are handled here. Anything that might
+// involve a metamethod or a new key returns false and goes the slow way.
+
+static inline bool cachedGet(const LuaValue* t, const LuaValue* key, int& hint, StkId ra) {
+  if(!t->isTable()) return false;
+  const LuaValue* v = t->getTable()->findHinted(*key, hint);
+  if((v == NULL) || v->isNil()) return false;
+  *ra = *v;
+  return true;
+}
+
+static inline bool cachedSet(const LuaValue* t, const LuaValue* key, int& hint, const LuaValue* val) {
+  if(!t->isTable() || val->isNil()) return false;
+  LuaTable* h = t->getTable();
+  if(h->isMetaWatched()) return false;
+  LuaValue* v = h->findHinted(*key, hint);
+  if((v == NULL) || v->isNil()) return false;
+  *v = *val;
+  luaC_barrierback(h, *val);
+  return true;
+}
+
+// Method lookups for OP_SELF. When the receiver doesn't have the key itself
+// and its metatable's __index chain is made of plain tables, the method the
+// chain resolved to is remembered per call site along with the receiver's
+// metatable. The entry stays valid until a table on the chain changes, which
+// bumps the VM-wide metaEpoch_ - see LuaTable::metaChanged.
+
+// Walks the __index chain starting at metatable 'mt', watching every table
+// it looks at. Fails if the chain runs into anything but a table.
+static bool resolveMethod(LuaVM* g, LuaTable* mt, const LuaValue& key, LuaValue& outMethod) {
+  for (int loop = 0; loop < MAXTAGLOOP; loop++) {
+    mt->setMetaWatched();
+    LuaValue tm = fasttm2(g, mt, TM_INDEX);
+    if(!tm.isTable()) return false;
+
+    LuaTable* h = tm.getTable();
+    h->setMetaWatched();
+    LuaValue v = h->get(key);
+    if(!v.isNone() && !v.isNil()) {
+      outMethod = v;
+      return true;
+    }
+
+    mt = h->metatable;
+    if(mt == NULL) return false;
+  }
+  return false;
+}
+
+static inline bool cachedMethod(LuaThread* L, const LuaValue* t, const LuaValue* key, LuaMethodCache& c, StkId ra) {
+  if(!key->isString()) return false;
+
+  LuaTable* mt;
+  if(t->isTable()) {
+    LuaTable* h = t->getTable();
+    const LuaValue* v = h->findHinted(*key, c.hint);
+    if(v && !v->isNil()) {
+      *ra = *v;
+      return true;
+    }
+    mt = h->metatable;
+  } else if(t->isString()) {
+    mt = G(L)->base_metatables_[LUA_TSTRING];
+  } else {
+    return false;
+  }
+  if(mt == NULL) return false;
+
+  if((mt == c.metatable) && (c.epoch == G(L)->metaEpoch_)) {
+    *ra = c.method;
+    return true;
+  }
+
+  LuaValue method;
+  if(!resolveMethod(G(L), mt, *key, method)) return false;
+  c.metatable = mt;
+  c.epoch = G(L)->metaEpoch_;
+  c.method = method;
+  *ra = method;
+  return true;
+}
+
 enum RunResult {
   RR_DONE,
-  RR_CALL,
   RR_TAILCALL,
   RR_RETURN,
+  RR_SWITCH,    // the hook mask changed, resume in another instance
 };
 
-RunResult luaV_run2 (LuaThread *L) {
-  LuaResult result = LUA_OK;
+//-----------------------------------------------------------------------------
+// Interpreter instances. The dispatch loop is compiled once per policy, so a
+// script running without hooks - the usual case - never tests for them on
+// each instruction, call or return. An instance checks whether it's still
+// the right one only at safe points: entering or resuming a frame, after
+// calling out to C, and on backward branches. debug.sethook is a call, so
+// its hooks take effect from the next instruction; a hook installed from a
+// metamethod or a signal handler takes effect at the next safe point.
+
+enum VMPolicyId {
+  VM_PLAIN,
+  VM_COUNT,
+  VM_TRACE,
+};
 
-  THREAD_CHECK(L);
-  
-  /* main loop of interpreter */
-  for (int cycle = 0;; cycle++) {
-    
-    LuaStackFrame *ci = L->stack_.callinfo_;
+// No hooks at all.
+struct VMPlain {
+  static const int kId = VM_PLAIN;
+  static const bool kHooks = false;
+  static const bool kCount = false;
+  static const bool kTrace = false;
+};
 
-    if(thread_G->getGCDebt() > 0) {
-      luaC_step();
-    }
+// Only a count hook, i.e. an instruction budget.
+struct VMCount {
+  static const int kId = VM_COUNT;
+  static const bool kHooks = true;
+  static const bool kCount = true;
+  static const bool kTrace = false;
+};
 
-    l_memcontrol.checkLimit();
+// Line hooks, or call and return hooks with or without a count hook.
+struct VMTrace {
+  static const int kId = VM_TRACE;
+  static const bool kHooks = true;
+  static const bool kCount = false;
+  static const bool kTrace = true;
+};
 
-    Instruction i = ci->beginInstruction();
-    OpCode opcode = (OpCode)(i & 0x0000003F);
+static inline int vmPolicyFor(int hookmask) {
+  if (hookmask == 0) return VM_PLAIN;
+  if (hookmask == LUA_MASKCOUNT) return VM_COUNT;
+  return VM_TRACE;
+}
 
-    uint32_t A  = (i >>  6) & 0x000000FF;
-    uint32_t B  = (i >> 23) & 0x000001FF;
-    uint32_t Bk = (i >> 23) & 0x000000FF;
-    uint32_t C  = (i >> 14) & 0x000001FF;
-    uint32_t Ck = (i >> 14) & 0x000000FF;
-    //uint32_t Ax = (i >>  6) & 0x03FFFFFF;
-    uint32_t Bx = (i >> 14) & 0x0003FFFF;
-    //int32_t Bs = (int32_t)Bx - 0x1FFFF;
+// Runs the count and line hooks for the instruction at the frame's saved pc.
+// Only called when one of those hooks is installed.
+static void traceexec (LuaThread *L) {
+  LuaStackFrame *ci = L->stack_.callinfo_;
+  int mask = L->hookmask;
 
-    // Various hook and debug calls expect that the program counter is incremented _before_
-    // the instruction is executed. This is annoying.
+  L->hookcount--;
 
-    int mask = L->hookmask;
-    if (mask & (LUA_MASKLINE | LUA_MASKCOUNT)) {
-      L->hookcount--;
+  if ((mask & LUA_MASKCOUNT) && L->hookcount == 0) {
+    L->hookcount = L->basehookcount;
+    luaD_hook(L, LUA_HOOKCOUNT, -1);
+  }
 
-      if ((mask & LUA_MASKCOUNT) && L->hookcount == 0) {
-        L->hookcount = L->basehookcount;
-        luaD_hook(L, LUA_HOOKCOUNT, -1);
-      }
+  LuaProto *p = ci->getFunc()->getLClosure()->proto_;
+  int npc = ci->getCurrentPC();
+  int newline = ci->getCurrentLine();
 
-      LuaProto *p = ci->getFunc()->getLClosure()->proto_;
-      int npc = ci->getCurrentPC();
-      int newline = ci->getCurrentLine();
+  if (mask & LUA_MASKLINE) {
+    if (npc == 0 ||  /* call linehook when enter a new function, */
+        npc <= L->oldpc ||  /* when jump back (loop), or when */
+        newline != p->getLine(L->oldpc))  /* enter a new line */
+      luaD_hook(L, LUA_HOOKLINE, newline);
+  }
 
-      if (mask & LUA_MASKLINE) {
-        if (npc == 0 ||  /* call linehook when enter a new function, */
-            ci->getCurrentPC() <= L->oldpc ||  /* when jump back (loop), or when */
-            newline != p->getLine(L->oldpc))  /* enter a new line */
-          luaD_hook(L, LUA_HOOKLINE, newline);
-      }
+  L->oldpc = ci->getCurrentPC();
+
+  if (L->status == LUA_YIELD) {  /* did hook yield? */
+    /* undo increment (resume will increment it again) */
+    ci->undoInstruction();
+    throwError(LUA_YIELD);
+  }
+}
 
-      L->oldpc = ci->getCurrentPC();
+// Runs the count hook when the budget set with lua_sethook is used up.
+static void counthook (LuaThread *L) {
+  if (!(L->hookmask & LUA_MASKCOUNT)) return;
+  L->hookcount = L->basehookcount;
+  luaD_hook(L, LUA_HOOKCOUNT, -1);
+
+  if (L->status == LUA_YIELD) {  /* did hook yield? */
+    /* undo increment (resume will increment it again) */
+    L->stack_.callinfo_->undoInstruction();
+    throwError(LUA_YIELD);
+  }
+}
+
+template<class Policy>
+static RunResult luaV_run2 (LuaThread *L) {
+  LuaResult result = LUA_OK;
 
-      if (L->status == LUA_YIELD) {  /* did hook yield? */
-        /* undo increment (resume will increment it again) */
-        ci->undoInstruction();
-        throwError(LUA_YIELD);
-      }
-    }
 
-    //assert(base <= L->stack_.top_ && L->stack_.top_ < L->stack_.end());
-    LuaValue* base = ci->getBase();
-    StkId ra = &base[A];
-    LuaClosure* cl = ci->getFunc()->getClosure();
-    LuaValue* k = ci->getConstants();
+#if LUA_USE_JUMPTABLE
+  // Must match the order of the OpCode enum in lopcodes.h.
+  static const void* const disptab[NUM_OPCODES] = {
+    &&L_OP_MOVE,
+    &&L_OP_LOADK,
+    &&L_OP_LOADKX,
+    &&L_OP_LOADBOOL,
+    &&L_OP_LOADNIL,
+    &&L_OP_GETUPVAL,
+    &&L_OP_GETTABUP,
+    &&L_OP_GETTABLE,
+    &&L_OP_SETTABUP,
+    &&L_OP_SETUPVAL,
+    &&L_OP_SETTABLE,
+    &&L_OP_NEWTABLE,
+    &&L_OP_SELF,
+    &&L_OP_ADD,
+    &&L_OP_SUB,
+    &&L_OP_MUL,
+    &&L_OP_DIV,
+    &&L_OP_MOD,
+    &&L_OP_POW,
+    &&L_OP_UNM,
+    &&L_OP_NOT,
+    &&L_OP_LEN,
+    &&L_OP_CONCAT,
+    &&L_OP_JMP,
+    &&L_OP_EQ,
+    &&L_OP_LT,
+    &&L_OP_LE,
+    &&L_OP_TEST,
+    &&L_OP_TESTSET,
+    &&L_OP_CALL,
+    &&L_OP_TAILCALL,
+    &&L_OP_RETURN,
+    &&L_OP_FORLOOP,
+    &&L_OP_FORPREP,
+    &&L_OP_TFORCALL,
+    &&L_OP_TFORLOOP,
+    &&L_OP_SETLIST,
+    &&L_OP_CLOSURE,
+    &&L_OP_VARARG,
+    &&L_OP_GETFIELD,
+    &&L_OP_SETFIELD,
+    &&L_OP_GETUPFIELD,
+    &&L_OP_SETUPFIELD,
+    &&L_OP_ADDK,
+    &&L_OP_SUBK,
+    &&L_OP_EQK,
+    &&L_OP_ADD_NN,
+    &&L_OP_SUB_NN,
+    &&L_OP_MUL_NN,
+    &&L_OP_LT_NN,
+    &&L_OP_LE_NN,
+    &&L_OP_GETTABLE_AI,
+    &&L_OP_SETTABLE_AI,
+    &&L_OP_EXTRAARG,
+  };
+#endif
+
+  LuaStackFrame* ci;
+  LuaClosure* cl;
+  LuaValue* k;
+  LuaValue* base;
+  const Instruction* code;
+  const Instruction* pc;
+  int* hints;
+  Instruction i;
+
+  // (Re)entry point for a new frame - everything cached in locals above comes
+  // from the current stack frame.
+newframe:
+  ci = L->stack_.callinfo_;
+  cl = ci->getFunc()->getClosure();
+  k = ci->getConstants();
+  base = ci->getBase();
+  code = ci->getCode();
+  hints = cl->proto_->tableHints_.begin();
+  pc = code + ci->getCurrentPC() + 1;
+  safepoint();
+
+  // Entering a fresh frame grew the stack, so treat it as an allocation site.
+  if (pc == code) {
+    checkGC();
+  }
 
-    switch(opcode) {
-      case OP_MOVE:
+  /* main loop of interpreter */
+  for (;;) {
+
+    vmfetch();
+
+    vmdispatch(GET_OPCODE(i)) {
+      vmcase(OP_MOVE)
         {
-          base[A] = base[B];
-          break;
+          base[GETARG_A(i)] = base[GETARG_B(i)];
+          vmbreak;
         }
 
-      case OP_LOADK:
+      vmcase(OP_LOADK)
         {
-          base[A] = k[Bx];
-          break;
+          base[GETARG_A(i)] = k[GETARG_Bx(i)];
+          vmbreak;
         }
 
-      case OP_LOADKX:
+      vmcase(OP_LOADKX)
         {
-          assert(ci->getNextOp() == OP_EXTRAARG);
-          base[A] = k[GETARG_Ax(ci->getNextInstruction())];
-          ci->Jump(1);
-          break;
+          assert(GET_OPCODE(*pc) == OP_EXTRAARG);
+          base[GETARG_A(i)] = k[GETARG_Ax(*pc)];
+          pc++;
+          vmbreak;
         }
 
-      case OP_LOADBOOL:
+      vmcase(OP_LOADBOOL)
         {
-          base[A] = B ? true : false;
-          if (C) ci->Jump(1);  /* skip next instruction (if C) */
-          break;
+          base[GETARG_A(i)] = GETARG_B(i) ? true : false;
+          if (GETARG_C(i)) pc++;  /* skip next instruction (if C) */
+          vmbreak;
         }
 
-      case OP_LOADNIL: 
+      vmcase(OP_LOADNIL)
         {
-          for(uint32_t b = 0; b <= B; b++) {
-            base[A+b] = LuaValue::Nil();
+          StkId ra = RA(i);
+          for(int b = GETARG_B(i); b >= 0; b--) {
+            *ra++ = LuaValue::Nil();
           }
-          break;
+          vmbreak;
         }
 
-      case OP_GETUPVAL: 
+      vmcase(OP_GETUPVAL)
         {
-          base[A] = *cl->ppupvals_[B]->v;
-          break;
+          base[GETARG_A(i)] = *cl->ppupvals_[GETARG_B(i)]->v;
+          vmbreak;
         }
 
-      case OP_GETTABUP:
+      vmcase(OP_GETTABUP)
         {
-          luaV_gettable(L, cl->ppupvals_[B]->v, RKC(i), &base[A]); 
-          break;
+          Protect(luaV_gettable(L, cl->ppupvals_[GETARG_B(i)]->v, RKC(i), RA(i)));
+          vmbreak;
         }
 
-      case OP_GETTABLE:
+      vmcase(OP_GETTABLE)
         {
-          luaV_gettable(L, &base[B], RKC(i), &base[A]);
-          break;
+          if (RB(i)->isTable() && RKC(i)->isInteger()) quicken(OP_GETTABLE_AI);
+          Protect(luaV_gettable(L, RB(i), RKC(i), RA(i)));
+          vmbreak;
         }
 
-      case OP_SETTABUP: 
+      vmcase(OP_SETTABUP)
         {
-          int a = GETARG_A(i);
-          luaV_settable(L, cl->ppupvals_[a]->v, RKB(i), RKC(i));
-          break;
+          Protect(luaV_settable(L, cl->ppupvals_[GETARG_A(i)]->v, RKB(i), RKC(i)));
+          vmbreak;
         }
 
-      case OP_SETUPVAL:
+      vmcase(OP_SETUPVAL)
         {
           LuaUpvalue *uv = cl->ppupvals_[GETARG_B(i)];
-          *uv->v = base[A];
-          luaC_barrier(uv, base[A]);
-          break;
+          StkId ra = RA(i);
+          *uv->v = *ra;
+          luaC_barrier(uv, *ra);
+          vmbreak;
         }
 
-      case OP_SETTABLE:
+      vmcase(OP_SETTABLE)
         {
-          luaV_settable(L, &base[A], RKB(i), RKC(i));
-          break;
+          if (RA(i)->isTable() && RKB(i)->isInteger()) quicken(OP_SETTABLE_AI);
+          Protect(luaV_settable(L, RA(i), RKB(i), RKC(i)));
+          vmbreak;
         }
 
-      case OP_NEWTABLE:
+      vmcase(OP_NEWTABLE)
         {
           int b = luaO_fb2int( GETARG_B(i) );
           int c = luaO_fb2int( GETARG_C(i) );
 
-          LuaTable* t = new LuaTable(b, c);
-          base[A] = t;
+          LuaTable* t = new (G(L)) LuaTable(G(L), b, c);
+          base[GETARG_A(i)] = t;
 
-          break;
+          checkGC();
+          vmbreak;
         }
 
-      case OP_SELF:
+      vmcase(OP_SELF)
         {
-          base[A+1] = base[B];
-          luaV_gettable(L,
-                        &base[B],
-                        (C & 256) ? &k[Ck] : &base[Ck],
-                        &base[A]);
-          break;
+          StkId ra = RA(i);
+          StkId rb = RB(i);
+          LuaValue* rc = RKC(i);
+          ra[1] = *rb;
+          if(ISK(GETARG_C(i)) && cachedMethod(L, rb, rc, cl->proto_->methodCaches_[HINT()], ra)) { vmbreak; }
+          Protect(luaV_gettable(L, rb, rc, ra));
+          vmbreak;
         }
 
-      case OP_ADD:
+      vmcase(OP_ADD)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-          if (rb->isNumber() && rc->isNumber()) {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int64_t ires;
+          if (rb->isInteger() && rc->isInteger() &&
+              luaO_addInt(rb->getInteger(), rc->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+            quicken(OP_ADD_NN);
+          } else if (rb->isNumber() && rc->isNumber()) {
             double nb = rb->getNumber();
             double nc = rc->getNumber();
-            base[A] = nb + nc;
+            base[GETARG_A(i)] = nb + nc;
+            quicken(OP_ADD_NN);
           } else {
-            luaV_arith(L,
-                       &base[A],
-                       rb,
-                       rc,
-                       TM_ADD);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_ADD));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_SUB:
+      vmcase(OP_SUB)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-          if (rb->isNumber() && rc->isNumber()) {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int64_t ires;
+          if (rb->isInteger() && rc->isInteger() &&
+              luaO_subInt(rb->getInteger(), rc->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+            quicken(OP_SUB_NN);
+          } else if (rb->isNumber() && rc->isNumber()) {
             double nb = rb->getNumber();
             double nc = rc->getNumber();
-            base[A] = nb - nc;
+            base[GETARG_A(i)] = nb - nc;
+            quicken(OP_SUB_NN);
           } else {
-            luaV_arith(L,
-                       &base[A],
-                       rb,
-                       rc,
-                       TM_SUB);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_SUB));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_MUL:
+      vmcase(OP_MUL)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-          if (rb->isNumber() && rc->isNumber()) {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int64_t ires;
+          if (rb->isInteger() && rc->isInteger() &&
+              luaO_mulInt(rb->getInteger(), rc->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+            quicken(OP_MUL_NN);
+          } else if (rb->isNumber() && rc->isNumber()) {
             double nb = rb->getNumber();
             double nc = rc->getNumber();
-            base[A] = nb * nc;
+            base[GETARG_A(i)] = nb * nc;
+            quicken(OP_MUL_NN);
           } else {
-            luaV_arith(L,
-                       &base[A],
-                       rb,
-                       rc,
-                       TM_MUL);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_MUL));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_DIV:
+      vmcase(OP_DIV)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
           if (rb->isNumber() && rc->isNumber()) {
             double nb = rb->getNumber();
             double nc = rc->getNumber();
-            base[A] = nb / nc;
+            base[GETARG_A(i)] = nb / nc;
           } else {
-            luaV_arith(L,
-                       &base[A],
-                       rb,
-                       rc,
-                       TM_DIV);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_DIV));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_MOD:
+      vmcase(OP_MOD)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-          if (rb->isNumber() && rc->isNumber()) {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int64_t ires;
+          if (rb->isInteger() && rc->isInteger() &&
+              luaO_modInt(rb->getInteger(), rc->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+          } else if (rb->isNumber() && rc->isNumber()) {
             double nb = rb->getNumber();
             double nc = rc->getNumber();
-            base[A] = ((nb) - floor((nb)/(nc))*(nc));
+            base[GETARG_A(i)] = ((nb) - floor((nb)/(nc))*(nc));
           } else {
-            luaV_arith(L,
-                       &base[A],
-                       rb,
-                       rc,
-                       TM_MOD);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_MOD));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_POW:
+      vmcase(OP_POW)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
           if (rb->isNumber() && rc->isNumber()) {
             double nb = rb->getNumber();
             double nc = rc->getNumber();
-            base[A] = pow(nb,nc);
+            base[GETARG_A(i)] = pow(nb,nc);
           } else {
-            luaV_arith(L,
-                       &base[A],
-                       rb,
-                       rc,
-                       TM_POW);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_POW));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_UNM:
+      vmcase(OP_UNM)
         {
-          if (base[B].isNumber()) {
-            double nb = base[B].getNumber();
-            base[A] = -nb;
+          StkId rb = RB(i);
+          int64_t ires;
+          if (rb->isInteger() && luaO_unmInt(rb->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+          }
+          else if (rb->isNumber()) {
+            double nb = rb->getNumber();
+            base[GETARG_A(i)] = -nb;
           }
           else {
-            luaV_arith(L,
-                       &base[A],
-                       &base[B],
-                       &base[B],
-                       TM_UNM);
+            Protect(luaV_arith(L, RA(i), rb, rb, TM_UNM));
           }
-          break;
+          vmbreak;
         }
 
-      case OP_NOT:
+      vmcase(OP_NOT)
         {
-          base[A] = base[B].isFalse();
-          break;
+          base[GETARG_A(i)] = base[GETARG_B(i)].isFalse();
+          vmbreak;
         }
 
-      case OP_LEN:
+      vmcase(OP_LEN)
         {
-          luaV_objlen(L, &base[A], &base[B]);
-          break;
+          Protect(luaV_objlen(L, RA(i), RB(i)));
+          vmbreak;
         }
 
-      case OP_CONCAT:
+      vmcase(OP_CONCAT)
         {
-          L->stack_.top_ = &base[C + 1];  /* mark the end of concat operands */
-          luaV_concat(L, C - B + 1);
-
-          // concat may realloc the stack
-          base = ci->getBase();
-          base[A] = base[B];
+          int b = GETARG_B(i);
+          int c = GETARG_C(i);
+          L->stack_.top_ = base + c + 1;  /* mark the end of concat operands */
+          Protect(luaV_concat(L, c - b + 1));
 
+          base[GETARG_A(i)] = base[b];
           L->stack_.top_ = ci->getTop();  /* restore top */
-          break;
+
+          checkGC();
+          vmbreak;
         }
 
-      case OP_JMP:
+      vmcase(OP_JMP)
         {
-          if (A > 0) {
-            L->stack_.closeUpvals(&base[A-1]);
+          int a = GETARG_A(i);
+          int offset = GETARG_sBx(i);
+          if (a > 0) {
+            L->stack_.closeUpvals(G(L), base + a - 1);
+          }
+          pc += offset;
+          if (offset < 0) {
+            checkGC();
+            safepoint();
           }
-          ci->Jump(GETARG_sBx(i));
-          break;
+          vmbreak;
         }
 
-      case OP_EQ:
+      vmcase(OP_EQ)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-          if (cast_int(luaV_equalobj_(L, rb, rc)) != GETARG_A(i)) {
-            ci->Jump(1);
-          }
-          break;
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int res;
+          Protect(res = luaV_equalobj_(L, rb, rc));
+          if (res != GETARG_A(i)) pc++;
+          else donextjump();
+          vmbreak;
         }
 
-      case OP_LT:
+      vmcase(OP_LT)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-
-          int result = luaV_lessthan(L, rb, rc);
-
-          if (result != (int)A) ci->Jump(1);
-          break;
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int res;
+          if (rb->isNumber() && rc->isNumber()) quicken(OP_LT_NN);
+          Protect(res = luaV_lessthan(L, rb, rc));
+          if (res != GETARG_A(i)) pc++;
+          else donextjump();
+          vmbreak;
         }
 
-      case OP_LE:
+      vmcase(OP_LE)
         {
-          LuaValue* rb = (B & 256) ? &k[Bk] : &base[Bk];
-          LuaValue* rc = (C & 256) ? &k[Ck] : &base[Ck];
-
-          int result = luaV_lessequal(L, rb, rc);
-
-          if (result != (int)A) ci->Jump(1);
-          break;
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int res;
+          if (rb->isNumber() && rc->isNumber()) quicken(OP_LE_NN);
+          Protect(res = luaV_lessequal(L, rb, rc));
+          if (res != GETARG_A(i)) pc++;
+          else donextjump();
+          vmbreak;
         }
 
-      case OP_TEST:
+      vmcase(OP_TEST)
         {
-          bool isfalse = base[A].isFalse();
-
-          if (isfalse == (C ? true : false)) ci->Jump(1);
-          break;
+          bool isfalse = base[GETARG_A(i)].isFalse();
+          if (isfalse == (GETARG_C(i) ? true : false)) pc++;
+          else donextjump();
+          vmbreak;
         }
 
-      case OP_TESTSET:
+      vmcase(OP_TESTSET)
         {
-          bool isfalse = base[B].isFalse();
-
-          if (isfalse == (C ? true : false)) {
-            ci->Jump(1);
+          StkId rb = RB(i);
+          bool isfalse = rb->isFalse();
+          if (isfalse == (GETARG_C(i) ? true : false)) {
+            pc++;
           } else {
-            base[A] = base[B];
+            base[GETARG_A(i)] = *rb;
+            donextjump();
           }
-          break;
+          vmbreak;
         }
 
-      case OP_CALL:
+      vmcase(OP_CALL)
         {
+          StkId ra = RA(i);
           int nargs = GETARG_B(i) - 1;
           int nresults = GETARG_C(i) - 1;
 
@@ -1077,31 +1380,50 @@ RunResult luaV_run2 (LuaThread *L) {
             L->stack_.top_ = ra + nargs + 1;
           }
           else {
-            nargs = (L->stack_.top_ - ra) - 1;
+            nargs = cast_int(L->stack_.top_ - ra) - 1;
           }
 
-          int funcindex = L->stack_.topsize() - nargs - 1;
-          LuaValue func = L->stack_[funcindex];
+          savepc();
+
+          // Calls to Lua functions with fixed parameters, when the stack has
+          // room and nobody hooks calls, get their frame set up right here.
+          if (ra->isLClosure() && (!Policy::kHooks || !(L->hookmask & LUA_MASKCALL))) {
+            LuaProto* p = ra->getLClosure()->proto_;
+            if (!p->is_vararg && (L->stack_.last() - L->stack_.top_) > p->maxstacksize) {
+              for (; nargs < p->numparams; nargs++) {
+                *L->stack_.top_++ = LuaValue::Nil();  /* missing arguments */
+              }
+              LuaStackFrame* nci = ci->next ? ci->next : L->stack_.nextCallinfo();
+              nci->initLua(ra, p, nresults);
+              L->stack_.callinfo_ = nci;
+              L->stack_.top_ = nci->getTop();
+              goto newframe;
+            }
+          }
 
+          int funcindex = L->stack_.topsize() - nargs - 1;
           result = luaD_precall2(L, funcindex, nresults);
           handleResult(result);
 
-          if (func.isCallback() || func.isCClosure()) {  /* C function? */
+          if (!L->stack_.callinfo_->isLua()) {  /* C function? */
             luaV_execute(L, funcindex, nresults);
             if (nresults >= 0) {
               L->stack_.top_ = ci->getTop();  /* adjust results */
             }
+            updatebase();
+            checkGC();
+            safepoint();
           }
           else {  /* Lua function */
-            ci = L->stack_.callinfo_;
-            ci->callstatus |= CIST_REENTRY;
-            return RR_CALL;
+            L->stack_.callinfo_->callstatus |= CIST_REENTRY;
+            goto newframe;
           }
-          break;
+          vmbreak;
         }
 
-      case OP_TAILCALL:
+      vmcase(OP_TAILCALL)
         {
+          StkId ra = RA(i);
           int nargs = GETARG_B(i) - 1;
 
           // If nargs == -1, top is already set, so compute nargs from ra
@@ -1109,17 +1431,17 @@ RunResult luaV_run2 (LuaThread *L) {
             L->stack_.top_ = ra + nargs + 1;
           }
           else {
-            nargs = (L->stack_.top_ - ra) - 1;
+            nargs = cast_int(L->stack_.top_ - ra) - 1;
           }
           assert(GETARG_C(i) - 1 == LUA_MULTRET);
 
           int funcindex = L->stack_.topsize() - nargs - 1;
 
+          savepc();
           result = luaD_precall2(L, funcindex, LUA_MULTRET);
           handleResult(result);
 
-          LuaValue func = L->stack_[funcindex];
-          if (!func.isCallback() && !func.isCClosure()) {
+          if (L->stack_.callinfo_->isLua()) {
             /* tail call: put called frame (n) in place of caller one (o) */
             LuaStackFrame *nci = L->stack_.callinfo_;  /* called frame */
             LuaStackFrame *oci = nci->previous;  /* caller frame */
@@ -1128,7 +1450,7 @@ RunResult luaV_run2 (LuaThread *L) {
             /* last stack slot filled by 'precall' */
             StkId lim = nci->getBase() + nfunc->getLClosure()->proto_->numparams;
             /* close all upvalues from previous call */
-            if (cl->proto_->subprotos_.size() > 0) L->stack_.closeUpvals(oci->getBase());
+            if (cl->proto_->subprotos_.size() > 0) L->stack_.closeUpvals(G(L), oci->getBase());
             /* move new frame into old one */
             for (int aux = 0; nfunc + aux < lim; aux++) {
               ofunc[aux] = nfunc[aux];
@@ -1138,127 +1460,210 @@ RunResult luaV_run2 (LuaThread *L) {
             oci->setTop( L->stack_.top_ );
             oci->resetPC();
             oci->callstatus |= CIST_TAIL;  /* function was tail called */
-            ci = L->stack_.callinfo_ = oci;  /* remove new frame */
+            L->stack_.callinfo_ = oci;  /* remove new frame */
             assert(L->stack_.top_ == oci->getBase() + ofunc->getLClosure()->proto_->maxstacksize);
+            goto newframe;
           }
           else {
             luaV_execute(L, funcindex, LUA_MULTRET);
+            updatebase();
+            checkGC();
+            safepoint();
           }
-          break;
+          vmbreak;
         }
 
-      case OP_RETURN:
+      vmcase(OP_RETURN)
         {
+          StkId ra = RA(i);
           int nresults = GETARG_B(i) - 1;
 
           if(nresults == -1) {
-            nresults = L->stack_.top_ - ra;
+            nresults = cast_int(L->stack_.top_ - ra);
           }
           else {
              L->stack_.top_ = ra + nresults;
           }
 
           if (cl->proto_->subprotos_.size() > 0) {
-            L->stack_.closeUpvals(base);
+            L->stack_.closeUpvals(G(L), base);
+          }
+
+          savepc();
+
+          // Returning to a Lua caller with no return or line hooks to run:
+          // move the results down and resume the caller here.
+          if ((ci->callstatus & CIST_REENTRY) &&
+              (!Policy::kHooks || !(L->hookmask & (LUA_MASKRET | LUA_MASKLINE)))) {
+            StkId res = ci->getFunc();
+            int wanted = (ci->nresults == LUA_MULTRET) ? nresults : ci->nresults;
+            int j = 0;
+            for (; j < wanted && j < nresults; j++) res[j] = ra[j];
+            for (; j < wanted; j++) res[j] = LuaValue::Nil();
+            L->stack_.callinfo_ = ci->previous;
+            L->stack_.top_ = (ci->nresults >= 0) ? ci->previous->getTop() : res + wanted;
+            goto newframe;
           }
 
-          LuaStackFrame* old_frame = L->stack_.callinfo_;
           luaD_postcall(L, ra, nresults);
-          LuaStackFrame* new_frame = L->stack_.callinfo_;
 
-          if (!(old_frame->callstatus & CIST_REENTRY)) {  /* 'ci' still the called one */
+          if (!(ci->callstatus & CIST_REENTRY)) {  /* 'ci' still the called one */
             return RR_DONE;  /* external invocation: return */
           }
-          else {  /* invocation via reentry: continue execution */
-            if (old_frame->nresults >= 0) {
-              L->stack_.top_ = new_frame->getTop();
-            }
-            assert(new_frame->getCurrentOp() == OP_CALL);
+
+          /* invocation via reentry: continue execution */
+          LuaStackFrame* new_frame = L->stack_.callinfo_;
+          if (ci->nresults >= 0) {
+            L->stack_.top_ = new_frame->getTop();
           }
-          break;
+          assert(new_frame->getCurrentOp() == OP_CALL);
+          goto newframe;
         }
 
         // TODO(aappleby): What's the 'external index'?
         // OP_FORLOOP comes at the _end_ of a for block. It updates the loop
         // counter and jump back to the start of the loop if the counter has
         // not passed the limit.
-      case OP_FORLOOP:
+      vmcase(OP_FORLOOP)
         {
-          double index = base[A+0].getNumber();
-          double limit = base[A+1].getNumber();
-          double step  = base[A+2].getNumber();
+          StkId ra = RA(i);
+
+          // Integer loop - FORPREP only sets this up when the limit is an
+          // integer too, so an overflowing increment has passed the limit.
+          if (ra[0].isInteger() && ra[2].isInteger()) {
+            int64_t step = ra[2].getInteger();
+            int64_t limit = ra[1].getInteger();
+            int64_t index;
+            if (luaO_addInt(ra[0].getInteger(), step, &index) &&
+                ((step > 0) ? (index <= limit) : (index >= limit))) {
+              pc += GETARG_sBx(i);  /* jump back */
+              ra[0] = index;  /* update internal index... */
+              ra[3] = index;  /* ...and external index */
+              checkGC();
+              safepoint();
+            }
+            vmbreak;
+          }
+
+          double index = ra[0].getNumber();
+          double limit = ra[1].getNumber();
+          double step  = ra[2].getNumber();
 
           index += step;
 
           if ((step > 0) ? (index <= limit) : (index >= limit)) {
-            ci->Jump(GETARG_sBx(i));  /* jump back */
-            base[A+0] = index;  /* update internal index... */
-            base[A+3] = index;  /* ...and external index */
+            pc += GETARG_sBx(i);  /* jump back */
+            ra[0] = index;  /* update internal index... */
+            ra[3] = index;  /* ...and external index */
+            checkGC();
+            safepoint();
           }
-          break;
+          vmbreak;
         }
 
-      case OP_FORPREP:
+      vmcase(OP_FORPREP)
         {
-          LuaValue index = base[A+0].convertToNumber();
-          LuaValue limit = base[A+1].convertToNumber();
-          LuaValue step  = base[A+2].convertToNumber();
-
-          if (index.isNone()) {
-            result = luaG_runerror(LUA_QL("for") " initial value must be a number");
+          StkId ra = RA(i);
+          LuaValue index = ra[0].convertToNumber();
+          LuaValue limit = ra[1].convertToNumber();
+          LuaValue step  = ra[2].convertToNumber();
+
+          if (index.isNone() || limit.isNone() || step.isNone()) {
+            savepc();
+            if (index.isNone()) {
+              result = luaG_runerror(LUA_QL("for") " initial value must be a number");
+            }
+            else if (limit.isNone()) {
+              result = luaG_runerror(LUA_QL("for") " limit must be a number");
+            }
+            else {
+              result = luaG_runerror(LUA_QL("for") " step must be a number");
+            }
             handleResult(result);
           }
-          if (limit.isNone()) {
-            result = luaG_runerror(LUA_QL("for") " limit must be a number");
-            handleResult(result);
+
+          // Run the loop on integers if the initial value and step are
+          // integers and the limit can be clipped to one that LuaValue
+          // stores as an integer; otherwise fall back to a floating-point
+          // loop.
+          int64_t ilimit;
+          int64_t iindex;
+          if (index.isInteger() && step.isInteger() &&
+              forlimit(limit, step.getInteger(), &ilimit) &&
+              luaO_subInt(index.getInteger(), step.getInteger(), &iindex) &&
+              LuaValue::fitsInteger(ilimit) && LuaValue::fitsInteger(iindex)) {
+            ra[0] = iindex;
+            ra[1] = ilimit;
+            ra[2] = step;
           }
-          if (step.isNone()) {
-            result = luaG_runerror(LUA_QL("for") " step must be a number");
-            handleResult(result);
+          else {
+            ra[0] = index.getNumber() - step.getNumber();
+            ra[1] = limit;
+            ra[2] = LuaValue(step.getNumber());
           }
 
-          base[A+0] = index.getNumber() - step.getNumber();
-          base[A+1] = limit;
-          base[A+2] = step;
-
-          ci->Jump(GETARG_sBx(i));
-          break;
+          pc += GETARG_sBx(i);
+          vmbreak;
         }
-      
-      case OP_TFORCALL:
+
+      vmcase(OP_TFORCALL)
         {
+          // pairs() over a table without __pairs - step through the table
+          // directly instead of calling 'next', so each step picks up from
+          // the table's iteration cursor. Hooks still see the real call.
+          StkId ra = RA(i);
+          if (ra[0].isCallback() && (ra[0].getCallback() == luaB_next) &&
+              ra[1].isTable() && (!Policy::kHooks || !L->hookmask)) {
+            LuaValue key, val;
+            int found = ra[1].getTable()->next(ra[2], key, val);
+            if (found < 0) {
+              savepc();
+              result = luaG_runerror("invalid key to " LUA_QL("next"));
+              handleResult(result);
+            }
+            int nresults = GETARG_C(i);
+            ra[3] = found ? key : LuaValue::Nil();
+            if (nresults >= 2) ra[4] = found ? val : LuaValue::Nil();
+            for (int j = 2; j < nresults; j++) ra[3 + j] = LuaValue::Nil();
+            vmbreak;
+          }
+
           StkId cb = ra + 3;  /* call base */
-          cb[2] = ra[2];
-          cb[1] = ra[1];
-          cb[0] = ra[0];
+          cb[2] = cb[-1];
+          cb[1] = cb[-2];
+          cb[0] = cb[-3];
 
           L->stack_.top_ = cb + 3;  /* func. + 2 args (state and index) */
-          luaD_call(L, 2, C, 1);
+          Protect(luaD_call(L, 2, GETARG_C(i), 1));
           L->stack_.top_ = ci->getTop();
-          
-          break;
+          safepoint();
+          vmbreak;
         }
 
-      case OP_TFORLOOP:
+      vmcase(OP_TFORLOOP)
         {
+          StkId ra = RA(i);
           if (ra[1].isNotNil()) {  /* continue loop? */
             ra[0] = ra[1];  /* save control variable */
-            ci->Jump(GETARG_sBx(i));  /* jump back */
+            pc += GETARG_sBx(i);  /* jump back */
+            checkGC();
+            safepoint();
           }
-          break;
+          vmbreak;
         }
 
-      case OP_SETLIST:
+      vmcase(OP_SETLIST)
         {
+          StkId ra = RA(i);
           int n = GETARG_B(i);
           int c = GETARG_C(i);
           int last;
           LuaTable *h;
           if (n == 0) n = cast_int(L->stack_.top_ - ra) - 1;
           if (c == 0) {
-            assert(ci->getNextOp() == OP_EXTRAARG);
-            c = GETARG_Ax(ci->getNextInstruction());
-            ci->Jump(1);
+            assert(GET_OPCODE(*pc) == OP_EXTRAARG);
+            c = GETARG_Ax(*pc);
+            pc++;
           }
           h = ra->getTable();
           last = ((c-1)*LFIELDS_PER_FLUSH) + n;
@@ -1267,41 +1672,46 @@ RunResult luaV_run2 (LuaThread *L) {
           // NOTE(aappleby): This is mostly a performance optimization, but the
           // nextvar.lua tests break if it's removed.
           if (last > (int)h->getArraySize()) {
-            h->resize(last, (int)h->getHashSize());
+            h->resizeArray(last);
           }
 
+          // Fill in ascending order so the table's length hint follows along.
           // TODO(aappleby): we probably don't have to call barrierback every time through this loop
-          for (; n > 0; n--) {
-            h->set(LuaValue(last--), ra[n]);
-            luaC_barrierback(h, ra[n]);
+          int first = last - n;
+          for (int j = 1; j <= n; j++) {
+            h->set(LuaValue(first + j), ra[j]);
+            luaC_barrierback(h, ra[j]);
           }
           L->stack_.top_ = ci->getTop();  /* correct top (in case of previous open call) */
-          break;
+          vmbreak;
         }
 
-      case OP_CLOSURE:
+      vmcase(OP_CLOSURE)
         {
           LuaProto *p = cl->proto_->subprotos_[GETARG_Bx(i)];
           LuaClosure *ncl = getcached(p, cl->ppupvals_, base);  /* cached closure */
           if (ncl == NULL)  /* no match? */
-            pushclosure(L, p, cl->ppupvals_, base, &base[A]);  /* create a new one */
+            pushclosure(L, p, cl->ppupvals_, base, RA(i));  /* create a new one */
           else {
-            base[A] = LuaValue(ncl);  /* push cashed closure */
+            base[GETARG_A(i)] = LuaValue(ncl);  /* push cashed closure */
           }
-          break;
+          checkGC();
+          vmbreak;
         }
 
-      case OP_VARARG:
+      vmcase(OP_VARARG)
         {
-          int b = B - 1;
+          StkId ra = RA(i);
+          int b = GETARG_B(i) - 1;
 
           int n = cast_int(base - ci->getFunc()) - cl->proto_->numparams - 1;
 
           if (b < 0) {  /* B == 0? */
             b = n;  /* get all var. arguments */
-            LuaResult result = L->stack_.reserve2(n);
+            savepc();
+            result = L->stack_.reserve2(n);
             handleResult(result);
-            base = ci->getBase();
+            updatebase();
 
             ra = RA(i);  /* previous call may change the stack */
             L->stack_.top_ = ra + n;
@@ -1315,13 +1725,228 @@ RunResult luaV_run2 (LuaThread *L) {
               ra[j] = LuaValue::Nil();
             }
           }
-          break;
+          vmbreak;
+        }
+
+      // Specialized forms of the table, arithmetic and comparison opcodes
+      // for a constant operand - no RK decoding, and the table accesses
+      // always go through the inline caches.
+
+      vmcase(OP_GETFIELD)
+        {
+          LuaValue* rc = KC(i);
+          if(cachedGet(RB(i), rc, HINT(), RA(i))) { vmbreak; }
+          Protect(luaV_gettable(L, RB(i), rc, RA(i)));
+          vmbreak;
+        }
+
+      vmcase(OP_SETFIELD)
+        {
+          LuaValue* rb = KB(i);
+          if(cachedSet(RA(i), rb, HINT(), RKC(i))) { vmbreak; }
+          Protect(luaV_settable(L, RA(i), rb, RKC(i)));
+          vmbreak;
+        }
+
+      vmcase(OP_GETUPFIELD)
+        {
+          LuaValue* upval = cl->ppupvals_[GETARG_B(i)]->v;
+          LuaValue* rc = KC(i);
+          if(cachedGet(upval, rc, HINT(), RA(i))) { vmbreak; }
+          Protect(luaV_gettable(L, upval, rc, RA(i)));
+          vmbreak;
+        }
+
+      vmcase(OP_SETUPFIELD)
+        {
+          LuaValue* upval = cl->ppupvals_[GETARG_A(i)]->v;
+          LuaValue* rb = KB(i);
+          if(cachedSet(upval, rb, HINT(), RKC(i))) { vmbreak; }
+          Protect(luaV_settable(L, upval, rb, RKC(i)));
+          vmbreak;
+        }
+
+      vmcase(OP_ADDK)
+        {
+          LuaValue* rb = RB(i);
+          LuaValue* kc = KC(i);
+          int64_t ires;
+          if (rb->isInteger() && kc->isInteger() &&
+              luaO_addInt(rb->getInteger(), kc->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+          } else if (rb->isNumber()) {
+            base[GETARG_A(i)] = rb->getNumber() + kc->getNumber();
+          } else {
+            Protect(luaV_arith(L, RA(i), rb, kc, TM_ADD));
+          }
+          vmbreak;
+        }
+
+      vmcase(OP_SUBK)
+        {
+          LuaValue* rb = RB(i);
+          LuaValue* kc = KC(i);
+          int64_t ires;
+          if (rb->isInteger() && kc->isInteger() &&
+              luaO_subInt(rb->getInteger(), kc->getInteger(), &ires)) {
+            base[GETARG_A(i)] = ires;
+          } else if (rb->isNumber()) {
+            base[GETARG_A(i)] = rb->getNumber() - kc->getNumber();
+          } else {
+            Protect(luaV_arith(L, RA(i), rb, kc, TM_SUB));
+          }
+          vmbreak;
         }
 
-      case OP_EXTRAARG:
+      vmcase(OP_EQK)
+        {
+          // The constant is never a table or userdata, so there's no __eq
+          // to call.
+          LuaValue* rb = RB(i);
+          LuaValue* kc = KC(i);
+          int res = (rb->isNumber() && kc->isNumber()) ? luaO_numeq(*rb, *kc)
+                                                        : (*rb == *kc);
+          if (res != GETARG_A(i)) pc++;
+          else donextjump();
+          vmbreak;
+        }
+
+      // Quickened instructions. Each one handles the operand types it was
+      // quickened for and turns back into the generic instruction when it
+      // sees anything else.
+
+      vmcase(OP_ADD_NN)
+        {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          if (rb->isNumber() && rc->isNumber()) {
+            int64_t ires;
+            if (rb->isInteger() && rc->isInteger() &&
+                luaO_addInt(rb->getInteger(), rc->getInteger(), &ires)) {
+              base[GETARG_A(i)] = ires;
+            } else {
+              base[GETARG_A(i)] = rb->getNumber() + rc->getNumber();
+            }
+          } else {
+            quicken(OP_ADD);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_ADD));
+          }
+          vmbreak;
+        }
+
+      vmcase(OP_SUB_NN)
+        {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          if (rb->isNumber() && rc->isNumber()) {
+            int64_t ires;
+            if (rb->isInteger() && rc->isInteger() &&
+                luaO_subInt(rb->getInteger(), rc->getInteger(), &ires)) {
+              base[GETARG_A(i)] = ires;
+            } else {
+              base[GETARG_A(i)] = rb->getNumber() - rc->getNumber();
+            }
+          } else {
+            quicken(OP_SUB);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_SUB));
+          }
+          vmbreak;
+        }
+
+      vmcase(OP_MUL_NN)
+        {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          if (rb->isNumber() && rc->isNumber()) {
+            int64_t ires;
+            if (rb->isInteger() && rc->isInteger() &&
+                luaO_mulInt(rb->getInteger(), rc->getInteger(), &ires)) {
+              base[GETARG_A(i)] = ires;
+            } else {
+              base[GETARG_A(i)] = rb->getNumber() * rc->getNumber();
+            }
+          } else {
+            quicken(OP_MUL);
+            Protect(luaV_arith(L, RA(i), rb, rc, TM_MUL));
+          }
+          vmbreak;
+        }
+
+      vmcase(OP_LT_NN)
+        {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int res;
+          if (rb->isNumber() && rc->isNumber()) {
+            res = luaO_numlt(*rb, *rc);
+          } else {
+            quicken(OP_LT);
+            Protect(res = luaV_lessthan(L, rb, rc));
+          }
+          if (res != GETARG_A(i)) pc++;
+          else donextjump();
+          vmbreak;
+        }
+
+      vmcase(OP_LE_NN)
+        {
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          int res;
+          if (rb->isNumber() && rc->isNumber()) {
+            res = luaO_numle(*rb, *rc);
+          } else {
+            quicken(OP_LE);
+            Protect(res = luaV_lessequal(L, rb, rc));
+          }
+          if (res != GETARG_A(i)) pc++;
+          else donextjump();
+          vmbreak;
+        }
+
+      vmcase(OP_GETTABLE_AI)
+        {
+          LuaValue* rb = RB(i);
+          LuaValue* rc = RKC(i);
+          if (rb->isTable() && rc->isInteger()) {
+            LuaValue* v = rb->getTable()->arraySlot(rc->getInteger());
+            if (v && !v->isNil()) {
+              base[GETARG_A(i)] = *v;
+              vmbreak;
+            }
+          } else {
+            quicken(OP_GETTABLE);
+          }
+          Protect(luaV_gettable(L, rb, rc, RA(i)));
+          vmbreak;
+        }
+
+      vmcase(OP_SETTABLE_AI)
+        {
+          // Only overwrites of existing array entries are done here -
+          // anything else can move the border or hit __newindex.
+          LuaValue* ra = RA(i);
+          LuaValue* rb = RKB(i);
+          LuaValue* rc = RKC(i);
+          if (ra->isTable() && rb->isInteger()) {
+            LuaTable* h = ra->getTable();
+            LuaValue* v = h->arraySlot(rb->getInteger());
+            if (v && !v->isNil() && !rc->isNil() && !h->isMetaWatched()) {
+              *v = *rc;
+              luaC_barrierback(h, *rc);
+              vmbreak;
+            }
+          } else {
+            quicken(OP_SETTABLE);
+          }
+          Protect(luaV_settable(L, ra, rb, rc));
+          vmbreak;
+        }
+
+      vmcase(OP_EXTRAARG)
         {
           assert(0);
-          break;
+          vmbreak;
         }
     }
   }
@@ -1330,7 +1955,11 @@ RunResult luaV_run2 (LuaThread *L) {
 void luaV_run (LuaThread *L) {
   RunResult r;
   do {
-    r = luaV_run2(L);
+    switch (vmPolicyFor(L->hookmask)) {
+      case VM_PLAIN: r = luaV_run2<VMPlain>(L); break;
+      case VM_COUNT: r = luaV_run2<VMCount>(L); break;
+      default:       r = luaV_run2<VMTrace>(L); break;
+    }
   } while(r != RR_DONE);
 }
 
@@ -21,7 +21,7 @@ int luaV_equalobj2_ (const LuaValue *t1, const LuaValue *t2);
 int luaV_lessthan (LuaThread *L, const LuaValue *l, const LuaValue *r);
 int luaV_lessequal (LuaThread *L, const LuaValue *l, const LuaValue *r);
 
-int luaV_tostring (LuaValue* v);
+int luaV_tostring (LuaThread *L, LuaValue* v);
 
 void luaV_gettable (LuaThread *L, const LuaValue *t, LuaValue *key, StkId val);
 LuaResult luaV_gettable2 (LuaThread *L, LuaValue table, LuaValue key, LuaValue& outResult);
@@ -301,5 +301,20 @@ assert((function () return nil end)(4) == nil)
 assert((function () local a; return a end)(4) == nil)
 assert((function (a) return a end)() == nil)
 
+-- missing parameters and results are nil even where an earlier call left
+-- values behind in the stack
+do
+  local function f (a, b, c) return a, b, c end
+  local function g () local x, y, z = f(1, 2, 3); return x, y, z end
+  g()
+  local a, b, c = f(1)
+  assert(a == 1 and b == nil and c == nil)
+  local function h () return end
+  g()
+  local x, y = h()
+  assert(x == nil and y == nil)
+  assert(select('#', f()) == 3 and select('#', h()) == 0)
+end
+
 print('OK')
 return deep
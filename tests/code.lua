@@ -38,7 +38,7 @@ end
 -- some basic instructions
 check(function ()
   (function () end){f()}
-end, 'CLOSURE', 'NEWTABLE', 'GETTABUP', 'CALL', 'SETLIST', 'CALL', 'RETURN')
+end, 'CLOSURE', 'NEWTABLE', 'GETUPFIELD', 'CALL', 'SETLIST', 'CALL', 'RETURN')
 
 
 -- sequence of LOADNILs
@@ -94,7 +94,7 @@ check(function ()
 end,
   'LOADNIL',
   'MUL',
-  'DIV', 'ADD', 'GETTABLE', 'SUB', 'GETTABLE', 'POW',
+  'DIV', 'ADD', 'GETTABLE', 'SUB', 'GETFIELD', 'POW',
     'UNM', 'SETTABLE', 'SETTABLE', 'RETURN')
 
 
@@ -110,7 +110,7 @@ check(function ()
   a[true] = false
 end,
   'LOADNIL',
-  'SETTABLE', 'SETTABLE', 'SETTABLE', 'SUB', 'DIV', 'LOADK',
+  'SETFIELD', 'SETFIELD', 'SETTABLE', 'SUB', 'DIV', 'LOADK',
   'SETTABLE', 'RETURN')
 
 -- constant folding
@@ -145,7 +145,7 @@ checkequal(function () if (a==nil) then a=1 end; if a~=nil then a=1 end end,
            function () if (a==9) then a=1 end; if a~=9 then a=1 end end)
 
 check(function () if a==nil then a=1 end end,
-'GETTABUP', 'EQ', 'JMP', 'SETTABUP', 'RETURN')
+'GETUPFIELD', 'EQK', 'JMP', 'SETUPFIELD', 'RETURN')
 
 -- de morgan
 checkequal(function () local a; if not (a or b) then b=a end end,
@@ -155,7 +155,8 @@ checkequal(function (l) local a; return 0 <= a and a <= l end,
            function (l) local a; return not (not(a >= 0) or not(a <= l)) end)
 
 
--- if-goto optimizations
+-- if-goto optimizations (the jump of the final 'else' leads to the return
+-- and goes away)
 check(function (a)
         if a == 1 then goto l1
         elseif a == 2 then goto l2
@@ -165,7 +166,7 @@ check(function (a)
              end
         end
         ::l1:: ::l2:: ::l3:: ::l4:: 
-end, 'EQ', 'JMP', 'EQ', 'JMP', 'EQ', 'JMP', 'EQ', 'JMP', 'JMP', 'RETURN')
+end, 'EQK', 'JMP', 'EQK', 'JMP', 'EQK', 'JMP', 'EQK', 'JMP', 'RETURN')
 
 checkequal(
 function (a) while a < 10 do a = a + 1 end end,
@@ -178,5 +179,180 @@ function (a) while a < 10 do a = a + 1 end end,
 function (a) while true do if not(a < 10) then break end; a = a + 1; end end
 )
 
+-- unreachable code goes away, and so do jumps left pointing at the next
+-- instruction
+check(function () do return end; print(1) end, 'RETURN', 'RETURN')
+
+local function f (a)
+  local x = 0
+  if a then goto l1 end; x = x + 1 ::l1:: goto l2; x = x + 10 ::l2:: return x
+end
+check(f, 'LOADK', 'TEST', 'JMP', 'ADDK', 'RETURN', 'RETURN')
+assert(f(true) == 0 and f(false) == 1)
+
+-- nil loads aren't dropped for locals a closure can assign, nor after
+-- anything that can run Lua code
+do
+  local x; local function set () x = 5 end
+  x = nil; set(); x = nil
+  assert(x == nil)
+end
+
+do
+  local x
+  local t = setmetatable({}, {__index = function () x = 5 end})
+  x = nil; local _ = t.k; x = nil
+  assert(x == nil)
+end
+
+local function f (t)
+  local x
+  local _ = t.k   -- sets 'x' through the debug library
+  x = nil
+  return x
+end
+check(f, 'LOADNIL', 'GETFIELD', 'LOADNIL', 'RETURN', 'RETURN')
+assert(f(setmetatable({}, {__index = function () debug.setlocal(2, 2, 5) end})) == nil)
+
+-- specialized opcodes for constant operands
+check(function (a) return a + 1, a - 2.5, 1 + a, 1 - a end,
+  'ADDK', 'SUBK', 'ADD', 'SUB', 'RETURN')
+
+check(function (a) return a + "1" end, 'ADD', 'RETURN')
+
+check(function (a) if 1 == a then return end end,
+  'EQK', 'JMP', 'RETURN', 'RETURN')
+
+check(function () return {x = 1, [1] = 2} end,
+  'NEWTABLE', 'SETFIELD', 'SETTABLE', 'RETURN')
+
+check(function (a) a.x = a.y end, 'GETFIELD', 'SETFIELD', 'RETURN')
+
+do
+  local mt = {__add = function (a, b) return "add" end,
+              __sub = function (a, b) return b end,
+              __index = function (t, k) return k end,
+              __newindex = function (t, k, v) rawset(t, k, v + 1) end}
+  local a = setmetatable({}, mt)
+  assert(a + 1 == "add" and a - 2 == 2)
+  assert(a.field == "field")
+  a.x = 1; assert(rawget(a, "x") == 2)
+  local n = 2^53
+  assert(n + 1 == 2^53 and n - 1 == 2^53 - 1)
+  local x = 10
+  assert(x + 1 == 11 and x - 0.5 == 9.5 and x == 10.0 and x ~= "10")
+  local s = "a"
+  assert(s == "a" and s ~= "b" and not (s == nil))
+  local count = 0
+  for i = 1, 10 do if i == 5 then count = count + 1 end end
+  assert(count == 1)
+end
+
+-- level 2: constant propagation and folding, dropping branches that can't
+-- be taken, without losing the names of locals
+do
+  local function load2 (s)
+    local old = T.optlevel(2)
+    local f = assert(load(s))
+    assert(T.optlevel(old) == 2)
+    return f
+  end
+
+  local f = load2[[
+    local a, b = 3, 4
+    if a > b then return 1 end
+    return 2
+  ]]
+  check(f, 'LOADK', 'LOADK', 'LOADK', 'RETURN', 'RETURN')
+  assert(f() == 2)
+
+  f = load2[[
+    local v = true
+    if v then return 1 else return 2 end
+  ]]
+  check(f, 'LOADBOOL', 'LOADK', 'RETURN', 'RETURN')
+  assert(f() == 1)
+
+  f = load2[[
+    local k = "x"
+    local t = {}
+    t[k] = 1
+    return t[k]
+  ]]
+  check(f, 'LOADK', 'NEWTABLE', 'SETFIELD', 'GETFIELD', 'RETURN', 'RETURN')
+  assert(f() == 1)
+
+  f = load2[[
+    local a = "ab"
+    return a .. "cd" .. a
+  ]]
+  check(f, 'LOADK', 'LOADK', 'RETURN', 'RETURN')
+  assert(f() == "abcdab")
+
+  -- 'b = a; a = b' drops the second move only because both are locals
+  f = load2[[
+    local a, b = ...
+    b = a; a = b
+    return a, b
+  ]]
+  check(f, 'VARARG', 'MOVE', 'MOVE', 'MOVE', 'RETURN', 'RETURN')
+  assert(select(2, f(1, 2)) == 1)
+
+  -- error messages and the debug library still see the locals
+  local st, msg = pcall(load2"local x = true; return 1 + x")
+  assert(not st and string.find(msg, "local 'x'"))
+  st, msg = pcall(load2"local a, bbbb = 2, 3; a = math.sin(1) and bbbb(3)")
+  assert(not st and string.find(msg, "local 'bbbb'"))
+  f = load2[[
+    local f
+    function f () return debug.getinfo(1, "n").name end
+    if 3 > 4 then return end
+    return (f())
+  ]]
+  assert(f() == "f")
+  f = load2[[
+    local a, b = 1, "x"
+    if a == 1 then
+      return debug.getlocal(1, 1), debug.getlocal(1, 2)
+    end
+  ]]
+  local n1, n2 = f()
+  assert(n1 == "a" and n2 == "b")
+end
+
+-- quickening
+do
+  local function get (t, i) return t[i] end
+  local function add (a, b) return a + b end
+  local function lt (a, b) return a < b end
+  check(get, 'GETTABLE', 'RETURN')
+  assert(get({10, 20}, 2) == 20)
+  check(get, 'GETTABLE_AI', 'RETURN')
+  assert(get({10, 20}, 3) == nil and get(setmetatable({}, {__index = function () return 1 end}), 5) == 1)
+  check(get, 'GETTABLE_AI', 'RETURN')
+  -- dumped code is always generic
+  check(load(string.dump(get)), 'GETTABLE', 'RETURN')
+  assert(get({x = 1}, "x") == 1)
+  check(get, 'GETTABLE', 'RETURN')
+  assert(add(1, 2) == 3 and add(1.5, 2) == 3.5)
+  check(add, 'ADD_NN', 'RETURN')
+  assert(add("1", 2) == 3)
+  check(add, 'ADD', 'RETURN')
+  assert(lt(1, 2) and not lt(2, 1.5))
+  check(lt, 'LT_NN', 'JMP', 'LOADBOOL', 'LOADBOOL', 'RETURN')
+  assert(lt("a", "b"))
+  check(lt, 'LT', 'JMP', 'LOADBOOL', 'LOADBOOL', 'RETURN')
+  local function set (t, i, v) t[i] = v end
+  local a = {1, 2, 3}
+  set(a, 1, 10); set(a, 2, 20)
+  check(set, 'SETTABLE_AI', 'RETURN')
+  set(a, 3, nil); set(a, 4, 4)
+  assert(a[1] == 10 and a[2] == 20 and a[3] == nil and a[4] == 4)
+  local log = {}
+  local b = setmetatable({1}, {__newindex = function (t, k, v) log[k] = v end})
+  set(b, 1, 5); set(b, 2, 6)
+  assert(b[1] == 5 and rawget(b, 2) == nil and log[2] == 6)
+end
+
 print 'OK'
 
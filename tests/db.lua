@@ -390,6 +390,26 @@ end
 
 debug.sethook()
 
+-- hooks set from inside a loop or a called function take effect there
+a=0
+for i=1,100 do
+  if i == 50 then debug.sethook(function (e) a=a+1 end, "", 1) end
+end
+debug.sethook()
+assert(a > 100)
+a=0
+local function sethere () debug.sethook(function (e) a=a+1 end, "", 1) end
+sethere(); for i=1,100 do end
+debug.sethook()
+assert(a > 100)
+-- a count hook can bound a loop that never calls anything
+local st, msg = pcall(function ()
+  debug.sethook(function () error("budget") end, "", 1000)
+  while true do end
+end)
+debug.sethook()
+assert(not st and string.find(msg, "budget"))
+
 
 -- tests for tail calls
 local function f (x)
@@ -381,6 +381,62 @@ child = setmetatable({}, parent)
 child.foo = 10      --> CRASH (on some machines)
 assert(T == parent and K == "foo" and V == 10)
 
+-- metamethods added after a lookup found them missing
+do
+  local mt = {}
+  local t = setmetatable({}, mt)
+  assert(t.x == nil and #t == 0)
+  t.y = 1
+  assert(not (t == setmetatable({}, mt)))
+  mt.__index = function () return "idx" end
+  assert(t.x == "idx")
+  rawset(mt, "__newindex", function (t, k, v) rawset(t, k, v * 2) end)
+  t.z = 5; assert(rawget(t, "z") == 10)
+  mt.__len = function () return 42 end
+  assert(#t == 42)
+  mt.__eq = function () return true end
+  assert(t == setmetatable({}, mt))
+  mt.__index = nil; mt.__newindex = nil
+  assert(t.x == nil)
+  t.w = 1; assert(rawget(t, "w") == 1)
+  mt.__add = function () return 7 end
+  assert(t + 1 == 7)
+end
+
+-- method lookups through __index chains, after the chain changes
+do
+  local Base = {}; Base.__index = Base
+  function Base:name () return "base" end
+  local Mid = setmetatable({}, Base); Mid.__index = Mid
+  local Leaf = setmetatable({}, Mid); Leaf.__index = Leaf
+  local o = setmetatable({}, Leaf)
+  local function call (x) return x:name() end
+  for i = 1, 3 do assert(call(o) == "base") end
+  function Mid:name () return "mid" end        -- override in the middle
+  assert(call(o) == "mid")
+  Mid.name = nil
+  assert(call(o) == "base")
+  o.name = function () return "own" end        -- receiver's own field
+  assert(call(o) == "own")
+  o.name = nil
+  setmetatable(Mid, {__index = function () return function () return "fn" end end})
+  assert(call(o) == "fn")                      -- chain ends in a function
+  setmetatable(Mid, Base)
+  assert(call(o) == "base")
+  local Other = {__index = {name = function () return "other" end}}
+  setmetatable(o, Other)                        -- receiver switches class
+  assert(call(o) == "other")
+  Other.__index = Leaf
+  assert(call(o) == "base")
+  local smt = getmetatable("")
+  local oldindex = smt.__index
+  assert(("x"):upper() == "X")
+  smt.__index = {upper = function () return "up" end}
+  assert(("x"):upper() == "up")
+  smt.__index = oldindex
+  assert(("x"):upper() == "X")
+end
+
 print 'OK'
 
 return 12
@@ -495,9 +495,13 @@ if T then
   collectgarbage("generational"); collectgarbage("stop")
   x = T.newuserdata(0)
   T.gcstate("propagate")    -- ensure 'x' is old
-  T.gcstate("sweepstring")
-  T.gcstate("propagate")
-  assert(string.find(T.gccolor(x), "/old"))
+  local n = 0
+  repeat   -- takes a few minor collections
+    T.gcstate("sweepstring")
+    T.gcstate("propagate")
+    n = n + 1
+  until string.find(T.gccolor(x), "/old")
+  assert(n > 1 and n < 4)
   local y = T.newuserdata(0)
   debug.setmetatable(y, {__gc = true})   -- bless the new udata before...
   debug.setmetatable(x, {__gc = true})   -- ...the old one
@@ -507,6 +511,151 @@ if T then
 end
 
 
+if T then   -- young objects stored in old ones survive minor collections
+  collectgarbage("generational"); collectgarbage("stop")
+  local old = {}
+  local function minor () T.gcstate("sweepstring"); T.gcstate("propagate") end
+  T.gcstate("propagate")
+  for i = 1, 4 do minor() end
+  assert(string.find(T.gccolor(old), "/old"))
+  -- a young table reachable only from the old one
+  old.x = {y = {}}
+  assert(string.find(T.gccolor(old), "/remembered"))
+  for i = 1, 4 do
+    minor()
+    T.checkmemory()
+    old.x.y[i] = {i}   -- and younger ones hanging from it
+  end
+  assert(string.find(T.gccolor(old.x), "/old"))
+  for i = 1, 4 do minor() end
+  assert(not string.find(T.gccolor(old), "/remembered"))
+  for i = 1, 4 do assert(old.x.y[i][1] == i) end
+  -- garbage dies young, and nothing reachable does
+  local live = {}
+  for i = 1, 100 do
+    live[i % 10 + 1] = {i}
+    local garbage = {{}, {}}
+    if i % 7 == 0 then minor() end
+  end
+  for i = 1, 10 do minor(); T.checkmemory() end
+  for i = 1, 10 do assert(live[i][1] % 10 + 1 == i) end
+  collectgarbage("incremental"); collectgarbage("restart")
+end
+
+
+do
+  print("parallel marking")
+  local old = collectgarbage("setmarkthreads", 4)
+  local live, weakv, eph = {}, setmetatable({}, {__mode = "v"}),
+                                setmetatable({}, {__mode = "k"})
+  local finalized = 0
+  local mt = {__gc = function () finalized = finalized + 1 end}
+  for i = 1, 5000 do
+    local t = {i, "s" .. i}
+    live[i] = t
+    weakv[i] = t
+    weakv[-i] = {}           -- only reachable through a weak value
+    eph[t] = {t}             -- value refers back to its key
+    eph[{}] = {}             -- dead key
+    local co = coroutine.wrap(function () coroutine.yield(t) end)
+    live[-i] = function () return t, co end
+    setmetatable({}, mt)
+  end
+  collectgarbage()
+  collectgarbage()
+  if T then T.checkmemory() end
+  assert(finalized == 5000)
+  for i = 1, 5000 do
+    assert(weakv[i] == live[i] and weakv[-i] == nil)
+    assert(eph[live[i]][1] == live[i] and live[-i]() == live[i])
+  end
+  local n = 0
+  for k in pairs(eph) do n = n + 1 end
+  assert(n == 5000)
+  live = nil
+  collectgarbage()
+  assert(next(weakv) == nil and next(eph) == nil)
+  assert(collectgarbage("setmarkthreads", old) == 4)
+end
+
+
+do
+  print("freeing on a helper thread")
+  local old = collectgarbage("setfreethread", 1)
+  collectgarbage()
+  local before = collectgarbage("count")
+  local tables = T and T.totalmem("table")
+  local mt = {__index = function (t, k) return k end}
+  local keep = {}
+  for i = 1, 20000 do
+    local t = setmetatable({i, {}, "x" .. i}, mt)
+    local long = string.rep("y", 100) .. i
+    local f = function () return t, long end
+    if i % 100 == 0 then keep[#keep + 1] = f end
+    collectgarbage("step", 0)
+  end
+  collectgarbage()
+  if T then
+    T.checkmemory()
+    assert(T.totalmem("table") == tables + 2 * #keep + 2)  -- and mt, keep
+  end
+  assert(collectgarbage("count") < before + 200)
+  for i = 1, #keep do
+    local t, long = keep[i]()
+    assert(t[1] == i * 100 and t.foo == "foo" and
+           long == string.rep("y", 100) .. t[1])
+  end
+  keep = nil
+  assert(collectgarbage("setfreethread", old and 1 or 0) == true)
+end
+
+
+do
+  print("sweeping object pages")
+  -- every kind of object, with survivors spread through their pages and
+  -- new ones made while the sweep is going through them
+  local function fill (n, keep)
+    for i = 1, n do
+      local s = "page" .. i
+      local t = {i, s}
+      local co = coroutine.create(function () return t end)
+      local f = function () return t, s, co end
+      if i % 7 == 0 then keep[#keep + 1] = f end
+    end
+  end
+  for _, mode in ipairs{"incremental", "generational"} do
+    collectgarbage(mode)
+    collectgarbage()
+    local counts = T and {T.totalmem("table"), T.totalmem("function"),
+                          T.totalmem("thread")}
+    local keep = {}
+    for round = 1, 5 do
+      fill(3000, keep)
+      for i = 1, 50 do collectgarbage("step", 0); fill(20, keep) end
+      if T then T.checkmemory() end
+    end
+    collectgarbage()
+    for i = 1, #keep do
+      local t, s, co = keep[i]()
+      assert(s == "page" .. t[1] and t[2] == s)
+      assert(coroutine.resume(co) and coroutine.status(co) == "dead")
+    end
+    if T then
+      T.checkmemory()
+      assert(T.totalmem("table") == counts[1] + #keep + 1)
+    end
+    keep = nil
+    collectgarbage()
+    if T then
+      assert(T.totalmem("table") == counts[1] and
+             T.totalmem("function") == counts[2] and
+             T.totalmem("thread") == counts[3])
+    end
+  end
+  collectgarbage("incremental")
+end
+
+
 if T then
   print("emergency collections")
   collectgarbage()
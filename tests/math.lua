@@ -221,9 +221,9 @@ if not _port then
   assert(mz == z)
   assert(1/mz < 0 and 0 < 1/z)
   
-  -- Minus zero != zero for table lookup
-  -- local a = {[mz] = 1}
-  -- assert(a[z] == 1 and a[mz] == 1)
+  -- Integral float keys (including minus zero) are normalized to integers.
+  local a = {[mz] = 1}
+  assert(a[z] == 1 and a[mz] == 1)
   
   local inf = math.huge * 2 + 1
   mz, z = -1/inf, 1/inf
@@ -256,6 +256,74 @@ if not _port then
 end
 
 
+print("testing integers")
+do
+  -- integers are exact past 2^53 (unless built with LUA_NANBOXING, which
+  -- only keeps 48 bits), and fall back to floats on overflow
+  local big = 9007199254740993
+  local bigints = (big ~= 2^53)
+  if bigints then
+    assert(big + 1 == 9007199254740994 and big - 1 == 9007199254740992)
+    assert(big > 2^53 and 2^53 < big)
+    assert(tostring(big) == "9007199254740993")
+  end
+  assert(140737488355327 + 1 == 2^47 and tostring(140737488355327) == "140737488355327")
+  assert(9223372036854775807 + 1 == 2^63)
+  assert(-(-9223372036854775807 - 1) == 2^63)
+
+  -- integers and floats with the same value are the same number
+  local t = {}
+  t[1] = "a"; t[2.0] = "b"; t[3] = "c"
+  assert(t[1.0] == "a" and t[2] == "b" and #t == 3)
+  assert(1 == 1.0 and rawequal(2, 2.0) and 3 <= 3.0 and not (3 < 3.0))
+  assert(next({[1.0] = true}) == 1)
+
+  -- division always produces a float, -0 stays a float
+  assert(7 / 2 == 3.5 and 1 / (0 * -1) < 0 and 1 / -0 < 0)
+  assert(7 % -3 == -2 and -7 % 3 == 2 and 7 % 3 == 1)
+
+  -- numeric for loops with integer and float limits
+  local n = 0
+  for i = 1, 2.5 do n = n + i end
+  assert(n == 3)
+  n = 0
+  for i = 3, 0.5, -1 do n = n + i end
+  assert(n == 6)
+  if bigints then
+    n = 0
+    for i = 9223372036854775806, 9223372036854775807 do n = n + 1 end
+    assert(n == 2)
+  end
+
+  -- limits and indices around 2^47, past which a NaN-boxed value no longer
+  -- keeps integers
+  n = 0
+  for i = 1, 1e15 do n = n + 1; if n > 3 then break end end
+  assert(n == 4)
+  n = 0
+  for i = -1, -1e15, -1 do n = n + i; if n < -5 then break end end
+  assert(n == -6)
+  local p47 = 140737488355328
+  n = 0
+  for i = p47 - 2, p47 + 1 do assert(i == p47 - 2 + n); n = n + 1 end
+  assert(n == 4)
+  n = 0
+  for i = -p47 + 1, -p47 - 1, -1 do assert(i == -p47 + 1 - n); n = n + 1 end
+  assert(n == 3)
+  n = 0
+  for i = p47 - 3, p47 - 1, 2 do n = n + 1 end
+  assert(n == 2)
+  n = 0
+  for i = 0, p47, 2^46 do n = n + 1 end
+  assert(n == 3)
+
+  -- integer constants survive a dump/load round trip
+  local f = load(string.dump(function () return 123456789012345, 2.0 end))
+  local a, b = f()
+  assert(a == 123456789012345 and tostring(a) == "123456789012345" and b == 2)
+end
+
+
 if not _port then
   print("testing 'math.random'")
   math.randomseed(0)
@@ -44,6 +44,13 @@ local function mp2 (n)   -- minimum power of 2 >= n
   return mp
 end
 
+local function hsize (n)   -- hash part slots needed for n keys
+  if n <= 4 then return mp2(n) end
+  local cap = 8
+  while cap - math.floor(cap / 8) < n do cap = cap * 2 end
+  return cap
+end
+
 local function fb (n)
   local r, nn = T.int2fb(n)
   assert(r < 256)
@@ -73,7 +80,7 @@ end
 do
   local s = 0
   for _ in pairs(math) do s = s + 1 end
-  check(math, 0, mp2(s))
+  check(math, 0, hsize(s))
 end
 
 
@@ -86,7 +93,7 @@ for i=1,lim do
   for k=0,lim do 
     local t = load(s..'}')()
     assert(#t == i)
-    check(t, fb(i), mp2(k))
+    check(t, fb(i), hsize(k))
     s = string.format('%sa%d=%d,', s, k, k)
   end
 end
@@ -121,29 +128,41 @@ a = {}
 for i = 1,lim do
   a['a'..i] = 1
   assert(#a == 0)
-  check(a, 0, mp2(i))
+  check(a, 0, hsize(i))
 end
 
 a = {}
 for i=1,16 do a[i] = i end
 check(a, 16, 0)
 if not _port then
+  -- assigning nil to a missing key doesn't insert it, so set and clear
   for i=1,11 do a[i] = nil end
-  for i=30,50 do a[i] = nil end   -- force a rehash (?)
+  for i=30,50 do a[i] = true; a[i] = nil end   -- force a rehash (?)
   check(a, 0, 8)   -- only 5 elements in the table
   a[10] = 1
-  for i=30,50 do a[i] = nil end   -- force a rehash (?)
+  for i=30,50 do a[i] = true; a[i] = nil end   -- force a rehash (?)
   check(a, 0, 8)   -- only 6 elements in the table
   for i=1,14 do a[i] = nil end
-  for i=18,50 do a[i] = nil end   -- force a rehash (?)
+  for i=18,50 do a[i] = true; a[i] = nil end   -- force a rehash (?)
   check(a, 0, 4)   -- only 2 elements ([15] and [16])
 end
 
--- reverse filling
+-- reverse filling: keys go to the hash part until a rehash moves them to
+-- the array part, so check that they stay reachable, that the two parts
+-- can hold them, and that they are in the array part once it grows past them
 for i=1,lim do
   local a = {}
-  for i=i,1,-1 do a[i] = i end   -- fill in reverse
-  check(a, mp2(i), 0)
+  for k=i,1,-1 do
+    a[k] = k   -- fill in reverse
+    for j=k,i do assert(a[j] == j) end
+  end
+  assert(#a == i)
+  local na, nh = T.querytab(a)
+  assert(na + nh >= i and na <= mp2(i) and (na == 0 or na == mp2(na)))
+  for k=i+1,2*mp2(i) do a[k] = k end   -- keep filling forwards
+  assert(#a == 2*mp2(i))
+  for k=1,#a do assert(a[k] == k) end
+  assert(T.querytab(a) >= mp2(i))
 end
 
 -- size tests for vararg
@@ -358,6 +377,43 @@ assert(next(a,nil) == 1000 and next(a,1000) == nil)
 assert(next({}) == nil)
 assert(next({}, nil) == nil)
 
+-- length of tables grown and shrunk at the end
+a = {}
+for i = 1, 100 do a[#a + 1] = i; assert(#a == i) end
+for i = 100, 1, -1 do assert(#a == i); a[#a] = nil end
+assert(#a == 0)
+a = {1, 2, 3, nil, 5}
+assert(#a == 3 or #a == 5)
+a[4] = 4; assert(#a == 5)
+a[6] = 6; a[7] = 7; assert(#a == 7)
+a[3] = nil; assert(#a == 2 or #a == 7)
+a = {n = 1}
+for i = 1, 20 do a[i] = i end    -- grows through the hash part
+a[10] = nil; assert(#a == 9 or #a == 20)
+a[10] = 10; assert(#a == 20)
+
+-- nested and interleaved traversals of the same table
+a = {10, 20, 30, x = 1, y = 2, z = 3}
+local n = 0
+for k1 in pairs(a) do
+  for k2 in pairs(a) do n = n + 1 end
+end
+assert(n == 36)
+local k1, k2 = next(a), next(a)
+n = 0
+while k1 do
+  assert(a[k1] and a[k2])
+  k1 = next(a, k1); k2 = next(a, k2); n = n + 1
+end
+assert(n == 6 and k2 == nil)
+-- clearing fields during a traversal
+for k in pairs(a) do a[k] = nil end
+assert(next(a) == nil)
+-- the control variable of a generic for is the key passed to 'next'
+assert(not pcall(function ()
+  for k in next, {1, 2}, 'nokey' do end
+end))
+
 for a,b in pairs{} do error"not here" end
 for i=1,0 do error'not here' end
 for i=0,1,-1 do error'not here' end
@@ -444,4 +500,42 @@ for k,v in ipairs(a) do
 end
 assert(i == a.n)
 
+-- field accesses with constant keys through tables of different layouts
+do
+  local function getx (t) return t.x end
+  local function setx (t, v) t.x = v end
+  local a = {x = 1}
+  local b = {y = 2, z = 3, x = 4}
+  for i = 1, 3 do
+    assert(getx(a) == 1 and getx(b) == 4)
+  end
+  -- rehash moves 'x' to another slot
+  for i = 1, 100 do a["k" .. i] = i end
+  assert(getx(a) == 1)
+  setx(a, 10); assert(a.x == 10 and getx(a) == 10)
+  -- removed key falls back to __index / __newindex
+  a.x = nil
+  assert(getx(a) == nil)
+  local log = {}
+  setmetatable(a, {__index = function (t, k) return k end,
+                   __newindex = function (t, k, v) log[k] = v end})
+  assert(getx(a) == "x")
+  setx(a, 20)
+  assert(log.x == 20 and rawget(a, "x") == nil)
+  rawset(a, "x", 30)
+  assert(getx(a) == 30)
+  setx(a, 40); assert(log.x == 20 and rawget(a, "x") == 40)
+  -- methods and globals
+  local obj = {val = 5, get = function (self) return self.val end}
+  assert(obj:get() == 5)
+  obj.get = function (self) return -self.val end
+  assert(obj:get() == -5)
+  X_CACHED = 1
+  local function incx () X_CACHED = X_CACHED + 1 end
+  incx(); incx()
+  assert(X_CACHED == 3)
+  X_CACHED = nil
+  assert(X_CACHED == nil)
+end
+
 print"OK"
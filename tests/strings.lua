@@ -266,6 +266,30 @@ assert(os.setlocale(nil, "numeric") == 'C')
 
 end
 
+-- long strings may have several copies, which still behave as one value
+do
+  local a = string.rep("x", 100)
+  local b = string.rep("x", 99) .. "x"
+  assert(a == b and not (a ~= b) and rawequal(a, b))
+  assert(a ~= string.rep("x", 99) .. "y" and a ~= string.rep("x", 101))
+  local t = {[a] = 1}
+  assert(t[b] == 1 and t[string.rep("xx", 50)] == 1)
+  t[b] = 2
+  assert(t[a] == 2 and next(t, nil) == a and next(t, a) == nil)
+  local k = table.concat({"one", "two", "three"}, ", ", 1, 3) .. string.rep("!", 40)
+  t[k] = true
+  assert(t["one, two, three" .. string.rep("!", 40)])
+  -- and names longer than the short string limit still resolve
+  local a_very_long_local_variable_name_that_is_not_short = 10
+  local function f ()
+    return a_very_long_local_variable_name_that_is_not_short + 1
+  end
+  assert(f() == 11)
+  another_very_long_global_variable_name_that_is_not_short = 20
+  assert(_G["another_very_long_global_variable_name_that_is_not_short"] == 20)
+  another_very_long_global_variable_name_that_is_not_short = nil
+end
+
 print('OK')
 
 